@@ -31,9 +31,15 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <poll.h>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #include "clients.h"
 #include "dlclient.h"
 #include "generic.h"
@@ -42,12 +48,102 @@
 #include "rbtree.h"
 #include "slclient.h"
 #include "tls.h"
+#include "uring.h"
 
 /* Progressive throttle stepping and maximum in milliseconds */
 #define THROTTLE_STEPPING 50  /* 50 milliseconds */
 #define THROTTLE_MAXIMUM 500  /* 1/2 second */
 
+static int ClientSetup (ClientInfo *cinfo, struct thread_data *mytdp, RingReader *reader);
+static int ClientStep (ClientInfo *cinfo, uint64_t *writeseq, uint32_t *throttle_msec);
+static void ClientCleanup (ClientInfo *cinfo, struct thread_data *mytdp);
 static int ClientRecv (ClientInfo *cinfo);
+static int PollClient (int socket, int notifyfd, int timeout_ms);
+static int SendWait (int socket, int readability);
+static int SendQueue (ClientInfo *cinfo, struct iovec *iov, int iovcnt);
+static int SendPending (ClientInfo *cinfo);
+
+#if defined(__linux__)
+#define WORKER_MAXEVENTS 256 /* Events per epoll_wait() */
+#define WORKER_TICK 50       /* Milliseconds between checks of client deadlines */
+#define WORKER_LINGER 10     /* Seconds to deliver a final response */
+
+#define WORKER_URING_ENTRIES   256  /* io_uring submission queue entries */
+#define WORKER_URING_CQENTRIES 4096 /* io_uring completion queue entries */
+
+/* io_uring requests are identified by the client pointer and the
+ * request type in the low bits, a NULL client is the wake descriptor */
+#define WORKER_OP_SOCKET 0 /* Poll of client socket */
+#define WORKER_OP_NOTIFY 1 /* Poll of ring notification descriptor */
+#define WORKER_OP_SEND   2 /* Send of queued data */
+#define WORKER_OP_CANCEL 3 /* Removal or cancellation, completion ignored */
+#define WORKER_OP_MASK   3
+#define WORKER_OP(WC, OP) ((uint64_t)(uintptr_t)(WC) | (OP))
+
+/* Events of client sockets */
+#define WORKER_SOCKET_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP)
+
+/* Append a client to a ready list if not already present */
+#define WORKER_READY(WC, HEAD, TAIL) \
+  do                                 \
+  {                                  \
+    if (!(WC)->ready)                \
+    {                                \
+      (WC)->ready     = 1;           \
+      (WC)->nextready = NULL;        \
+      if (TAIL)                      \
+        (TAIL)->nextready = (WC);    \
+      else                           \
+        (HEAD) = (WC);               \
+      (TAIL) = (WC);                 \
+    }                                \
+  } while (0)
+
+/* Client served by a worker thread */
+typedef struct WorkerClient
+{
+  struct thread_data *tdp;        /* Client thread data, td_prvtptr is the ClientInfo */
+  ClientInfo *cinfo;              /* Client information */
+  RingReader reader;              /* Ring reader of the client */
+  uint64_t writeseq;              /* Ring write sequence at last streaming */
+  uint32_t throttle_msec;         /* Throttle time in milliseconds */
+  nstime_t deadline;              /* Time to run the client without events, 0 for none */
+  nstime_t closing;               /* Time limit for a final response, 0 when not closing */
+  uint8_t ready;                  /* Flag: client is in the ready list */
+  uint8_t sending;                /* Flag: io_uring send of queued data in progress */
+  uint8_t polls;                  /* Count of active io_uring polls */
+  uint8_t closed;                 /* Flag: closed, waiting for io_uring requests to complete */
+  struct WorkerClient *next;      /* Next client of the worker */
+  struct WorkerClient *prev;      /* Previous client of the worker */
+  struct WorkerClient *nextready; /* Next client in the ready list */
+} WorkerClient;
+
+/* Worker thread serving many clients */
+typedef struct ClientWorker
+{
+  pthread_t thread;               /* Worker thread */
+  pthread_mutex_t lock;           /* Lock for incoming clients */
+  WorkerClient *incoming;         /* Clients added but not yet served */
+  int epollfd;                    /* epoll descriptor, -1 when using io_uring */
+  int wakefd;                     /* eventfd to wake the worker */
+  int useuring;                   /* Flag: worker uses io_uring instead of epoll */
+  URing uring;                    /* io_uring of the worker */
+  uint32_t clientcount;           /* Number of clients served */
+  int shutdown;                   /* Flag: worker should exit */
+} ClientWorker;
+
+static ClientWorker *workers = NULL;
+static int workercount       = 0;
+
+static void *ClientWorkerThread (void *arg);
+static int WorkerClientStart (ClientWorker *worker, WorkerClient *wc);
+static int WorkerClientRun (WorkerClient *wc, nstime_t now);
+static int WorkerClientClose (ClientWorker *worker, WorkerClient *wc);
+static int WorkerURingEvents (ClientWorker *worker, int timeout_ms,
+                              WorkerClient **ready, WorkerClient **readytail,
+                              WorkerClient **closed);
+static void WorkerURingSent (WorkerClient *wc, int32_t result);
+#endif
 
 /* Test first 3 characters of buffer for HTTP methods:
    GET, HEAD, POST, PUT, DELETE, TRACE and CONNECT */
@@ -73,11 +169,7 @@ ClientThread (void *arg)
   ClientInfo *cinfo;
   RingReader reader;
   struct thread_data *mytdp;
-  int sentbytes;
-  int sockflags;
-  int setuperr = 0;
-  ssize_t nrecv;
-  int nread;
+  uint64_t writeseq = 0;
 
   /* Throttle related */
   uint32_t throttle_msec = 0; /* Throttle time in milliseconds */
@@ -89,22 +181,98 @@ ClientThread (void *arg)
   mytdp = (struct thread_data *)arg;
   cinfo = (ClientInfo *)mytdp->td_prvtptr;
 
+  if (ClientSetup (cinfo, mytdp, &reader))
+    return NULL;
+
+  /* Main client loop, delegating processing and data flow */
+  while (mytdp->td_state != TDS_CLOSE)
+  {
+    /* Increment throttle if not at maximum */
+    if (throttle_msec < THROTTLE_MAXIMUM)
+      throttle_msec += THROTTLE_STEPPING;
+
+    if (ClientStep (cinfo, &writeseq, &throttle_msec))
+    {
+      break;
+    }
+
+    /* Throttle loop */
+    if (throttle_msec > 0)
+    {
+      /* For streaming clients wait until data is available from the client
+         or a new packet is written to the ring.  If a packet was written since
+         the last read do not wait at all. */
+      if (cinfo->state == STATE_STREAM && cinfo->type != CLIENT_UNDETERMINED)
+      {
+        if (RingWaitArm (&reader, writeseq) > 0)
+        {
+          PollClient (cinfo->socket, reader.notifyfd[0], throttle_msec);
+          RingWaitDisarm (&reader);
+        }
+      }
+      /* For known connection types throttle the loop until data is available */
+      else if (cinfo->type != CLIENT_UNDETERMINED)
+      {
+        PollSocket (cinfo->socket, 1, 0, throttle_msec);
+      }
+      /* For unknown (undetermined) connection types throttle the loop
+         using nanosleep() as one or two bytes may be available but not
+         enough to determine the type. */
+      else
+      {
+        timereq.tv_sec  = 0;
+        timereq.tv_nsec = throttle_msec * 1000000;
+
+        nanosleep (&timereq, NULL);
+      }
+    }
+  } /* End of main client loop */
+
+  ClientCleanup (cinfo, mytdp);
+
+  return NULL;
+} /* End of ClientThread() */
+
+/***********************************************************************
+ * ClientSetup:
+ *
+ * Prepare a new client connection for processing: resolve the
+ * hostname, allocate buffers, initialize the RingReader (storage
+ * supplied by the caller) and negotiate TLS if needed.  On success
+ * the thread state is set to TDS_ACTIVE.
+ *
+ * On errors the connection is closed, resources are released and
+ * the thread state is set to TDS_CLOSED.
+ *
+ * Returns 0 on success and -1 on error.
+ ***********************************************************************/
+static int
+ClientSetup (ClientInfo *cinfo, struct thread_data *mytdp, RingReader *reader)
+{
+  int sockflags;
+  int setuperr = 0;
+
   /* Connect linked structures */
-  cinfo->reader     = &reader;
-  reader.ringparams = cinfo->ringparams;
+  cinfo->reader      = reader;
+  reader->ringparams = cinfo->ringparams;
 
   /* Initialize RingReader parameters */
-  reader.pktoffset   = -1;
-  reader.pktid       = RINGID_NONE;
-  reader.pkttime     = NSTUNSET;
-  reader.datastart   = NSTUNSET;
-  reader.dataend     = NSTUNSET;
-  reader.limit       = NULL;
-  reader.limit_data  = NULL;
-  reader.match       = NULL;
-  reader.match_data  = NULL;
-  reader.reject      = NULL;
-  reader.reject_data = NULL;
+  reader->pktoffset   = -1;
+  reader->pktid       = RINGID_NONE;
+  reader->pkttime     = NSTUNSET;
+  reader->datastart   = NSTUNSET;
+  reader->dataend     = NSTUNSET;
+  reader->limit       = NULL;
+  reader->limit_data  = NULL;
+  reader->match       = NULL;
+  reader->match_data  = NULL;
+  reader->reject      = NULL;
+  reader->reject_data = NULL;
+  reader->matchcache  = NULL;
+  reader->streamset   = NULL;
+  reader->notifyfd[0] = -1;
+  reader->notifyfd[1] = -1;
+  reader->waiting     = 0;
 
   /* Set initial state */
   cinfo->state = STATE_COMMAND;
@@ -153,10 +321,10 @@ ClientThread (void *arg)
     setuperr = 1;
   }
 
-  /* Set client socket connection to non-blocking */
+  /* Set client socket connection to non-blocking, if not already done by accept4() */
   sockflags = fcntl (cinfo->socket, F_GETFL, 0);
-  sockflags |= O_NONBLOCK;
-  if (fcntl (cinfo->socket, F_SETFL, sockflags) == -1)
+  if (!(sockflags & O_NONBLOCK) &&
+      fcntl (cinfo->socket, F_SETFL, sockflags | O_NONBLOCK) == -1)
   {
     lprintf (0, "[%s] Error setting non-blocking flag: %s", cinfo->hostname, strerror (errno));
     setuperr = 1;
@@ -165,13 +333,20 @@ ClientThread (void *arg)
   /* Limit sources if specified */
   if (cinfo->limitstr)
   {
-    if (RingLimit (&reader, cinfo->limitstr) < 0)
+    if (RingLimit (reader, cinfo->limitstr) < 0)
     {
       lprintf (0, "[%s] Error with RingLimit for '%s'", cinfo->hostname, cinfo->limitstr);
       setuperr = 1;
     }
   }
 
+  /* Create descriptors for notification of new packets in the ring */
+  if (RingNotifyInit (reader))
+  {
+    lprintf (0, "[%s] Error creating ring notification", cinfo->hostname);
+    setuperr = 1;
+  }
+
   if (cinfo->tls && tls_configure (cinfo))
   {
     lprintf (0, "[%s] Error negotiating TLS", cinfo->hostname);
@@ -203,6 +378,9 @@ ClientThread (void *arg)
     if (cinfo->reader->limit_data)
       pcre2_match_data_free (cinfo->reader->limit_data);
 
+    RingReaderFree (cinfo->reader);
+    RingNotifyFree (cinfo->reader);
+
     cinfo->reader = NULL;
 
     /* Release stream tracking binary tree */
@@ -214,8 +392,6 @@ ClientThread (void *arg)
 
     free (cinfo->sendbuf);
     free (cinfo->recvbuf);
-    free (cinfo->addr);
-    cinfo->addr = NULL;
     free (cinfo->mswrite);
 
     lprintf (1, "Client setup error, disconnected: %s", cinfo->hostname);
@@ -225,7 +401,7 @@ ClientThread (void *arg)
     mytdp->td_state = TDS_CLOSED;
     pthread_mutex_unlock (&(mytdp->td_lock));
 
-    return NULL;
+    return -1;
   }
 
   /* If only one protocol is enabled set the expected client type */
@@ -242,161 +418,181 @@ ClientThread (void *arg)
     mytdp->td_state = TDS_ACTIVE;
   pthread_mutex_unlock (&(mytdp->td_lock));
 
-  /* Main client loop, delegating processing and data flow */
-  while (mytdp->td_state != TDS_CLOSE)
-  {
-    /* Increment throttle if not at maximum */
-    if (throttle_msec < THROTTLE_MAXIMUM)
-      throttle_msec += THROTTLE_STEPPING;
+  return 0;
+} /* End of ClientSetup() */
+
+/***********************************************************************
+ * ClientStep:
+ *
+ * Perform a single pass of client processing: determine the client
+ * type if needed, receive and handle a command and stream packets to
+ * the client.  The throttle time is reset to 0 when data was
+ * exchanged with the client and set to the maximum when streaming
+ * found no new packets.  The ring write sequence observed before
+ * streaming is stored at writeseq for waiting on new packets.
+ *
+ * Returns 0 on success and -1 when the connection should be closed.
+ ***********************************************************************/
+static int
+ClientStep (ClientInfo *cinfo, uint64_t *writeseq, uint32_t *throttle_msec)
+{
+  int sentbytes;
+  ssize_t nrecv;
+  int nread;
 
-    /* Determine client type from first 3 bytes of received data if not TLS */
-    if (cinfo->type == CLIENT_UNDETERMINED && cinfo->tlsctx == NULL)
+  /* Determine client type from first 3 bytes of received data if not TLS */
+  if (cinfo->type == CLIENT_UNDETERMINED && cinfo->tlsctx == NULL)
+  {
+    if ((nrecv = recv (cinfo->socket, cinfo->recvbuf, 3, MSG_PEEK)) == 3)
     {
-      if ((nrecv = recv (cinfo->socket, cinfo->recvbuf, 3, MSG_PEEK)) == 3)
+      /* DataLink commands start with 'DL' */
+      if (cinfo->protocols & PROTO_DATALINK &&
+          cinfo->recvbuf[0] == 'D' &&
+          cinfo->recvbuf[1] == 'L')
       {
-        /* DataLink commands start with 'DL' */
-        if (cinfo->protocols & PROTO_DATALINK &&
-            cinfo->recvbuf[0] == 'D' &&
-            cinfo->recvbuf[1] == 'L')
-        {
-          cinfo->type = CLIENT_DATALINK;
-        }
-        /* HTTP requests start with known method */
-        else if (cinfo->protocols & PROTO_HTTP &&
-                 HTTPMETHOD (cinfo->recvbuf))
-        {
-          cinfo->type = CLIENT_HTTP;
-        }
-        /* Everything else is SeedLink if it's allowed on this listener */
-        else if (cinfo->protocols & PROTO_SEEDLINK)
-        {
-          cinfo->type = CLIENT_SEEDLINK;
-        }
-        else
-        {
-          lprintf (0, "[%s] Cannot determine allowed client protocol from '%c%c%c'",
-                   cinfo->hostname,
-                   (cinfo->recvbuf[0] < 32 || cinfo->recvbuf[0] > 126) ? '?' : cinfo->recvbuf[0],
-                   (cinfo->recvbuf[1] < 32 || cinfo->recvbuf[1] > 126) ? '?' : cinfo->recvbuf[1],
-                   (cinfo->recvbuf[2] < 32 || cinfo->recvbuf[2] > 126) ? '?' : cinfo->recvbuf[2]);
-          break;
-        }
+        cinfo->type = CLIENT_DATALINK;
       }
-      /* Check for shutdown or errors except no data on non-blocking */
-      else if (nrecv == 0 || (nrecv == -1 && errno != EAGAIN  && errno != EWOULDBLOCK))
+      /* HTTP requests start with known method */
+      else if (cinfo->protocols & PROTO_HTTP &&
+               HTTPMETHOD (cinfo->recvbuf))
       {
-        break;
+        cinfo->type = CLIENT_HTTP;
+      }
+      /* Everything else is SeedLink if it's allowed on this listener */
+      else if (cinfo->protocols & PROTO_SEEDLINK)
+      {
+        cinfo->type = CLIENT_SEEDLINK;
+      }
+      else
+      {
+        lprintf (0, "[%s] Cannot determine allowed client protocol from '%c%c%c'",
+                 cinfo->hostname,
+                 (cinfo->recvbuf[0] < 32 || cinfo->recvbuf[0] > 126) ? '?' : cinfo->recvbuf[0],
+                 (cinfo->recvbuf[1] < 32 || cinfo->recvbuf[1] > 126) ? '?' : cinfo->recvbuf[1],
+                 (cinfo->recvbuf[2] < 32 || cinfo->recvbuf[2] > 126) ? '?' : cinfo->recvbuf[2]);
+        return -1;
       }
     }
-    else if (cinfo->type == CLIENT_UNDETERMINED && cinfo->tlsctx != NULL)
+    /* Check for shutdown or errors except no data on non-blocking */
+    else if (nrecv == 0 || (nrecv == -1 && errno != EAGAIN  && errno != EWOULDBLOCK))
     {
-      lprintf (1, "[%s] Client protocol cannot be detected on a TLS connection",
-               cinfo->hostname);
-      break;
+      return -1;
     }
 
-    /* Recv data from client */
-    nread = ClientRecv (cinfo);
-
-    /* Error receiving data, -1 = orderly shutdown, -2 = error */
-    if (nread < 0)
+    /* Wait for enough data to determine the client type */
+    if (cinfo->type == CLIENT_UNDETERMINED)
     {
-      break;
+      return 0;
     }
+  }
+  else if (cinfo->type == CLIENT_UNDETERMINED && cinfo->tlsctx != NULL)
+  {
+    lprintf (1, "[%s] Client protocol cannot be detected on a TLS connection",
+             cinfo->hostname);
+    return -1;
+  }
 
-    /* Data received from client */
-    if (nread > 0)
-    {
-      /* If data was received do not throttle */
-      throttle_msec = 0;
+  /* Recv data from client, io_uring workers track when data arrives */
+  nread = (cinfo->recvidle) ? 0 : ClientRecv (cinfo);
 
-      /* Update the time of the last packet exchange */
-      cinfo->lastxchange = NSnow ();
+  /* Error receiving data, -1 = orderly shutdown, -2 = error */
+  if (nread < 0)
+  {
+    return -1;
+  }
 
-      /* Handle data from client according to client type */
-      if (cinfo->type == CLIENT_DATALINK)
-      {
-        if (DLHandleCmd (cinfo))
-        {
-          break;
-        }
-      }
-      else if (cinfo->type == CLIENT_HTTP)
-      {
-        if (HandleHTTP (cinfo->recvbuf, cinfo))
-        {
-          break;
-        }
-      }
-      else
-      {
-        if (SLHandleCmd (cinfo))
-        {
-          break;
-        }
-      }
-    } /* Done handling data from client */
+  /* Nothing received, the socket is drained until the next event unless
+   * waiting for archive queue space, which is checked again later */
+  if (nread == 0 && cinfo->uringio && !cinfo->archivewait)
+    cinfo->recvidle = 1;
 
-    /* Regular, outbound data flow */
-    if (cinfo->state == STATE_STREAM)
-    {
-      sentbytes = 0;
+  /* Data received from client */
+  if (nread > 0)
+  {
+    /* If data was received do not throttle */
+    *throttle_msec = 0;
 
-      if (cinfo->type == CLIENT_DATALINK)
-      {
-        sentbytes = DLStreamPackets (cinfo);
-      }
-      else if (cinfo->type == CLIENT_SEEDLINK)
-      {
-        sentbytes = SLStreamPackets (cinfo);
-      }
+    /* Update the time of the last packet exchange */
+    cinfo->lastxchange = NSnow ();
 
-      if (sentbytes < 0) /* Bail on error */
-      {
-        break;
-      }
-      if (sentbytes == 0) /* No packet sent, maximum throttle immediately */
+    /* Handle data from client according to client type */
+    if (cinfo->type == CLIENT_DATALINK)
+    {
+      if (DLHandleCmd (cinfo))
       {
-        throttle_msec = THROTTLE_MAXIMUM;
+        return -1;
       }
-      else /* If packet sent do not throttle */
+    }
+    else if (cinfo->type == CLIENT_HTTP)
+    {
+      if (HandleHTTP (cinfo->recvbuf, cinfo))
       {
-        throttle_msec = 0;
+        return -1;
       }
-    } /* Done with data streaming */
-
-    /* Throttle loop and check for idle connections */
-    if (throttle_msec > 0)
+    }
+    else
     {
-      /* Check for connections with no communication and drop if idle
-         for more than 10 seconds */
-      if (throttle_msec >= THROTTLE_MAXIMUM &&
-          cinfo->lastxchange == cinfo->conntime &&
-          (NSnow () - cinfo->conntime) > ((nstime_t)NSTMODULUS * 10))
+      if (SLHandleCmd (cinfo))
       {
-        lprintf (0, "[%s] Non-communicating client timeout",
-                 cinfo->hostname);
-        break;
+        return -1;
       }
+    }
+  } /* Done handling data from client */
 
-      /* For known connection types throttle the loop until data is available */
-      if (cinfo->type != CLIENT_UNDETERMINED)
-      {
-        PollSocket (cinfo->socket, 1, 0, throttle_msec);
-      }
-      /* For unknown (undetermined) connection types throttle the loop
-         using nanosleep() as one or two bytes may be available but not
-         enough to determine the type. */
-      else
-      {
-        timereq.tv_sec  = 0;
-        timereq.tv_nsec = throttle_msec * 1000000;
+  /* Regular, outbound data flow */
+  if (cinfo->state == STATE_STREAM)
+  {
+    sentbytes = 0;
 
-        nanosleep (&timereq, NULL);
-      }
+    /* Track ring writes from this point to detect packets added while streaming */
+    *writeseq = __atomic_load_n (&cinfo->ringparams->writeseq, __ATOMIC_ACQUIRE);
+
+    if (cinfo->type == CLIENT_DATALINK)
+    {
+      sentbytes = DLStreamPackets (cinfo);
     }
-  } /* End of main client loop */
+    else if (cinfo->type == CLIENT_SEEDLINK)
+    {
+      sentbytes = SLStreamPackets (cinfo);
+    }
+
+    if (sentbytes < 0) /* Bail on error */
+    {
+      return -1;
+    }
+    if (sentbytes == 0) /* No packet sent, maximum throttle immediately */
+    {
+      *throttle_msec = THROTTLE_MAXIMUM;
+    }
+    else /* If packet sent do not throttle */
+    {
+      *throttle_msec = 0;
+    }
+  } /* Done with data streaming */
+
+  /* Check for connections with no communication and drop if idle
+     for more than 10 seconds */
+  if (*throttle_msec >= THROTTLE_MAXIMUM &&
+      cinfo->lastxchange == cinfo->conntime &&
+      (NSnow () - cinfo->conntime) > ((nstime_t)NSTMODULUS * 10))
+  {
+    lprintf (0, "[%s] Non-communicating client timeout",
+             cinfo->hostname);
+    return -1;
+  }
 
+  return 0;
+} /* End of ClientStep() */
+
+/***********************************************************************
+ * ClientCleanup:
+ *
+ * Close a client connection and release all associated resources,
+ * the thread state is set to TDS_CLOSED when done.
+ ***********************************************************************/
+static void
+ClientCleanup (ClientInfo *cinfo, struct thread_data *mytdp)
+{
   /* Set thread CLOSING status, locking entire client list */
   pthread_mutex_lock (&param.cthreads_lock);
   mytdp->td_state = TDS_CLOSING;
@@ -410,74 +606,853 @@ ClientThread (void *arg)
     cinfo->socket = -1;
   }
 
-  tls_cleanup (cinfo);
+  tls_cleanup (cinfo);
+
+  /* Write out transmission log for this client if requested */
+  if (TLogParams.tlogbasedir)
+  {
+    lprintf (2, "[%s] Writing transmission log", cinfo->hostname);
+    WriteTLog (cinfo, 1);
+  }
+
+  /* Release limit related PCRE2 data
+   * The limitstr is not owned by the client so not free'd */
+  if (cinfo->reader->limit)
+    pcre2_code_free (cinfo->reader->limit);
+  if (cinfo->reader->limit_data)
+    pcre2_match_data_free (cinfo->reader->limit_data);
+
+  /* Release match and reject selectors strings and related PCRE2 data */
+  free (cinfo->matchstr);
+  if (cinfo->reader->match)
+    pcre2_code_free (cinfo->reader->match);
+  if (cinfo->reader->match_data)
+    pcre2_match_data_free (cinfo->reader->match_data);
+  free (cinfo->rejectstr);
+  if (cinfo->reader->reject)
+    pcre2_code_free (cinfo->reader->reject);
+  if (cinfo->reader->reject_data)
+    pcre2_match_data_free (cinfo->reader->reject_data);
+
+  /* Release cached stream match verdicts and selected stream set */
+  RingReaderFree (cinfo->reader);
+
+  /* Leave the ring wait list and release notification descriptors */
+  RingNotifyFree (cinfo->reader);
+
+  cinfo->reader = NULL;
+
+  /* Release stream tracking binary tree */
+  pthread_mutex_lock (&(cinfo->streams_lock));
+  RBTreeDestroy (cinfo->streams);
+  cinfo->streams      = NULL;
+  cinfo->streamscount = 0;
+  pthread_mutex_unlock (&(cinfo->streams_lock));
+
+  /* Release the client send and receive buffers */
+  free (cinfo->sendbuf);
+  free (cinfo->recvbuf);
+  free (cinfo->sendpending);
+  cinfo->sendpending       = NULL;
+  cinfo->sendpendinglength = 0;
+
+  /* Shutdown and release miniSEED write data stream */
+  if (cinfo->mswrite)
+  {
+    /* The archive writer thread releases the data stream after queued records */
+    if (cinfo->mswrite->writer)
+    {
+      ds_writerclose (cinfo->mswrite, cinfo->hostname);
+    }
+    else
+    {
+      ds_streamproc (cinfo->mswrite, NULL, NULL, cinfo->hostname);
+      free (cinfo->mswrite);
+    }
+    cinfo->mswrite = NULL;
+  }
+
+  if (cinfo->type == CLIENT_SEEDLINK && cinfo->extinfo)
+    SLFree (cinfo);
+
+  if (cinfo->type == CLIENT_DATALINK && cinfo->extinfo)
+    DLFree (cinfo);
+
+  lprintf (1, "Client disconnected: %s", cinfo->hostname);
+
+  /* Set thread CLOSED status */
+  pthread_mutex_lock (&(mytdp->td_lock));
+  mytdp->td_state = TDS_CLOSED;
+  pthread_mutex_unlock (&(mytdp->td_lock));
+} /* End of ClientCleanup() */
+
+#if defined(__linux__)
+/***********************************************************************
+ * ClientWorkersStart:
+ *
+ * Start a pool of worker threads that multiplex client connections
+ * using epoll(7), as an alternative to a thread per client.  Clients
+ * are handed to the workers with ClientWorkerAdd().
+ *
+ * If 'useuring' is set the workers use io_uring(7) instead of epoll
+ * when the kernel supports it, otherwise epoll is used.
+ *
+ * Returns 0 on success and -1 on error.
+ ***********************************************************************/
+int
+ClientWorkersStart (uint32_t count, int useuring)
+{
+  struct epoll_event event;
+  ClientWorker *worker;
+  uint32_t idx;
+  int rc;
+
+  if (count == 0 || workers)
+    return -1;
+
+  if (!(workers = (ClientWorker *)calloc (count, sizeof (ClientWorker))))
+  {
+    lprintf (0, "%s(): Error allocating worker threads", __func__);
+    return -1;
+  }
+
+  for (idx = 0; idx < count; idx++)
+  {
+    worker = &workers[idx];
+
+    pthread_mutex_init (&worker->lock, NULL);
+    worker->epollfd  = -1;
+    worker->wakefd   = -1;
+    worker->uring.fd = -1;
+
+    if ((worker->wakefd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+      lprintf (0, "%s(): Error creating worker descriptors: %s", __func__, strerror (errno));
+      break;
+    }
+
+    /* Use io_uring if requested and available, the wake descriptor is
+     * identified by a NULL pointer */
+    if (useuring)
+    {
+      if (URingInit (&worker->uring, WORKER_URING_ENTRIES, WORKER_URING_CQENTRIES) == 0 &&
+          URingPrepPoll (&worker->uring, worker->wakefd, EPOLLIN, WORKER_OP (NULL, WORKER_OP_SOCKET)) == 0)
+      {
+        worker->useuring = 1;
+      }
+      else
+      {
+        lprintf (0, "Cannot use io_uring for client workers (%s), using epoll", strerror (errno));
+        URingFree (&worker->uring);
+        useuring = 0;
+      }
+    }
+
+    if (!worker->useuring)
+    {
+      if ((worker->epollfd = epoll_create1 (EPOLL_CLOEXEC)) < 0)
+      {
+        lprintf (0, "%s(): Error creating worker descriptors: %s", __func__, strerror (errno));
+        break;
+      }
+
+      event.events   = EPOLLIN;
+      event.data.ptr = NULL;
+      if (epoll_ctl (worker->epollfd, EPOLL_CTL_ADD, worker->wakefd, &event))
+      {
+        lprintf (0, "%s(): Error adding worker wake descriptor: %s", __func__, strerror (errno));
+        break;
+      }
+    }
+
+    if ((rc = pthread_create (&worker->thread, NULL, ClientWorkerThread, worker)))
+    {
+      lprintf (0, "%s(): Error creating worker thread: %s", __func__, strerror (rc));
+      break;
+    }
+
+    workercount++;
+  }
+
+  if (workercount < count)
+  {
+    /* Release descriptors of the worker that failed to start */
+    if (worker->epollfd >= 0)
+      close (worker->epollfd);
+    if (worker->wakefd >= 0)
+      close (worker->wakefd);
+    if (worker->useuring)
+      URingFree (&worker->uring);
+    pthread_mutex_destroy (&worker->lock);
+
+    ClientWorkersStop ();
+    return -1;
+  }
+
+  lprintf (1, "Started %u client worker threads using %s", count,
+           (useuring) ? "io_uring" : "epoll");
+
+  return 0;
+} /* End of ClientWorkersStart() */
+
+/***********************************************************************
+ * ClientWorkerAdd:
+ *
+ * Hand a new client connection to the worker thread serving the
+ * fewest clients.  The thread_data td_prvtptr is the ClientInfo, the
+ * worker sets up, serves and cleans up the client in the same way as
+ * ClientThread().
+ *
+ * Returns 0 on success and -1 on error.
+ ***********************************************************************/
+int
+ClientWorkerAdd (struct thread_data *tdp)
+{
+  ClientWorker *worker = NULL;
+  WorkerClient *wc;
+  uint64_t one = 1;
+  int idx;
+
+  if (!tdp || !workers)
+    return -1;
+
+  for (idx = 0; idx < workercount; idx++)
+  {
+    if (!worker || workers[idx].clientcount < worker->clientcount)
+      worker = &workers[idx];
+  }
+
+  if (!(wc = (WorkerClient *)calloc (1, sizeof (WorkerClient))))
+  {
+    lprintf (0, "%s(): Error allocating worker client", __func__);
+    return -1;
+  }
+
+  wc->tdp   = tdp;
+  wc->cinfo = (ClientInfo *)tdp->td_prvtptr;
+
+  wc->cinfo->pooled = 1;
+  tdp->td_pooled    = 1;
+  tdp->td_id        = worker->thread;
+
+  __atomic_add_fetch (&worker->clientcount, 1, __ATOMIC_RELAXED);
+
+  pthread_mutex_lock (&worker->lock);
+  wc->next         = worker->incoming;
+  worker->incoming = wc;
+  pthread_mutex_unlock (&worker->lock);
+
+  if (write (worker->wakefd, &one, sizeof (one)) < 0 && errno != EAGAIN)
+    lprintf (0, "%s(): Error waking worker thread: %s", __func__, strerror (errno));
+
+  return 0;
+} /* End of ClientWorkerAdd() */
+
+/***********************************************************************
+ * ClientWorkersStop:
+ *
+ * Stop and join the worker threads, all clients must be closed.
+ ***********************************************************************/
+void
+ClientWorkersStop (void)
+{
+  uint64_t one = 1;
+  int idx;
+
+  if (!workers)
+    return;
+
+  for (idx = 0; idx < workercount; idx++)
+  {
+    __atomic_store_n (&workers[idx].shutdown, 1, __ATOMIC_RELEASE);
+
+    if (write (workers[idx].wakefd, &one, sizeof (one)) < 0 && errno != EAGAIN)
+      lprintf (0, "%s(): Error waking worker thread: %s", __func__, strerror (errno));
+
+    pthread_join (workers[idx].thread, NULL);
+  }
+
+  for (idx = 0; idx < workercount; idx++)
+  {
+    if (workers[idx].useuring)
+      URingFree (&workers[idx].uring);
+    else
+      close (workers[idx].epollfd);
+    close (workers[idx].wakefd);
+    pthread_mutex_destroy (&workers[idx].lock);
+  }
+
+  free (workers);
+  workers     = NULL;
+  workercount = 0;
+} /* End of ClientWorkersStop() */
+
+/***********************************************************************
+ * ClientWorkerThread:
+ *
+ * Worker thread serving many clients.  Client sockets and ring
+ * notification descriptors are monitored with edge-triggered epoll
+ * and any event makes the client ready to run.  Ready clients are
+ * processed in turn with ClientStep(), clients that had no activity
+ * wait for an event or for their throttle time to expire, mirroring
+ * the loop of ClientThread().
+ *
+ * Data that cannot be sent immediately is queued by SendDataMB() and
+ * no further processing is done for the client until it is sent,
+ * so a slow client does not delay other clients of the worker.
+ *
+ * With io_uring the descriptors are monitored with multishot polls
+ * and all data is queued by SendDataMB().  The sends of queued data
+ * of all clients run in a pass are submitted together with the wait
+ * for the next events, a single system call per pass.
+ *
+ * Returns NULL.
+ ***********************************************************************/
+static void *
+ClientWorkerThread (void *arg)
+{
+  ClientWorker *worker = (ClientWorker *)arg;
+  struct epoll_event events[WORKER_MAXEVENTS];
+  WorkerClient *clients = NULL;
+  WorkerClient *ready   = NULL;
+  WorkerClient *readytail = NULL;
+  WorkerClient *closed  = NULL;
+  WorkerClient *wc;
+  WorkerClient *next;
+  nstime_t nextsweep = 0;
+  nstime_t now;
+  uint64_t drain;
+  int nevents;
+  int wake;
+  int idx;
+
+  while (!__atomic_load_n (&worker->shutdown, __ATOMIC_ACQUIRE))
+  {
+    wake = 0;
+
+    if (worker->useuring)
+    {
+      if ((wake = WorkerURingEvents (worker, (ready) ? 0 : WORKER_TICK,
+                                     &ready, &readytail, &closed)) < 0)
+        break;
+    }
+    else
+    {
+      nevents = epoll_wait (worker->epollfd, events, WORKER_MAXEVENTS,
+                            (ready) ? 0 : WORKER_TICK);
+
+      if (nevents < 0 && errno != EINTR)
+      {
+        lprintf (0, "%s(): Error waiting for events: %s", __func__, strerror (errno));
+        break;
+      }
+
+      for (idx = 0; idx < nevents; idx++)
+      {
+        if (events[idx].data.ptr == NULL)
+        {
+          wake = 1;
+        }
+        else
+        {
+          wc = (WorkerClient *)events[idx].data.ptr;
+          WORKER_READY (wc, ready, readytail);
+        }
+      }
+    }
+
+    /* New clients */
+    if (wake)
+    {
+      while (read (worker->wakefd, &drain, sizeof (drain)) > 0)
+        ;
+
+      pthread_mutex_lock (&worker->lock);
+      wc               = worker->incoming;
+      worker->incoming = NULL;
+      pthread_mutex_unlock (&worker->lock);
+
+      for (; wc; wc = next)
+      {
+        next = wc->next;
+
+        if (WorkerClientStart (worker, wc))
+        {
+          __atomic_sub_fetch (&worker->clientcount, 1, __ATOMIC_RELAXED);
+          free (wc);
+          continue;
+        }
+
+        wc->prev = NULL;
+        wc->next = clients;
+        if (clients)
+          clients->prev = wc;
+        clients = wc;
+
+        WORKER_READY (wc, ready, readytail);
+      }
+    }
+
+    /* Check for clients to close and expired throttle times */
+    now = NSnow ();
+    if (now >= nextsweep)
+    {
+      for (wc = clients; wc; wc = wc->next)
+      {
+        if (wc->tdp->td_state == TDS_CLOSE ||
+            (wc->deadline && now >= wc->deadline))
+          WORKER_READY (wc, ready, readytail);
+      }
+
+      nextsweep = now + (nstime_t)WORKER_TICK * 1000000;
+    }
+
+    /* Run the clients ready at this point, clients may become ready again */
+    wc        = ready;
+    ready     = NULL;
+    readytail = NULL;
+
+    for (; wc; wc = next)
+    {
+      next          = wc->nextready;
+      wc->nextready = NULL;
+      wc->ready     = 0;
+
+      if (WorkerClientRun (wc, now))
+      {
+        if (wc->prev)
+          wc->prev->next = wc->next;
+        else
+          clients = wc->next;
+        if (wc->next)
+          wc->next->prev = wc->prev;
+
+        __atomic_sub_fetch (&worker->clientcount, 1, __ATOMIC_RELAXED);
+
+        /* Clients with io_uring requests in progress are freed on completion */
+        if (WorkerClientClose (worker, wc))
+        {
+          wc->prev = NULL;
+          wc->next = closed;
+          if (closed)
+            closed->prev = wc;
+          closed = wc;
+        }
+        else
+        {
+          free (wc);
+        }
+
+        continue;
+      }
+
+      /* Submit a send of queued data, submitted with the next wait */
+      if (wc->cinfo->uringio && wc->cinfo->sendpendinglength > 0 && !wc->sending)
+      {
+        if (URingPrepSend (&worker->uring, wc->cinfo->socket, wc->cinfo->sendpending,
+                           wc->cinfo->sendpendinglength, WORKER_OP (wc, WORKER_OP_SEND)))
+        {
+          lprintf (0, "[%s] Error submitting send: %s", wc->cinfo->hostname, strerror (errno));
+          wc->cinfo->socketerr = -1;
+          wc->ready            = 1;
+        }
+        else
+        {
+          wc->sending = 1;
+        }
+      }
+
+      if (wc->ready)
+      {
+        wc->ready = 0;
+        WORKER_READY (wc, ready, readytail);
+      }
+    }
+  }
+
+  /* Release closed clients, their requests end with the io_uring */
+  for (wc = closed; wc; wc = next)
+  {
+    next = wc->next;
+    free (wc);
+  }
+
+  return NULL;
+} /* End of ClientWorkerThread() */
+
+/***********************************************************************
+ * WorkerClientStart:
+ *
+ * Set up a new client of a worker and add the client socket and ring
+ * notification descriptor to the worker's epoll set, or start polls
+ * of them with io_uring.
+ *
+ * Returns 0 on success and -1 on error, in which case the client has
+ * been cleaned up.
+ ***********************************************************************/
+static int
+WorkerClientStart (ClientWorker *worker, WorkerClient *wc)
+{
+  struct epoll_event event;
+
+  if (ClientSetup (wc->cinfo, wc->tdp, &wc->reader))
+    return -1;
+
+  if (worker->useuring)
+  {
+    if (URingPrepPoll (&worker->uring, wc->cinfo->socket, WORKER_SOCKET_EVENTS,
+                       WORKER_OP (wc, WORKER_OP_SOCKET)) ||
+        URingPrepPoll (&worker->uring, wc->reader.notifyfd[0], EPOLLIN,
+                       WORKER_OP (wc, WORKER_OP_NOTIFY)))
+    {
+      lprintf (0, "[%s] Error adding client to worker: %s", wc->cinfo->hostname, strerror (errno));
+      ClientCleanup (wc->cinfo, wc->tdp);
+      return -1;
+    }
+
+    /* All data is queued by SendDataMB() and sent by the worker */
+    wc->cinfo->uringio = 1;
+    wc->polls            = 2;
+
+    return 0;
+  }
+
+  event.events   = WORKER_SOCKET_EVENTS | EPOLLET;
+  event.data.ptr = wc;
+
+  if (epoll_ctl (worker->epollfd, EPOLL_CTL_ADD, wc->cinfo->socket, &event))
+  {
+    lprintf (0, "[%s] Error adding client to worker: %s", wc->cinfo->hostname, strerror (errno));
+    ClientCleanup (wc->cinfo, wc->tdp);
+    return -1;
+  }
+
+  event.events = EPOLLIN | EPOLLET;
+
+  if (epoll_ctl (worker->epollfd, EPOLL_CTL_ADD, wc->reader.notifyfd[0], &event))
+  {
+    lprintf (0, "[%s] Error adding client to worker: %s", wc->cinfo->hostname, strerror (errno));
+    epoll_ctl (worker->epollfd, EPOLL_CTL_DEL, wc->cinfo->socket, NULL);
+    ClientCleanup (wc->cinfo, wc->tdp);
+    return -1;
+  }
+
+  return 0;
+} /* End of WorkerClientStart() */
+
+/***********************************************************************
+ * WorkerClientRun:
+ *
+ * Run a ready client of a worker: send queued data, perform a pass of
+ * ClientStep() and determine what the client waits for next.  The
+ * client's ready flag is set if it should be run again without
+ * waiting.
+ *
+ * Returns 0 on success and -1 when the client should be closed.
+ ***********************************************************************/
+static int
+WorkerClientRun (WorkerClient *wc, nstime_t now)
+{
+  ClientInfo *cinfo = wc->cinfo;
+  int rv;
+
+  if (wc->tdp->td_state == TDS_CLOSE || cinfo->socketerr)
+    return -1;
+
+  wc->deadline = 0;
+
+  /* Send queued data first, wait for the socket to be writable if needed,
+   * with io_uring the worker sends queued data and the client waits */
+  if (cinfo->sendpendinglength > 0)
+  {
+    if (cinfo->uringio)
+      rv = 0;
+    else if ((rv = SendPending (cinfo)) < 0)
+      return -1;
+
+    if (rv == 0)
+    {
+      /* Limit the time to deliver a final response */
+      if (wc->closing)
+      {
+        if (now >= wc->closing)
+          return -1;
+
+        wc->deadline = wc->closing;
+      }
+
+      return 0;
+    }
+  }
+
+  /* Close after the final response was sent */
+  if (wc->closing)
+    return -1;
+
+  RingWaitDisarm (&wc->reader);
+
+  /* Increment throttle if not at maximum */
+  if (wc->throttle_msec < THROTTLE_MAXIMUM)
+    wc->throttle_msec += THROTTLE_STEPPING;
+
+  if (ClientStep (cinfo, &wc->writeseq, &wc->throttle_msec))
+  {
+    /* Deliver data queued before an orderly close, e.g. an HTTP response */
+    if (cinfo->sendpendinglength > 0 && cinfo->socketerr == 0)
+    {
+      wc->closing  = now + (nstime_t)WORKER_LINGER * NSTMODULUS;
+      wc->deadline = wc->closing;
+      return 0;
+    }
+
+    return -1;
+  }
+
+  /* Wait for the socket to be writable before any further processing */
+  if (cinfo->sendpendinglength > 0)
+    return 0;
+
+  if (wc->throttle_msec == 0)
+  {
+    wc->ready = 1;
+    return 0;
+  }
+
+  /* For streaming clients also wait for new packets in the ring, if a
+   * packet was written since the last read do not wait at all */
+  if (cinfo->state == STATE_STREAM && cinfo->type != CLIENT_UNDETERMINED &&
+      RingWaitArm (&wc->reader, wc->writeseq) == 0)
+  {
+    wc->ready = 1;
+    return 0;
+  }
+
+  wc->deadline = now + (nstime_t)wc->throttle_msec * 1000000;
+
+  return 0;
+} /* End of WorkerClientRun() */
+
+/***********************************************************************
+ * WorkerClientClose:
+ *
+ * Remove a client from the worker's epoll set and clean it up.
+ *
+ * With io_uring the polls of the client are removed and a send in
+ * progress is canceled.  The queued data is in use until the send
+ * completes, in which case the clean up is done by
+ * WorkerURingEvents() when the send completion is received.
+ *
+ * Returns 0 when the client can be freed and 1 when io_uring requests
+ * referencing the client are still in progress.
+ ***********************************************************************/
+static int
+WorkerClientClose (ClientWorker *worker, WorkerClient *wc)
+{
+  if (worker->useuring)
+  {
+    if (URingPrepPollRemove (&worker->uring, WORKER_OP (wc, WORKER_OP_SOCKET),
+                             WORKER_OP (NULL, WORKER_OP_CANCEL)) ||
+        URingPrepPollRemove (&worker->uring, WORKER_OP (wc, WORKER_OP_NOTIFY),
+                             WORKER_OP (NULL, WORKER_OP_CANCEL)) ||
+        (wc->sending &&
+         URingPrepCancel (&worker->uring, WORKER_OP (wc, WORKER_OP_SEND),
+                          WORKER_OP (NULL, WORKER_OP_CANCEL))))
+    {
+      lprintf (0, "[%s] Error removing client from worker: %s", wc->cinfo->hostname, strerror (errno));
+    }
+
+    wc->closed = 1;
+
+    if (!wc->sending)
+      ClientCleanup (wc->cinfo, wc->tdp);
+
+    return (wc->sending || wc->polls > 0) ? 1 : 0;
+  }
+
+  epoll_ctl (worker->epollfd, EPOLL_CTL_DEL, wc->cinfo->socket, NULL);
+  epoll_ctl (worker->epollfd, EPOLL_CTL_DEL, wc->reader.notifyfd[0], NULL);
+
+  ClientCleanup (wc->cinfo, wc->tdp);
+
+  return 0;
+} /* End of WorkerClientClose() */
+
+/***********************************************************************
+ * WorkerURingEvents:
+ *
+ * Submit the prepared io_uring requests of a worker, wait up to
+ * 'timeout_ms' for completions and process all completions.
+ *
+ * Clients with events or a completed send are added to the ready
+ * list.  Polls that ended are started again.  Closed clients are
+ * cleaned up when their send completes and removed from the 'closed'
+ * list and freed when no requests remain.
+ *
+ * Returns 1 when the wake descriptor was signaled, 0 when not and -1
+ * on error.
+ ***********************************************************************/
+static int
+WorkerURingEvents (ClientWorker *worker, int timeout_ms,
+                   WorkerClient **ready, WorkerClient **readytail,
+                   WorkerClient **closed)
+{
+  WorkerClient *wc;
+  uint64_t userdata;
+  int32_t result;
+  uint32_t flags;
+  int wake = 0;
+  int fd;
+  int op;
+
+  if (URingSubmit (&worker->uring, timeout_ms))
+  {
+    lprintf (0, "%s(): Error submitting io_uring requests: %s", __func__, strerror (errno));
+    return -1;
+  }
+
+  while (URingReap (&worker->uring, &userdata, &result, &flags))
+  {
+    op = (int)(userdata & WORKER_OP_MASK);
+    wc = (WorkerClient *)(uintptr_t)(userdata & ~(uint64_t)WORKER_OP_MASK);
+
+    if (op == WORKER_OP_CANCEL)
+      continue;
+
+    /* Wake descriptor, poll again if the poll ended */
+    if (wc == NULL)
+    {
+      wake = 1;
+
+      if (!(flags & URING_CQE_MORE) &&
+          URingPrepPoll (&worker->uring, worker->wakefd, EPOLLIN, userdata))
+      {
+        lprintf (0, "%s(): Error polling wake descriptor: %s", __func__, strerror (errno));
+        return -1;
+      }
+
+      continue;
+    }
+
+    if (op == WORKER_OP_SEND)
+    {
+      wc->sending = 0;
+
+      if (wc->closed)
+        ClientCleanup (wc->cinfo, wc->tdp);
+      else
+        WorkerURingSent (wc, result);
+    }
+    else if (op == WORKER_OP_SOCKET && result > 0 && !wc->closed &&
+             (result & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+    {
+      /* Data, shutdown or error to receive */
+      wc->cinfo->recvidle = 0;
+    }
+
+    if (op != WORKER_OP_SEND && !(flags & URING_CQE_MORE))
+    {
+      wc->polls--;
+
+      /* Poll again unless closed or failed, polls end when the completion queue is full */
+      if (!wc->closed && result < 0)
+      {
+        lprintf (0, "[%s] Error polling client: %s", wc->cinfo->hostname, strerror (-result));
+        wc->cinfo->socketerr = -1;
+      }
+      else if (!wc->closed)
+      {
+        fd = (op == WORKER_OP_SOCKET) ? wc->cinfo->socket : wc->reader.notifyfd[0];
 
-  /* Write out transmission log for this client if requested */
-  if (TLogParams.tlogbasedir)
-  {
-    lprintf (2, "[%s] Writing transmission log", cinfo->hostname);
-    WriteTLog (cinfo, 1);
-  }
+        if (URingPrepPoll (&worker->uring, fd,
+                           (op == WORKER_OP_SOCKET) ? WORKER_SOCKET_EVENTS : EPOLLIN,
+                           userdata))
+        {
+          lprintf (0, "[%s] Error polling client: %s", wc->cinfo->hostname, strerror (errno));
+          wc->cinfo->socketerr = -1;
+        }
+        else
+        {
+          wc->polls++;
+        }
+      }
+    }
 
-  /* Release limit related PCRE2 data
-   * The limitstr is not owned by the client so not free'd */
-  if (cinfo->reader->limit)
-    pcre2_code_free (cinfo->reader->limit);
-  if (cinfo->reader->limit_data)
-    pcre2_match_data_free (cinfo->reader->limit_data);
+    if (wc->closed)
+    {
+      if (!wc->sending && wc->polls == 0)
+      {
+        if (wc->prev)
+          wc->prev->next = wc->next;
+        else
+          *closed = wc->next;
+        if (wc->next)
+          wc->next->prev = wc->prev;
 
-  /* Release match and reject selectors strings and related PCRE2 data */
-  free (cinfo->matchstr);
-  if (cinfo->reader->match)
-    pcre2_code_free (cinfo->reader->match);
-  if (cinfo->reader->match_data)
-    pcre2_match_data_free (cinfo->reader->match_data);
-  free (cinfo->rejectstr);
-  if (cinfo->reader->reject)
-    pcre2_code_free (cinfo->reader->reject);
-  if (cinfo->reader->reject_data)
-    pcre2_match_data_free (cinfo->reader->reject_data);
+        free (wc);
+      }
 
-  cinfo->reader = NULL;
+      continue;
+    }
 
-  /* Release stream tracking binary tree */
-  pthread_mutex_lock (&(cinfo->streams_lock));
-  RBTreeDestroy (cinfo->streams);
-  cinfo->streams      = NULL;
-  cinfo->streamscount = 0;
-  pthread_mutex_unlock (&(cinfo->streams_lock));
+    WORKER_READY (wc, *ready, *readytail);
+  }
 
-  /* Release the client send and receive buffers */
-  free (cinfo->sendbuf);
-  free (cinfo->recvbuf);
+  return wake;
+} /* End of WorkerURingEvents() */
 
-  /* Release client socket structure, allocated in ListenThread() */
-  free (cinfo->addr);
-  cinfo->addr = NULL;
+/***********************************************************************
+ * WorkerURingSent:
+ *
+ * Handle the completion of an io_uring send of queued data, removing
+ * the sent data from the pending send buffer.  Data not sent is sent
+ * with a new request after the client is run.
+ ***********************************************************************/
+static void
+WorkerURingSent (WorkerClient *wc, int32_t result)
+{
+  ClientInfo *cinfo = wc->cinfo;
 
-  /* Shutdown and release miniSEED write data stream */
-  if (cinfo->mswrite)
+  if (result == -EAGAIN || result == -EINTR)
+    return;
+
+  if (result == -EPIPE || result == -ECONNRESET)
   {
-    ds_streamproc (cinfo->mswrite, NULL, NULL, cinfo->hostname);
-    free (cinfo->mswrite);
-    cinfo->mswrite = NULL;
+    cinfo->socketerr = -2;
+    return;
   }
 
-  if (cinfo->type == CLIENT_SEEDLINK && cinfo->extinfo)
-    SLFree (cinfo);
+  if (result < 0)
+  {
+    lprintf (0, "[%s] Error sending data: %s", cinfo->hostname, strerror (-result));
+    cinfo->socketerr = -1;
+    return;
+  }
 
-  if (cinfo->type == CLIENT_DATALINK && cinfo->extinfo)
-    DLFree (cinfo);
+  if ((size_t)result < cinfo->sendpendinglength)
+    memmove (cinfo->sendpending, cinfo->sendpending + result, cinfo->sendpendinglength - result);
 
-  lprintf (1, "Client disconnected: %s", cinfo->hostname);
+  cinfo->sendpendinglength -= result;
+  cinfo->lastxchange = NSnow ();
+} /* End of WorkerURingSent() */
+#else
+int
+ClientWorkersStart (uint32_t count)
+{
+  lprintf (0, "Client worker threads are not supported on this platform");
+  return -1;
+}
 
-  /* Set thread CLOSED status */
-  pthread_mutex_lock (&(mytdp->td_lock));
-  mytdp->td_state = TDS_CLOSED;
-  pthread_mutex_unlock (&(mytdp->td_lock));
+int
+ClientWorkerAdd (struct thread_data *tdp)
+{
+  return -1;
+}
 
-  return NULL;
-} /* End of ClientThread() */
+void
+ClientWorkersStop (void)
+{
+}
+#endif /* defined(__linux__) */
 
 /***********************************************************************
  * ClientRecv:
@@ -486,7 +1461,8 @@ ClientThread (void *arg)
  *
  * If WebSocket connection recv the framing and store the mask.
  *
- * Return >0 as number of bytes read on success
+ * Return >0 as number of bytes read on success, or to repeat a command
+ *           that waited for archive queue space
  * Return  0 when no data is available
  * Return -1 on error or timeout, ClientInfo.socketerr is set
  * Return -2 on orderly shutdown, ClientInfo.socketerr is set
@@ -500,8 +1476,26 @@ ClientRecv (ClientInfo *cinfo)
   if (!cinfo)
     return -1;
 
-  /* Recv a WebSocket frame if this connection is WebSocket */
-  if (cinfo->websocket && cinfo->recvlength == 0)
+  /* A command waiting for archive writer queue space is not received
+   * again, the command in ClientInfo.dlcommand is repeated once there
+   * is space for its records */
+  if (cinfo->archivewait)
+  {
+    if (!ds_writerspace (cinfo->mswrite, cinfo->archivewait))
+      return 0;
+
+    cinfo->archivewait = 0;
+
+    return 1;
+  }
+
+  /* Recv a WebSocket frame if this connection is WebSocket, no payload
+   * is expected and all received data has been consumed, or continue
+   * a partially received frame header.  Control frames (ping, pong) are
+   * handled completely and receiving continues with the next frame. */
+  while (cinfo->websocket &&
+         (cinfo->wsframing ||
+          (cinfo->wspayload == 0 && cinfo->recvlength <= cinfo->recvconsumed)))
   {
     nread = RecvWSFrame (cinfo, &wslength);
 
@@ -515,7 +1509,8 @@ ClientRecv (ClientInfo *cinfo)
     }
     else if (nread == 0)
     {
-      return 0;
+      if (cinfo->wsframing)
+        return 0;
     }
     else
     {
@@ -568,7 +1563,19 @@ SendData (ClientInfo *cinfo, void *buffer, size_t buflen, int no_wsframe)
  * If connection is a WebSocket, and no_wsframe is not set, create a single
  * frame header that represents the total of all buffers.
  *
- * Socket is set to blocking during the send operation.
+ * The client socket is left in non-blocking mode, all buffers are
+ * gathered into an I/O vector and sent with as few writev() calls as
+ * possible.  When the socket cannot accept more data this routine
+ * waits for it to become writable, making the send effectively
+ * blocking for the caller.  TLS connections write each buffer in turn.
+ *
+ * For clients served by a worker thread (pooled) data that cannot be
+ * sent immediately is queued with SendQueue() instead of waiting, and
+ * sent by the worker with SendPending() when the socket is writable.
+ * Workers using io_uring queue all data (uringio) and submit the
+ * sends of all their clients together.
+ *
+ * At most SENDDATA_MAXBUFS buffers may be sent in a single call.
  *
  * Return  0 on success
  * Return -1 on error or timeout, ClientInfo.socketerr is set
@@ -579,17 +1586,14 @@ SendDataMB (ClientInfo *cinfo, void *buffer[], size_t buflen[],
             int bufcount, int no_wsframe)
 {
   TLSCTX *tlsctx = cinfo->tlsctx;
+  struct iovec iov[SENDDATA_MAXBUFS + 1];
+  int iovcnt = 0;
+  int iovidx = 0;
   size_t totalbuflen = 0;
   ssize_t nsent;
-  int sockflags;
-  int blockflags;
   int idx;
 
-  uint8_t wsframe[10];
-  size_t wsframelen;
-  uint8_t length8;
-  uint16_t length16;
-  uint64_t length64;
+  uint8_t wsframe[WS_FRAMEMAX];
 
   if (!cinfo)
     return -1;
@@ -597,125 +1601,73 @@ SendDataMB (ClientInfo *cinfo, void *buffer[], size_t buflen[],
   if (bufcount <= 0)
     return 0;
 
-  for (idx = 0; idx < bufcount; idx++)
+  if (bufcount > SENDDATA_MAXBUFS)
   {
-    totalbuflen += buflen[idx];
+    lprintf (0, "[%s] %s(): Too many buffers to send: %d",
+             cinfo->hostname, __func__, bufcount);
+    cinfo->socketerr = -1;
+    return -1;
   }
 
-  /* Clear non-blocking flag from socket flags */
-  sockflags = blockflags = fcntl (cinfo->socket, F_GETFL, 0);
-  blockflags &= ~O_NONBLOCK;
-  if (fcntl (cinfo->socket, F_SETFL, blockflags) == -1)
+  for (idx = 0; idx < bufcount; idx++)
   {
-    lprintf (0, "[%s] %s(): Error clearing non-blocking flag: %s",
-             cinfo->hostname, __func__, strerror (errno));
-    cinfo->socketerr = -1;
-    return -1;
+    totalbuflen += buflen[idx];
   }
 
-  /* If connection is WebSocket, generate and send an appropriate frame */
+  /* If connection is WebSocket, the frame is sent first in the same write */
   if (cinfo->websocket && !no_wsframe)
   {
-    wsframelen = 0;
-    wsframe[0] = 0x82; /* FIN=1(0x80), OPCODE=binary(0x2) */
-    wsframe[1] = 0;    /* MASK=0, payload length added below */
-
-    if (totalbuflen < 126) /* If payload length < 126 store in bits 1-7 of byte 2 */
-    {
-      wsframelen = 2;
-      length8    = totalbuflen;
-      wsframe[1] |= length8;
-    }
-    else if (totalbuflen < UINT16_MAX) /* If payload length < 16-bit int store in next two bytes */
-    {
-      wsframelen = 4;
-      wsframe[1] |= 126;
-      length16 = totalbuflen;
-      memcpy (&wsframe[2], &length16, 2);
-      if (!ms_bigendianhost ())
-        ms_gswap2 (&wsframe[2]);
-    }
-    else if (totalbuflen < UINT64_MAX) /* If payload length < 64-bit int store in next 8 bytes */
-    {
-      wsframelen = 10;
-      wsframe[1] |= 127;
-      length64 = totalbuflen;
-      memcpy (&wsframe[2], &length64, 8);
-      if (!ms_bigendianhost ())
-        ms_gswap8 (&wsframe[2]);
-    }
-    else
-    {
-      lprintf (0, "[%s] %s() Payload length too large for WebSocket: %zu",
-               cinfo->hostname, __func__, totalbuflen);
-      return -1;
-    }
+    iov[iovcnt].iov_base = wsframe;
+    iov[iovcnt].iov_len  = WSFrameHeader (wsframe, totalbuflen);
+    iovcnt++;
+  }
 
-    /* Send WebSocket frame */
-    if (wsframelen)
-    {
-      if (cinfo->tlsctx)
-      {
-        /* TLS writes can be fragmented, loop until everything has been sent */
-        for (int written = 0; written < wsframelen; written += nsent)
-        {
-          while ((nsent = mbedtls_ssl_write (&tlsctx->ssl, wsframe + written, wsframelen - written)) <= 0)
-          {
-            if (nsent != MBEDTLS_ERR_SSL_WANT_READ &&
-                nsent != MBEDTLS_ERR_SSL_WANT_WRITE &&
-                nsent != MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS)
-              break;
-          }
-
-          if (nsent < 0)
-            break;
-        }
-      }
-      else
-      {
-        nsent = send (cinfo->socket, wsframe, wsframelen, 0);
-      }
+  /* Add each non-empty buffer in sequence */
+  for (idx = 0; idx < bufcount; idx++)
+  {
+    if (buflen[idx] == 0)
+      continue;
 
-      /* Connection closed by peer */
-      if ((cinfo->tlsctx && nsent == MBEDTLS_ERR_NET_CONN_RESET) ||
-          (nsent == -1 && errno == EPIPE))
-      {
-        cinfo->socketerr = -2; /* Indicate an orderly shutdown */
-        return -2;
-      }
-      /* Connection error */
-      else if (nsent < 0)
-      {
-        lprintf (0, "[%s] Error sending WebSocket frame", cinfo->hostname);
-        cinfo->socketerr = -1; /* Indicate fatal socket error */
-        return -1;
-      }
-    }
+    iov[iovcnt].iov_base = buffer[idx];
+    iov[iovcnt].iov_len  = buflen[idx];
+    iovcnt++;
   }
 
-  /* Send each buffer in sequence */
-  for (idx = 0; idx < bufcount; idx++)
+  /* Queue behind data already waiting to be sent to a pooled client */
+  if (cinfo->sendpendinglength > 0 || cinfo->uringio)
+    return SendQueue (cinfo, iov, iovcnt);
+
+  /* Send all vectors, waiting for the connection to be ready as needed */
+  while (iovidx < iovcnt)
   {
     if (cinfo->tlsctx)
     {
-      /* TLS writes can be fragmented, loop until everything has been sent */
-      for (int written = 0; written < buflen[idx]; written += nsent)
-      {
-        while ((nsent = mbedtls_ssl_write (&tlsctx->ssl, buffer[idx] + written, buflen[idx] - written)) <= 0)
-        {
-          if (nsent != MBEDTLS_ERR_SSL_WANT_READ &&
-              nsent != MBEDTLS_ERR_SSL_WANT_WRITE &&
-              nsent != MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS)
-            break;
-        }
+      /* TLS writes can be fragmented, partial writes are handled below */
+      nsent = mbedtls_ssl_write (&tlsctx->ssl, iov[iovidx].iov_base, iov[iovidx].iov_len);
 
-        if (nsent < 0)
-          break;
+      if (nsent == MBEDTLS_ERR_SSL_WANT_READ ||
+          nsent == MBEDTLS_ERR_SSL_WANT_WRITE ||
+          nsent == MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS)
+      {
+        if (SendWait (cinfo->socket, (nsent == MBEDTLS_ERR_SSL_WANT_READ)) < 0)
+          nsent = -1;
+        else
+          continue;
       }
     }
     else
     {
-      nsent = send (cinfo->socket, buffer[idx], buflen[idx], 0);
+      nsent = writev (cinfo->socket, &iov[iovidx], iovcnt - iovidx);
+
+      if (nsent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      {
+        /* Queue the remainder for a pooled client instead of waiting */
+        if (cinfo->pooled && errno != EINTR)
+          return SendQueue (cinfo, &iov[iovidx], iovcnt - iovidx);
+
+        if (SendWait (cinfo->socket, 0) >= 0)
+          continue;
+      }
     }
 
     /* Connection closed by peer */
@@ -731,10 +1683,10 @@ SendDataMB (ClientInfo *cinfo, void *buffer[], size_t buflen[],
       /* Create a limited, printable buffer for the diagnostic message */
       char pbuffer[100];
       char *cp;
-      size_t maxlength = (buflen[idx] < sizeof (pbuffer)) ? buflen[idx] : sizeof (pbuffer);
+      size_t maxlength = (iov[iovidx].iov_len < sizeof (pbuffer)) ? iov[iovidx].iov_len : sizeof (pbuffer);
 
-      strncpy (pbuffer, (char *)buffer[idx], maxlength - 1);
-      pbuffer[sizeof (pbuffer) - 1] = '\0';
+      memset (pbuffer, 0, sizeof (pbuffer));
+      strncpy (pbuffer, (char *)iov[iovidx].iov_base, maxlength - 1);
 
       if ((cp = memchr (pbuffer, '\r', maxlength)))
         *cp = '\0';
@@ -753,22 +1705,150 @@ SendDataMB (ClientInfo *cinfo, void *buffer[], size_t buflen[],
       cinfo->socketerr = -1; /* Indicate fatal socket error */
       return -1;
     }
-  } /* Done looping through supplied buffers */
+
+    /* Skip completely sent vectors and adjust a partially sent vector */
+    while (nsent > 0 && iovidx < iovcnt)
+    {
+      if ((size_t)nsent >= iov[iovidx].iov_len)
+      {
+        nsent -= iov[iovidx].iov_len;
+        iovidx++;
+      }
+      else
+      {
+        iov[iovidx].iov_base = (char *)iov[iovidx].iov_base + nsent;
+        iov[iovidx].iov_len -= nsent;
+        nsent = 0;
+      }
+    }
+  } /* Done sending all vectors */
 
   /* Update the time of the last packet exchange */
   cinfo->lastxchange = NSnow ();
 
-  /* Restore original socket flags */
-  if (fcntl (cinfo->socket, F_SETFL, sockflags) == -1)
+  return 0;
+} /* End of SendDataMB() */
+
+/***************************************************************************
+ * SendWait:
+ *
+ * Wait for a non-blocking socket to become writable, or readable if
+ * 'readability' is set (needed by TLS renegotiation), after a send
+ * could not be completed.  The socket is polled until it is ready,
+ * matching the behavior of a blocking send.
+ *
+ * Return >=1 when the socket is ready
+ * Return  <0 on error, check errno
+ ***************************************************************************/
+static int
+SendWait (int socket, int readability)
+{
+  int rv;
+
+  do
   {
-    lprintf (0, "[%s] %s(): Error setting non-blocking flag: %s",
-             cinfo->hostname, __func__, strerror (errno));
-    cinfo->socketerr = -1;
-    return -1;
+    rv = PollSocket (socket, readability, !readability, 1000);
+  } while (rv == 0 || (rv < 0 && errno == EINTR));
+
+  return rv;
+} /* End of SendWait() */
+
+/***************************************************************************
+ * SendQueue:
+ *
+ * Append the data in an I/O vector to the pending send buffer of a
+ * pooled client.
+ *
+ * Return  0 on success
+ * Return -1 on error, ClientInfo.socketerr is set
+ ***************************************************************************/
+static int
+SendQueue (ClientInfo *cinfo, struct iovec *iov, int iovcnt)
+{
+  size_t length = cinfo->sendpendinglength;
+  size_t size;
+  char *newbuf;
+  int idx;
+
+  for (idx = 0; idx < iovcnt; idx++)
+    length += iov[idx].iov_len;
+
+  if (length > cinfo->sendpendingsize)
+  {
+    size = (cinfo->sendpendingsize) ? cinfo->sendpendingsize : cinfo->sendbufsize;
+    while (size < length)
+      size *= 2;
+
+    if ((newbuf = (char *)realloc (cinfo->sendpending, size)) == NULL)
+    {
+      lprintf (0, "[%s] Error growing pending send buffer to %zu bytes", cinfo->hostname, size);
+      cinfo->socketerr = -1;
+      return -1;
+    }
+
+    cinfo->sendpending     = newbuf;
+    cinfo->sendpendingsize = size;
+  }
+
+  for (idx = 0; idx < iovcnt; idx++)
+  {
+    memcpy (cinfo->sendpending + cinfo->sendpendinglength, iov[idx].iov_base, iov[idx].iov_len);
+    cinfo->sendpendinglength += iov[idx].iov_len;
   }
 
+  /* Update the time of the last packet exchange */
+  cinfo->lastxchange = NSnow ();
+
   return 0;
-} /* End of SendDataMB() */
+} /* End of SendQueue() */
+
+/***************************************************************************
+ * SendPending:
+ *
+ * Send data queued for a pooled client without waiting.
+ *
+ * Return  1 when no data remains queued
+ * Return  0 when the socket cannot accept all queued data
+ * Return -1 on error, ClientInfo.socketerr is set
+ * Return -2 on orderly shutdown, ClientInfo.socketerr is set
+ ***************************************************************************/
+static int
+SendPending (ClientInfo *cinfo)
+{
+  ssize_t nsent;
+
+  while (cinfo->sendpendinglength > 0)
+  {
+    nsent = send (cinfo->socket, cinfo->sendpending, cinfo->sendpendinglength, 0);
+
+    if (nsent == -1 && errno == EINTR)
+      continue;
+
+    if (nsent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+
+    if (nsent == -1 && (errno == EPIPE || errno == ECONNRESET))
+    {
+      cinfo->socketerr = -2;
+      return -2;
+    }
+
+    if (nsent < 0)
+    {
+      lprintf (0, "[%s] Error sending data: %s", cinfo->hostname, strerror (errno));
+      cinfo->socketerr = -1;
+      return -1;
+    }
+
+    if ((size_t)nsent < cinfo->sendpendinglength)
+      memmove (cinfo->sendpending, cinfo->sendpending + nsent, cinfo->sendpendinglength - nsent);
+
+    cinfo->sendpendinglength -= nsent;
+    cinfo->lastxchange = NSnow ();
+  }
+
+  return 1;
+} /* End of SendPending() */
 
 /***********************************************************************
  * RecvData:
@@ -793,11 +1873,18 @@ SendDataMB (ClientInfo *cinfo, void *buffer[], size_t buflen[],
  * For any blocking reads this routine will poll the socket for up to
  * 10 seconds before timing out and returning -2.
  *
+ * Clients served by worker threads (pooled) never block, if not all
+ * recvlen bytes are available the received data is kept in the
+ * receive buffer and 0 is returned.  The caller must repeat the
+ * request, without consuming any data, when the socket is readable
+ * again.
+ *
  * The caller _must_ consume the data requested.  It will be discarded
  * on the next call to RecvData().
  *
  * Return >0 as number of bytes for the caller to consume on success
- * Return  0 when fulfill == 0 and no data is available
+ * Return  0 when fulfill == 0 and no data is available, or when pooled
+ *         and not all requested data is available
  * Return -1 on error or timeout, ClientInfo.socketerr may be set
  * Return -2 on orderly shutdown, ClientInfo.socketerr is set
  ***********************************************************************/
@@ -808,6 +1895,8 @@ RecvData (ClientInfo *cinfo, void *buffer, size_t requested, int fulfill)
   ssize_t nrecv;
   size_t nread = 0;
   size_t receivable;
+  size_t needed;
+  size_t frameend;
   char *recvptr;
   char peekbyte[1];
 
@@ -854,8 +1943,24 @@ RecvData (ClientInfo *cinfo, void *buffer, size_t requested, int fulfill)
   recvptr = cinfo->recvbuf + cinfo->recvlength;
   receivable = cinfo->recvbufsize - cinfo->recvlength;
 
-  /* Recv until requested bytes are available */
-  while ((cinfo->recvlength + nread) < requested)
+  /* Do not read past the current WebSocket frame, the header of a
+   * following frame must be received separately and is not masked */
+  if (cinfo->websocket)
+  {
+    frameend = (requested > cinfo->wspayload) ? requested : cinfo->wspayload;
+
+    if (frameend > cinfo->recvlength && (frameend - cinfo->recvlength) < receivable)
+      receivable = frameend - cinfo->recvlength;
+  }
+
+  /* Recv until requested bytes are available, including the rest of a
+   * WebSocket payload, which is only usable once completely unmasked */
+  needed = requested;
+
+  if (cinfo->wspayload > needed && cinfo->wspayload <= cinfo->recvbufsize)
+    needed = cinfo->wspayload;
+
+  while ((cinfo->recvlength + nread) < needed)
   {
     if (cinfo->tlsctx)
     {
@@ -878,6 +1983,13 @@ RecvData (ClientInfo *cinfo, void *buffer, size_t requested, int fulfill)
       if (fulfill == 0 && nread == 0)
         return 0;
 
+      /* Pooled clients do not wait, keep the data read until the request is repeated */
+      if (cinfo->pooled)
+      {
+        cinfo->recvlength += nread;
+        return 0;
+      }
+
       /* Poll up to 10 seconds == 10,000 milliseconds */
       int pollret = PollSocket (cinfo->socket, 1, 0, 10000);
 
@@ -929,10 +2041,9 @@ RecvData (ClientInfo *cinfo, void *buffer, size_t requested, int fulfill)
   {
     if (cinfo->recvlength >= cinfo->wspayload)
     {
-      recvptr = cinfo->recvbuf;
-      for (int idx = 0; idx < cinfo->wspayload; idx++, recvptr++, cinfo->wsmaskidx++)
-        *recvptr = *recvptr ^ cinfo->wsmask.four[cinfo->wsmaskidx % 4];
+      WSUnmask ((uint8_t *)cinfo->recvbuf, cinfo->wspayload, cinfo->wsmask.four, cinfo->wsmaskidx);
 
+      cinfo->wsmaskidx += cinfo->wspayload;
       cinfo->wspayload = 0;
     }
     else
@@ -967,8 +2078,16 @@ RecvData (ClientInfo *cinfo, void *buffer, size_t requested, int fulfill)
  * read.  If no data has been read and no data is available from the
  * socket this routine will return immediately.
  *
- * The command (header body) returned in the ClientInfo.recvbuf buffer
- * will always be a NULL terminated string.
+ * The pre-header and header body are received together and are only
+ * consumed when complete, so a pooled client that received part of a
+ * command resumes with the pre-header on the next call.
+ *
+ * A command waiting for its data (ClientInfo.recvpending) is returned
+ * again once the data has been received, leaving the data unconsumed
+ * for the command to receive.
+ *
+ * The command (header body) returned in the ClientInfo.dlcommand
+ * buffer will always be a NULL terminated string.
  *
  * Return >0 as number of bytes read on success
  * Return  0 when no data is available
@@ -978,7 +2097,6 @@ RecvData (ClientInfo *cinfo, void *buffer, size_t requested, int fulfill)
 int
 RecvDLCommand (ClientInfo *cinfo)
 {
-  int nread = 0;
   int nrecv;
   uint8_t headerlen;
 
@@ -988,6 +2106,22 @@ RecvDLCommand (ClientInfo *cinfo)
     return -1;
   }
 
+  /* Repeat a command once the data it is waiting for has been received */
+  if (cinfo->recvpending)
+  {
+    nrecv = RecvData (cinfo, cinfo->recvbuf, cinfo->recvpending, 1);
+
+    if (nrecv <= 0)
+    {
+      return nrecv;
+    }
+
+    cinfo->recvconsumed = 0;
+    cinfo->recvpending  = 0;
+
+    return nrecv;
+  }
+
   /* Receive and process the 3 byte DataLink pre-header */
   nrecv = RecvData (cinfo, cinfo->recvbuf, 3, 0);
 
@@ -996,8 +2130,6 @@ RecvDLCommand (ClientInfo *cinfo)
     return nrecv;
   }
 
-  nread += nrecv;
-
   /* Sequence bytes of 'DL' identify DataLink */
   if (cinfo->recvbuf[0] == 'D' && cinfo->recvbuf[1] == 'L')
   {
@@ -1021,21 +2153,22 @@ RecvDLCommand (ClientInfo *cinfo)
     return -1;
   }
 
-  /* Receive command in header body, must be fulfilled */
-  nrecv = RecvData (cinfo, cinfo->dlcommand, headerlen, 1);
+  /* Receive pre-header and command in header body, must be fulfilled */
+  cinfo->recvconsumed = 0;
+  nrecv = RecvData (cinfo, cinfo->recvbuf, 3 + headerlen, 1);
 
-  if (nrecv != headerlen)
+  if (nrecv != 3 + headerlen)
   {
     return nrecv;
   }
 
-  nread += nrecv;
+  memcpy (cinfo->dlcommand, cinfo->recvbuf + 3, headerlen);
 
   /* Make sure the command is NULL terminated. The command buffer size is the
    * the maximum header length (UINT8_MAX) plus 1, so this should be safe. */
-  cinfo->dlcommand[nrecv] = '\0';
+  cinfo->dlcommand[headerlen] = '\0';
 
-  return nread;
+  return nrecv;
 } /* End of RecvDLCommand() */
 
 /***********************************************************************
@@ -1183,6 +2316,37 @@ PollSocket (int socket, int readability, int writability, int timeout_ms)
   return poll (&pfd, 1, timeout_ms);
 } /* End of PollSocket() */
 
+/***************************************************************************
+ * PollClient:
+ *
+ * Poll a client socket for readability and a ring notification
+ * descriptor for a new packet signal for a specified amount of time.
+ *
+ * The timeout is specified in milliseconds.
+ *
+ * return >=1 : success
+ * return   0 : if time-out expires or socket not connected
+ * return  <0 : errors, check errno
+ ***************************************************************************/
+static int
+PollClient (int socket, int notifyfd, int timeout_ms)
+{
+  struct pollfd pfd[2];
+
+  if (socket < 0 || timeout_ms < 0)
+    return 0;
+
+  if (notifyfd < 0)
+    return PollSocket (socket, 1, 0, timeout_ms);
+
+  pfd[0].fd     = socket;
+  pfd[0].events = POLLIN;
+  pfd[1].fd     = notifyfd;
+  pfd[1].events = POLLIN;
+
+  return poll (pfd, 2, timeout_ms);
+} /* End of PollClient() */
+
 /***************************************************************************
  * GetStreamNode:
  *
@@ -35,6 +35,13 @@ extern "C" {
 #include "ringserver.h"
 #include "dsarchive.h"
 
+/* Maximum number of buffers in a single SendDataMB() call */
+#define SENDDATA_MAXBUFS 128
+
+/* Limits for packets streamed to a client in a single send */
+#define STREAM_BATCH_PACKETS 32    /* Maximum packets in a batch */
+#define STREAM_BATCH_BYTES   65536 /* Maximum packet data bytes in a batch */
+
 /* Client types */
 typedef enum
 {
@@ -66,6 +73,8 @@ typedef struct ClientInfo
   size_t      recvbufsize;  /* Length of receive buffer in bytes */
   size_t      recvlength;   /* Length of data in recvbuf */
   size_t      recvconsumed; /* Bytes of recvbuf that have been consumed */
+  size_t      recvpending;  /* Bytes of command data awaited before repeating the command */
+  uint32_t    archivewait;  /* Records awaiting archive queue space before repeating the command */
   char        dlcommand[UINT8_MAX + 1]; /* DataLink command buffer */
   RingPacket  packet;       /* Client specific ring packet header */
   struct sockaddr *addr;    /* client socket structure */
@@ -85,6 +94,7 @@ typedef struct ClientInfo
   } wsmask;                 /* Masking key for WebSocket message */
   size_t      wsmaskidx;    /* Index for unmasking WebSocket message */
   uint64_t    wspayload;    /* Length of WebSocket payload */
+  uint8_t     wsframing;    /* Flag: WebSocket frame header is partially received */
   uint8_t     writeperm;    /* Write permission flag */
   uint8_t     trusted;      /* Trusted client flag */
   float       timewinlimit; /* Time window ring search limit in percent */
@@ -114,6 +124,12 @@ typedef struct ClientInfo
   double      rxbyterate;   /* Track rate of data byte reception */
   nstime_t    ratetime;     /* Time stamp for TX and RX rate calculations */
   void       *extinfo;      /* Extended client info, protocol specific */
+  uint8_t     pooled;       /* Flag identifying a client served by a worker thread */
+  char       *sendpending;  /* Data queued for a pooled client, not yet sent */
+  size_t      sendpendingsize;   /* Size of pending send buffer in bytes */
+  size_t      sendpendinglength; /* Length of data in pending send buffer */
+  uint8_t     uringio;      /* Flag: I/O is driven by a worker thread using io_uring */
+  uint8_t     recvidle;     /* Flag: nothing to receive until the next socket event */
 } ClientInfo;
 
 /* Structure used as the data for B-tree of stream tracking */
@@ -128,12 +144,16 @@ typedef struct StreamNode
 } StreamNode;
 
 extern void *ClientThread (void *arg);
+extern int ClientWorkersStart (uint32_t count, int useuring);
+extern int ClientWorkerAdd (struct thread_data *tdp);
+extern void ClientWorkersStop (void);
 
 extern int SendData (ClientInfo *cinfo, void *buffer, size_t buflen, int no_wsframe);
 
 extern int SendDataMB (ClientInfo *cinfo, void *buffer[], size_t buflen[],
                        int bufcount, int no_wsframe);
 
+
 extern int RecvData (ClientInfo *cinfo, void *buffer, size_t requested, int fulfill);
 
 extern int RecvDLCommand (ClientInfo *cinfo);
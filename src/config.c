@@ -26,6 +26,7 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
@@ -48,6 +49,7 @@ static int YesNo (const char *value);
 static int InitServerSocket (char *portstr, ListenOptions options);
 static int ConfigMSWrite (char *value);
 static int AddListenThreads (ListenPortParams *lpp);
+static int InitListenSockets (void);
 static uint64_t CalcSize (const char *sizestr);
 static int AddMSeedScanThread (const char *configstr);
 static int AddServerThread (ServerThreadType type, void *params);
@@ -394,6 +396,10 @@ ProcessParam (int argcount, char **argvec)
     loopstp = loopstp->next;
   }
 
+  /* Apply listen socket parameters now that all are known */
+  if (InitListenSockets ())
+    exit (1);
+
   return 0;
 } /* End of ProcessParam() */
 
@@ -481,6 +487,30 @@ ReadEnvironmentVariables (void)
     count++;
   }
 
+  if ((envvar = getenv ("RS_RING_HUGE_PAGES")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "RingHugePages %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
+  if ((envvar = getenv ("RS_RING_PREFAULT")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "RingPrefault %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
+  if ((envvar = getenv ("RS_RING_NUMA_POLICY")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "RingNUMAPolicy %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
   if ((envvar = getenv ("RS_AUTO_RECOVERY")) && strcasecmp (envvar, "DISABLE"))
   {
     snprintf (paramstr, sizeof (paramstr), "AutoRecovery %s", envvar);
@@ -561,6 +591,38 @@ ReadEnvironmentVariables (void)
     count++;
   }
 
+  if ((envvar = getenv ("RS_LISTEN_BACKLOG")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "ListenBacklog %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
+  if ((envvar = getenv ("RS_LISTEN_THREADS")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "ListenThreads %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
+  if ((envvar = getenv ("RS_WORKER_THREADS")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "WorkerThreads %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
+  if ((envvar = getenv ("RS_WORKER_IO")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "WorkerIO %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
   if ((envvar = getenv ("RS_RESOLVE_HOSTNAMES")) && strcasecmp (envvar, "DISABLE"))
   {
     snprintf (paramstr, sizeof (paramstr), "ResolveHostnames %s", envvar);
@@ -681,6 +743,46 @@ ReadEnvironmentVariables (void)
     count++;
   }
 
+  if ((envvar = getenv ("RS_MSEED_WRITE_THREADS")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "MSeedWriteThreads %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
+  if ((envvar = getenv ("RS_MSEED_WRITE_QUEUE")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "MSeedWriteQueue %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
+  if ((envvar = getenv ("RS_MSEED_WRITE_FLUSH")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "MSeedWriteFlush %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
+  if ((envvar = getenv ("RS_MSEED_WRITE_OPEN_FILES")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "MSeedWriteOpenFiles %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
+  if ((envvar = getenv ("RS_MSEED_WRITE_SYNC")) && strcasecmp (envvar, "DISABLE"))
+  {
+    snprintf (paramstr, sizeof (paramstr), "MSeedWriteSync %s", envvar);
+    if (SetParameter (paramstr, 0) <= 0)
+      return -1;
+    count++;
+  }
+
   if ((envvar = getenv ("RS_TLS_CERT_FILE")) && strcasecmp (envvar, "DISABLE"))
   {
     snprintf (paramstr, sizeof (paramstr), "TLSCertFile \"%s\"", envvar);
@@ -916,7 +1018,14 @@ ReadConfigFile (char *configfile, int dynamiconly, time_t mtime)
  * MaxPacketID <id>  (deprecated, parsed and prints a warning)
  * MaxPacketSize <size>
  * MemoryMapRing <1|0>
- * AutoRecovery <2|1|0>
+ * RingHugePages <none|transparent|explicit>
+ * RingPrefault <none|populate|lock>
+ * RingNUMAPolicy <default|interleave|bind> [nodes]
+ * AutoRecovery <3|2|1|0>
+ * WorkerThreads <count|auto>
+ * WorkerIO <epoll|io_uring>
+ * ListenBacklog <count>
+ * ListenThreads <count>
  * ListenPort <port> [flags]
  * SeedLinkPort <port> [flags]
  * DataLinkPort <port> [flags]
@@ -941,6 +1050,11 @@ ReadConfigFile (char *configfile, int dynamiconly, time_t mtime)
  * [D] WebRoot <web content root>
  * [D] HTTPHeader <HTTP header>
  * [D] MSeedWrite <format>
+ * MSeedWriteThreads <count>
+ * MSeedWriteQueue <records>
+ * MSeedWriteFlush <milliseconds>
+ * MSeedWriteOpenFiles <count>
+ * [D] MSeedWriteSync <none|always|interval>
  * [D[ TLSCertFile <file>
  * [D] TLSKeyFile <file>
  * [D] TLSVerifyClientCert 0|1
@@ -1065,13 +1179,20 @@ SetParameter (const char *paramstring, int dynamiconly)
     if (dynamiconly)
       return fieldcount;
 
-    if ((yesno = YesNo (field[1])) < 0)
+    /* Recovery modes 0-3, or a yes/no value for modes 1 and 0 */
+    if (field[1][0] >= '0' && field[1][0] <= '3' && field[1][1] == '\0')
+    {
+      config.autorecovery = field[1][0] - '0';
+    }
+    else if ((yesno = YesNo (field[1])) >= 0)
+    {
+      config.autorecovery = yesno;
+    }
+    else
     {
       lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
       return -1;
     }
-
-    config.autorecovery = yesno;
   }
   else if (!strcasecmp ("MemoryMapRing", field[0]) && fieldcount == 2)
   {
@@ -1086,6 +1207,65 @@ SetParameter (const char *paramstring, int dynamiconly)
 
     config.memorymapring = yesno;
   }
+  else if (!strcasecmp ("RingHugePages", field[0]) && fieldcount == 2)
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    if (!strcasecmp (field[1], "none"))
+      config.ringmem.hugepages = RING_HUGEPAGES_NONE;
+    else if (!strcasecmp (field[1], "transparent"))
+      config.ringmem.hugepages = RING_HUGEPAGES_TRANSPARENT;
+    else if (!strcasecmp (field[1], "explicit"))
+      config.ringmem.hugepages = RING_HUGEPAGES_EXPLICIT;
+    else
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+  }
+  else if (!strcasecmp ("RingPrefault", field[0]) && fieldcount == 2)
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    if (!strcasecmp (field[1], "none"))
+      config.ringmem.prefault = RING_PREFAULT_NONE;
+    else if (!strcasecmp (field[1], "populate"))
+      config.ringmem.prefault = RING_PREFAULT_POPULATE;
+    else if (!strcasecmp (field[1], "lock"))
+      config.ringmem.prefault = RING_PREFAULT_LOCK;
+    else
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+  }
+  else if (!strcasecmp ("RingNUMAPolicy", field[0]) && (fieldcount == 2 || fieldcount == 3))
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    config.ringmem.numanodes = 0;
+
+    if (!strcasecmp (field[1], "default") && fieldcount == 2)
+      config.ringmem.numapolicy = RING_NUMA_DEFAULT;
+    else if (!strcasecmp (field[1], "interleave"))
+      config.ringmem.numapolicy = RING_NUMA_INTERLEAVE;
+    else if (!strcasecmp (field[1], "bind") && fieldcount == 3)
+      config.ringmem.numapolicy = RING_NUMA_BIND;
+    else
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+
+    if (fieldcount == 3 && ParseNumberList (field[2], &config.ringmem.numanodes))
+    {
+      lprintf (0, "Error with %s config parameter, invalid node list: %s", field[0], paramstring);
+      return -1;
+    }
+  }
   else if ((!strcasecmp ("ListenPort", field[0]) ||
             !strcasecmp ("DataLinkPort", field[0]) ||
             !strcasecmp ("SeedLinkPort", field[0]) ||
@@ -1243,6 +1423,74 @@ SetParameter (const char *paramstring, int dynamiconly)
       return -1;
     }
   }
+  else if (!strcasecmp ("ListenBacklog", field[0]) && fieldcount == 2)
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    if (sscanf (field[1], "%" SCNu32, &config.listenbacklog) != 1 ||
+        config.listenbacklog == 0 || config.listenbacklog > INT_MAX)
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+  }
+  else if (!strcasecmp ("ListenThreads", field[0]) && fieldcount == 2)
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    if (sscanf (field[1], "%" SCNu32, &config.listenthreads) != 1 ||
+        config.listenthreads == 0)
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+
+#if !defined(SO_REUSEPORT)
+    if (config.listenthreads > 1)
+    {
+      lprintf (0, "%s requires SO_REUSEPORT, not supported on this platform", field[0]);
+      return -1;
+    }
+#endif
+  }
+  else if (!strcasecmp ("WorkerThreads", field[0]) && fieldcount == 2)
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    if (!strcasecmp (field[1], "auto"))
+    {
+      long int online = sysconf (_SC_NPROCESSORS_ONLN);
+
+      config.workerthreads = (online > 0) ? (uint32_t)online : 1;
+    }
+    else if (sscanf (field[1], "%" SCNu32, &config.workerthreads) != 1)
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+  }
+  else if (!strcasecmp ("WorkerIO", field[0]) && fieldcount == 2)
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    if (!strcasecmp (field[1], "epoll"))
+    {
+      config.workeruring = 0;
+    }
+    else if (!strcasecmp (field[1], "io_uring"))
+    {
+      config.workeruring = 1;
+    }
+    else
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+  }
   else if (!strcasecmp ("ResolveHostnames", field[0]) && fieldcount == 2)
   {
     if ((yesno = YesNo (field[1])) < 0)
@@ -1402,6 +1650,66 @@ SetParameter (const char *paramstring, int dynamiconly)
       return -1;
     }
   }
+  else if (!strcasecmp ("MSeedWriteThreads", field[0]) && fieldcount == 2)
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    if (sscanf (field[1], "%" SCNu32, &config.mseedwritethreads) != 1)
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+  }
+  else if (!strcasecmp ("MSeedWriteQueue", field[0]) && fieldcount == 2)
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    if (sscanf (field[1], "%" SCNu32, &config.mseedwritequeue) != 1 || config.mseedwritequeue == 0)
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+  }
+  else if (!strcasecmp ("MSeedWriteFlush", field[0]) && fieldcount == 2)
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    if (sscanf (field[1], "%" SCNu32, &config.mseedwriteflush) != 1)
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+  }
+  else if (!strcasecmp ("MSeedWriteOpenFiles", field[0]) && fieldcount == 2)
+  {
+    if (dynamiconly)
+      return fieldcount;
+
+    if (sscanf (field[1], "%" SCNu32, &config.mseedwriteopenfiles) != 1 || config.mseedwriteopenfiles <= 10)
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+  }
+  else if (!strcasecmp ("MSeedWriteSync", field[0]) && fieldcount == 2)
+  {
+    if (!strcasecmp (field[1], "none"))
+    {
+      config.mseedwritesync = -1;
+    }
+    else if (!strcasecmp (field[1], "always"))
+    {
+      config.mseedwritesync = 0;
+    }
+    else if (sscanf (field[1], "%d", &config.mseedwritesync) != 1 || config.mseedwritesync <= 0)
+    {
+      lprintf (0, "Error with %s config parameter: %s", field[0], paramstring);
+      return -1;
+    }
+  }
   else if (!strcasecmp ("MSeedScan", field[0]) && fieldcount >= 2)
   {
     if (dynamiconly)
@@ -1474,7 +1782,9 @@ YesNo (const char *value)
  * InitServerSocket:
  *
  * Initialize a TCP server socket on the specified port bound to all
- * local addresses/interfaces.
+ * local addresses/interfaces.  The socket is created with the
+ * configured backlog and, if more than one accepting thread is
+ * configured, with SO_REUSEPORT.
  *
  * Return socket descriptor on success and -1 on error.
  ***********************************************************************/
@@ -1501,7 +1811,7 @@ InitServerSocket (char *portstr, ListenOptions options)
       close(fd);
       return -1;
     }
-    if (listen(fd, 10) == -1)
+    if (listen(fd, (int)config.listenbacklog) == -1)
     {
       lprintf(0, "Error with listen(), UNIX path %s: %s", portstr, strerror(errno));
       close(fd);
@@ -1569,6 +1879,18 @@ InitServerSocket (char *portstr, ListenOptions options)
     return -1;
   }
 
+#if defined(SO_REUSEPORT)
+  /* Allow multiple sockets, one per accepting thread, to bind the same port */
+  if (config.listenthreads > 1 &&
+      setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof (optval)))
+  {
+    lprintf (0, "Error setting SO_REUSEPORT with setsockopt(), %s port %s: %s",
+             familystr, portstr, strerror (errno));
+    close (fd);
+    return -1;
+  }
+#endif
+
   /* Limit IPv6 sockets to IPv6 only, avoid mapped addresses, we handle IPv4 separately */
   if (addr->ai_family == AF_INET6 &&
       setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval, sizeof (optval)))
@@ -1587,7 +1909,7 @@ InitServerSocket (char *portstr, ListenOptions options)
     return -1;
   }
 
-  if (listen (fd, 10) == -1)
+  if (listen (fd, (int)config.listenbacklog) == -1)
   {
     lprintf (0, "Error with listen(), %s port %s: %s",
              familystr, portstr, strerror (errno));
@@ -1781,6 +2103,78 @@ AddListenThreads (ListenPortParams *lpp)
   return threads;
 } /* End of AddListenThreads() */
 
+/***************************************************************************
+ * InitListenSockets:
+ *
+ * Apply the ListenBacklog and ListenThreads parameters to the listening
+ * sockets created while processing listen port parameters, as those
+ * may be specified in any order.
+ *
+ * The backlog of each listening socket is updated with listen().  If
+ * more than one accepting thread is configured, the socket of each
+ * TCP listening port is re-created with SO_REUSEPORT and additional
+ * listen threads, each with their own socket bound to the same port,
+ * are added to the server thread list.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+InitListenSockets (void)
+{
+  struct sthread *loopstp;
+  struct sthread *laststp;
+  ListenPortParams *lpp;
+  ListenPortParams extra;
+  uint32_t idx;
+
+  /* Find the last entry, additional threads are added after it */
+  for (laststp = param.sthreads; laststp && laststp->next; laststp = laststp->next)
+    ;
+
+  for (loopstp = param.sthreads; loopstp; loopstp = loopstp->next)
+  {
+    if (loopstp->type == LISTEN_THREAD)
+    {
+      lpp = (ListenPortParams *)loopstp->params;
+
+      if (config.listenthreads > 1 && !(lpp->options & FAMILY_UNIX))
+      {
+        close (lpp->socket);
+
+        if ((lpp->socket = InitServerSocket (lpp->portstr, lpp->options)) < 0)
+        {
+          lprintf (0, "Error re-initializing server listening socket for port %s", lpp->portstr);
+          return -1;
+        }
+
+        for (idx = 1; idx < config.listenthreads; idx++)
+        {
+          extra = *lpp;
+
+          if ((extra.socket = InitServerSocket (lpp->portstr, lpp->options)) < 0)
+          {
+            lprintf (0, "Error initializing additional listening socket for port %s", lpp->portstr);
+            return -1;
+          }
+
+          if (AddServerThread (LISTEN_THREAD, &extra))
+            return -1;
+        }
+      }
+      else if (listen (lpp->socket, (int)config.listenbacklog) == -1)
+      {
+        lprintf (0, "Error with listen() for port %s: %s", lpp->portstr, strerror (errno));
+        return -1;
+      }
+    }
+
+    if (loopstp == laststp)
+      break;
+  }
+
+  return 0;
+} /* End of InitListenSockets() */
+
 /***************************************************************************
  * AddMSeedScanThread:
  *
@@ -1810,6 +2204,8 @@ AddMSeedScanThread (const char *scanconfig)
   mssinfo.throttlensec = 100;                /* Nanoseconds to sleep after reading each record */
   mssinfo.filemaxrecs  = 100;                /* Maximum records to read from each file per scan */
   mssinfo.stateint     = 300;                /* State saving interval in seconds */
+  mssinfo.watchrescan  = 600;                /* Full scan interval in seconds when watching */
+  mssinfo.parsethreads = 1;                  /* Threads parsing records, including the scan thread */
 
   strncpy (myconfig, scanconfig, sizeof (myconfig) - 1);
   configstr = myconfig;
@@ -1873,6 +2269,38 @@ AddMSeedScanThread (const char *scanconfig)
     {
       mssinfo.maxrecur = strtol (vptr, NULL, 10);
     }
+    else if (!strncasecmp ("ParseThreads", kptr, 12)) /* Record parsing threads */
+    {
+      mssinfo.parsethreads = strtol (vptr, NULL, 10);
+
+      if (mssinfo.parsethreads <= 0 || mssinfo.parsethreads > 64)
+      {
+        lprintf (0, "Unrecognized ParseThreads value: '%s'", vptr);
+        return -1;
+      }
+    }
+    else if (!strncasecmp ("WatchRescan", kptr, 11)) /* Full scan interval when watching */
+    {
+      mssinfo.watchrescan = strtol (vptr, NULL, 10);
+
+      if (mssinfo.watchrescan <= 0)
+      {
+        lprintf (0, "Unrecognized WatchRescan value: '%s'", vptr);
+        return -1;
+      }
+    }
+    else if (!strncasecmp ("Watch", kptr, 5)) /* Watch directories for changes */
+    {
+      if (*vptr == '1' || *vptr == 'Y' || *vptr == 'y')
+        mssinfo.watch = 1;
+      else if (*vptr == '0' || *vptr == 'N' || *vptr == 'n')
+        mssinfo.watch = 0;
+      else
+      {
+        lprintf (0, "Unrecognized Watch value: '%s'", vptr);
+        return -1;
+      }
+    }
     else
     {
       lprintf (0, "Unrecognized MSeedScan sub-option: '%s'", kptr);
@@ -2352,6 +2780,10 @@ ListenPort 18000\n\
 \n\
 \n\
 # Certficate file for TLS connections.  This is a dynamic parameter.\n\
+# The certificate and key are loaded once and shared by all TLS\n\
+# connections, they are reloaded when either file is modified.\n\
+# Reconnecting clients may resume sessions using session tickets or\n\
+# the session cache, avoiding a full handshake.\n\
 # Equivalent environment variable: RS_TLS_CERT_FILE\n\
 \n\
 #TLSCertFile /path/to/certificate.pem\n\
@@ -2409,6 +2841,51 @@ ListenPort 18000\n\
 #ClientTimeout 3600\n\
 \n\
 \n\
+# Specify the backlog of pending connections for listening sockets,\n\
+# i.e. connections not yet accepted by the server.  A large backlog\n\
+# avoids dropping connections when many clients reconnect at once.\n\
+# The operating system may limit this value, e.g. net.core.somaxconn\n\
+# on Linux.  Applies to all listening ports.\n\
+# Equivalent environment variable: RS_LISTEN_BACKLOG\n\
+\n\
+#ListenBacklog 1024\n\
+\n\
+\n\
+# Specify the number of threads accepting connections for each\n\
+# listening port.  When more than one, each thread uses a separate\n\
+# socket bound to the port with SO_REUSEPORT and the system spreads\n\
+# incoming connections over them.  Does not apply to UNIX sockets.\n\
+# Equivalent environment variable: RS_LISTEN_THREADS\n\
+\n\
+#ListenThreads 1\n\
+\n\
+\n\
+# Specify the number of worker threads that serve client connections.\n\
+# By default (0) each client connection is served by a dedicated\n\
+# thread.  When set, client connections are distributed over a pool\n\
+# of worker threads that multiplex many connections each, reducing\n\
+# the memory and scheduling overhead for large numbers of clients.\n\
+# The value 'auto' uses one worker per online CPU.  TLS connections\n\
+# are always served by a dedicated thread.  Worker threads are only\n\
+# supported on Linux.  As hostname resolution is performed by the\n\
+# worker threads, ResolveHostnames 0 is recommended when used.\n\
+# Equivalent environment variable: RS_WORKER_THREADS\n\
+\n\
+#WorkerThreads 0\n\
+\n\
+\n\
+# Specify the I/O method of the client worker threads, either 'epoll'\n\
+# (default) or 'io_uring'.  With io_uring, readiness of all clients\n\
+# of a worker is received and the data for all clients is sent with\n\
+# a single system call per pass, reducing system call overhead when\n\
+# many streaming clients are served.  Requires Linux 5.13 or later,\n\
+# if io_uring is not available epoll is used.  Only applies when\n\
+# WorkerThreads is set.\n\
+# Equivalent environment variable: RS_WORKER_IO\n\
+\n\
+#WorkerIO epoll\n\
+\n\
+\n\
 # Control the usage of memory mapping of the ring packet buffer.  If\n\
 # this parameter is 1 (or not defined) the packet buffer will be\n\
 # memory-mapped directly from the packet buffer file, otherwise it\n\
@@ -2422,6 +2899,47 @@ ListenPort 18000\n\
 #MemoryMapRing 1\n\
 \n\
 \n\
+# Control the use of huge pages for the ring packet buffer, which can\n\
+# reduce TLB misses and page faults for large rings.  If this\n\
+# parameter is \"transparent\" the buffer is advised for transparent\n\
+# huge pages, if \"explicit\" the buffer is allocated in explicit\n\
+# (reserved) huge pages, falling back to transparent huge pages when\n\
+# none are available.  Explicit huge pages are only used for rings that\n\
+# are not memory mapped (see MemoryMapRing) or volatile rings; a memory\n\
+# mapped ring uses huge pages only when the ring directory is on a\n\
+# file system that supports them, e.g. hugetlbfs or tmpfs.  By default\n\
+# no huge pages are requested (\"none\").\n\
+# Equivalent environment variable: RS_RING_HUGE_PAGES\n\
+\n\
+#RingHugePages none\n\
+\n\
+\n\
+# Control pre-faulting of the ring packet buffer during startup.  If\n\
+# this parameter is \"populate\" all pages of the buffer are faulted in,\n\
+# reading a memory mapped packet buffer file, before clients are\n\
+# served, avoiding stalls for the first clients after a restart.  If\n\
+# \"lock\" the pages are also locked in memory, which requires an\n\
+# adequate memory lock limit (ulimit -l) or privileges.  Progress,\n\
+# elapsed time and page fault counts are logged.  By default the\n\
+# buffer is not pre-faulted (\"none\").\n\
+# Equivalent environment variable: RS_RING_PREFAULT\n\
+\n\
+#RingPrefault none\n\
+\n\
+\n\
+# Control the NUMA memory policy of the ring packet buffer.  If this\n\
+# parameter is \"interleave\" the pages of the buffer are interleaved\n\
+# over the listed NUMA nodes, or all online nodes if none are listed.\n\
+# If \"bind\" the pages are allocated on the listed nodes only.  Nodes\n\
+# are listed as numbers and ranges, e.g. \"0-1,3\".  Pages of a memory\n\
+# mapped packet buffer file are placed by this policy when faulted in\n\
+# during startup, combine with RingPrefault to place all pages.  By\n\
+# default the system policy is used (\"default\").\n\
+# Equivalent environment variable: RS_RING_NUMA_POLICY\n\
+\n\
+#RingNUMAPolicy default\n\
+\n\
+\n\
 # Control auto-recovery after corruption detection.  Be default if\n\
 # corruption is detected in the ring packet buffer file or stream\n\
 # index file during initialization the ring and stream files will be\n\
@@ -2429,7 +2947,11 @@ ListenPort 18000\n\
 # attempted a 2nd time.  If this option is 0 (off) the server will\n\
 # exit on these corruption errors.  If this option is 1 (the default)\n\
 # the server will move the buffers to .corrupt files.  If this option\n\
-# is 2 (delete) the server will delete the corrupt buffer files.\n\
+# is 2 (delete) the server will delete the corrupt buffer files.  If\n\
+# this option is 3 (rebuild) the server will rebuild the stream index\n\
+# and packet links by scanning the packet headers in the buffer,\n\
+# keeping the packets, and move the buffers to .corrupt files only if\n\
+# the rebuild fails.\n\
 # Equivalent environment variable: RS_AUTO_RECOVERY\n\
 \n\
 #AutoRecovery 1\n\
@@ -2588,12 +3110,64 @@ ListenPort 18000\n\
 #MSeedWrite <format>\n\
 \n\
 \n\
+# Specify the number of threads that write the miniSEED archive\n\
+# configured with MSeedWrite.  Records are queued to the writer\n\
+# threads and the records for each file are written in batches,\n\
+# decoupling the acknowledgement of received data from archive I/O.\n\
+# The records of each client are written by a single thread in the\n\
+# order received.  Writer threads are started when MSeedWrite is\n\
+# configured at startup.  If 0, records are written by the client\n\
+# threads before acknowledgement.  Default is 1.\n\
+# Equivalent environment variable: RS_MSEED_WRITE_THREADS\n\
+\n\
+#MSeedWriteThreads 1\n\
+\n\
+\n\
+# Specify the maximum number of records queued or waiting to be\n\
+# written by each archive writer thread.  When reached, clients\n\
+# submitting data wait until records are written.  Default is 10000.\n\
+# Equivalent environment variable: RS_MSEED_WRITE_QUEUE\n\
+\n\
+#MSeedWriteQueue 10000\n\
+\n\
+\n\
+# Specify the time in milliseconds the archive writer threads collect\n\
+# records before writing them, allowing larger batches to be written\n\
+# for the same file.  By default (0) records are written as soon as\n\
+# the queued records are processed.\n\
+# Equivalent environment variable: RS_MSEED_WRITE_FLUSH\n\
+\n\
+#MSeedWriteFlush 0\n\
+\n\
+\n\
+# Specify the maximum number of archive files kept open for each\n\
+# client writing to the miniSEED archive.  When reached, the least\n\
+# recently used files are closed.  Must be greater than 10, default\n\
+# is 50.  The process open file limit is raised as needed.\n\
+# Equivalent environment variable: RS_MSEED_WRITE_OPEN_FILES\n\
+\n\
+#MSeedWriteOpenFiles 50\n\
+\n\
+\n\
+# Control the synchronization of miniSEED archive files to storage\n\
+# using fdatasync(2).  With 'none' (default) files are never synced\n\
+# explicitly, with 'always' files are synced after each write and\n\
+# with a number of seconds files are synced at most at that interval\n\
+# and when closed.  This is a dynamic parameter.\n\
+# Equivalent environment variable: RS_MSEED_WRITE_SYNC\n\
+\n\
+#MSeedWriteSync none\n\
+\n\
+\n\
 # Enable a special mode of operation where files containing miniSEED\n\
 # are scanned continuously and data records are inserted into the ring.\n\
 # By default all sub-directories will be recursively scanned.  Sub-options\n\
 # can be used to control the scanning, the StateFile sub-option is highly\n\
 # recommended.  Values for sub-options should not be quoted and cannot\n\
-# contain spaces.\n\
+# contain spaces.  On Linux, Watch=y checks only files reported as\n\
+# changed by inotify with a full scan every WatchRescan seconds.\n\
+# ParseThreads=<count> parses (and validates CRCs of) records read\n\
+# from files with that many threads, including the scan thread.\n\
 # Equivalent environment variable: RS_MSEED_SCAN\n\
 # See the ringserver(1) man page for more details.\n\
 \n\
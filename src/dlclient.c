@@ -43,17 +43,29 @@
 #include "ring.h"
 #include "ringserver.h"
 #include "infoxml.h"
+#include "wirecache.h"
 
 /* Define the number of no-action loops that trigger the throttle */
 #define THROTTLE_TRIGGER 10
 
+/* Packet headers shared by all DataLink clients */
+static WireCache headercache;
+
 static int HandleNegotiation (ClientInfo *cinfo);
 static int HandleWrite (ClientInfo *cinfo);
+static int HandleWriteBatch (ClientInfo *cinfo);
+static int RecvCommandData (ClientInfo *cinfo, void *buffer, size_t size);
+static int ParseWrite (ClientInfo *cinfo, char *command, RingPacket *packet, char *flags);
+static int ArchiveWait (ClientInfo *cinfo, uint32_t records);
+static int ArchiveWrite (ClientInfo *cinfo, RingPacket *packet, char *data);
+static int UpdateRecvCounts (ClientInfo *cinfo, RingPacket *packets, uint32_t count);
 static int HandleRead (ClientInfo *cinfo);
 static int HandleInfo (ClientInfo *cinfo, int socket);
 static int SendPacket (ClientInfo *cinfo, char *header, char *data,
                        uint64_t value, int addvalue, int addsize);
 static int SendRingPacket (ClientInfo *cinfo);
+static int CreatePacketHeader (ClientInfo *cinfo, RingPacket *packet, char *header);
+static int UpdateSentCounts (ClientInfo *cinfo, RingPacket *packet);
 static int SelectedStreams (RingParams *ringparams, RingReader *reader);
 
 /***********************************************************************
@@ -106,6 +118,12 @@ DLHandleCmd (ClientInfo *cinfo)
       SendPacket (cinfo, "ERROR", "Write permission not granted, no soup for you!", 0, 1, 1);
       return -1;
     }
+    /* Any errors from HandleWriteBatch are fatal */
+    else if (!strncmp (cinfo->dlcommand, "WRITEBATCH", 10))
+    {
+      if (HandleWriteBatch (cinfo))
+        return -1;
+    }
     /* Any errors from HandleWrite are fatal */
     else if (HandleWrite (cinfo))
     {
@@ -181,50 +199,118 @@ DLHandleCmd (ClientInfo *cinfo)
  *
  * Send selected ring packets to DataLink client.
  *
+ * Up to STREAM_BATCH_PACKETS packets, or about STREAM_BATCH_BYTES of
+ * packet data, are read from the ring and sent together to reduce the
+ * system call overhead for clients catching up.
+ *
+ * The packet data is not copied, it is sent directly from the ring
+ * using references from RingReadNextRef().  After sending, each packet
+ * is checked with RingReadValid(); if a packet was replaced while
+ * being sent the client received corrupt data and is disconnected.
+ * Only readers at the trailing edge of the ring, about to be lapped,
+ * can be affected.
+ *
+ * WebSocket clients are sent the same batch with a frame header before
+ * each packet, in the same gather write, so that each DataLink packet
+ * is contained in its own WebSocket message.
+ *
  * Returns packet size sent on success, zero when no packet sent,
  * negative value on error.  On error the client should disconnected.
  ***********************************************************************/
 int
 DLStreamPackets (ClientInfo *cinfo)
 {
+  RingPacket packets[STREAM_BATCH_PACKETS];
+  char headers[STREAM_BATCH_PACKETS][UINT8_MAX + 3];
+  uint8_t wsframes[STREAM_BATCH_PACKETS][WS_FRAMEMAX];
+  void *buffers[STREAM_BATCH_PACKETS * 3];
+  size_t buflens[STREAM_BATCH_PACKETS * 3];
+  char *packetref;
+  size_t batchbytes = 0;
+  int bufcount      = 0;
+  int sentbytes     = 0;
+  int count         = 0;
+  int headerlen;
+  int idx;
   uint64_t readid;
 
   if (!cinfo)
     return -1;
 
-  /* Read next packet from ring */
-  readid = RingReadNext (cinfo->reader, &cinfo->packet, cinfo->sendbuf);
-
-  if (readid == RINGID_ERROR)
+  /* Read packets from ring until the batch is full */
+  while (count < STREAM_BATCH_PACKETS && batchbytes < STREAM_BATCH_BYTES)
   {
-    lprintf (0, "[%s] Error reading next packet from ring", cinfo->hostname);
-    return -1;
+    readid = RingReadNextRef (cinfo->reader, &packets[count], &packetref);
+
+    if (readid == RINGID_ERROR)
+    {
+      lprintf (0, "[%s] Error reading next packet from ring", cinfo->hostname);
+      return -1;
+    }
+    else if (readid == RINGID_NONE)
+    {
+      break;
+    }
+
+    lprintf (3, "[%s] Read %s (%u bytes) packet ID %" PRIu64 " from ring",
+             cinfo->hostname, packets[count].streamid,
+             packets[count].datasize, packets[count].pktid);
+
+    if ((headerlen = CreatePacketHeader (cinfo, &packets[count], headers[count])) < 0)
+      return -1;
+
+    /* Each packet is sent to a WebSocket client in a separate frame */
+    if (cinfo->websocket)
+    {
+      buffers[bufcount]   = wsframes[count];
+      buflens[bufcount++] = WSFrameHeader (wsframes[count], headerlen + packets[count].datasize);
+    }
+
+    buffers[bufcount]   = headers[count];
+    buflens[bufcount++] = (size_t)headerlen;
+    buffers[bufcount]   = packetref;
+    buflens[bufcount++] = packets[count].datasize;
+
+    batchbytes += packets[count].datasize;
+    count++;
   }
-  else if (readid == RINGID_NONE)
-  {
+
+  if (count == 0)
     return 0;
-  }
-  else
+
+  /* Send all packets to client, WebSocket frames were added above */
+  if (SendDataMB (cinfo, buffers, buflens, bufcount, 1))
   {
-    lprintf (3, "[%s] Read %s (%u bytes) packet ID %" PRIu64 " from ring",
-             cinfo->hostname, cinfo->packet.streamid,
-             cinfo->packet.datasize, cinfo->packet.pktid);
+    if (cinfo->socketerr != -2)
+      lprintf (1, "[%s] Error sending packet to client", cinfo->hostname);
 
-    /* Send packet to client */
-    if (SendRingPacket (cinfo))
-    {
-      if (cinfo->socketerr != -2)
-        lprintf (1, "[%s] Error sending packet to client", cinfo->hostname);
+    return -1;
+  }
 
+  /* Socket errors are fatal */
+  if (cinfo->socketerr)
+    return -1;
+
+  for (idx = 0; idx < count; idx++)
+  {
+    /* Packets replaced in the ring while sending cannot be recalled */
+    if (!RingReadValid (cinfo->reader, &packets[idx]))
+    {
+      lprintf (0, "[%s] Packet ID %" PRIu64 " was replaced in the ring while sending, disconnecting",
+               cinfo->hostname, packets[idx].pktid);
       return -1;
     }
 
-    /* Socket errors are fatal */
-    if (cinfo->socketerr)
+    if (UpdateSentCounts (cinfo, &packets[idx]))
       return -1;
+
+    sentbytes += packets[idx].datasize;
   }
 
-  return (int)cinfo->packet.datasize;
+  /* Retain the last packet sent as the current client packet */
+  memcpy (&cinfo->packet, &packets[count - 1], sizeof (RingPacket));
+
+  return sentbytes;
 } /* End of DLStreamPackets() */
 
 /***********************************************************************
@@ -249,6 +335,11 @@ DLFree (ClientInfo *cinfo)
   if (dlinfo->legacy_mseed_streamid_data)
     pcre2_match_data_free (dlinfo->legacy_mseed_streamid_data);
 
+  /* Free the WRITEBATCH buffers */
+  free (dlinfo->batchbuf);
+  free (dlinfo->batchpackets);
+  free (dlinfo->batchdata);
+
   free (dlinfo);
   cinfo->extinfo = NULL;
 
@@ -278,6 +369,7 @@ HandleNegotiation (ClientInfo *cinfo)
 {
   char sendbuffer[255];
   size_t size;
+  int nread;
   int fields;
   int selected;
 
@@ -303,11 +395,11 @@ HandleNegotiation (ClientInfo *cinfo)
       lprintf (2, "[%s] Received ID", cinfo->hostname);
     }
 
-    /* Create server version and capability flags string (DLSERVER_ID + PACKETSIZE + WRITE if permission) */
+    /* Create server version and capability flags string (DLSERVER_ID + PACKETSIZE + WRITE and WRITEBATCH if permission) */
     snprintf (sendbuffer, sizeof (sendbuffer),
               "ID " DLSERVER_ID " PACKETSIZE:%lu%s",
               (unsigned long int)(cinfo->ringparams->pktsize - sizeof (RingPacket)),
-              (cinfo->writeperm) ? " WRITE" : "");
+              (cinfo->writeperm) ? " WRITE WRITEBATCH" : "");
 
     /* Send the server ID string */
     if (SendPacket (cinfo, sendbuffer, NULL, 0, 0, 0))
@@ -517,22 +609,26 @@ HandleNegotiation (ClientInfo *cinfo)
     }
     else
     {
-      free (cinfo->matchstr);
-
-      /* Read regex of size bytes from socket */
-      if (!(cinfo->matchstr = (char *)malloc (size + 1)))
+      /* Read regex of size bytes from socket, repeated when pending */
+      if ((nread = RecvCommandData (cinfo, cinfo->recvbuf, size)) <= 0)
       {
-        lprintf (0, "[%s] Error allocating memory", cinfo->hostname);
+        if (nread == 0)
+          return 0;
+
+        lprintf (0, "[%s] Error Recv'ing data", cinfo->hostname);
         return -1;
       }
 
-      if (RecvData (cinfo, cinfo->matchstr, size, 1) < 0)
+      free (cinfo->matchstr);
+
+      if (!(cinfo->matchstr = (char *)malloc (size + 1)))
       {
-        lprintf (0, "[%s] Error Recv'ing data", cinfo->hostname);
+        lprintf (0, "[%s] Error allocating memory", cinfo->hostname);
         return -1;
       }
 
       /* Make sure buffer is a terminated string */
+      memcpy (cinfo->matchstr, cinfo->recvbuf, size);
       cinfo->matchstr[size] = '\0';
 
       /* Compile match expression */
@@ -596,22 +692,26 @@ HandleNegotiation (ClientInfo *cinfo)
     }
     else
     {
-      free (cinfo->rejectstr);
-
-      /* Read regex of size bytes from socket */
-      if (!(cinfo->rejectstr = (char *)malloc (size + 1)))
+      /* Read regex of size bytes from socket, repeated when pending */
+      if ((nread = RecvCommandData (cinfo, cinfo->recvbuf, size)) <= 0)
       {
-        lprintf (0, "[%s] Error allocating memory", cinfo->hostname);
+        if (nread == 0)
+          return 0;
+
+        lprintf (0, "[%s] Error Recv'ing data", cinfo->hostname);
         return -1;
       }
 
-      if (RecvData (cinfo, cinfo->rejectstr, size, 1) < 0)
+      free (cinfo->rejectstr);
+
+      if (!(cinfo->rejectstr = (char *)malloc (size + 1)))
       {
-        lprintf (0, "[%s] Error Recv'ing data", cinfo->hostname);
+        lprintf (0, "[%s] Error allocating memory", cinfo->hostname);
         return -1;
       }
 
       /* Make sure buffer is a terminated string */
+      memcpy (cinfo->rejectstr, cinfo->recvbuf, size);
       cinfo->rejectstr[size] = '\0';
 
       /* Compile reject expression */
@@ -676,35 +776,342 @@ HandleNegotiation (ClientInfo *cinfo)
 static int
 HandleWrite (ClientInfo *cinfo)
 {
-  DLInfo *dlinfo;
-  StreamNode *stream;
-  char replystr[200];
-  char streamid[101];
   char flags[101];
   int nread;
-  int newstream = 0;
   int rv;
 
-  MS3Record *msr = NULL;
+  if (!cinfo || !cinfo->extinfo)
+    return -1;
+
+  if (ParseWrite (cinfo, cinfo->dlcommand, &cinfo->packet, flags))
+    return -1;
+
+  /* Recv packet data from socket, the command is repeated when pending */
+  if ((nread = RecvCommandData (cinfo, cinfo->recvbuf, cinfo->packet.datasize)) <= 0)
+    return nread;
+
+  /* Leave the data unconsumed while waiting for archive queue space */
+  if (ArchiveWait (cinfo, 1))
+  {
+    cinfo->recvconsumed = 0;
+    return 0;
+  }
+
+  /* Write received miniSEED to a disk archive if configured */
+  if (ArchiveWrite (cinfo, &cinfo->packet, cinfo->recvbuf))
+    return -1;
+
+  /* Add the packet to the ring */
+  if ((rv = RingWrite (cinfo->ringparams, &cinfo->packet, cinfo->recvbuf, cinfo->packet.datasize)))
+  {
+    if (rv == -2)
+      lprintf (1, "[%s] Error with RingWrite, corrupt ring, shutdown signalled", cinfo->hostname);
+    else
+      lprintf (1, "[%s] Error with RingWrite", cinfo->hostname);
+
+    SendPacket (cinfo, "ERROR", "Error adding packet to ring", 0, 1, 1);
+
+    /* Set the shutdown signal if ring corruption was detected */
+    if (rv == -2)
+      param.shutdownsig = 1;
+
+    return -1;
+  }
+
+  if (UpdateRecvCounts (cinfo, &cinfo->packet, 1))
+    return -1;
+
+  /* Send acknowledgement if requested (flags contain 'A') */
+  if (strchr (flags, 'A'))
+  {
+    if (SendPacket (cinfo, "OK", NULL, cinfo->packet.pktid, 1, 1))
+      return -1;
+  }
+
+  return (cinfo->socketerr) ? -1 : 0;
+} /* End of HandleWrite */
+
+/***************************************************************************
+ * HandleWriteBatch:
+ *
+ * Handle DataLink WRITEBATCH request, a group of packets written to
+ * the ring together.
+ *
+ * The command syntax is: "WRITEBATCH <count> <flags> <size>"
+ *
+ * The size is the length in bytes of the batch following the header,
+ * which contains count packets each framed as a DataLink WRITE:
+ * "DL", the header length, the "WRITE ..." header and the packet data,
+ * see HandleWrite() for the WRITE header parameters.  The flags of the
+ * batch are interpreted the following way, while the flags of each
+ * WRITE only select a packet ID:
+ *
+ * flags:
+ * 'N' = no acknowledgement is requested
+ * 'A' = acknowledgement is requested, server will send a reply with
+ *       the packet ID of the last packet
+ *
+ * All packets are received and checked before any are written to the
+ * ring, errors in the batch reject the entire batch.
+ *
+ * Returns 0 on success and -1 on error which should disconnect.
+ ***************************************************************************/
+static int
+HandleWriteBatch (ClientInfo *cinfo)
+{
+  DLInfo *dlinfo;
+  char replystr[200];
+  char command[UINT8_MAX + 1];
+  char flags[101];
+  char pktflags[101];
+  uint32_t count;
+  uint32_t size;
+  uint32_t offset;
+  uint32_t idx;
+  size_t chunk;
+  uint8_t headerlen;
+  int rv;
 
   if (!cinfo || !cinfo->extinfo)
     return -1;
 
   dlinfo = (DLInfo *)cinfo->extinfo;
 
+  /* Parse command parameters: WRITEBATCH <count> <flags> <size> */
+  if (sscanf (cinfo->dlcommand, "%*s %" SCNu32 " %100s %" SCNu32, &count, flags, &size) != 3)
+  {
+    lprintf (1, "[%s] Error parsing WRITEBATCH parameters: %.100s",
+             cinfo->hostname, cinfo->dlcommand);
+
+    SendPacket (cinfo, "ERROR", "Error parsing WRITEBATCH command parameters", 0, 1, 1);
+
+    return -1;
+  }
+
+  /* Limit the batch to the packet count, the size of that many packets
+   * and a total size independent of the packet size */
+  if (count == 0 || count > DLMAXBATCHPACKETS || size > DLMAXBATCHBYTES ||
+      size > (uint64_t)count * (3 + UINT8_MAX + cinfo->ringparams->pktsize))
+  {
+    lprintf (1, "[%s] Submitted batch of %" PRIu32 " packets and %" PRIu32 " bytes is not allowed",
+             cinfo->hostname, count, size);
+
+    snprintf (replystr, sizeof (replystr), "Batch of %" PRIu32 " packets and %" PRIu32 " bytes is not allowed, "
+              "maximum is %d packets of %u bytes and %d bytes in total",
+              count, size, DLMAXBATCHPACKETS, cinfo->ringparams->pktsize, DLMAXBATCHBYTES);
+    SendPacket (cinfo, "ERROR", replystr, 0, 1, 1);
+
+    return -1;
+  }
+
+  /* Grow batch buffers as needed */
+  if (size > dlinfo->batchbufsize)
+  {
+    free (dlinfo->batchbuf);
+
+    if (!(dlinfo->batchbuf = (char *)malloc (size)))
+    {
+      lprintf (0, "[%s] Error allocating batch buffer", cinfo->hostname);
+      dlinfo->batchbufsize = 0;
+      return -1;
+    }
+
+    dlinfo->batchbufsize = size;
+  }
+
+  if (count > dlinfo->batchmax)
+  {
+    free (dlinfo->batchpackets);
+    free (dlinfo->batchdata);
+
+    dlinfo->batchpackets = (RingPacket *)malloc (count * sizeof (RingPacket));
+    dlinfo->batchdata    = (char **)malloc (count * sizeof (char *));
+
+    if (!dlinfo->batchpackets || !dlinfo->batchdata)
+    {
+      lprintf (0, "[%s] Error allocating batch packets", cinfo->hostname);
+      dlinfo->batchmax = 0;
+      return -1;
+    }
+
+    dlinfo->batchmax = count;
+  }
+
+  /* Recv batch from socket, in pieces no larger than the receive buffer.
+   * When a piece is pending the command is repeated and continues with it. */
+  for (offset = dlinfo->batchoffset; offset < size; offset += chunk)
+  {
+    chunk = ((size - offset) < cinfo->recvbufsize) ? (size - offset) : cinfo->recvbufsize;
+
+    if ((rv = RecvCommandData (cinfo, dlinfo->batchbuf + offset, chunk)) <= 0)
+    {
+      dlinfo->batchoffset = offset;
+      return rv;
+    }
+  }
+
+  dlinfo->batchoffset = 0;
+
+  /* Parse and check each packet in the batch */
+  for (idx = 0, offset = 0; idx < count; idx++)
+  {
+    if ((size - offset) < 3 ||
+        dlinfo->batchbuf[offset] != 'D' || dlinfo->batchbuf[offset + 1] != 'L')
+    {
+      lprintf (1, "[%s] Error, invalid packet %" PRIu32 " in WRITEBATCH", cinfo->hostname, idx);
+
+      SendPacket (cinfo, "ERROR", "Error, invalid packet in WRITEBATCH", 0, 1, 1);
+
+      return -1;
+    }
+
+    headerlen = (uint8_t)dlinfo->batchbuf[offset + 2];
+    offset += 3;
+
+    if ((size - offset) < headerlen ||
+        headerlen < 6 || strncmp (dlinfo->batchbuf + offset, "WRITE ", 6))
+    {
+      lprintf (1, "[%s] Error, invalid packet header %" PRIu32 " in WRITEBATCH", cinfo->hostname, idx);
+
+      SendPacket (cinfo, "ERROR", "Error, invalid packet header in WRITEBATCH", 0, 1, 1);
+
+      return -1;
+    }
+
+    memcpy (command, dlinfo->batchbuf + offset, headerlen);
+    command[headerlen] = '\0';
+    offset += headerlen;
+
+    if (ParseWrite (cinfo, command, &dlinfo->batchpackets[idx], pktflags))
+      return -1;
+
+    if ((size - offset) < dlinfo->batchpackets[idx].datasize)
+    {
+      lprintf (1, "[%s] Error, packet %" PRIu32 " data exceeds WRITEBATCH size", cinfo->hostname, idx);
+
+      SendPacket (cinfo, "ERROR", "Error, packet data exceeds WRITEBATCH size", 0, 1, 1);
+
+      return -1;
+    }
+
+    dlinfo->batchdata[idx] = dlinfo->batchbuf + offset;
+    offset += dlinfo->batchpackets[idx].datasize;
+  }
+
+  if (offset != size)
+  {
+    lprintf (1, "[%s] Error, WRITEBATCH size (%" PRIu32 ") does not match packets (%" PRIu32 ")",
+             cinfo->hostname, size, offset);
+
+    SendPacket (cinfo, "ERROR", "Error, WRITEBATCH size does not match packets", 0, 1, 1);
+
+    return -1;
+  }
+
+  /* Write received miniSEED to a disk archive if configured, keeping
+   * the batch and the packets archived while waiting for queue space */
+  for (idx = dlinfo->batcharchived; idx < count; idx++)
+  {
+    if (ArchiveWait (cinfo, 1))
+    {
+      dlinfo->batchoffset   = size;
+      dlinfo->batcharchived = idx;
+      return 0;
+    }
+
+    if (ArchiveWrite (cinfo, &dlinfo->batchpackets[idx], dlinfo->batchdata[idx]))
+      return -1;
+  }
+
+  dlinfo->batcharchived = 0;
+
+  /* Add the packets to the ring */
+  if ((rv = RingWriteBatch (cinfo->ringparams, dlinfo->batchpackets, dlinfo->batchdata, count)))
+  {
+    if (rv == -2)
+      lprintf (1, "[%s] Error with RingWriteBatch, corrupt ring, shutdown signalled", cinfo->hostname);
+    else
+      lprintf (1, "[%s] Error with RingWriteBatch", cinfo->hostname);
+
+    SendPacket (cinfo, "ERROR", "Error adding packets to ring", 0, 1, 1);
+
+    /* Set the shutdown signal if ring corruption was detected */
+    if (rv == -2)
+      param.shutdownsig = 1;
+
+    return -1;
+  }
+
+  if (UpdateRecvCounts (cinfo, dlinfo->batchpackets, count))
+    return -1;
+
+  /* Send acknowledgement if requested (flags contain 'A') */
+  if (strchr (flags, 'A'))
+  {
+    if (SendPacket (cinfo, "OK", NULL, dlinfo->batchpackets[count - 1].pktid, 1, 1))
+      return -1;
+  }
+
+  return (cinfo->socketerr) ? -1 : 0;
+} /* End of HandleWriteBatch */
+
+/***************************************************************************
+ * RecvCommandData:
+ *
+ * Receive data following a command with RecvData().  Clients served
+ * by worker threads do not wait for data, if only part of the data is
+ * available the size is stored in ClientInfo.recvpending and the
+ * command is repeated by RecvDLCommand() once all data is received.
+ *
+ * Returns the size on success, 0 when the data is pending and -1 on
+ * error.
+ ***************************************************************************/
+static int
+RecvCommandData (ClientInfo *cinfo, void *buffer, size_t size)
+{
+  int nread;
+
+  if ((nread = RecvData (cinfo, buffer, size, 1)) == 0)
+    cinfo->recvpending = size;
+
+  return (nread < 0) ? -1 : nread;
+} /* End of RecvCommandData() */
+
+/***************************************************************************
+ * ParseWrite:
+ *
+ * Parse a DataLink WRITE command into a packet header, translating
+ * legacy stream IDs and checking the stream ID is allowed and the data
+ * size fits in the ring.  The flags are returned in the flags buffer,
+ * which must hold 101 bytes.
+ *
+ * On error a reply is sent to the client.
+ *
+ * Returns 0 on success and -1 on error which should disconnect.
+ ***************************************************************************/
+static int
+ParseWrite (ClientInfo *cinfo, char *command, RingPacket *packet, char *flags)
+{
+  DLInfo *dlinfo;
+  char replystr[200];
+  char streamid[101];
+  int rv;
+
+  dlinfo = (DLInfo *)cinfo->extinfo;
+
   /* Parse command parameters: WRITE <streamid> <datastart> <dataend> <flags> <datasize> [pktid] */
-  rv = sscanf (cinfo->dlcommand, "%*s %100s %" SCNd64 " %" SCNd64 " %100s %" SCNu32 " %" SCNu64,
+  rv = sscanf (command, "%*s %100s %" SCNd64 " %" SCNd64 " %100s %" SCNu32 " %" SCNu64,
                streamid,
-               &(cinfo->packet.datastart),
-               &(cinfo->packet.dataend),
+               &(packet->datastart),
+               &(packet->dataend),
                flags,
-               &(cinfo->packet.datasize),
-               &(cinfo->packet.pktid));
+               &(packet->datasize),
+               &(packet->pktid));
 
   if (rv < 5)
   {
     lprintf (1, "[%s] Error parsing WRITE parameters: %.100s",
-             cinfo->hostname, cinfo->dlcommand);
+             cinfo->hostname, command);
 
     SendPacket (cinfo, "ERROR", "Error parsing WRITE command parameters", 0, 1, 1);
 
@@ -724,7 +1131,7 @@ HandleWrite (ClientInfo *cinfo)
   /* Set packet ID to RINGID_NONE if not provided */
   if (rv == 5 || (rv == 6 && strchr (flags, 'I') == NULL))
   {
-    cinfo->packet.pktid = RINGID_NONE;
+    packet->pktid = RINGID_NONE;
   }
 
   /* Translate legacy stream ID: NN_SSSSS_LL_CCC/MSEED
@@ -736,42 +1143,42 @@ HandleWrite (ClientInfo *cinfo)
   {
     char *prechannel = strrchr (streamid, '_');
 
-    snprintf (cinfo->packet.streamid, sizeof (cinfo->packet.streamid),
+    snprintf (packet->streamid, sizeof (packet->streamid),
               "FDSN:%.*s_%c_%c_%c%s",
               (int)(prechannel - streamid), streamid,
               prechannel[1], prechannel[2], prechannel[3],
               &prechannel[4]);
 
     lprintf (3, "Translating legacy stream ID: %s -> %s",
-             streamid, cinfo->packet.streamid);
+             streamid, packet->streamid);
   }
   /* Otherwise copy stream ID verbatim */
   else
   {
     /* Copy the stream ID verbatim */
-    memcpy (cinfo->packet.streamid, streamid, sizeof (cinfo->packet.streamid));
+    memcpy (packet->streamid, streamid, sizeof (packet->streamid));
 
     /* Make sure the streamid is terminated */
-    cinfo->packet.streamid[sizeof (cinfo->packet.streamid) - 1] = '\0';
+    packet->streamid[sizeof (packet->streamid) - 1] = '\0';
   }
 
   /* Wire protocol for DataLink uses time stamps in as microseconds since the epoch,
    * convert these to the nanosecond ticks used internally. */
-  cinfo->packet.datastart = MS_HPTIME2NSTIME (cinfo->packet.datastart);
-  cinfo->packet.dataend   = MS_HPTIME2NSTIME (cinfo->packet.dataend);
+  packet->datastart = MS_HPTIME2NSTIME (packet->datastart);
+  packet->dataend   = MS_HPTIME2NSTIME (packet->dataend);
 
   /* Check that client is allowed to write this stream ID if limit is present */
   if (cinfo->reader->limit)
   {
-    if (pcre2_match (cinfo->reader->limit, (PCRE2_SPTR8)cinfo->packet.streamid,
+    if (pcre2_match (cinfo->reader->limit, (PCRE2_SPTR8)packet->streamid,
                      PCRE2_ZERO_TERMINATED, 0, 0,
                      cinfo->reader->limit_data, NULL) < 0)
     {
       lprintf (1, "[%s] Error, permission denied for WRITE of stream ID: %s",
-               cinfo->hostname, cinfo->packet.streamid);
+               cinfo->hostname, packet->streamid);
 
       snprintf (replystr, sizeof (replystr), "Error, permission denied for WRITE of stream ID: %s",
-                cinfo->packet.streamid);
+                packet->streamid);
       SendPacket (cinfo, "ERROR", replystr, 0, 1, 1);
 
       return -1;
@@ -779,43 +1186,94 @@ HandleWrite (ClientInfo *cinfo)
   }
 
   /* Make sure this packet data would fit into the ring */
-  if (cinfo->packet.datasize > cinfo->ringparams->pktsize)
+  if (packet->datasize > cinfo->ringparams->pktsize)
   {
     lprintf (1, "[%s] Submitted packet size (%d) is greater than ring packet size (%d)",
-             cinfo->hostname, cinfo->packet.datasize, cinfo->ringparams->pktsize);
+             cinfo->hostname, packet->datasize, cinfo->ringparams->pktsize);
 
     snprintf (replystr, sizeof (replystr), "Packet size (%d) is too large for ring, maximum is %d bytes",
-              cinfo->packet.datasize, cinfo->ringparams->pktsize);
+              packet->datasize, cinfo->ringparams->pktsize);
     SendPacket (cinfo, "ERROR", replystr, 0, 1, 1);
 
     return -1;
   }
 
-  /* Recv packet data from socket */
-  nread = RecvData (cinfo, cinfo->recvbuf, cinfo->packet.datasize, 1);
+  return 0;
+} /* End of ParseWrite */
 
-  if (nread < 0)
-    return -1;
+/***************************************************************************
+ * ArchiveWait:
+ *
+ * Check if a client served by a worker thread (pooled) must wait for
+ * space in the archive writer queue before archiving 'records'.
+ * Waiting on the queue would stall all clients of the worker, instead
+ * the client is not received from until there is space and the
+ * command is then repeated, see ClientInfo.archivewait.  Other
+ * clients wait in ds_writerqueue() as needed.
+ *
+ * Returns 1 if the command must wait and 0 otherwise.
+ ***************************************************************************/
+static int
+ArchiveWait (ClientInfo *cinfo, uint32_t records)
+{
+  if (!cinfo->pooled || !cinfo->mswrite || !cinfo->mswrite->writer)
+    return 0;
+
+  if (ds_writerspace (cinfo->mswrite, records))
+    return 0;
+
+  cinfo->archivewait = records;
+
+  return 1;
+} /* End of ArchiveWait() */
+
+/***************************************************************************
+ * ArchiveWrite:
+ *
+ * Write received miniSEED to a disk archive if configured, either
+ * queued for an archive writer thread or written directly.  Data that
+ * is not miniSEED is ignored.
+ *
+ * On error a reply is sent to the client.
+ *
+ * Returns 0 on success and -1 on error which should disconnect.
+ ***************************************************************************/
+static int
+ArchiveWrite (ClientInfo *cinfo, RingPacket *packet, char *data)
+{
+  MS3Record *msr = NULL;
 
-  /* Write received miniSEED to a disk archive if configured */
   if (cinfo->mswrite &&
-      (MS2_ISVALIDHEADER (cinfo->recvbuf) ||
-       MS3_ISVALIDHEADER (cinfo->recvbuf)))
+      (MS2_ISVALIDHEADER (data) ||
+       MS3_ISVALIDHEADER (data)))
   {
     char filename[100] = {0};
-    char *fn;
+    char *fn           = NULL;
 
-    /* Parse the miniSEED record header */
-    if (msr3_parse (cinfo->recvbuf, cinfo->packet.datasize, &msr, 0, 0) == MS_NOERROR)
+    /* Check for file name in streamid: e.g. "filename::streamid/MSEED" */
+    if ((fn = strstr (packet->streamid, "::")))
     {
-      /* Check for file name in streamid: e.g. "filename::streamid/MSEED" */
-      if ((fn = strstr (cinfo->packet.streamid, "::")))
+      strncpy (filename, packet->streamid, (fn - packet->streamid));
+      filename[(fn - packet->streamid)] = '\0';
+      fn                                = filename;
+    }
+
+    /* Queue miniSEED record for an archive writer thread */
+    if (cinfo->mswrite->writer)
+    {
+      if (ds_writerqueue (cinfo->mswrite, data, packet->datasize,
+                          fn, cinfo->hostname))
       {
-        strncpy (filename, cinfo->packet.streamid, (fn - cinfo->packet.streamid));
-        filename[(fn - cinfo->packet.streamid)] = '\0';
-        fn                                      = filename;
-      }
+        lprintf (1, "[%s] Error writing miniSEED to disk", cinfo->hostname);
 
+        SendPacket (cinfo, "ERROR", "Error writing miniSEED to disk", 0, 1, 1);
+
+        return -1;
+      }
+    }
+    /* Parse the miniSEED record header */
+    else if (msr3_parse (data, packet->datasize, &msr, 0, 0) == MS_NOERROR)
+    {
       /* Write miniSEED record to disk */
       if (ds_streamproc (cinfo->mswrite, msr, fn, cinfo->hostname))
       {
@@ -823,6 +1281,7 @@ HandleWrite (ClientInfo *cinfo)
 
         SendPacket (cinfo, "ERROR", "Error writing miniSEED to disk", 0, 1, 1);
 
+        msr3_free (&msr);
         return -1;
       }
 
@@ -830,57 +1289,58 @@ HandleWrite (ClientInfo *cinfo)
     }
   }
 
-  /* Add the packet to the ring */
-  if ((rv = RingWrite (cinfo->ringparams, &cinfo->packet, cinfo->recvbuf, cinfo->packet.datasize)))
-  {
-    if (rv == -2)
-      lprintf (1, "[%s] Error with RingWrite, corrupt ring, shutdown signalled", cinfo->hostname);
-    else
-      lprintf (1, "[%s] Error with RingWrite", cinfo->hostname);
-
-    SendPacket (cinfo, "ERROR", "Error adding packet to ring", 0, 1, 1);
-
-    /* Set the shutdown signal if ring corruption was detected */
-    if (rv == -2)
-      param.shutdownsig = 1;
-
-    return -1;
-  }
+  return 0;
+} /* End of ArchiveWrite */
 
-  /* Get (creating if needed) the StreamNode for this streamid */
-  if ((stream = GetStreamNode (cinfo->streams, &cinfo->streams_lock,
-                               cinfo->packet.streamid, &newstream)) == NULL)
-  {
-    lprintf (0, "[%s] Error with GetStreamNode for %s",
-             cinfo->hostname, cinfo->packet.streamid);
-    return -1;
-  }
+/***************************************************************************
+ * UpdateRecvCounts:
+ *
+ * Update the client and per-stream receive counts for packets written
+ * to the ring.  Consecutive packets of the same stream share the
+ * StreamNode found for the first.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+UpdateRecvCounts (ClientInfo *cinfo, RingPacket *packets, uint32_t count)
+{
+  StreamNode *stream = NULL;
+  uint32_t idx;
+  int newstream = 0;
 
-  if (newstream)
+  for (idx = 0; idx < count; idx++)
   {
-    lprintf (3, "[%s] New stream for client: %s", cinfo->hostname, cinfo->packet.streamid);
-    cinfo->streamscount++;
-  }
+    /* Get (creating if needed) the StreamNode for this streamid */
+    if (!stream || strcmp (stream->streamid, packets[idx].streamid))
+    {
+      if ((stream = GetStreamNode (cinfo->streams, &cinfo->streams_lock,
+                                   packets[idx].streamid, &newstream)) == NULL)
+      {
+        lprintf (0, "[%s] Error with GetStreamNode for %s",
+                 cinfo->hostname, packets[idx].streamid);
+        return -1;
+      }
 
-  /* Update StreamNode packet and byte counts */
-  pthread_mutex_lock (&(cinfo->streams_lock));
-  stream->rxpackets++;
-  stream->rxbytes += cinfo->packet.datasize;
-  pthread_mutex_unlock (&(cinfo->streams_lock));
+      if (newstream)
+      {
+        lprintf (3, "[%s] New stream for client: %s", cinfo->hostname, packets[idx].streamid);
+        cinfo->streamscount++;
+      }
+    }
 
-  /* Update client receive counts */
-  cinfo->rxpackets[0]++;
-  cinfo->rxbytes[0] += cinfo->packet.datasize;
+    /* Update StreamNode packet and byte counts */
+    pthread_mutex_lock (&(cinfo->streams_lock));
+    stream->rxpackets++;
+    stream->rxbytes += packets[idx].datasize;
+    pthread_mutex_unlock (&(cinfo->streams_lock));
 
-  /* Send acknowledgement if requested (flags contain 'A') */
-  if (strchr (flags, 'A'))
-  {
-    if (SendPacket (cinfo, "OK", NULL, cinfo->packet.pktid, 1, 1))
-      return -1;
+    /* Update client receive counts */
+    cinfo->rxpackets[0]++;
+    cinfo->rxbytes[0] += packets[idx].datasize;
   }
 
-  return (cinfo->socketerr) ? -1 : 0;
-} /* End of HandleWrite */
+  return 0;
+} /* End of UpdateRecvCounts */
 
 /***************************************************************************
  * HandleRead:
@@ -1146,94 +1606,140 @@ SendPacket (ClientInfo *cinfo, char *header, char *data,
 /***************************************************************************
  * SendRingPacket:
  *
- * Create a packet header for a RingPacket and send() the header and
- * the packet data to the client.  Upon success update the client
- * transmission counts.
- *
- * The packet header is: "DL<size>PACKET <streamid> <pktid> <hppackettime> <hpdatastart> <hpdataend> <size>"
+ * Create a packet header for the current client RingPacket and send()
+ * the header and the packet data to the client.  Upon success update
+ * the client transmission counts.
  *
  * Returns 0 on success and -1 on error.
  ***************************************************************************/
 static int
 SendRingPacket (ClientInfo *cinfo)
 {
-  StreamNode *stream;
-  char preheader[3];
-  char header[UINT8_MAX];
-  uint8_t headerlen_u8;
-  size_t headerlen;
-  int newstream = 0;
+  char header[UINT8_MAX + 3];
+  int headerlen;
 
   if (!cinfo)
     return -1;
 
+  if ((headerlen = CreatePacketHeader (cinfo, &cinfo->packet, header)) < 0)
+    return -1;
+
+  /* Send complete wire packet */
+  if (SendDataMB (cinfo,
+                  (void *[]){header, cinfo->sendbuf},
+                  (size_t[]){(size_t)headerlen, cinfo->packet.datasize},
+                  2, 0))
+  {
+    if (cinfo->socketerr != -2)
+      lprintf (0, "[%s] SendRingPacket(): Error sending packet: %s",
+               cinfo->hostname, strerror (errno));
+    return -1;
+  }
+
+  return UpdateSentCounts (cinfo, &cinfo->packet);
+} /* End of SendRingPacket() */
+
+/***************************************************************************
+ * CreatePacketHeader:
+ *
+ * Create the wire header, including the pre-header sequence, for a
+ * RingPacket in the supplied buffer, which must be at least
+ * UINT8_MAX + 3 bytes.
+ *
+ * The packet header is: "DL<size>PACKET <streamid> <pktid> <hppackettime> <hpdatastart> <hpdataend> <size>"
+ *
+ * The header is identical for all clients, it is created by the first
+ * client to send a packet and copied from the shared header cache by
+ * the others.
+ *
+ * Returns the length of the wire header on success and -1 on error.
+ ***************************************************************************/
+static int
+CreatePacketHeader (ClientInfo *cinfo, RingPacket *packet, char *header)
+{
+  uint8_t headerlen_u8;
+  size_t headerlen;
+  int wirelen;
+
+  if ((wirelen = WireCacheGet (&headercache, packet, header)) > 0)
+    return wirelen;
+
   /* Create microsecond values for wire protocol from nanosecond values */
-  int64_t uspkttime   = (cinfo->packet.pkttime) ? MS_NSTIME2HPTIME (cinfo->packet.pkttime) : 0;
-  int64_t usdatastart = (cinfo->packet.datastart) ? MS_NSTIME2HPTIME (cinfo->packet.datastart) : 0;
-  int64_t usdataend   = (cinfo->packet.dataend) ? MS_NSTIME2HPTIME (cinfo->packet.dataend) : 0;
+  int64_t uspkttime   = (packet->pkttime) ? MS_NSTIME2HPTIME (packet->pkttime) : 0;
+  int64_t usdatastart = (packet->datastart) ? MS_NSTIME2HPTIME (packet->datastart) : 0;
+  int64_t usdataend   = (packet->dataend) ? MS_NSTIME2HPTIME (packet->dataend) : 0;
 
   /* Create packet header: "PACKET <streamid> <pktid> <hppackettime> <hpdatatime> <size>" */
-  headerlen = (size_t)snprintf (header, sizeof (header),
+  headerlen = (size_t)snprintf (header + 3, UINT8_MAX,
                                 "PACKET %s %" PRIu64 " %" PRId64 " %" PRId64 " %" PRId64 " %u",
-                                cinfo->packet.streamid, cinfo->packet.pktid, uspkttime,
-                                usdatastart, usdataend, cinfo->packet.datasize);
+                                packet->streamid, packet->pktid, uspkttime,
+                                usdatastart, usdataend, packet->datasize);
 
   /* Sanity check header length */
-  if (headerlen > UINT8_MAX)
+  if (headerlen >= UINT8_MAX)
   {
-    lprintf (0, "[%s] SendRingPacket(): Header length is too large: %zu",
+    lprintf (0, "[%s] CreatePacketHeader(): Header length is too large: %zu",
              cinfo->hostname, headerlen);
     return -1;
   }
 
   /* Populate pre-header sequence of wire packet */
-  preheader[0] = 'D';
-  preheader[1] = 'L';
-  headerlen_u8      = (uint8_t)headerlen;
-  memcpy (preheader + 2, &headerlen_u8, 1);
+  header[0]    = 'D';
+  header[1]    = 'L';
+  headerlen_u8 = (uint8_t)headerlen;
+  memcpy (header + 2, &headerlen_u8, 1);
 
-  /* Send complete wire packet */
-  if (SendDataMB (cinfo,
-                  (void *[]){preheader, header, cinfo->sendbuf},
-                  (size_t[]){3, headerlen, cinfo->packet.datasize},
-                  3, 0))
-  {
-    if (cinfo->socketerr != -2)
-      lprintf (0, "[%s] SendRingPacket(): Error sending packet: %s",
-               cinfo->hostname, strerror (errno));
-    return -1;
-  }
+  wirelen = (int)(3 + headerlen);
+
+  WireCachePut (&headercache, packet, header, wirelen);
+
+  return wirelen;
+} /* End of CreatePacketHeader() */
+
+/***************************************************************************
+ * UpdateSentCounts:
+ *
+ * Update the stream and client transmission counts and the last sent
+ * packet ID after a RingPacket has been sent to the client.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+UpdateSentCounts (ClientInfo *cinfo, RingPacket *packet)
+{
+  StreamNode *stream;
+  int newstream = 0;
 
   /* Get (creating if needed) the StreamNode for this streamid */
   if ((stream = GetStreamNode (cinfo->streams, &cinfo->streams_lock,
-                               cinfo->packet.streamid, &newstream)) == NULL)
+                               packet->streamid, &newstream)) == NULL)
   {
     lprintf (0, "[%s] Error with GetStreamNode for %s",
-             cinfo->hostname, cinfo->packet.streamid);
+             cinfo->hostname, packet->streamid);
     return -1;
   }
 
   if (newstream)
   {
-    lprintf (3, "[%s] New stream for client: %s", cinfo->hostname, cinfo->packet.streamid);
+    lprintf (3, "[%s] New stream for client: %s", cinfo->hostname, packet->streamid);
     cinfo->streamscount++;
   }
 
   /* Update StreamNode packet and byte counts */
   pthread_mutex_lock (&(cinfo->streams_lock));
   stream->txpackets++;
-  stream->txbytes += cinfo->packet.datasize;
+  stream->txbytes += packet->datasize;
   pthread_mutex_unlock (&(cinfo->streams_lock));
 
   /* Update client transmit and counts */
   cinfo->txpackets[0]++;
-  cinfo->txbytes[0] += cinfo->packet.datasize;
+  cinfo->txbytes[0] += packet->datasize;
 
   /* Update last sent packet ID */
-  cinfo->lastid = cinfo->packet.pktid;
+  cinfo->lastid = packet->pktid;
 
   return 0;
-} /* End of SendRingPacket() */
+} /* End of UpdateSentCounts() */
 
 /***************************************************************************
  * SelectedStreams:
@@ -36,12 +36,21 @@ extern "C" {
 #define DLSERVER_ID "DataLink v1.1 (" DLSERVERVER ") :: " DLCAPABILITIES_ID
 
 #define DLMAXREGEXLEN  1048576  /* Maximum regex pattern size */
+#define DLMAXBATCHPACKETS 10000 /* Maximum packets in a WRITEBATCH */
+#define DLMAXBATCHBYTES 8388608 /* Maximum size of a WRITEBATCH */
 
 /* Structure to hold DataLink specific parameters */
 typedef struct DLInfo
 {
   pcre2_code *legacy_mseed_streamid_match;      /* Compiled match expression */
   pcre2_match_data *legacy_mseed_streamid_data; /* Match data results */
+  char *batchbuf;                               /* WRITEBATCH receive buffer */
+  size_t batchbufsize;                          /* Size of WRITEBATCH receive buffer */
+  RingPacket *batchpackets;                     /* WRITEBATCH packet headers */
+  char **batchdata;                             /* WRITEBATCH packet data pointers */
+  uint32_t batchmax;                            /* Packets allocated for WRITEBATCH */
+  uint32_t batchoffset;                         /* Bytes of a pending WRITEBATCH received */
+  uint32_t batcharchived;                       /* Packets of a pending WRITEBATCH archived */
 } DLInfo;
 
 extern int DLHandleCmd (ClientInfo *cinfo);
@@ -27,13 +27,16 @@
  * @author Chad Trabant, EarthScope Data Services
  ***************************************************************************/
 
+
 #include <errno.h>
 #include <fcntl.h>
 #include <glob.h>
+#include <pthread.h>
 #include <string.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -41,14 +44,52 @@
 
 #include "clients.h"
 #include "dsarchive.h"
+#include "generic.h"
 #include "logging.h"
 
+/* An operation of a compiled archive path format */
+typedef struct DSTemplateOp
+{
+  char flag;        /* Format flag, 0 for literal text and '/' for a directory separator */
+  char def;         /* Non-zero for a defining flag */
+  size_t textlen;   /* Length of literal text */
+  const char *text; /* Literal text */
+} DSTemplateOp;
+
+/* An archive path format compiled into a sequence of operations */
+typedef struct DSTemplate
+{
+  char *postpath;     /* Post path included in the format, NULL if none */
+  int nondefflags;    /* Number of non-defining flags */
+  int opcount;        /* Number of operations */
+  DSTemplateOp *ops;  /* Operations */
+  char *strings;      /* Storage for literal text */
+} DSTemplate;
+
+/* Maximum number of directories in a file name */
+#define DS_MAXDIRS 64
+
 /* Functions internal to this source file */
+static DSTemplate *ds_compile (const char *path, const char *postpath, char *ident);
+static void ds_freetemplate (DSTemplate *template);
+static int ds_expand (DSTemplate *template, MS3Record *msr, char *hostname,
+                      char *filename, char *definition, char *globmatch,
+                      size_t *dirs, int *dircount);
+static int ds_makedirs (char *filename, size_t *dirs, int dircount, char *ident);
 static DataStreamGroup *ds_getstream (DataStream *datastream, const char *defkey,
                                       char *filename, char *postpath, int nondefflags,
-                                      const char *globmatch, char *hostname);
+                                      const char *globmatch, size_t *dirs, int dircount,
+                                      char *hostname);
+static DataStreamGroup *ds_findgroup (DataStream *datastream, const char *defkey,
+                                      const char *postpath, uint64_t hash);
+static int ds_addgroup (DataStream *datastream, DataStreamGroup *group);
+static void ds_closegroup (DataStream *datastream, DataStreamGroup *group, char *ident);
 static int ds_openfile (DataStream *datastream, const char *filename, char *ident);
 static void ds_shutdown (DataStream *datastream, char *ident);
+static int ds_flushgroup (DataStream *datastream, DataStreamGroup *group, char *ident);
+static int ds_flush (DataStream *datastream, char *ident);
+static void ds_syncgroup (DataStream *datastream, DataStreamGroup *group, char *ident,
+                          int force);
 
 /* For a linked list of strings, as filled by ds_strparse() */
 typedef struct DSstrlist_s
@@ -59,6 +100,59 @@ typedef struct DSstrlist_s
 
 static int ds_strparse (const char *string, const char *delim, DSstrlist **list);
 
+/* A record or DataStream close request queued for a writer thread */
+typedef struct DSQueueItem
+{
+  struct DSQueueItem *next;
+  DataStream *datastream;
+  int   reclen;     /* Record length, 0 to close the DataStream */
+  char *postpath;   /* Optional post path, NULL if none */
+  char *ident;      /* Identifier for log messages */
+  char  data[];     /* Storage for record, post path and identifier */
+} DSQueueItem;
+
+/* An archive writer thread and its queue */
+typedef struct DSWriter
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t queuecond;  /* Signalled when items are queued */
+  pthread_cond_t spacecond;  /* Signalled when records are released */
+  DSQueueItem *head;
+  DSQueueItem **tail;
+  uint64_t held;             /* Records queued or waiting to be written */
+  int shutdown;
+  DSWriterStats stats;
+} DSWriter;
+
+/* Remove a group from the LRU list of a DataStream */
+#define DS_LRU_REMOVE(DS, G)                 \
+  do                                         \
+  {                                          \
+    if ((G)->lruprev)                        \
+      (G)->lruprev->lrunext = (G)->lrunext;  \
+    else                                     \
+      (DS)->lruhead = (G)->lrunext;          \
+    if ((G)->lrunext)                        \
+      (G)->lrunext->lruprev = (G)->lruprev;  \
+    else                                     \
+      (DS)->lrutail = (G)->lruprev;          \
+    (G)->lruprev = (G)->lrunext = NULL;      \
+  } while (0)
+
+/* Insert a group at the head (most recently used) of the LRU list */
+#define DS_LRU_PUSH(DS, G)                   \
+  do                                         \
+  {                                          \
+    (G)->lruprev = NULL;                     \
+    (G)->lrunext = (DS)->lruhead;            \
+    if ((DS)->lruhead)                       \
+      (DS)->lruhead->lruprev = (G);          \
+    else                                     \
+      (DS)->lrutail = (G);                   \
+    (DS)->lruhead = (G);                     \
+  } while (0)
+
 /***************************************************************************
  * ds_streamproc:
  *
@@ -73,6 +167,9 @@ static int ds_strparse (const char *string, const char *delim, DSstrlist **list)
  * example, the datastream archive could specify a base directory and
  * the postpath could specify a file name.
  *
+ * The archive path format is compiled once by ds_compile(), the
+ * compiled format of the last post path used is retained.
+ *
  * Returns 0 on success, -1 on error.
  ***************************************************************************/
 extern int
@@ -80,33 +177,16 @@ ds_streamproc (DataStream *datastream, MS3Record *msr, char *postpath,
                char *hostname)
 {
   DataStreamGroup *foundgroup = NULL;
-  DSstrlist *fnlist, *fnptr;
-  struct tm ctm;
-  time_t curtime;
-  char *tptr;
-  char tstr[32];
+  DSTemplate *template;
   char filename[MAX_FILENAME_LEN];
   char definition[MAX_FILENAME_LEN];
-  char pathformat[MAX_FILENAME_LEN];
   char globmatch[MAX_FILENAME_LEN];
-  size_t fnlen    = 0;
-  int nondefflags = 0;
+  size_t dirs[DS_MAXDIRS];
+  int dircount = 0;
   size_t writebytes;
   int writeloops;
   int rv;
 
-  char network[10]  = {0};
-  char station[10]  = {0};
-  char location[10] = {0};
-  char channel[10]  = {0};
-
-  uint16_t year = 0;
-  uint16_t yday = 0;
-  uint8_t hour  = 0;
-  uint8_t min   = 0;
-  uint8_t sec   = 0;
-  uint32_t nsec = 0;
-
   /* Special case for stream shutdown */
   if (!msr)
   {
@@ -117,458 +197,76 @@ ds_streamproc (DataStream *datastream, MS3Record *msr, char *postpath,
     return 0;
   }
 
-  /* Build file path and name from pathformat */
-  filename[0]   = '\0';
-  definition[0] = '\0';
-  globmatch[0]  = '\0';
-
-  if (postpath)
-    snprintf (pathformat, sizeof (pathformat), "%s/%s", datastream->path, postpath);
-  else
-    snprintf (pathformat, sizeof (pathformat), "%s", datastream->path);
-
-  pathformat[sizeof (pathformat) - 1] = '\0';
-
-  ds_strparse (pathformat, "/", &fnlist);
-
-  fnptr = fnlist;
-
-  /* Count all of the non-defining flags */
-  tptr = pathformat;
-  while ((tptr = strchr (tptr, '#')))
+  /* Compile the archive path format, with the post path if specified */
+  if (!postpath)
   {
-    if (*(tptr + 1) != '#')
-      nondefflags++;
-    tptr++;
-  }
+    if (!datastream->template &&
+        !(datastream->template = ds_compile (datastream->path, NULL, hostname)))
+      return -1;
 
-  /* Special case of an absolute path (first entry is empty) */
-  if (*fnptr->element == '\0')
+    template = datastream->template;
+  }
+  else
   {
-    if (fnptr->next)
-    {
-      strcat (filename, "/");
-      strcat (globmatch, "/");
-      fnptr = fnptr->next;
-    }
-    else
+    if (!datastream->posttemplate || strcmp (datastream->posttemplate->postpath, postpath))
     {
-      lprintf (0, "[%s] ds_streamproc(): empty path format",
-               hostname);
-      ds_strparse (NULL, NULL, &fnlist);
-      return -1;
+      ds_freetemplate (datastream->posttemplate);
+
+      if (!(datastream->posttemplate = ds_compile (datastream->path, postpath, hostname)))
+        return -1;
     }
+
+    template = datastream->posttemplate;
   }
 
-  /* Decompose SID into codes */
-  ms_sid2nslc (msr->sid, network, station, location, channel);
+  /* Build file path and name from the compiled format */
+  if (ds_expand (template, msr, hostname, filename, definition, globmatch,
+                 dirs, &dircount))
+    return -1;
 
-  /* Decompose start time */
-  ms_nstime2time (msr->starttime, &year, &yday, &hour, &min, &sec, &nsec);
+  /* Check for previously used stream entry, otherwise create it */
+  foundgroup = ds_getstream (datastream, definition, filename, postpath,
+                             template->nondefflags, globmatch, dirs, dircount,
+                             hostname);
 
-  while (fnptr)
+  if (foundgroup != NULL)
   {
-    size_t globlen = 0;
-    int tdy;
-    char *w, *p, def;
-
-    p = fnptr->element;
-
-    /* Special case of no file given */
-    if (*p == '\0' && fnptr->next == NULL)
-    {
-      lprintf (0, "[%s] ds_streamproc(): no file name specified, only %s",
-               hostname, filename);
-      ds_strparse (NULL, NULL, &fnlist);
-      return -1;
-    }
-
-    while ((w = strpbrk (p, "%#")) != NULL)
+    /* Queue the record for ds_flush() when served by an archive writer,
+     * the record buffer must remain valid until then */
+    if (datastream->writer)
     {
-      def = (*w == '%');
-      *w  = '\0';
-
-      strncat (filename, p, (sizeof (filename) - fnlen));
-      fnlen = strlen (filename);
-
-      if (nondefflags > 0)
+      if (!foundgroup->pending &&
+          !(foundgroup->pending = (struct iovec *)malloc (sizeof (struct iovec) * DS_WRITEV_MAX)))
       {
-        strncat (globmatch, p, (sizeof (globmatch) - globlen));
-        globlen = strlen (globmatch);
+        lprintf (0, "[%s] ds_streamproc: cannot allocate memory for pending records", hostname);
+        return -1;
       }
 
-      w += 1;
-
-      switch (*w)
+      /* Add the group to the pending list on its first record, a full
+       * group is written and remains on the list */
+      if (foundgroup->pendingcount == 0)
       {
-      case 'n':
-        strncat (filename, network, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, network, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, network, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "*", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 's':
-        strncat (filename, station, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, station, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, station, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "*", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'l':
-        strncat (filename, location, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, location, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, location, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "*", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'c':
-        strncat (filename, channel, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, channel, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, channel, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "*", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'q':
-        memset (tstr, 0, sizeof (tstr));
-        mseh_get_string (msr, "FDSN.DataQuality", tstr, 1);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "?", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'Y':
-        snprintf (tstr, sizeof (tstr), "%04d", year);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "[0-9][0-9][0-9][0-9]", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'y':
-        tdy = year;
-        while (tdy > 100)
-        {
-          tdy -= 100;
-        }
-        snprintf (tstr, sizeof (tstr), "%02d", tdy);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "[0-9][0-9]", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'j':
-        snprintf (tstr, sizeof (tstr), "%03d", yday);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "[0-9][0-9][0-9]", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'H':
-        snprintf (tstr, sizeof (tstr), "%02d", hour);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "[0-9][0-9]", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'M':
-        snprintf (tstr, sizeof (tstr), "%02d", min);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "[0-9][0-9]", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'S':
-        snprintf (tstr, sizeof (tstr), "%02d", sec);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "[0-9][0-9]", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'F':
-        snprintf (tstr, sizeof (tstr), "%09d", nsec);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "[0-9][0-9][0-9][0-9]", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'D':
-        curtime = time (NULL);
-        if (!curtime || !localtime_r (&curtime, &ctm))
-        {
-          lprintf (0, "[%s] error creating current year-day time stamp: %s",
-                   hostname, strerror (errno));
-          p = w;
-          break;
-        }
-        snprintf (tstr, sizeof (tstr), "%04d%03d", ctm.tm_year + 1900, ctm.tm_yday + 1);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "[0-9][0-9][0-9][0-9][0-9][0-9][0-9]", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'L':
-        snprintf (tstr, sizeof (tstr), "%d", msr->reclen);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "*", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'r':
-        snprintf (tstr, sizeof (tstr), "%ld", (long int)(msr->samprate + 0.5));
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "*", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'R':
-        snprintf (tstr, sizeof (tstr), "%.6f", msr->samprate);
-        strncat (filename, tstr, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, tstr, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, tstr, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "*", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case 'h':
-        if (!hostname)
-          break;
-        strncat (filename, hostname, (sizeof (filename) - fnlen));
-        if (def)
-          strncat (definition, hostname, (sizeof (definition) - fnlen));
-        if (nondefflags > 0)
-        {
-          if (def)
-            strncat (globmatch, hostname, (sizeof (globmatch) - globlen));
-          else
-            strncat (globmatch, "*", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      case '%':
-        strncat (filename, "%", (sizeof (filename) - fnlen));
-        strncat (globmatch, "%", (sizeof (globmatch) - globlen));
-        fnlen   = strlen (filename);
-        globlen = strlen (globmatch);
-        p       = w + 1;
-        break;
-      case '#':
-        strncat (filename, "#", (sizeof (filename) - fnlen));
-        nondefflags--;
-        if (nondefflags > 0)
-        {
-          strncat (globmatch, "#", (sizeof (globmatch) - globlen));
-          globlen = strlen (globmatch);
-        }
-        fnlen = strlen (filename);
-        p     = w + 1;
-        break;
-      default:
-        lprintf (0, "[%s] unknown file name format code: %c",
-                 hostname, *w);
-        p = w;
-        break;
+        foundgroup->pendingnext = datastream->pendingroot;
+        datastream->pendingroot = foundgroup;
       }
-    }
-
-    strncat (filename, p, (sizeof (filename) - fnlen));
-    fnlen = strlen (filename);
-
-    if (nondefflags > 0)
-    {
-      strncat (globmatch, p, (sizeof (globmatch) - globlen));
-      globlen = strlen (globmatch);
-    }
-
-    /* If not the last entry then it should be a directory */
-    if (fnptr->next)
-    {
-      if (access (filename, F_OK))
+      else if (foundgroup->pendingcount >= DS_WRITEV_MAX)
       {
-        if (errno == ENOENT)
-        {
-          lprintf (2, "[%s] Creating directory: %s", hostname, filename);
-          if (mkdir (filename, S_IRWXU | S_IRWXG | S_IRWXO)) /* Mode 0777 */
-          {
-            lprintf (0, "[%s] ds_streamproc: mkdir(%s) %s",
-                     hostname, filename, strerror (errno));
-            ds_strparse (NULL, NULL, &fnlist);
-            return -1;
-          }
-        }
-        else
-        {
-          lprintf (0, "[%s] %s: access denied, %s",
-                   hostname, filename, strerror (errno));
-          ds_strparse (NULL, NULL, &fnlist);
-          return -1;
-        }
-      }
-
-      strncat (filename, "/", (sizeof (filename) - fnlen));
-      fnlen++;
+        /* Write errors are flagged in the DataStream by ds_flushgroup() */
+        ds_flushgroup (datastream, foundgroup, hostname);
 
-      if (nondefflags > 0)
-      {
-        strncat (globmatch, "/", (sizeof (globmatch) - globlen));
-        globlen++;
+        if (foundgroup->modtime > 0)
+          foundgroup->modtime *= -1;
       }
-    }
 
-    fnptr = fnptr->next;
-  }
-
-  ds_strparse (NULL, NULL, &fnlist);
+      foundgroup->pending[foundgroup->pendingcount].iov_base = (void *)msr->record;
+      foundgroup->pending[foundgroup->pendingcount].iov_len  = (size_t)msr->reclen;
+      foundgroup->pendingcount++;
 
-  /* Make sure the filename and definition are NULL terminated */
-  *(filename + sizeof (filename) - 1)     = '\0';
-  *(definition + sizeof (definition) - 1) = '\0';
-
-  /* Check for previously used stream entry, otherwise create it */
-  foundgroup = ds_getstream (datastream, definition, filename, postpath,
-                             nondefflags, globmatch, hostname);
+      /* The mod time remains negative, keeping ds_closeidle() from
+       * closing this stream, until the records are written */
+      return 0;
+    }
 
-  if (foundgroup != NULL)
-  {
     /*  Write the record to the appropriate file */
     lprintf (3, "[%s] Writing data to data stream file %s",
              hostname, foundgroup->filename);
@@ -613,7 +311,10 @@ ds_streamproc (DataStream *datastream, MS3Record *msr, char *postpath,
     }
 
     /* Update mod time for this entry */
-    foundgroup->modtime = time (NULL);
+    foundgroup->modtime  = time (NULL);
+    foundgroup->unsynced = 1;
+
+    ds_syncgroup (datastream, foundgroup, hostname, 0);
 
     return 0;
   }
@@ -622,128 +323,649 @@ ds_streamproc (DataStream *datastream, MS3Record *msr, char *postpath,
 } /* End of ds_streamproc() */
 
 /***************************************************************************
- * ds_closeidle:
+ * ds_compile:
  *
- * Close all stream files that have not been active for the specified
- * idletimeout.
+ * Compile an archive path format, with an optional post path appended,
+ * into a sequence of literal text, directory separator and flag
+ * operations to be expanded for each record by ds_expand().
  *
- * Return the number of files closed.
+ * Unknown flags are treated as literal characters.
+ *
+ * Returns a DSTemplate to be freed with ds_freetemplate() on success
+ * and NULL on error.
  ***************************************************************************/
-int
-ds_closeidle (DataStream *datastream, int idletimeout, char *ident)
+static DSTemplate *
+ds_compile (const char *path, const char *postpath, char *ident)
 {
-  int count                    = 0;
-  DataStreamGroup *searchgroup = NULL;
-  DataStreamGroup *prevgroup   = NULL;
-  DataStreamGroup *nextgroup   = NULL;
-  time_t curtime;
+  DSTemplate *template = NULL;
+  DSTemplateOp *op;
+  DSstrlist *fnlist = NULL;
+  DSstrlist *fnptr;
+  char pathformat[MAX_FILENAME_LEN];
+  char *strings;
+  char *tptr;
+  char *p;
+  char *w;
+  size_t formatlen;
+  int maxops;
+
+  if (!path)
+    return NULL;
+
+  if (postpath)
+    snprintf (pathformat, sizeof (pathformat), "%s/%s", path, postpath);
+  else
+    snprintf (pathformat, sizeof (pathformat), "%s", path);
 
-  searchgroup = datastream->grouproot;
-  curtime     = time (NULL);
+  formatlen = strlen (pathformat);
 
-  /* Traverse the stream chain */
-  while (searchgroup != NULL)
+  /* Each character is at most one operation, plus a separator for each element */
+  maxops = (int)formatlen * 2 + 2;
+
+  if (!(template = (DSTemplate *)calloc (1, sizeof (DSTemplate))) ||
+      !(template->ops = (DSTemplateOp *)calloc (maxops, sizeof (DSTemplateOp))) ||
+      !(template->strings = (char *)malloc (formatlen + 1)) ||
+      (postpath && !(template->postpath = strdup (postpath))))
   {
-    nextgroup = searchgroup->next;
+    lprintf (0, "[%s] ds_compile(): cannot allocate memory", ident);
+    ds_freetemplate (template);
+    return NULL;
+  }
 
-    if (searchgroup->modtime > 0 && (curtime - searchgroup->modtime) >= idletimeout)
-    {
-      lprintf (2, "[%s] Closing idle stream with key %s",
-               ident, searchgroup->defkey);
+  strings = template->strings;
 
-      /* Re-link the stream chain */
-      if (prevgroup != NULL)
-      {
-        prevgroup->next = searchgroup->next;
-      }
-      else
-      {
-        datastream->grouproot = searchgroup->next;
-      }
+  /* Count all of the non-defining flags */
+  tptr = pathformat;
+  while ((tptr = strchr (tptr, '#')))
+  {
+    if (*(tptr + 1) == '#')
+      tptr++;
+    else if (*(tptr + 1) != '\0')
+      template->nondefflags++;
+    tptr++;
+  }
 
-      /* Close the associated file */
-      if (close (searchgroup->filed))
-        lprintf (2, "[%s] ds_closeidle(), closing data stream file, %s",
-                 ident, strerror (errno));
-      else
-        count++;
+  ds_strparse (pathformat, "/", &fnlist);
 
-      free (searchgroup->defkey);
-      free (searchgroup);
+  fnptr = fnlist;
+
+  /* Special case of an absolute path (first entry is empty) */
+  if (*fnptr->element == '\0')
+  {
+    if (fnptr->next)
+    {
+      op          = &template->ops[template->opcount++];
+      op->text    = "/";
+      op->textlen = 1;
+      fnptr       = fnptr->next;
     }
     else
     {
-      prevgroup = searchgroup;
+      lprintf (0, "[%s] ds_streamproc(): empty path format", ident);
+      ds_strparse (NULL, NULL, &fnlist);
+      ds_freetemplate (template);
+      return NULL;
     }
-
-    searchgroup = nextgroup;
   }
 
-  datastream->openfilecount -= count;
+  while (fnptr)
+  {
+    p = fnptr->element;
 
-  return count;
-} /* End of ds_closeidle() */
+    /* Special case of no file given */
+    if (*p == '\0' && fnptr->next == NULL)
+    {
+      lprintf (0, "[%s] ds_streamproc(): no file name specified: %s", ident, pathformat);
+      ds_strparse (NULL, NULL, &fnlist);
+      ds_freetemplate (template);
+      return NULL;
+    }
 
-/***************************************************************************
- * ds_getstream:
- *
- * Find the DataStreamGroup entry that matches the definition key, if
- * no matching entries are found allocate a new entry and open the
- * given file.
- *
- * Resource maintenance is performed here: the modification time of
- * each stream, modtime, is compared to the current time.  If the
- * stream entry has been idle for 'DataStream.idletimeout' seconds
- * then the stream will be closed (file closed and memory freed).
- *
- * Returns a pointer to a DataStreamGroup on success or NULL on error.
- ***************************************************************************/
-static DataStreamGroup *
-ds_getstream (DataStream *datastream, const char *defkey, char *filename,
-              char *postpath, int nondefflags, const char *globmatch, char *ident)
-{
-  DataStreamGroup *foundgroup  = NULL;
-  DataStreamGroup *searchgroup = NULL;
-  DataStreamGroup *prevgroup   = NULL;
-  time_t curtime;
-  char *matchedfilename = NULL;
+    while (*p)
+    {
+      /* Literal text up to the next flag, a flag character following
+       * the modifier of an unknown or trailing flag is also literal */
+      w = strpbrk ((*p == '%' || *p == '#') ? p + 1 : p, "%#");
 
-  searchgroup = datastream->grouproot;
-  curtime     = time (NULL);
+      if (*p == '%' || *p == '#')
+      {
+        switch (*(p + 1))
+        {
+        case 'n':
+        case 's':
+        case 'l':
+        case 'c':
+        case 'q':
+        case 'Y':
+        case 'y':
+        case 'j':
+        case 'H':
+        case 'M':
+        case 'S':
+        case 'F':
+        case 'D':
+        case 'L':
+        case 'r':
+        case 'R':
+        case 'h':
+          op       = &template->ops[template->opcount++];
+          op->flag = *(p + 1);
+          op->def  = (*p == '%');
+          p += 2;
+          continue;
+        case '%':
+        case '#':
+          /* Escaped modifier character as literal text */
+          p++;
+          w = p + 1;
+          break;
+        case '\0':
+          /* Trailing modifier is dropped */
+          p++;
+          continue;
+        default:
+          lprintf (0, "[%s] unknown file name format code: %c", ident, *(p + 1));
+          p++;
+          w = strpbrk (p, "%#");
+          break;
+        }
+      }
 
-  /* Traverse the stream chain looking for matching streams */
-  while (searchgroup != NULL)
-  {
-    DataStreamGroup *nextgroup = (DataStreamGroup *)searchgroup->next;
+      if (!w)
+        w = p + strlen (p);
 
-    if (!strcmp (searchgroup->defkey, defkey) &&
-        (!postpath || !strcmp (searchgroup->postpath, postpath)))
-    {
-      if (postpath)
-        lprintf (3, "[%s] Found data stream entry for key %s (%s)",
-                 ident, defkey, postpath);
-      else
-        lprintf (3, "[%s] Found data stream entry for key %s",
-                 ident, defkey);
+      op          = &template->ops[template->opcount++];
+      op->textlen = (size_t)(w - p);
+      op->text    = strings;
+      memcpy (strings, p, op->textlen);
+      strings += op->textlen;
 
-      foundgroup = searchgroup;
+      p = w;
+    }
 
-      break;
+    /* If not the last entry then it is a directory */
+    if (fnptr->next)
+    {
+      op       = &template->ops[template->opcount++];
+      op->flag = '/';
     }
 
-    prevgroup   = searchgroup;
-    searchgroup = nextgroup;
+    fnptr = fnptr->next;
   }
 
-  /* If no matching stream entry was found but the format included
-     non-defining flags, try to use globmatch to find a matching file
-     and resurrect a stream entry */
-  if (foundgroup == NULL && nondefflags > 0)
-  {
-    glob_t pglob;
-    int rval;
+  ds_strparse (NULL, NULL, &fnlist);
 
-    lprintf (3, "[%s] No stream entry found, searching for: %s",
+  return template;
+} /* End of ds_compile() */
+
+/***************************************************************************
+ * ds_freetemplate:
+ *
+ * Free a compiled archive path format.
+ ***************************************************************************/
+static void
+ds_freetemplate (DSTemplate *template)
+{
+  if (!template)
+    return;
+
+  free (template->postpath);
+  free (template->ops);
+  free (template->strings);
+  free (template);
+} /* End of ds_freetemplate() */
+
+/* Append a string to a file name buffer, truncating at MAX_FILENAME_LEN */
+static inline void
+ds_append (char *buffer, size_t *length, const char *string, size_t stringlen)
+{
+  if (*length + stringlen >= MAX_FILENAME_LEN)
+    stringlen = MAX_FILENAME_LEN - 1 - *length;
+
+  memcpy (buffer + *length, string, stringlen);
+  *length += stringlen;
+  buffer[*length] = '\0';
+}
+
+/***************************************************************************
+ * ds_expand:
+ *
+ * Expand a compiled archive path format for a record into the file
+ * name, the definition key made of the defining flag values and, if
+ * the format contains non-defining flags, a glob(3) pattern matching
+ * files of the same definition.
+ *
+ * The offsets of the directory separators in the file name are
+ * returned in 'dirs'.
+ *
+ * Returns 0 on success, -1 on error.
+ ***************************************************************************/
+static int
+ds_expand (DSTemplate *template, MS3Record *msr, char *hostname,
+           char *filename, char *definition, char *globmatch,
+           size_t *dirs, int *dircount)
+{
+  DSTemplateOp *op;
+  struct tm ctm;
+  time_t curtime;
+  const char *value;
+  const char *pattern;
+  char tstr[32];
+  size_t fnlen   = 0;
+  size_t deflen  = 0;
+  size_t globlen = 0;
+  int glob       = (template->nondefflags > 0);
+  int tdy;
+  int idx;
+
+  char network[10]  = {0};
+  char station[10]  = {0};
+  char location[10] = {0};
+  char channel[10]  = {0};
+
+  uint16_t year = 0;
+  uint16_t yday = 0;
+  uint8_t hour  = 0;
+  uint8_t min   = 0;
+  uint8_t sec   = 0;
+  uint32_t nsec = 0;
+
+  filename[0]   = '\0';
+  definition[0] = '\0';
+  globmatch[0]  = '\0';
+  *dircount     = 0;
+
+  /* Decompose SID into codes */
+  ms_sid2nslc (msr->sid, network, station, location, channel);
+
+  /* Decompose start time */
+  ms_nstime2time (msr->starttime, &year, &yday, &hour, &min, &sec, &nsec);
+
+  for (idx = 0; idx < template->opcount; idx++)
+  {
+    op = &template->ops[idx];
+
+    /* Literal text */
+    if (!op->flag)
+    {
+      ds_append (filename, &fnlen, op->text, op->textlen);
+      if (glob)
+        ds_append (globmatch, &globlen, op->text, op->textlen);
+      continue;
+    }
+
+    /* Directory separator */
+    if (op->flag == '/')
+    {
+      if (*dircount >= DS_MAXDIRS)
+      {
+        lprintf (0, "[%s] ds_streamproc(): too many directories in path", hostname);
+        return -1;
+      }
+
+      dirs[(*dircount)++] = fnlen;
+
+      ds_append (filename, &fnlen, "/", 1);
+      if (glob)
+        ds_append (globmatch, &globlen, "/", 1);
+      continue;
+    }
+
+    value   = tstr;
+    pattern = "*";
+
+    switch (op->flag)
+    {
+    case 'n':
+      value = network;
+      break;
+    case 's':
+      value = station;
+      break;
+    case 'l':
+      value = location;
+      break;
+    case 'c':
+      value = channel;
+      break;
+    case 'q':
+      memset (tstr, 0, sizeof (tstr));
+      mseh_get_string (msr, "FDSN.DataQuality", tstr, 1);
+      pattern = "?";
+      break;
+    case 'Y':
+      snprintf (tstr, sizeof (tstr), "%04d", year);
+      pattern = "[0-9][0-9][0-9][0-9]";
+      break;
+    case 'y':
+      tdy = year;
+      while (tdy > 100)
+      {
+        tdy -= 100;
+      }
+      snprintf (tstr, sizeof (tstr), "%02d", tdy);
+      pattern = "[0-9][0-9]";
+      break;
+    case 'j':
+      snprintf (tstr, sizeof (tstr), "%03d", yday);
+      pattern = "[0-9][0-9][0-9]";
+      break;
+    case 'H':
+      snprintf (tstr, sizeof (tstr), "%02d", hour);
+      pattern = "[0-9][0-9]";
+      break;
+    case 'M':
+      snprintf (tstr, sizeof (tstr), "%02d", min);
+      pattern = "[0-9][0-9]";
+      break;
+    case 'S':
+      snprintf (tstr, sizeof (tstr), "%02d", sec);
+      pattern = "[0-9][0-9]";
+      break;
+    case 'F':
+      snprintf (tstr, sizeof (tstr), "%09d", nsec);
+      pattern = "[0-9][0-9][0-9][0-9]";
+      break;
+    case 'D':
+      curtime = time (NULL);
+      if (!curtime || !localtime_r (&curtime, &ctm))
+      {
+        lprintf (0, "[%s] error creating current year-day time stamp: %s",
+                 hostname, strerror (errno));
+        snprintf (tstr, sizeof (tstr), "D");
+        pattern = "D";
+        break;
+      }
+      snprintf (tstr, sizeof (tstr), "%04d%03d", ctm.tm_year + 1900, ctm.tm_yday + 1);
+      pattern = "[0-9][0-9][0-9][0-9][0-9][0-9][0-9]";
+      break;
+    case 'L':
+      snprintf (tstr, sizeof (tstr), "%d", msr->reclen);
+      break;
+    case 'r':
+      snprintf (tstr, sizeof (tstr), "%ld", (long int)(msr->samprate + 0.5));
+      break;
+    case 'R':
+      snprintf (tstr, sizeof (tstr), "%.6f", msr->samprate);
+      break;
+    case 'h':
+      value = (hostname) ? hostname : "";
+      break;
+    }
+
+    ds_append (filename, &fnlen, value, strlen (value));
+    if (op->def)
+      ds_append (definition, &deflen, value, strlen (value));
+    if (glob)
+      ds_append (globmatch, &globlen, (op->def) ? value : pattern,
+                 strlen ((op->def) ? value : pattern));
+  }
+
+  return 0;
+} /* End of ds_expand() */
+
+/***************************************************************************
+ * ds_makedirs:
+ *
+ * Create the directories of a file name as returned by ds_expand() if
+ * they do not exist.
+ *
+ * Returns 0 on success, -1 on error.
+ ***************************************************************************/
+static int
+ds_makedirs (char *filename, size_t *dirs, int dircount, char *ident)
+{
+  int retval = 0;
+  int idx;
+
+  for (idx = 0; idx < dircount && retval == 0; idx++)
+  {
+    filename[dirs[idx]] = '\0';
+
+    if (access (filename, F_OK))
+    {
+      if (errno == ENOENT)
+      {
+        lprintf (2, "[%s] Creating directory: %s", ident, filename);
+        /* Another client may have created the directory since the check */
+        if (mkdir (filename, S_IRWXU | S_IRWXG | S_IRWXO) && errno != EEXIST) /* Mode 0777 */
+        {
+          lprintf (0, "[%s] ds_streamproc: mkdir(%s) %s",
+                   ident, filename, strerror (errno));
+          retval = -1;
+        }
+      }
+      else
+      {
+        lprintf (0, "[%s] %s: access denied, %s",
+                 ident, filename, strerror (errno));
+        retval = -1;
+      }
+    }
+
+    filename[dirs[idx]] = '/';
+  }
+
+  return retval;
+} /* End of ds_makedirs() */
+
+/***************************************************************************
+ * ds_closeidle:
+ *
+ * Close all stream files that have not been active for the specified
+ * idletimeout.  Stream groups are ordered by use, idle groups are
+ * closed starting from the least recently used until an active group
+ * is found.
+ *
+ * Return the number of files closed.
+ ***************************************************************************/
+int
+ds_closeidle (DataStream *datastream, int idletimeout, char *ident)
+{
+  DataStreamGroup *group;
+  int count = 0;
+  time_t curtime;
+
+  curtime = time (NULL);
+
+  while ((group = datastream->lrutail) != NULL &&
+         group->modtime > 0 && (curtime - group->modtime) >= idletimeout)
+  {
+    lprintf (2, "[%s] Closing idle stream with key %s",
+             ident, group->defkey);
+
+    ds_closegroup (datastream, group, ident);
+    count++;
+  }
+
+  return count;
+} /* End of ds_closeidle() */
+
+/***************************************************************************
+ * ds_findgroup:
+ *
+ * Find the DataStreamGroup with the specified definition key and post
+ * path in the hash table of a DataStream.
+ *
+ * Returns a pointer to a DataStreamGroup if found or NULL.
+ ***************************************************************************/
+static DataStreamGroup *
+ds_findgroup (DataStream *datastream, const char *defkey, const char *postpath,
+              uint64_t hash)
+{
+  DataStreamGroup *group;
+
+  if (!datastream->grouphash)
+    return NULL;
+
+  for (group = datastream->grouphash[hash & (datastream->grouphashsize - 1)];
+       group != NULL;
+       group = group->hashnext)
+  {
+    if (group->hash == hash &&
+        !strcmp (group->defkey, defkey) &&
+        !strcmp (group->postpath, postpath))
+      return group;
+  }
+
+  return NULL;
+} /* End of ds_findgroup() */
+
+/***************************************************************************
+ * ds_addgroup:
+ *
+ * Add a DataStreamGroup to the hash table of a DataStream, growing the
+ * table as needed, and make it the most recently used group.
+ *
+ * Returns 0 on success, -1 on error.
+ ***************************************************************************/
+static int
+ds_addgroup (DataStream *datastream, DataStreamGroup *group)
+{
+  DataStreamGroup **grouphash;
+  DataStreamGroup *next;
+  DataStreamGroup *search;
+  uint32_t size;
+  uint32_t idx;
+
+  /* Grow the table to keep an average bucket length of 1 or less */
+  if (datastream->groupcount >= datastream->grouphashsize)
+  {
+    size = (datastream->grouphashsize) ? datastream->grouphashsize * 2 : 64;
+
+    if (!(grouphash = (DataStreamGroup **)calloc (size, sizeof (DataStreamGroup *))))
+      return -1;
+
+    for (idx = 0; idx < datastream->grouphashsize; idx++)
+    {
+      for (search = datastream->grouphash[idx]; search != NULL; search = next)
+      {
+        next                                = search->hashnext;
+        search->hashnext                    = grouphash[search->hash & (size - 1)];
+        grouphash[search->hash & (size - 1)] = search;
+      }
+    }
+
+    free (datastream->grouphash);
+    datastream->grouphash     = grouphash;
+    datastream->grouphashsize = size;
+  }
+
+  idx                        = group->hash & (datastream->grouphashsize - 1);
+  group->hashnext            = datastream->grouphash[idx];
+  datastream->grouphash[idx] = group;
+  datastream->groupcount++;
+
+  DS_LRU_PUSH (datastream, group);
+
+  return 0;
+} /* End of ds_addgroup() */
+
+/***************************************************************************
+ * ds_closegroup:
+ *
+ * Close the file of a DataStreamGroup, remove it from the DataStream
+ * and free it.  The group must not have pending records.
+ ***************************************************************************/
+static void
+ds_closegroup (DataStream *datastream, DataStreamGroup *group, char *ident)
+{
+  DataStreamGroup **link;
+
+  /* Unlink from hash bucket */
+  link = &datastream->grouphash[group->hash & (datastream->grouphashsize - 1)];
+  while (*link && *link != group)
+    link = &(*link)->hashnext;
+  if (*link)
+    *link = group->hashnext;
+  datastream->groupcount--;
+
+  DS_LRU_REMOVE (datastream, group);
+
+  /* Close the associated file */
+  if (group->filed > 0)
+  {
+    ds_syncgroup (datastream, group, ident, 1);
+
+    if (close (group->filed))
+      lprintf (2, "[%s] ds_closegroup(), closing data stream file, %s",
+               ident, strerror (errno));
+
+    datastream->openfilecount--;
+  }
+
+  free (group->defkey);
+  free (group->pending);
+  free (group);
+} /* End of ds_closegroup() */
+
+/***************************************************************************
+ * ds_getstream:
+ *
+ * Find the DataStreamGroup entry that matches the definition key, if
+ * no matching entries are found allocate a new entry and open the
+ * given file, creating directories as needed.
+ *
+ * Resource maintenance is performed here: stream entries that have
+ * been idle for 'DataStream.idletimeout' seconds are closed (file
+ * closed and memory freed).
+ *
+ * Returns a pointer to a DataStreamGroup on success or NULL on error.
+ ***************************************************************************/
+static DataStreamGroup *
+ds_getstream (DataStream *datastream, const char *defkey, char *filename,
+              char *postpath, int nondefflags, const char *globmatch,
+              size_t *dirs, int dircount, char *ident)
+{
+  DataStreamGroup *foundgroup = NULL;
+  time_t curtime;
+  char *matchedfilename = NULL;
+  uint64_t hash;
+  glob_t pglob;
+  int rval;
+
+  if (!postpath)
+    postpath = "";
+
+  hash = FNVhash64 (defkey);
+  if (*postpath)
+    hash ^= FNVhash64 (postpath) * 31;
+
+  if ((foundgroup = ds_findgroup (datastream, defkey, postpath, hash)) != NULL)
+  {
+    lprintf (3, "[%s] Found data stream entry for key %s (%s)",
+             ident, defkey, postpath);
+
+    /* Make this the most recently used group */
+    if (foundgroup != datastream->lruhead)
+    {
+      DS_LRU_REMOVE (datastream, foundgroup);
+      DS_LRU_PUSH (datastream, foundgroup);
+    }
+
+    /* Keep ds_closeidle() from closing this stream */
+    if (foundgroup->modtime > 0)
+      foundgroup->modtime *= -1;
+
+    /* Close idle stream files */
+    ds_closeidle (datastream, datastream->idletimeout, ident);
+
+    return foundgroup;
+  }
+
+  /* Close idle stream files */
+  ds_closeidle (datastream, datastream->idletimeout, ident);
+
+  /* Create directories of the file name if needed */
+  if (ds_makedirs (filename, dirs, dircount, ident))
+    return NULL;
+
+  /* If no matching stream entry was found but the format included
+     non-defining flags, try to use globmatch to find a matching file
+     and resurrect a stream entry */
+  if (nondefflags > 0)
+  {
+    lprintf (3, "[%s] No stream entry found, searching for: %s",
              ident, globmatch);
 
     rval = glob (globmatch, 0, NULL, &pglob);
@@ -754,10 +976,13 @@ ds_getstream (DataStream *datastream, const char *defkey, char *filename,
       {
       case GLOB_ABORTED:
         lprintf (1, "[%s] glob(): Unignored lower-level error", ident);
+        break;
       case GLOB_NOSPACE:
         lprintf (1, "[%s] glob(): Not enough memory", ident);
+        break;
       case GLOB_NOSYS:
         lprintf (1, "[%s] glob(): Function not supported", ident);
+        break;
       default:
         lprintf (1, "[%s] glob(): %d", ident, rval);
       }
@@ -780,85 +1005,62 @@ ds_getstream (DataStream *datastream, const char *defkey, char *filename,
     globfree (&pglob);
   }
 
-  /* If not found, create a stream entry */
-  if (foundgroup == NULL)
-  {
-    if (matchedfilename)
-      lprintf (2, "[%s] Resurrecting data stream entry for key %s", ident, defkey);
-    else
-      lprintf (2, "[%s] Creating data stream entry for key %s", ident, defkey);
-
-    foundgroup = (DataStreamGroup *)malloc (sizeof (DataStreamGroup));
-
-    memset (foundgroup, 0, sizeof (DataStreamGroup));
-    foundgroup->defkey  = strdup (defkey);
-    foundgroup->filed   = 0;
-    foundgroup->modtime = curtime;
-    strncpy (foundgroup->filename, filename, sizeof (foundgroup->filename));
-    if (postpath)
-      strncpy (foundgroup->postpath, postpath, sizeof (foundgroup->postpath) - 1);
-    else
-      foundgroup->postpath[0] = '\0';
-    foundgroup->next = NULL;
+  /* Create a stream entry */
+  if (matchedfilename)
+    lprintf (2, "[%s] Resurrecting data stream entry for key %s", ident, defkey);
+  else
+    lprintf (2, "[%s] Creating data stream entry for key %s", ident, defkey);
 
-    /* Set the stream root if this is the first entry */
-    if (datastream->grouproot == NULL)
-    {
-      datastream->grouproot = foundgroup;
-    }
-    /* Otherwise add to the end of the chain */
-    else if (prevgroup != NULL)
-    {
-      prevgroup->next = foundgroup;
-    }
-    else
-    {
-      lprintf (0, "[%s] stream chain is broken!", ident);
-      return NULL;
-    }
-  }
+  curtime = time (NULL);
 
-  /* Keep ds_closeidle() from closing this stream */
-  if (foundgroup->modtime > 0)
+  if (!(foundgroup = (DataStreamGroup *)calloc (1, sizeof (DataStreamGroup))) ||
+      !(foundgroup->defkey = strdup (defkey)))
   {
-    foundgroup->modtime *= -1;
+    lprintf (0, "[%s] Cannot allocate memory for data stream entry", ident);
+    free (foundgroup);
+    return NULL;
   }
 
-  /* Close idle stream files */
-  ds_closeidle (datastream, datastream->idletimeout, ident);
+  foundgroup->hash     = hash;
+  foundgroup->synctime = curtime;
+  strncpy (foundgroup->filename, filename, sizeof (foundgroup->filename));
+  strncpy (foundgroup->postpath, postpath, sizeof (foundgroup->postpath) - 1);
 
-  /* If no file is open, well, open it */
-  if (foundgroup->filed == 0)
-  {
-    int filepos;
+  /* Keep ds_closeidle() from closing this stream */
+  foundgroup->modtime = -curtime;
 
-    lprintf (1, "[%s] Opening data stream file %s", ident, filename);
+  lprintf (1, "[%s] Opening data stream file %s", ident, filename);
 
-    if ((foundgroup->filed = ds_openfile (datastream, filename, ident)) == -1)
-    {
-      /* Do not complain if the call was interrupted (signals are used for shutdown) */
-      if (errno == EINTR)
-        foundgroup->filed = 0;
-      else
-        lprintf (2, "[%s] cannot open data stream file, %s",
-                 ident, strerror (errno));
+  if ((foundgroup->filed = ds_openfile (datastream, filename, ident)) == -1)
+  {
+    /* Do not complain if the call was interrupted (signals are used for shutdown) */
+    if (errno != EINTR)
+      lprintf (2, "[%s] cannot open data stream file, %s",
+               ident, strerror (errno));
 
-      return NULL;
-    }
+    free (foundgroup->defkey);
+    free (foundgroup);
+    return NULL;
+  }
 
-    if ((filepos = (int)lseek (foundgroup->filed, (off_t)0, SEEK_END)) < 0)
-    {
-      lprintf (2, "[%s] cannot seek in data stream file, %s",
-               ident, strerror (errno));
-      return NULL;
-    }
+  if (ds_addgroup (datastream, foundgroup))
+  {
+    lprintf (0, "[%s] Cannot allocate memory for data stream index", ident);
+    close (foundgroup->filed);
+    datastream->openfilecount--;
+    free (foundgroup->defkey);
+    free (foundgroup);
+    return NULL;
   }
 
-  /* There used to be a further check here, but it shouldn't be reached, just in
-     case this is left for the moment until I'm convinced. */
-  else if (strcmp (defkey, foundgroup->defkey))
-    lprintf (0, "[%s] Arg! open file for a key that no longer matches",
-             ident);
+  if (lseek (foundgroup->filed, (off_t)0, SEEK_END) < 0)
+  {
+    lprintf (2, "[%s] cannot seek in data stream file, %s",
+             ident, strerror (errno));
+    foundgroup->modtime = curtime;
+    ds_closegroup (datastream, foundgroup, ident);
+    return NULL;
+  }
 
   return foundgroup;
 } /* End of ds_getstream() */
@@ -868,8 +1070,8 @@ ds_getstream (DataStream *datastream, const char *defkey, char *filename,
  *
  * Open a specified file, if the open file limit has been reach try
  * once to increase the limit, if that fails or has already been done
- * start closing idle files with decreasing idle timeouts until a file
- * can be opened.
+ * close the least recently used stream files until a file can be
+ * opened.
  *
  * Return the result of open(2), normally this a the file descriptor
  * on success and -1 on error.
@@ -878,8 +1080,9 @@ static int
 ds_openfile (DataStream *datastream, const char *filename, char *ident)
 {
   static char rlimit = 0;
+  DataStreamGroup *group;
+  DataStreamGroup *prevgroup;
   struct rlimit rlim;
-  int idletimeout = datastream->idletimeout;
   int oret        = 0;
   int flags       = (O_RDWR | O_CREAT | O_APPEND);
   mode_t mode     = (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH); /* Mode 0666 */
@@ -926,16 +1129,26 @@ ds_openfile (DataStream *datastream, const char *filename, char *ident)
     }
   }
 
-  /* Close open files from the DataStream if already at the limit of (maxopenfiles - 10) */
+  /* Close least recently used files if already at the limit of (maxopenfiles - 10),
+   * groups with a negative mod time are in use and skipped */
   if ((datastream->openfilecount + 10) > datastream->maxopenfiles)
   {
-    lprintf (2, "[%s] Maximum open archive files reached (%d), closing idle stream files",
+    lprintf (2, "[%s] Maximum open archive files reached (%d), closing least recently used",
              ident, (datastream->maxopenfiles - 10));
 
-    /* Close idle streams until we have free descriptors */
-    while (ds_closeidle (datastream, idletimeout, ident) == 0 && idletimeout >= 0)
+    for (group = datastream->lrutail;
+         group != NULL && (datastream->openfilecount + 10) > datastream->maxopenfiles;
+         group = prevgroup)
     {
-      idletimeout = (idletimeout / 2) - 1;
+      prevgroup = group->lruprev;
+
+      if (group->modtime > 0)
+      {
+        lprintf (3, "[%s] Closing least recently used stream with key %s",
+                 ident, group->defkey);
+
+        ds_closegroup (datastream, group, ident);
+      }
     }
   }
 
@@ -952,34 +1165,681 @@ ds_openfile (DataStream *datastream, const char *filename, char *ident)
  * ds_shutdown:
  *
  * Close all stream files and release all of the DataStreamGroup memory
- * structures.
+ * structures and compiled path formats.
  ***************************************************************************/
 static void
 ds_shutdown (DataStream *datastream, char *ident)
 {
-  DataStreamGroup *curgroup  = NULL;
-  DataStreamGroup *prevgroup = NULL;
+  DataStreamGroup *group;
 
-  curgroup = datastream->grouproot;
+  /* Write any records still pending */
+  ds_flush (datastream, ident);
 
-  while (curgroup != NULL)
+  while ((group = datastream->lruhead) != NULL)
   {
-    prevgroup = curgroup;
-    curgroup  = curgroup->next;
-
     lprintf (3, "[%s] Shutting down stream with key: %s (%s)",
-             ident, prevgroup->defkey, prevgroup->postpath);
+             ident, group->defkey, group->postpath);
 
-    if (prevgroup->filed)
-      if (close (prevgroup->filed))
-        lprintf (0, "[%s] ds_shutdown(), closing data stream file, %s",
-                 ident, strerror (errno));
-
-    free (prevgroup->defkey);
-    free (prevgroup);
+    ds_closegroup (datastream, group, ident);
   }
+
+  free (datastream->grouphash);
+  datastream->grouphash     = NULL;
+  datastream->grouphashsize = 0;
+  datastream->groupcount    = 0;
+
+  ds_freetemplate (datastream->template);
+  ds_freetemplate (datastream->posttemplate);
+  datastream->template     = NULL;
+  datastream->posttemplate = NULL;
 } /* End of ds_shutdown() */
 
+/***************************************************************************
+ * ds_flushgroup:
+ *
+ * Write the records pending for a stream group to its file with as few
+ * writev() calls as possible.  The pending records are released even
+ * on error, the error is flagged in the DataStream for the client.
+ *
+ * Returns 0 on success, -1 on error.
+ ***************************************************************************/
+static int
+ds_flushgroup (DataStream *datastream, DataStreamGroup *group, char *ident)
+{
+  struct iovec *iov = group->pending;
+  int iovcnt        = group->pendingcount;
+  size_t bytes      = 0;
+  uint64_t writes   = 0;
+  int writeloops    = 0;
+  int retval        = 0;
+  ssize_t rv;
+
+  if (iovcnt <= 0)
+    return 0;
+
+  lprintf (3, "[%s] Writing %d records to data stream file %s",
+           ident, iovcnt, group->filename);
+
+  /* Try up to 10 times to write the data out, could be interrupted by signal */
+  while (iovcnt > 0 && writeloops < 10)
+  {
+    rv = writev (group->filed, iov, iovcnt);
+
+    if (rv < 0)
+    {
+      if (errno != EINTR)
+      {
+        lprintf (0, "[%s] ds_flushgroup: failed to write records: %s (%s)",
+                 ident, strerror (errno), group->filename);
+        break;
+      }
+
+      lprintf (1, "[%s] ds_flushgroup: Interrupted call to writev (%s), retrying",
+               ident, group->filename);
+    }
+    else
+    {
+      writes++;
+      bytes += (size_t)rv;
+
+      /* Skip completely written records and adjust a partially written one */
+      while (iovcnt > 0 && (size_t)rv >= iov->iov_len)
+      {
+        rv -= (ssize_t)iov->iov_len;
+        iov++;
+        iovcnt--;
+      }
+
+      if (iovcnt > 0)
+      {
+        iov->iov_base = (char *)iov->iov_base + rv;
+        iov->iov_len -= (size_t)rv;
+      }
+    }
+
+    writeloops++;
+  }
+
+  if (iovcnt > 0)
+  {
+    if (writeloops >= 10)
+      lprintf (0, "[%s] ds_flushgroup: Tried 10 times to write records, interrupted each time",
+               ident);
+
+    __atomic_store_n (&datastream->writeerror, 1, __ATOMIC_RELAXED);
+    retval = -1;
+  }
+
+  if (datastream->writer)
+  {
+    __atomic_add_fetch (&datastream->writer->stats.records, group->pendingcount - iovcnt, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&datastream->writer->stats.bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&datastream->writer->stats.writes, writes, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&datastream->writer->stats.errors, iovcnt, __ATOMIC_RELAXED);
+  }
+
+  group->pendingcount = 0;
+
+  /* Update mod time for this entry, allowing it to be closed when idle */
+  group->modtime  = time (NULL);
+  group->unsynced = 1;
+
+  ds_syncgroup (datastream, group, ident, 0);
+
+  return retval;
+} /* End of ds_flushgroup() */
+
+/***************************************************************************
+ * ds_flush:
+ *
+ * Write all records pending for a DataStream.
+ *
+ * Returns 0 on success, -1 on error.
+ ***************************************************************************/
+static int
+ds_flush (DataStream *datastream, char *ident)
+{
+  DataStreamGroup *group;
+  int retval = 0;
+
+  for (group = datastream->pendingroot; group != NULL; group = group->pendingnext)
+  {
+    if (group->pendingcount > 0 && ds_flushgroup (datastream, group, ident))
+      retval = -1;
+  }
+
+  datastream->pendingroot = NULL;
+
+  return retval;
+} /* End of ds_flush() */
+
+/***************************************************************************
+ * ds_syncgroup:
+ *
+ * Synchronize the file of a stream group to storage according to the
+ * DataStream sync interval.  If 'force' is set the file is synchronized
+ * when any data has been written since the last sync, unless syncing
+ * is disabled.
+ ***************************************************************************/
+static void
+ds_syncgroup (DataStream *datastream, DataStreamGroup *group, char *ident, int force)
+{
+  time_t curtime;
+
+  if (datastream->syncinterval < 0 || !group->unsynced || group->filed <= 0)
+    return;
+
+  curtime = time (NULL);
+
+  if (!force && (curtime - group->synctime) < datastream->syncinterval)
+    return;
+
+#if defined(__APPLE__)
+  if (fsync (group->filed))
+#else
+  if (fdatasync (group->filed))
+#endif
+    lprintf (0, "[%s] ds_syncgroup: cannot sync data stream file: %s (%s)",
+             ident, strerror (errno), group->filename);
+  else if (datastream->writer)
+    __atomic_add_fetch (&datastream->writer->stats.syncs, 1, __ATOMIC_RELAXED);
+
+  group->synctime = curtime;
+  group->unsynced = 0;
+} /* End of ds_syncgroup() */
+
+/***************************************************************************
+ * Archive writer threads
+ *
+ * When archive writer threads are running, records received from
+ * clients are queued to a writer thread instead of being written by
+ * the client thread.  Each DataStream is served by a single writer,
+ * preserving the record order of each client.
+ *
+ * A writer thread takes all queued records at once, records for the
+ * same file are written with a single writev() when the batch has
+ * been processed, or after the flush interval when configured.
+ *
+ * The number of records queued or waiting to be written by each
+ * writer is limited, clients wait for the writer when the limit is
+ * reached.
+ ***************************************************************************/
+
+static DSWriter *writers        = NULL;
+static uint32_t writercount     = 0;
+static uint32_t writernext      = 0;
+static uint32_t writercapacity  = 0;
+static uint32_t writerflushms   = 0;
+
+/***************************************************************************
+ * ds_writerbatch:
+ *
+ * Write all records held by a writer thread and release them.
+ ***************************************************************************/
+static void
+ds_writerbatch (DSWriter *writer, DataStream **flushlist, DSQueueItem **held,
+                uint64_t *heldcount)
+{
+  DataStream *datastream;
+  DSQueueItem *item;
+
+  while ((datastream = *flushlist))
+  {
+    *flushlist = datastream->flushnext;
+
+    ds_flush (datastream, datastream->flushident);
+
+    datastream->flushnext  = NULL;
+    datastream->flushident = NULL;
+  }
+
+  while ((item = *held))
+  {
+    *held = item->next;
+    free (item);
+  }
+
+  pthread_mutex_lock (&writer->lock);
+  writer->held -= *heldcount;
+  pthread_cond_broadcast (&writer->spacecond);
+  pthread_mutex_unlock (&writer->lock);
+
+  *heldcount = 0;
+} /* End of ds_writerbatch() */
+
+/***************************************************************************
+ * ds_writerthread:
+ *
+ * Archive writer thread, process queued items until shutdown and the
+ * queue is empty.
+ ***************************************************************************/
+static void *
+ds_writerthread (void *arg)
+{
+  DSWriter *writer       = (DSWriter *)arg;
+  DataStream *flushlist  = NULL;
+  DSQueueItem *held      = NULL;
+  DSQueueItem *closes    = NULL;
+  DSQueueItem *items;
+  DSQueueItem *item;
+  MS3Record *msr         = NULL;
+  uint64_t heldcount     = 0;
+  struct timespec flushtime;
+  int flushnow;
+  int shutdown;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&writer->lock);
+
+    while (!writer->head && !writer->shutdown)
+    {
+      if (!heldcount)
+        pthread_cond_wait (&writer->queuecond, &writer->lock);
+      else if (pthread_cond_timedwait (&writer->queuecond, &writer->lock, &flushtime) == ETIMEDOUT)
+        break;
+    }
+
+    items        = writer->head;
+    writer->head = NULL;
+    writer->tail = &writer->head;
+    shutdown     = writer->shutdown;
+
+    pthread_mutex_unlock (&writer->lock);
+
+    /* Start the flush interval with the first held record */
+    if (!heldcount && items && writerflushms)
+    {
+      clock_gettime (CLOCK_REALTIME, &flushtime);
+      flushtime.tv_sec += writerflushms / 1000;
+      flushtime.tv_nsec += (long)(writerflushms % 1000) * 1000000;
+      if (flushtime.tv_nsec >= 1000000000)
+      {
+        flushtime.tv_sec++;
+        flushtime.tv_nsec -= 1000000000;
+      }
+    }
+
+    while ((item = items))
+    {
+      items = item->next;
+
+      if (item->reclen == 0)
+      {
+        item->next = closes;
+        closes     = item;
+        continue;
+      }
+
+      /* The parsed record refers to the item data, held until written */
+      if (msr3_parse (item->data, (uint64_t)item->reclen, &msr, 0, 0) == MS_NOERROR)
+      {
+        if (!item->datastream->flushident)
+        {
+          item->datastream->flushnext = flushlist;
+          flushlist                   = item->datastream;
+        }
+        item->datastream->flushident = item->ident;
+
+        if (ds_streamproc (item->datastream, msr, item->postpath, item->ident))
+        {
+          __atomic_store_n (&item->datastream->writeerror, 1, __ATOMIC_RELAXED);
+          __atomic_add_fetch (&writer->stats.errors, 1, __ATOMIC_RELAXED);
+        }
+      }
+
+      item->next = held;
+      held       = item;
+      heldcount++;
+    }
+
+    /* Write held records unless waiting for the flush interval */
+    flushnow = (!writerflushms || closes || shutdown || (heldcount * 2) >= writercapacity);
+
+    if (heldcount && !flushnow)
+    {
+      struct timespec now;
+
+      clock_gettime (CLOCK_REALTIME, &now);
+      flushnow = (now.tv_sec > flushtime.tv_sec ||
+                  (now.tv_sec == flushtime.tv_sec && now.tv_nsec >= flushtime.tv_nsec));
+    }
+
+    if (heldcount && flushnow)
+      ds_writerbatch (writer, &flushlist, &held, &heldcount);
+
+    /* Close DataStreams of disconnected clients, all records are written */
+    while ((item = closes))
+    {
+      closes = item->next;
+
+      ds_streamproc (item->datastream, NULL, NULL, item->ident);
+      free (item->datastream);
+      free (item);
+    }
+
+    if (shutdown && !heldcount)
+    {
+      pthread_mutex_lock (&writer->lock);
+      items = writer->head;
+      pthread_mutex_unlock (&writer->lock);
+
+      if (!items)
+        break;
+    }
+  }
+
+  msr3_free (&msr);
+
+  return NULL;
+} /* End of ds_writerthread() */
+
+/***************************************************************************
+ * ds_writerstart:
+ *
+ * Start archive writer threads.  Each writer holds up to 'capacity'
+ * records queued or waiting to be written.  If 'flushms' is non-zero
+ * records are collected for up to that many milliseconds to write
+ * larger batches.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+ds_writerstart (uint32_t threads, uint32_t capacity, uint32_t flushms)
+{
+  DSWriter *writer;
+  uint32_t idx;
+  int rc;
+
+  if (threads == 0 || capacity == 0 || writers)
+    return -1;
+
+  if (!(writers = (DSWriter *)calloc (threads, sizeof (DSWriter))))
+  {
+    lprintf (0, "%s(): Error allocating archive writer threads", __func__);
+    return -1;
+  }
+
+  writercapacity = capacity;
+  writerflushms  = flushms;
+
+  for (idx = 0; idx < threads; idx++)
+  {
+    writer = &writers[idx];
+
+    pthread_mutex_init (&writer->lock, NULL);
+    pthread_cond_init (&writer->queuecond, NULL);
+    pthread_cond_init (&writer->spacecond, NULL);
+    writer->tail = &writer->head;
+
+    if ((rc = pthread_create (&writer->thread, NULL, ds_writerthread, writer)))
+    {
+      lprintf (0, "%s(): Error creating archive writer thread: %s", __func__, strerror (rc));
+
+      pthread_mutex_destroy (&writer->lock);
+      pthread_cond_destroy (&writer->queuecond);
+      pthread_cond_destroy (&writer->spacecond);
+
+      ds_writerstop ();
+      return -1;
+    }
+
+    writercount++;
+  }
+
+  lprintf (1, "Started %u miniSEED archive writer threads", threads);
+
+  return 0;
+} /* End of ds_writerstart() */
+
+/***************************************************************************
+ * ds_writerassign:
+ *
+ * Select a writer thread for a new DataStream.
+ *
+ * Returns the writer or NULL if no writer threads are running.
+ ***************************************************************************/
+DSWriter *
+ds_writerassign (void)
+{
+  if (!writers)
+    return NULL;
+
+  return &writers[__atomic_fetch_add (&writernext, 1, __ATOMIC_RELAXED) % writercount];
+} /* End of ds_writerassign() */
+
+/***************************************************************************
+ * ds_writerenqueue:
+ *
+ * Add an item to the queue of a writer thread.  Records wait while the
+ * writer holds its capacity of records.
+ ***************************************************************************/
+static void
+ds_writerenqueue (DSWriter *writer, DSQueueItem *item)
+{
+  nstime_t waitstart;
+
+  pthread_mutex_lock (&writer->lock);
+
+  if (item->reclen > 0)
+  {
+    if (writer->held >= writercapacity && !writer->shutdown)
+    {
+      waitstart = NSnow ();
+
+      while (writer->held >= writercapacity && !writer->shutdown)
+        pthread_cond_wait (&writer->spacecond, &writer->lock);
+
+      writer->stats.waits++;
+      writer->stats.waitus += (uint64_t)((NSnow () - waitstart) / 1000);
+    }
+
+    writer->held++;
+
+    if (writer->held > writer->stats.queuedmax)
+      writer->stats.queuedmax = writer->held;
+  }
+
+  item->next    = NULL;
+  *writer->tail = item;
+  writer->tail  = &item->next;
+
+  pthread_cond_signal (&writer->queuecond);
+  pthread_mutex_unlock (&writer->lock);
+} /* End of ds_writerenqueue() */
+
+/***************************************************************************
+ * ds_writerspace:
+ *
+ * Check if the writer thread of a DataStream can queue 'records'
+ * without waiting.  An empty queue always accepts records, so a group
+ * larger than the queue capacity is not refused indefinitely.
+ *
+ * Returns 1 if there is space and 0 if queuing would wait.
+ ***************************************************************************/
+int
+ds_writerspace (DataStream *datastream, uint32_t records)
+{
+  DSWriter *writer;
+  int space;
+
+  if (!datastream || !(writer = datastream->writer))
+    return 1;
+
+  pthread_mutex_lock (&writer->lock);
+  space = (writer->held == 0 || writer->shutdown ||
+           (writer->held + records) <= writercapacity);
+  pthread_mutex_unlock (&writer->lock);
+
+  return space;
+} /* End of ds_writerspace() */
+
+/***************************************************************************
+ * ds_writerqueue:
+ *
+ * Queue a copy of a miniSEED record to be written to the archive of
+ * a DataStream by its writer thread.
+ *
+ * Returns 0 on success and -1 on error, including when an earlier
+ * record for the DataStream could not be written.  Such an error is
+ * reported once, following records are queued again.
+ ***************************************************************************/
+int
+ds_writerqueue (DataStream *datastream, const char *record, int reclen,
+                const char *postpath, const char *ident)
+{
+  DSQueueItem *item;
+  size_t postpathlen = (postpath) ? strlen (postpath) + 1 : 0;
+  size_t identlen    = strlen (ident) + 1;
+
+  if (!datastream || !datastream->writer || !record || reclen <= 0)
+    return -1;
+
+  if (__atomic_exchange_n (&datastream->writeerror, 0, __ATOMIC_RELAXED))
+    return -1;
+
+  if (!(item = (DSQueueItem *)malloc (sizeof (DSQueueItem) + reclen + postpathlen + identlen)))
+  {
+    lprintf (0, "[%s] Error allocating memory for archive record", ident);
+    return -1;
+  }
+
+  item->datastream = datastream;
+  item->reclen     = reclen;
+  memcpy (item->data, record, reclen);
+
+  item->postpath = NULL;
+  if (postpath)
+  {
+    item->postpath = item->data + reclen;
+    memcpy (item->postpath, postpath, postpathlen);
+  }
+
+  item->ident = item->data + reclen + postpathlen;
+  memcpy (item->ident, ident, identlen);
+
+  ds_writerenqueue (datastream->writer, item);
+
+  return 0;
+} /* End of ds_writerqueue() */
+
+/***************************************************************************
+ * ds_writerclose:
+ *
+ * Queue the shutdown of a DataStream after all of its queued records
+ * are written.  The writer thread frees the DataStream, it must not be
+ * used by the caller afterwards.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+ds_writerclose (DataStream *datastream, const char *ident)
+{
+  DSQueueItem *item;
+  size_t identlen = strlen (ident) + 1;
+
+  if (!datastream || !datastream->writer)
+    return -1;
+
+  if (!(item = (DSQueueItem *)malloc (sizeof (DSQueueItem) + identlen)))
+  {
+    lprintf (0, "[%s] Error allocating memory for archive close", ident);
+    return -1;
+  }
+
+  lprintf (2, "[%s] Queueing close of archive for %s", ident, datastream->path);
+
+  item->datastream = datastream;
+  item->reclen     = 0;
+  item->postpath   = NULL;
+  item->ident      = item->data;
+  memcpy (item->ident, ident, identlen);
+
+  ds_writerenqueue (datastream->writer, item);
+
+  return 0;
+} /* End of ds_writerclose() */
+
+/***************************************************************************
+ * ds_writerstats:
+ *
+ * Populate the statistics of all archive writer threads.
+ *
+ * Returns 0 on success and -1 if no writer threads are running.
+ ***************************************************************************/
+int
+ds_writerstats (DSWriterStats *stats)
+{
+  DSWriter *writer;
+  uint32_t idx;
+
+  if (!stats || !writers)
+    return -1;
+
+  memset (stats, 0, sizeof (DSWriterStats));
+
+  stats->threads  = writercount;
+  stats->capacity = writercapacity;
+
+  for (idx = 0; idx < writercount; idx++)
+  {
+    writer = &writers[idx];
+
+    pthread_mutex_lock (&writer->lock);
+    stats->queued += writer->held;
+    if (writer->stats.queuedmax > stats->queuedmax)
+      stats->queuedmax = writer->stats.queuedmax;
+    stats->waits += writer->stats.waits;
+    stats->waitus += writer->stats.waitus;
+    pthread_mutex_unlock (&writer->lock);
+
+    stats->records += __atomic_load_n (&writer->stats.records, __ATOMIC_RELAXED);
+    stats->bytes += __atomic_load_n (&writer->stats.bytes, __ATOMIC_RELAXED);
+    stats->writes += __atomic_load_n (&writer->stats.writes, __ATOMIC_RELAXED);
+    stats->syncs += __atomic_load_n (&writer->stats.syncs, __ATOMIC_RELAXED);
+    stats->errors += __atomic_load_n (&writer->stats.errors, __ATOMIC_RELAXED);
+  }
+
+  return 0;
+} /* End of ds_writerstats() */
+
+/***************************************************************************
+ * ds_writerstop:
+ *
+ * Stop and join the archive writer threads after all queued records are
+ * written, all clients must be closed.
+ ***************************************************************************/
+void
+ds_writerstop (void)
+{
+  uint32_t idx;
+
+  if (!writers)
+    return;
+
+  for (idx = 0; idx < writercount; idx++)
+  {
+    pthread_mutex_lock (&writers[idx].lock);
+    writers[idx].shutdown = 1;
+    pthread_cond_signal (&writers[idx].queuecond);
+    pthread_cond_broadcast (&writers[idx].spacecond);
+    pthread_mutex_unlock (&writers[idx].lock);
+
+    pthread_join (writers[idx].thread, NULL);
+  }
+
+  for (idx = 0; idx < writercount; idx++)
+  {
+    pthread_mutex_destroy (&writers[idx].lock);
+    pthread_cond_destroy (&writers[idx].queuecond);
+    pthread_cond_destroy (&writers[idx].spacecond);
+  }
+
+  free (writers);
+  writers     = NULL;
+  writercount = 0;
+} /* End of ds_writerstop() */
+
 /*************************************************************************
  * Parse/split a string on a specified delimiter
  *
@@ -24,7 +24,9 @@
 #ifndef DSARCHIVE_H
 #define DSARCHIVE_H
 
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/uio.h>
 #include <time.h>
 
 #include <libmseed.h>
@@ -41,6 +43,12 @@
 #define SDAYLAYOUT  "%n.%s.%Y:%j"
 #define HSDAYLAYOUT "%h/%n.%s.%Y:%j"
 
+/* Maximum records coalesced into a single writev() for a file */
+#define DS_WRITEV_MAX 64
+
+struct DSWriter;
+struct DSTemplate;
+
 typedef struct DataStreamGroup
 {
   char   *defkey;
@@ -48,7 +56,15 @@ typedef struct DataStreamGroup
   time_t  modtime;
   char    filename[MAX_FILENAME_LEN];
   char    postpath[MAX_FILENAME_LEN];
-  struct  DataStreamGroup *next;
+  uint64_t hash;          /* Hash of definition key and post path */
+  time_t  synctime;       /* Time of last fdatasync() */
+  int     unsynced;       /* Data written since last fdatasync() */
+  int     pendingcount;   /* Records waiting in pending */
+  struct  iovec *pending; /* Records to write with the next ds_flush() */
+  struct  DataStreamGroup *hashnext;    /* Next group in hash bucket */
+  struct  DataStreamGroup *lruprev;     /* More recently used group */
+  struct  DataStreamGroup *lrunext;     /* Less recently used group */
+  struct  DataStreamGroup *pendingnext; /* Next group with pending records */
 }
 DataStreamGroup;
 
@@ -58,12 +74,49 @@ typedef struct DataStream
   int     idletimeout;
   int     maxopenfiles;
   int     openfilecount;
-  struct  DataStreamGroup *grouproot;
+  int     syncinterval;   /* fdatasync() interval in seconds, 0 for every write, -1 never */
+  int     writeerror;     /* Set when a queued record could not be written */
+  struct  DSWriter *writer;       /* Archive writer thread, NULL to write directly */
+  struct  DataStream *flushnext;  /* Archive writer list of streams to flush */
+  char   *flushident;             /* Archive writer identifier for flush, NULL if not listed */
+  struct  DSTemplate *template;     /* Compiled archive path format */
+  struct  DSTemplate *posttemplate; /* Compiled archive path format of last post path */
+  uint32_t groupcount;              /* Groups in grouphash */
+  uint32_t grouphashsize;           /* Buckets in grouphash, a power of 2 */
+  struct  DataStreamGroup **grouphash;  /* Groups by definition key and post path */
+  struct  DataStreamGroup *lruhead;     /* Most recently used group */
+  struct  DataStreamGroup *lrutail;     /* Least recently used group */
+  struct  DataStreamGroup *pendingroot; /* Groups with pending records */
 }
 DataStream;
 
+/* Archive writer thread statistics, summed over all writer threads */
+typedef struct DSWriterStats
+{
+  uint32_t threads;     /* Writer threads */
+  uint32_t capacity;    /* Records each writer thread may hold */
+  uint64_t queued;      /* Records queued or waiting to be written */
+  uint64_t queuedmax;   /* Most records queued or waiting for a single thread */
+  uint64_t records;     /* Records written */
+  uint64_t bytes;       /* Bytes written */
+  uint64_t writes;      /* writev() calls */
+  uint64_t syncs;       /* fdatasync() calls */
+  uint64_t errors;      /* Records that could not be written */
+  uint64_t waits;       /* Times a client waited for a full queue */
+  uint64_t waitus;      /* Microseconds clients waited for a full queue */
+} DSWriterStats;
+
 extern int ds_streamproc (DataStream *datastream, MS3Record *msr, char *postpath,
                           char *hostname);
 extern int ds_closeidle (DataStream *datastream, int idletimeout, char *ident);
 
+extern int ds_writerstart (uint32_t threads, uint32_t capacity, uint32_t flushms);
+extern struct DSWriter *ds_writerassign (void);
+extern int ds_writerspace (DataStream *datastream, uint32_t records);
+extern int ds_writerqueue (DataStream *datastream, const char *record, int reclen,
+                           const char *postpath, const char *ident);
+extern int ds_writerclose (DataStream *datastream, const char *ident);
+extern int ds_writerstats (DSWriterStats *stats);
+extern void ds_writerstop (void);
+
 #endif
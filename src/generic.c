@@ -21,6 +21,7 @@
  * @author Chad Trabant, EarthScope Data Services
  **************************************************************************/
 
+#include <ctype.h>
 #include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
@@ -317,3 +318,57 @@ HumanSizeString (uint64_t bytes, char *sizestring, size_t sizestringlen)
 
   return (printed < 0 || printed >= sizestringlen) ? -1 : 0;
 } /* End of HumanSizeString() */
+
+/*********************************************************************
+ * ParseNumberList:
+ *
+ * Parse a list of numbers and ranges between 0 and 63, such as the
+ * NUMA node lists of Linux, e.g. "0-3,6", into a bit mask with the
+ * bit of each listed number set.  Trailing white space, e.g. a
+ * newline, is allowed.
+ *
+ * Return 0 on success and -1 on error.
+ *********************************************************************/
+int
+ParseNumberList (const char *list, uint64_t *mask)
+{
+  const char *ptr = list;
+  char *end;
+  long first;
+  long last;
+
+  if (!list || !mask)
+    return -1;
+
+  *mask = 0;
+
+  while (*ptr && !isspace ((unsigned char)*ptr))
+  {
+    first = strtol (ptr, &end, 10);
+    if (end == ptr || first < 0 || first > 63)
+      return -1;
+
+    last = first;
+    ptr  = end;
+
+    if (*ptr == '-')
+    {
+      ptr++;
+      last = strtol (ptr, &end, 10);
+      if (end == ptr || last < first || last > 63)
+        return -1;
+
+      ptr = end;
+    }
+
+    for (; first <= last; first++)
+      *mask |= UINT64_C (1) << first;
+
+    if (*ptr == ',')
+      ptr++;
+    else if (*ptr && !isspace ((unsigned char)*ptr))
+      return -1;
+  }
+
+  return (*mask) ? 0 : -1;
+} /* End of ParseNumberList() */
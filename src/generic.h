@@ -39,6 +39,7 @@ extern uint64_t FNVhash64 (const char *str);
 extern int KeyCompare (const void *a, const void *b);
 extern int IsAllDigits (const char *string);
 extern int HumanSizeString (uint64_t bytes, char *sizestring, size_t sizestringlen);
+extern int ParseNumberList (const char *list, uint64_t *mask);
 
 #ifdef __cplusplus
 }
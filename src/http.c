@@ -26,6 +26,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <sys/stat.h>
 
@@ -70,15 +71,78 @@ const char *MediaTypes[] = {
 unsigned char favicon_ico[];
 uint64_t favicon_ico_len = 4414;
 
+/* Cached responses for the server information endpoints */
+#define RESPONSECACHE_ENTRIES  16
+#define RESPONSECACHE_KEYMAX   256
+#define RESPONSECACHE_MAXBYTES (32 * 1024 * 1024) /* Largest response cached */
+
+/* Server state changes that expire a cached response */
+typedef enum
+{
+  EXPIRE_STREAMGEN, /* Streams added or removed */
+  EXPIRE_STREAMS,   /* Streams added or removed, or statistics updated after packets were written */
+  EXPIRE_STATSGEN   /* Statistics updated */
+} ResponseExpiry;
+
+/* Server state a response was generated from */
+typedef struct ResponseState
+{
+  uint64_t streamgen; /* Stream index generation */
+  uint64_t writeseq;  /* Ring write sequence */
+  uint64_t statsgen;  /* Statistics generation */
+} ResponseState;
+
+typedef struct ResponseCacheEntry
+{
+  char key[RESPONSECACHE_KEYMAX]; /* Endpoint with match and limit expressions */
+  ResponseExpiry expiry;          /* State changes that expire the response */
+  ResponseState state;            /* State the response was generated from */
+  nstime_t lastused;              /* Time of last use, oldest is replaced */
+  MediaType type;                 /* Media type of the response */
+  char *response;                 /* Response body */
+  int responsebytes;              /* Length of response body */
+} ResponseCacheEntry;
+
+static ResponseCacheEntry responsecache[RESPONSECACHE_ENTRIES];
+static pthread_mutex_t responsecache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Responses larger than a chunk are sent with chunked transfer encoding */
+#define HTTPCHUNKSIZE 65536
+
+/* Content length indicating chunked transfer encoding to GenerateHeader() */
+#define HTTP_CHUNKED UINT64_MAX
+
+/* Context for sending a response in chunks */
+typedef struct HTTPChunks
+{
+  ClientInfo *cinfo;   /* Client the response is sent to */
+  MediaType type;      /* Media type of the response */
+  int started;         /* Header and first chunk have been sent */
+  char *body;          /* Copy of the response sent, NULL when not kept */
+  size_t bodysize;     /* Allocated size of body */
+  size_t bodylength;   /* Length of response in body */
+  int keep;            /* Flag: keep a copy of the response for the cache */
+} HTTPChunks;
+
 static int ParseHeader (char *header, char **value);
 static int GenerateHeader (ClientInfo *cinfo, int status, MediaType type,
                            uint64_t contentlength, const char *message, const char *header);
 static int GenerateID (ClientInfo *cinfo, const char *path, char **response, MediaType *type);
 static int GenerateStreams (ClientInfo *cinfo, const char *path, const char *query,
-                            char **response, MediaType *type);
+                            int chunked, char **response, MediaType *type);
+static int GenerateStreamsJSON (ClientInfo *cinfo, const char *matchexpr, int chunked,
+                                char **response, int *chunkedbytes);
+static int FlushChunks (InfoWriter *writer, int final);
+static int GenerateStreamList (ClientInfo *cinfo, const char *matchexpr, int just_ids,
+                               char **response);
 static int GenerateStatus (ClientInfo *cinfo, const char *path, char **response, MediaType *type);
 static int GenerateConnections (ClientInfo *cinfo, const char *path, const char *query,
                                 char **response, MediaType *type);
+static void ResponseStateGet (RingParams *ringparams, ResponseState *state);
+static int ResponseCacheGet (const char *key, const ResponseState *state,
+                             char **response, MediaType *type);
+static void ResponseCachePut (const char *key, ResponseExpiry expiry, const ResponseState *state,
+                              const char *response, int responsebytes, MediaType type);
 static int SendFileHTTP (ClientInfo *cinfo, char *path);
 static int NegotiateWebSocket (ClientInfo *cinfo, char *version,
                                char *upgradeHeader, char *connectionHeader,
@@ -310,7 +374,14 @@ HandleHTTP (char *recvbuffer, ClientInfo *cinfo)
   else if (!strcasecmp (path, "/streams") || !strcasecmp (path, "/streams/json") ||
            !strcasecmp (path, "/streamids"))
   {
-    responsebytes = GenerateStreams (cinfo, path, query, &response, &type);
+    responsebytes = GenerateStreams (cinfo, path, query, !strcmp (version, "HTTP/1.1"),
+                                     &response, &type);
+
+    /* Response already sent in chunks */
+    if (responsebytes == -2)
+    {
+      return (cinfo->socketerr) ? -1 : 0;
+    }
 
     /* Create header */
     if (responsebytes > 0)
@@ -589,6 +660,10 @@ HandleHTTP (char *recvbuffer, ClientInfo *cinfo)
  * WebSocket pings and pongs are handled.  If a ping is received an
  * appropriate pong is returned.  If a pong received it is ignored.
  *
+ * The frame header is only consumed when completely received.  While
+ * it is partially received ClientInfo.wsframing is set and the next
+ * call continues with it.
+ *
  * A WebSocket frame has the following, variable structure:
  *
  *  0               1               2               3
@@ -617,7 +692,7 @@ HandleHTTP (char *recvbuffer, ClientInfo *cinfo)
  * +---------------------------------------------------------------+
  *
  * Return >0 as number of bytes read on success
- * Return  0 when no data is available
+ * Return  0 when no data is available or a ping or pong was handled
  * Return -1 on error or timeout, ClientInfo.socketerr is set
  * Return -2 on orderly shutdown, ClientInfo.socketerr is set
  ***************************************************************************/
@@ -625,11 +700,14 @@ int
 RecvWSFrame (ClientInfo *cinfo, uint64_t *length)
 {
   unsigned char payload[125];
-  uint32_t framemask;
+  void *pongbuf[2];
+  size_t ponglen[2];
+  uint32_t framemask = 0;
   uint8_t onetwo[2];
   uint16_t length16;
   uint8_t length7;
-  int totalrecv = 0;
+  uint8_t *frame;
+  int framelen;
   int nrecv;
   int opcode;
 
@@ -640,15 +718,22 @@ RecvWSFrame (ClientInfo *cinfo, uint64_t *length)
   cinfo->wsmask.one = 0;
   cinfo->wsmaskidx  = 0;
 
+  /* The frame header is received in the receive buffer and only consumed
+   * when complete, a partially received header is continued by the next
+   * call as indicated by ClientInfo.wsframing */
+  cinfo->wsframing = 1;
+
   /* Recv first two bytes */
-  nrecv = RecvData (cinfo, onetwo, 2, 0);
+  nrecv = RecvData (cinfo, cinfo->recvbuf, 2, 0);
 
   if (nrecv != 2)
   {
     return nrecv;
   }
 
-  totalrecv += 2;
+  frame     = (uint8_t *)cinfo->recvbuf;
+  onetwo[0] = frame[0];
+  onetwo[1] = frame[1];
 
   /* Check if FIN flag is set, bit 0 of the 1st byte */
   if (!(onetwo[0] & 0x80))
@@ -658,18 +743,54 @@ RecvWSFrame (ClientInfo *cinfo, uint64_t *length)
     return -2;
   }
 
+  /* Extract opcode, bits 4-7 of the 1st byte */
+  opcode = onetwo[0] & 0xf;
+
   /* Extract payload length */
   length7 = onetwo[1] & 0x7f;
 
-  /* If 126, the length is a 16-bit value in the next 2 bytes */
+  /* Determine frame length: extended payload length and masking key */
+  framelen = 2;
+
   if (length7 == 126)
+    framelen += 2;
+  else if (length7 == 127)
+    framelen += 8;
+
+  if (onetwo[1] & 0x80)
+    framelen += 4;
+
+  /* Ping and pong payloads are received with the frame */
+  if (opcode == 0x9 || opcode == 0xa)
+  {
+    if (length7 > 125)
+    {
+      lprintf (0, "[%s] Error, WebSocket payload length > 125, which is not allowed for a %s",
+               cinfo->hostname, (opcode == 0x9) ? "ping" : "pong");
+      return -2;
+    }
+
+    framelen += length7;
+  }
+
+  /* Recv the remainder of the frame, must be fulfilled */
+  cinfo->recvconsumed = 0;
+  nrecv = RecvData (cinfo, cinfo->recvbuf, framelen, 1);
+
+  if (nrecv != framelen)
   {
-    nrecv = RecvData (cinfo, &length16, 2, 1);
+    return nrecv;
+  }
+
+  cinfo->wsframing = 0;
 
-    if (nrecv != 2)
-      return nrecv;
+  frame = (uint8_t *)cinfo->recvbuf + 2;
 
-    totalrecv += 2;
+  /* If 126, the length is a 16-bit value in the next 2 bytes */
+  if (length7 == 126)
+  {
+    memcpy (&length16, frame, 2);
+    frame += 2;
 
     if (!ms_bigendianhost ())
       ms_gswap2 (&length16);
@@ -679,12 +800,8 @@ RecvWSFrame (ClientInfo *cinfo, uint64_t *length)
   /* If 127, the length is a 64-bit value in the next 8 bytes */
   else if (length7 == 127)
   {
-    nrecv = RecvData (cinfo, length, 8, 1);
-
-    if (nrecv != 8)
-      return nrecv;
-
-    totalrecv += 8;
+    memcpy (length, frame, 8);
+    frame += 8;
 
     if (!ms_bigendianhost ())
       ms_gswap8 (length);
@@ -697,72 +814,34 @@ RecvWSFrame (ClientInfo *cinfo, uint64_t *length)
   /* If mask flag, the masking key is the next 4 bytes */
   if (onetwo[1] & 0x80)
   {
-    nrecv = RecvData (cinfo, &framemask, 4, 1);
-
-    if (nrecv != 4)
-      return nrecv;
-
-    totalrecv += 4;
+    memcpy (&framemask, frame, 4);
+    frame += 4;
   }
 
-  /* Extract opcode, bits 4-7 of the 1st byte */
-  opcode = onetwo[0] & 0xf;
-
   /* Check for ping, consume payload and send pong with same payload */
   if (opcode == 0x9)
   {
-    if (*length > 125)
-    {
-      lprintf (0, "[%s] Error, WebSocket payload length of %" PRIu64 " > 125, which is not allowed for a ping",
-               cinfo->hostname, *length);
-      return -2;
-    }
-
-    if (*length > 0)
-    {
-      nrecv = RecvData (cinfo, payload, *length, 1);
-
-      if (nrecv != (int)*length)
-      {
-        lprintf (0, "[%s] Error receiving payload for WebSocket ping, nrecv: %d, expected length: %" PRIu64 "\n",
-                 cinfo->hostname, nrecv, *length);
-        return -2;
-      }
+    memcpy (payload, frame, *length);
 
-      totalrecv += nrecv;
-    }
+    /* Send pong with same, unmasked, payload data in a single write */
+    if (onetwo[1] & 0x80)
+      WSUnmask (payload, *length, (uint8_t *)&framemask, 0);
 
-    /* Send pong with same payload data */
-    onetwo[0] = 0x8a; /* Change opcode to pong */
-    SendData (cinfo, onetwo, 2, 1);
-    SendData (cinfo, payload, *length, 1);
+    onetwo[0]     = 0x8a; /* Change opcode to pong */
+    onetwo[1]     = (uint8_t)*length;
+    pongbuf[0]    = onetwo;
+    pongbuf[1]    = payload;
+    ponglen[0]    = 2;
+    ponglen[1]    = *length;
+    SendDataMB (cinfo, pongbuf, ponglen, 2, 1);
 
     return 0;
   }
 
-  /* Check for pong, consume payload and ignore */
+  /* Check for pong, payload is consumed with the frame and ignored */
   if (opcode == 0xa)
   {
-    if (*length > 125)
-    {
-      lprintf (0, "[%s] Error, WebSocket payload length of %" PRIu64 " > 125, which is not allowed for a pong",
-               cinfo->hostname, *length);
-      return -2;
-    }
-
-    if (*length > 0)
-    {
-      nrecv = RecvData (cinfo, payload, *length, 1);
-
-      if (nrecv != (int)*length)
-      {
-        lprintf (0, "[%s] Error receiving payload for unexpected WebSocket pong, nrecv: %d, expected length: %" PRIu64 "\n",
-                 cinfo->hostname, nrecv, *length);
-        return -2;
-      }
-
-      totalrecv += nrecv;
-    }
+    return 0;
   }
 
   /* Check for Close frame, connection shutdown */
@@ -780,9 +859,51 @@ RecvWSFrame (ClientInfo *cinfo, uint64_t *length)
   /* Set mask value, done later to avoid use in RecvData() above */
   cinfo->wsmask.one = framemask;
 
-  return totalrecv;
+  return framelen;
 } /* End of RecvWSFrame() */
 
+/***************************************************************************
+ * WSFrameHeader:
+ *
+ * Create the header of an unmasked, binary WebSocket frame with a
+ * payload of 'length' bytes in 'frame', which must have room for
+ * WS_FRAMEMAX bytes.
+ *
+ * Returns the length of the frame header.
+ ***************************************************************************/
+int
+WSFrameHeader (uint8_t *frame, uint64_t length)
+{
+  uint16_t length16;
+  int idx;
+
+  frame[0] = 0x82; /* FIN=1(0x80), OPCODE=binary(0x2) */
+
+  /* Payload length < 126 is stored in bits 1-7 of byte 2, MASK=0 */
+  if (length < 126)
+  {
+    frame[1] = (uint8_t)length;
+    return 2;
+  }
+
+  /* Payload length <= 16-bit int is stored in the next two bytes */
+  if (length <= UINT16_MAX)
+  {
+    frame[1] = 126;
+    length16 = (uint16_t)length;
+    frame[2] = (uint8_t)(length16 >> 8);
+    frame[3] = (uint8_t)length16;
+    return 4;
+  }
+
+  /* Otherwise the payload length is stored in the next 8 bytes */
+  frame[1] = 127;
+  for (idx = 0; idx < 8; idx++)
+    frame[2 + idx] = (uint8_t)(length >> (56 - idx * 8));
+
+  return WS_FRAMEMAX;
+} /* End of WSFrameHeader() */
+
 /***************************************************************************
  * ParseHeader:
  *
@@ -836,7 +957,8 @@ ParseHeader (char *header, char **value)
  * GenerateHeader:
  *
  * Generate HTTP header for status, type, length with optional message
- * and write to the ClientInfo send buffer.
+ * and write to the ClientInfo send buffer.  A 200 status with a length
+ * of HTTP_CHUNKED is a header for chunked transfer encoding.
  *
  * The caller must free the header buffer allocated by this routine.
  *
@@ -849,7 +971,20 @@ GenerateHeader (ClientInfo *cinfo, int status, MediaType type,
 {
   int headlen;
 
-  if (status == 200)
+  if (status == 200 && contentlength == HTTP_CHUNKED)
+  {
+    headlen = snprintf (cinfo->sendbuf, cinfo->sendbufsize,
+                        "HTTP/1.1 200 OK\r\n"
+                        "Transfer-Encoding: chunked\r\n"
+                        "Content-Type: %s\r\n"
+                        "%s"
+                        "%s"
+                        "\r\n",
+                        MediaTypes[type],
+                        (cinfo->httpheaders) ? cinfo->httpheaders : "",
+                        (header) ? header : "");
+  }
+  else if (status == 200)
   {
     headlen = snprintf (cinfo->sendbuf, cinfo->sendbufsize,
                         "HTTP/1.1 200 OK\r\n"
@@ -1008,25 +1143,34 @@ GenerateID (ClientInfo *cinfo, const char *path, char **response, MediaType *typ
  * Check for 'match' parameter in 'path' and use value as a regular
  * expression to match against stream identifiers.
  *
+ * Responses are cached until streams are added or removed and, except
+ * for the list of stream IDs, packets are written and the statistics
+ * are updated.
+ *
+ * If 'chunked' is true, a JSON stream list larger than HTTPCHUNKSIZE
+ * is sent to the client with chunked transfer encoding as it is
+ * generated and a copy is cached, unless larger than
+ * RESPONSECACHE_MAXBYTES.  Cached responses are sent whole.
+ *
  * Return >0 size of response on success
  * Return  0 for unrecognized path
  * Return -1 on error
+ * Return -2 when the response was sent in chunks, on error the
+ *   ClientInfo.socketerr value is set as the response is incomplete
  ***************************************************************************/
 static int
 GenerateStreams (ClientInfo *cinfo, const char *path, const char *query,
-                 char **response, MediaType *type)
+                 int chunked, char **response, MediaType *type)
 {
-  size_t streamcount;
-  size_t streamlistsize;
+  ResponseState state;
+  ResponseExpiry expiry;
+  char cachekey[RESPONSECACHE_KEYMAX];
   char matchstr[64] = {0};
   int matchlen      = 0;
 
   char *cp;
-  char *writeptr    = NULL;
-  int written       = 0;
   int responsebytes = 0;
-
-  char *json_string;
+  int chunkedbytes  = 0;
 
   if (!cinfo || !path || !response || !type)
     return -1;
@@ -1037,107 +1181,338 @@ GenerateStreams (ClientInfo *cinfo, const char *path, const char *query,
     cp += 6; /* Advance to character after '=' */
 
     /* Copy parameter value into matchstr, stop at terminator, '&' or max length */
-    for (matchlen = 0; *cp != '\0' && *cp != '&' && matchlen < sizeof (matchstr); cp++, matchlen++)
+    for (matchlen = 0; *cp != '\0' && *cp != '&' && matchlen < sizeof (matchstr) - 1; cp++, matchlen++)
     {
       matchstr[matchlen] = *cp;
     }
     matchstr[matchlen] = '\0';
   }
 
-  json_string = info_json (cinfo, PACKAGE "/" VERSION, INFO_STREAMS, (matchlen > 0) ? matchstr : NULL);
+  if (!strcasecmp (path, "/streamids"))
+    expiry = EXPIRE_STREAMGEN;
+  else if (!strcasecmp (path, "/streams") || !strcasecmp (path, "/streams/json"))
+    expiry = EXPIRE_STREAMS;
+  else
+    return 0;
+
+  /* Return a cached response if current, the ring limit determines the streams included */
+  ResponseStateGet (cinfo->ringparams, &state);
 
-  if (!json_string)
-    return -1;
+  if (snprintf (cachekey, sizeof (cachekey), "%s %s %s", path, matchstr,
+                (cinfo->limitstr) ? cinfo->limitstr : "") >= sizeof (cachekey))
+    cachekey[0] = '\0';
+  else if ((responsebytes = ResponseCacheGet (cachekey, &state, response, type)) >= 0)
+    return responsebytes;
 
   if (!strcasecmp (path, "/streams/json"))
   {
-    *response     = json_string;
-    responsebytes = (*response) ? strlen (*response) : 0;
+    responsebytes = GenerateStreamsJSON (cinfo, (matchlen > 0) ? matchstr : NULL, chunked,
+                                         response, &chunkedbytes);
     *type         = JSON;
   }
-  else if (!strcasecmp (path, "/streams") ||
-           !strcasecmp (path, "/streamids"))
+  else
   {
-    yyjson_doc *json;
-    yyjson_val *root;
-    yyjson_val *stream_array;
-    yyjson_val *stream_iter = NULL;
-    size_t idx, max;
+    responsebytes = GenerateStreamList (cinfo, (matchlen > 0) ? matchstr : NULL,
+                                        (expiry == EXPIRE_STREAMGEN), response);
+    *type         = TEXT;
+  }
 
-    int just_ids = (!strcasecmp (path, "/streamids")) ? 1 : 0;
+  /* Cache the copy of a response sent in chunks */
+  if (responsebytes == -2)
+  {
+    if (*response && cachekey[0])
+      ResponseCachePut (cachekey, expiry, &state, *response, chunkedbytes, *type);
 
-    if ((json = yyjson_read (json_string, strlen (json_string), 0)) == NULL)
+    free (*response);
+    *response = NULL;
+  }
+  else if (responsebytes > 0 && cachekey[0])
+  {
+    ResponseCachePut (cachekey, expiry, &state, *response, responsebytes, *type);
+  }
+
+  return responsebytes;
+} /* End of GenerateStreams() */
+
+/***************************************************************************
+ * GenerateStreamsJSON:
+ *
+ * Generate a JSON stream list from a snapshot of the stream index with
+ * info_json_stream().  The list is placed into a buffer that should
+ * be free'd by the caller, unless 'chunked' is true and the list is
+ * larger than HTTPCHUNKSIZE, in which case it is sent to the client
+ * in chunks as it is generated.  A complete response sent in chunks
+ * is also returned in 'response', with its size in 'chunkedbytes',
+ * unless larger than RESPONSECACHE_MAXBYTES.
+ *
+ * Return >0 size of list, -1 on error and -2 when sent in chunks.
+ ***************************************************************************/
+static int
+GenerateStreamsJSON (ClientInfo *cinfo, const char *matchexpr, int chunked,
+                     char **response, int *chunkedbytes)
+{
+  RingStream *streams;
+  uint32_t streamcount;
+  int rv;
+
+  HTTPChunks chunks = {.cinfo = cinfo, .type = JSON, .started = 0, .keep = 1};
+  InfoWriter writer = {.flush = (chunked) ? FlushChunks : info_write_grow, .handle = &chunks};
+
+  *response = NULL;
+
+  if ((streams = GetStreamsArray (cinfo->ringparams, cinfo->reader, &streamcount)) == NULL)
+  {
+    lprintf (0, "[%s] Error getting streams", cinfo->hostname);
+    return -1;
+  }
+
+  if ((writer.buffer = (char *)malloc (HTTPCHUNKSIZE)) == NULL)
+  {
+    lprintf (0, "[%s] Error allocating memory", cinfo->hostname);
+    free (streams);
+    return -1;
+  }
+  writer.size = HTTPCHUNKSIZE;
+
+  rv = info_json_stream (cinfo, PACKAGE "/" VERSION, INFO_STREAMS, streams, &streamcount,
+                         matchexpr, &writer);
+
+  free (streams);
+
+  if (chunks.started)
+  {
+    free (writer.buffer);
+
+    /* An incomplete response cannot be recovered, the connection must be closed */
+    if (rv && !cinfo->socketerr)
+      cinfo->socketerr = -1;
+
+    if (rv || !chunks.keep)
     {
-      free (json_string);
-      return -1;
+      free (chunks.body);
+      return -2;
     }
-    free (json_string);
-    root = yyjson_doc_get_root (json);
 
-    if ((stream_array = yyjson_obj_get (root, "stream")) != NULL)
+    *response     = chunks.body;
+    *chunkedbytes = (int)chunks.bodylength;
+
+    return -2;
+  }
+
+  if (rv || writer.length > INT_MAX)
+  {
+    free (writer.buffer);
+    return -1;
+  }
+
+  *response = writer.buffer;
+
+  return (int)writer.length;
+} /* End of GenerateStreamsJSON() */
+
+/***************************************************************************
+ * FlushChunks:
+ *
+ * InfoWriter flush() to send the pending output to the client as a
+ * chunk with chunked transfer encoding, preceded by the response
+ * header with the first chunk.  A response completed before any chunk
+ * is sent is left in the writer buffer to be sent normally.
+ *
+ * A copy of the chunks sent is collected for the response cache until
+ * it exceeds RESPONSECACHE_MAXBYTES.
+ *
+ * Returns the count of bytes consumed on success and -1 on error.
+ ***************************************************************************/
+static int
+FlushChunks (InfoWriter *writer, int final)
+{
+  HTTPChunks *chunks = (HTTPChunks *)writer->handle;
+  ClientInfo *cinfo  = chunks->cinfo;
+  char chunkhead[20];
+  int headlen = 0;
+  int chunkheadlen;
+
+  if (final && !chunks->started)
+    return 0;
+
+  if (!chunks->started)
+  {
+    if ((headlen = GenerateHeader (cinfo, 200, chunks->type, HTTP_CHUNKED, NULL, NULL)) <= 0)
+      return -1;
+
+    chunks->started = 1;
+  }
+
+  chunkheadlen = snprintf (chunkhead, sizeof (chunkhead), "%zx\r\n", writer->length);
+
+  /* Send header (first), chunk and, when final, the terminating empty chunk */
+  if (SendDataMB (cinfo,
+                  (void *[]){cinfo->sendbuf, chunkhead, writer->buffer, (final) ? "\r\n0\r\n\r\n" : "\r\n"},
+                  (size_t[]){(size_t)headlen, (size_t)chunkheadlen, writer->length, (final) ? 7 : 2},
+                  4, 0))
+    return -1;
+
+  if (chunks->keep && (chunks->bodylength + writer->length) > RESPONSECACHE_MAXBYTES)
+  {
+    free (chunks->body);
+    chunks->body = NULL;
+    chunks->keep = 0;
+  }
+
+  if (chunks->keep)
+  {
+    if ((chunks->bodylength + writer->length) > chunks->bodysize)
     {
-      streamcount = yyjson_arr_size (stream_array);
+      size_t size = (chunks->bodysize) ? chunks->bodysize : (4 * HTTPCHUNKSIZE);
+      char *body;
 
-      /* Allocate stream list buffer with maximum expected:
-       * for /streamids output, maximum per entry is 60 characters + newline
-       * for /streams output, maximum per entry is 60 + 2x32 (time strings) plus a few spaces and newline */
-      streamlistsize = (just_ids) ? 64 : 124;
-      streamlistsize *= streamcount;
+      while (size < (chunks->bodylength + writer->length))
+        size *= 2;
 
-      if (!(*response = (char *)malloc (streamlistsize)))
+      if (size > RESPONSECACHE_MAXBYTES)
+        size = RESPONSECACHE_MAXBYTES;
+
+      if ((body = (char *)realloc (chunks->body, size)) == NULL)
       {
-        lprintf (0, "[%s] Error for HTTP STREAM[ID]S (cannot allocate response buffer of size %zu)",
-                 cinfo->hostname, streamlistsize);
-        yyjson_doc_free (json);
-        return -1;
+        free (chunks->body);
+        chunks->body = NULL;
+        chunks->keep = 0;
+
+        return (int)writer->length;
       }
 
-      writeptr = *response;
+      chunks->body     = body;
+      chunks->bodysize = size;
+    }
 
-      responsebytes = 0;
+    memcpy (chunks->body + chunks->bodylength, writer->buffer, writer->length);
+    chunks->bodylength += writer->length;
+  }
 
-      yyjson_arr_foreach (stream_array, idx, max, stream_iter)
-      {
-        if (just_ids)
-        {
-          written = snprintf (writeptr, streamlistsize - responsebytes, "%s\n",
-                              DASHNULL (yyjson_get_str (yyjson_obj_get (stream_iter, "id"))));
-        }
-        else
-        {
-          written = snprintf (writeptr, streamlistsize - responsebytes, "%s %s %s\n",
-                              DASHNULL (yyjson_get_str (yyjson_obj_get (stream_iter, "id"))),
-                              DASHNULL (yyjson_get_str (yyjson_obj_get (stream_iter, "start_time"))),
-                              DASHNULL (yyjson_get_str (yyjson_obj_get (stream_iter, "end_time"))));
-        }
+  return (int)writer->length;
+} /* End of FlushChunks() */
 
-        if ((responsebytes + written) >= streamlistsize)
-        {
-          lprintf (0, "[%s] Error for HTTP STREAM[ID]S (response buffer overflow)",
-                   cinfo->hostname);
-          yyjson_doc_free (json);
-          return -1;
-        }
+/***************************************************************************
+ * GenerateStreamList:
+ *
+ * Generate a plain text list of streams directly from the stream
+ * index, one stream per line.  If 'just_ids' is true only the stream
+ * IDs are listed, otherwise each is followed by the earliest data
+ * start and latest data end times.  The list is placed into a buffer
+ * that should be free'd by the caller.
+ *
+ * Return >0 size of list, 0 when no streams are selected and -1 on error.
+ ***************************************************************************/
+static int
+GenerateStreamList (ClientInfo *cinfo, const char *matchexpr, int just_ids,
+                    char **response)
+{
+  Stack *ringstreams;
+  StackNode *node;
+  RingStream *ringstream;
+  char starttime[32];
+  char endtime[32];
+  size_t streamcount = 0;
+  size_t streamlistsize;
+  char *writeptr;
+  int responsebytes = 0;
+  int written;
 
-        writeptr += written;
-        responsebytes += written;
-      }
+  pcre2_code *match_code       = NULL;
+  pcre2_match_data *match_data = NULL;
 
-      /* Add a final terminator to stream list buffer */
-      *writeptr = '\0';
+  *response = NULL;
+
+  /* Compile match expression if provided */
+  if (matchexpr && UpdatePattern (&match_code, &match_data, matchexpr, "stream match expression"))
+    return -1;
+
+  /* Get copy of streams as a Stack, sorted by stream ID */
+  if ((ringstreams = GetStreamsStack (cinfo->ringparams, cinfo->reader)) == NULL)
+  {
+    lprintf (0, "[%s] Error getting streams stack", cinfo->hostname);
+    if (match_code)
+      pcre2_code_free (match_code);
+    if (match_data)
+      pcre2_match_data_free (match_data);
+    return -1;
+  }
+
+  for (node = ringstreams->top; node; node = node->next)
+    streamcount++;
 
-      yyjson_doc_free (json);
-      *type = TEXT;
+  /* Allocate stream list buffer with maximum expected per entry:
+   * stream ID, 2x time strings, spaces and a newline */
+  streamlistsize = (just_ids) ? (MAXSTREAMID + 1) : (MAXSTREAMID + 2 * sizeof (starttime) + 3);
+  streamlistsize = streamlistsize * streamcount + 1;
+
+  if (!(*response = (char *)malloc (streamlistsize)))
+  {
+    lprintf (0, "[%s] Error for HTTP STREAM[ID]S (cannot allocate response buffer of size %zu)",
+             cinfo->hostname, streamlistsize);
+    responsebytes = -1;
+  }
+
+  writeptr = *response;
+
+  while ((ringstream = (RingStream *)StackPop (ringstreams)))
+  {
+    /* Skip if stream ID does not match provided expression */
+    if (responsebytes < 0 ||
+        (match_code &&
+         pcre2_match (match_code, (PCRE2_SPTR8)ringstream->streamid, PCRE2_ZERO_TERMINATED, 0, 0, match_data, NULL) < 0))
+    {
+      free (ringstream);
+      continue;
+    }
+
+    if (just_ids)
+    {
+      written = snprintf (writeptr, streamlistsize - responsebytes, "%s\n",
+                          ringstream->streamid);
     }
+    else
+    {
+      ms_nstime2timestr (ringstream->earliestdstime, starttime, ISOMONTHDAY_Z, MICRO);
+      ms_nstime2timestr (ringstream->latestdetime, endtime, ISOMONTHDAY_Z, MICRO);
+
+      written = snprintf (writeptr, streamlistsize - responsebytes, "%s %s %s\n",
+                          ringstream->streamid, starttime, endtime);
+    }
+
+    free (ringstream);
+
+    if ((responsebytes + written) >= streamlistsize)
+    {
+      lprintf (0, "[%s] Error for HTTP STREAM[ID]S (response buffer overflow)",
+               cinfo->hostname);
+      responsebytes = -1;
+      continue;
+    }
+
+    writeptr += written;
+    responsebytes += written;
   }
-  else
+
+  StackDestroy (ringstreams, free);
+
+  if (match_code)
+    pcre2_code_free (match_code);
+  if (match_data)
+    pcre2_match_data_free (match_data);
+
+  if (responsebytes < 0)
   {
-    free (json_string);
-    return 0;
+    free (*response);
+    *response = NULL;
+    return -1;
   }
 
+  /* Add a final terminator to stream list buffer */
+  *writeptr = '\0';
+
   return responsebytes;
-} /* End of GenerateStreams() */
+} /* End of GenerateStreamList() */
 
 /***************************************************************************
  * GenerateStatus:
@@ -1145,11 +1520,14 @@ GenerateStreams (ClientInfo *cinfo, const char *path, const char *query,
  * Generate server status and place into buffer, which will be
  * allocated to the length needed and should be free'd by the caller.
  *
+ * Responses are cached until the statistics are updated.
+ *
  * Returns length of status response in bytes on sucess and -1 on error.
  ***************************************************************************/
 static int
 GenerateStatus (ClientInfo *cinfo, const char *path, char **response, MediaType *type)
 {
+  ResponseState state;
   size_t responsesize;
   char *writeptr    = NULL;
   int written       = 0;
@@ -1160,6 +1538,14 @@ GenerateStatus (ClientInfo *cinfo, const char *path, char **response, MediaType
   if (!cinfo || !path || !response || !type)
     return -1;
 
+  /* Return a cached response if current */
+  ResponseStateGet (cinfo->ringparams, &state);
+
+  if ((responsebytes = ResponseCacheGet (path, &state, response, type)) >= 0)
+    return responsebytes;
+
+  responsebytes = 0;
+
   json_string = info_json (cinfo, PACKAGE "/" VERSION, INFO_ID | INFO_STATUS, NULL);
 
   if (!json_string)
@@ -1178,6 +1564,7 @@ GenerateStatus (ClientInfo *cinfo, const char *path, char **response, MediaType
     yyjson_val *server;
     yyjson_val *thread_array;
     yyjson_val *thread_iter = NULL;
+    yyjson_val *archive;
     size_t idx, max;
 
     if ((json = yyjson_read (json_string, strlen (json_string), 0)) == NULL)
@@ -1190,7 +1577,7 @@ GenerateStatus (ClientInfo *cinfo, const char *path, char **response, MediaType
 
     if ((server = yyjson_obj_get (root, "server")) != NULL)
     {
-      responsesize = 2048;
+      responsesize = 4096;
 
       if (!(*response = (char *)malloc (responsesize)))
       {
@@ -1313,6 +1700,41 @@ GenerateStatus (ClientInfo *cinfo, const char *path, char **response, MediaType
           responsebytes += written;
         }
       }
+
+      if ((archive = yyjson_obj_get (server, "miniseed_archive")) != NULL)
+      {
+        written = snprintf (writeptr, responsesize - responsebytes,
+                            "\nminiSEED archive writer:\n"
+                            "  Writer threads: %" PRIu64 "\n"
+                            "  Queue capacity: %" PRIu64 "\n"
+                            "  Queued records: %" PRIu64 "  Max: %" PRIu64 "\n"
+                            "  Written records: %" PRIu64 "  Bytes: %" PRIu64 "\n"
+                            "  Write calls: %" PRIu64 "  Sync calls: %" PRIu64 "\n"
+                            "  Write errors: %" PRIu64 "\n"
+                            "  Queue waits: %" PRIu64 "  Wait time: %.3f seconds\n",
+                            yyjson_get_uint (yyjson_obj_get (archive, "writer_threads")),
+                            yyjson_get_uint (yyjson_obj_get (archive, "queue_capacity")),
+                            yyjson_get_uint (yyjson_obj_get (archive, "queued_records")),
+                            yyjson_get_uint (yyjson_obj_get (archive, "queued_records_max")),
+                            yyjson_get_uint (yyjson_obj_get (archive, "written_records")),
+                            yyjson_get_uint (yyjson_obj_get (archive, "written_bytes")),
+                            yyjson_get_uint (yyjson_obj_get (archive, "write_calls")),
+                            yyjson_get_uint (yyjson_obj_get (archive, "sync_calls")),
+                            yyjson_get_uint (yyjson_obj_get (archive, "write_errors")),
+                            yyjson_get_uint (yyjson_obj_get (archive, "queue_waits")),
+                            yyjson_get_real (yyjson_obj_get (archive, "queue_wait_seconds")));
+
+        if ((responsebytes + written) >= responsesize)
+        {
+          lprintf (0, "[%s] Error for HTTP STATUS (response buffer overflow)",
+                   cinfo->hostname);
+          yyjson_doc_free (json);
+          return -1;
+        }
+
+        writeptr += written;
+        responsebytes += written;
+      }
     }
 
     yyjson_doc_free (json);
@@ -1324,6 +1746,9 @@ GenerateStatus (ClientInfo *cinfo, const char *path, char **response, MediaType
     return 0;
   }
 
+  if (responsebytes > 0)
+    ResponseCachePut (path, EXPIRE_STATSGEN, &state, *response, responsebytes, *type);
+
   return responsebytes;
 } /* End of GenerateStatus() */
 
@@ -1336,6 +1761,8 @@ GenerateStatus (ClientInfo *cinfo, const char *path, char **response, MediaType
  * Check for 'match' parameter in 'path' and use value as a regular
  * expression to match against stream identifiers.
  *
+ * Responses are cached until the statistics are updated.
+ *
  * Return >0 size of response on success
  * Return  0 for unrecognized path
  * Return -1 on error
@@ -1344,6 +1771,8 @@ static int
 GenerateConnections (ClientInfo *cinfo, const char *path, const char *query,
                      char **response, MediaType *type)
 {
+  ResponseState state;
+  char cachekey[RESPONSECACHE_KEYMAX];
   size_t clientcount = 0;
   size_t responsesize;
   char matchstr[50];
@@ -1365,13 +1794,23 @@ GenerateConnections (ClientInfo *cinfo, const char *path, const char *query,
     cp += 6; /* Advance to character after '=' */
 
     /* Copy parameter value into matchstr, stop at terminator, '&' or max length */
-    for (matchlen = 0; *cp && *cp != '&' && matchlen < sizeof (matchstr); cp++, matchlen++)
+    for (matchlen = 0; *cp && *cp != '&' && matchlen < sizeof (matchstr) - 1; cp++, matchlen++)
     {
       matchstr[matchlen] = *cp;
     }
     matchstr[matchlen] = '\0';
   }
 
+  /* Return a cached response if current */
+  ResponseStateGet (cinfo->ringparams, &state);
+
+  snprintf (cachekey, sizeof (cachekey), "%s %s", path, (matchlen > 0) ? matchstr : "");
+
+  if ((responsebytes = ResponseCacheGet (cachekey, &state, response, type)) >= 0)
+    return responsebytes;
+
+  responsebytes = 0;
+
   json_string = info_json (cinfo, PACKAGE "/" VERSION, INFO_CONNECTIONS, (matchlen > 0) ? matchstr : NULL);
 
   if (!json_string)
@@ -1508,9 +1947,138 @@ GenerateConnections (ClientInfo *cinfo, const char *path, const char *query,
     return 0;
   }
 
+  if (responsebytes > 0)
+    ResponseCachePut (cachekey, EXPIRE_STATSGEN, &state, *response, responsebytes, *type);
+
   return responsebytes;
 } /* End of GenerateConnections() */
 
+/***************************************************************************
+ * ResponseStateGet:
+ *
+ * Get the current server state that cached responses depend on.  The
+ * state must be determined before a response is generated so that
+ * changes during generation expire the cached response.
+ ***************************************************************************/
+static void
+ResponseStateGet (RingParams *ringparams, ResponseState *state)
+{
+  state->streamgen = __atomic_load_n (&ringparams->streamgen, __ATOMIC_ACQUIRE);
+  state->writeseq  = __atomic_load_n (&ringparams->writeseq, __ATOMIC_ACQUIRE);
+  state->statsgen  = __atomic_load_n (&param.statsgen, __ATOMIC_ACQUIRE);
+} /* End of ResponseStateGet() */
+
+/***************************************************************************
+ * ResponseCacheGet:
+ *
+ * Search the response cache for 'key' and, if the cached response is
+ * current for the server 'state', place a copy of it into a buffer
+ * that should be free'd by the caller.
+ *
+ * Streams listings are expired by new or removed streams and, when
+ * packets have been written, by a statistics update.  This limits
+ * the age of the data times listed to the statistics interval of
+ * about a second, while an idle ring is always served from the cache.
+ *
+ * Return size of response on success and -1 if not cached or expired.
+ ***************************************************************************/
+static int
+ResponseCacheGet (const char *key, const ResponseState *state,
+                  char **response, MediaType *type)
+{
+  ResponseCacheEntry *entry;
+  int responsebytes = -1;
+  int current;
+  int idx;
+
+  pthread_mutex_lock (&responsecache_lock);
+
+  for (idx = 0; idx < RESPONSECACHE_ENTRIES; idx++)
+  {
+    entry = &responsecache[idx];
+
+    if (!entry->response || strcmp (entry->key, key))
+      continue;
+
+    if (entry->expiry == EXPIRE_STREAMGEN)
+      current = (entry->state.streamgen == state->streamgen);
+    else if (entry->expiry == EXPIRE_STREAMS)
+      current = (entry->state.streamgen == state->streamgen &&
+                 (entry->state.writeseq == state->writeseq ||
+                  entry->state.statsgen == state->statsgen));
+    else
+      current = (entry->state.statsgen == state->statsgen);
+
+    if (current && (*response = (char *)malloc (entry->responsebytes + 1)))
+    {
+      memcpy (*response, entry->response, entry->responsebytes + 1);
+      *type           = entry->type;
+      responsebytes   = entry->responsebytes;
+      entry->lastused = NSnow ();
+    }
+
+    break;
+  }
+
+  pthread_mutex_unlock (&responsecache_lock);
+
+  return responsebytes;
+} /* End of ResponseCacheGet() */
+
+/***************************************************************************
+ * ResponseCachePut:
+ *
+ * Add a copy of a response generated from the server 'state' to the
+ * response cache, replacing an entry with the same 'key' or the least
+ * recently used entry.  Responses larger than RESPONSECACHE_MAXBYTES
+ * are not cached.
+ ***************************************************************************/
+static void
+ResponseCachePut (const char *key, ResponseExpiry expiry, const ResponseState *state,
+                  const char *response, int responsebytes, MediaType type)
+{
+  ResponseCacheEntry *entry = NULL;
+  char *copy;
+  int idx;
+
+  if (!key || !response || responsebytes <= 0 || responsebytes > RESPONSECACHE_MAXBYTES ||
+      strlen (key) >= RESPONSECACHE_KEYMAX)
+    return;
+
+  if (!(copy = (char *)malloc (responsebytes + 1)))
+    return;
+
+  memcpy (copy, response, responsebytes);
+  copy[responsebytes] = '\0';
+
+  pthread_mutex_lock (&responsecache_lock);
+
+  for (idx = 0; idx < RESPONSECACHE_ENTRIES; idx++)
+  {
+    if (responsecache[idx].response && !strcmp (responsecache[idx].key, key))
+    {
+      entry = &responsecache[idx];
+      break;
+    }
+
+    if (!entry || !responsecache[idx].response ||
+        (entry->response && responsecache[idx].lastused < entry->lastused))
+      entry = &responsecache[idx];
+  }
+
+  free (entry->response);
+
+  strcpy (entry->key, key);
+  entry->expiry        = expiry;
+  entry->state         = *state;
+  entry->lastused      = NSnow ();
+  entry->type          = type;
+  entry->response      = copy;
+  entry->responsebytes = responsebytes;
+
+  pthread_mutex_unlock (&responsecache_lock);
+} /* End of ResponseCachePut() */
+
 /***************************************************************************
  * SendFileHTTP:
  *
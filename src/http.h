@@ -29,11 +29,16 @@ extern "C" {
 #include "ring.h"
 #include "clients.h"
 
+/* Maximum length of a WebSocket frame header sent by the server */
+#define WS_FRAMEMAX 10
+
 /* Extract bit range and shift to start */
 #define EXTRACTBITRANGE(VALUE, STARTBIT, LENGTH) ((VALUE & (((1 << LENGTH) - 1) << STARTBIT)) >> STARTBIT)
 
 extern int HandleHTTP (char *recvbuffer, ClientInfo *cinfo);
 extern int RecvWSFrame (ClientInfo *cinfo, uint64_t *length);
+extern int WSFrameHeader (uint8_t *frame, uint64_t length);
+extern void WSUnmask (uint8_t *buffer, size_t length, const uint8_t mask[4], size_t maskidx);
 
 #ifdef __cplusplus
 }
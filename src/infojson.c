@@ -24,6 +24,8 @@
  * @author Chad Trabant, EarthScope Data Services
  **************************************************************************/
 #include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +39,8 @@
 #include "ring.h"
 #include "mseedscan.h"
 
+static int info_write_jsonstr (InfoWriter *writer, const char *string);
+
 /***************************************************************************
  * info_create_root:
  *
@@ -303,273 +307,6 @@ info_add_streams (ClientInfo *cinfo, yyjson_mut_doc *doc, const char *matchexpr)
   return doc;
 }
 
-/***************************************************************************
- * info_add_stations:
- *
- * Add station array, and optionally a stream sub-array, to the JSON document.
- *
- * Returns pointer to JSON document success and NULL on error.
- ***************************************************************************/
-static yyjson_mut_doc *
-info_add_stations (ClientInfo *cinfo, yyjson_mut_doc *doc, int include_streams,
-                   const char *matchexpr)
-{
-  yyjson_mut_val *root = yyjson_mut_doc_get_root (doc);
-  yyjson_mut_val *station_array;
-  yyjson_mut_val *station;
-  yyjson_mut_val *stream_array;
-  yyjson_mut_val *stream;
-
-  Stack *ringstreams;
-  RingStream *ringstream;
-
-  struct station_details
-  {
-    char id[MAXSTREAMID];
-    uint64_t earliestid;
-    uint64_t latestid;
-    Stack *streams;
-  };
-
-  struct stream_details
-  {
-    char id[MAXSTREAMID];
-    char format[2];
-    char subformat[2];
-    nstime_t earliesttime;
-    nstime_t latesttime;
-  };
-
-  struct station_details *station_details = NULL;
-  struct stream_details *stream_details   = NULL;
-
-  Stack *station_stack = NULL;
-
-  char net[MAXSTREAMID]  = {0};
-  char sta[MAXSTREAMID]  = {0};
-  char loc[MAXSTREAMID]  = {0};
-  char chan[MAXSTREAMID] = {0};
-
-  char staid[MAXSTREAMID]    = {0};
-  char streamid[MAXSTREAMID] = {0};
-
-  int error         = 0;
-  char *type        = NULL;
-  char string96[96] = {0};
-
-  pcre2_code *match_code       = NULL;
-  pcre2_match_data *match_data = NULL;
-
-  /* Compile match expression if provided */
-  if (matchexpr && UpdatePattern (&match_code, &match_data, matchexpr, "stream match expression"))
-  {
-    return NULL;
-  }
-
-  /* Get copy of streams as a Stack, sorted by stream ID */
-  if ((ringstreams = GetStreamsStack (cinfo->ringparams, cinfo->reader)) == NULL)
-  {
-    lprintf (0, "[%s] Error getting streams stack", cinfo->hostname);
-    return NULL;
-  }
-
-  if ((station_stack = StackCreate ()) == NULL)
-  {
-    lprintf (0, "[%s] Error allocating memory", cinfo->hostname);
-    StackDestroy (ringstreams, free);
-    return NULL;
-  }
-
-  /* Build Stacks of stations and optionally streams */
-  while ((ringstream = (RingStream *)StackPop (ringstreams)))
-  {
-    /* Skip if stream ID does not match provided expression */
-    if (match_code &&
-        pcre2_match (match_code, (PCRE2_SPTR8)ringstream->streamid, PCRE2_ZERO_TERMINATED, 0, 0, match_data, NULL) < 0)
-    {
-      free (ringstream);
-      continue;
-    }
-
-    /* Truncate stream ID at type suffix */
-    if ((type = strchr (ringstream->streamid, '/')))
-      *type++ = '\0';
-
-    /* Extract codes from FDSN Source ID (streamid) */
-    if (strncmp (ringstream->streamid, "FDSN:", 5) == 0)
-    {
-      if (ms_sid2nslc (ringstream->streamid, net, sta, loc, chan))
-      {
-        lprintf (0, "[%s] Error splitting stream ID: %s", cinfo->hostname, ringstream->streamid);
-        free (ringstream);
-        error = 1;
-        break;
-      }
-
-      /* Create station ID as combination of network and station codes */
-      snprintf (staid, sizeof (staid), "%s_%s", net, sta);
-
-      /* Create stream ID as combination of location and channel codes,
-       * expanding SEED channel if needed */
-      if (strlen (chan) == 3)
-        snprintf (streamid, sizeof (streamid), "%s_%c_%c_%c", loc, chan[0], chan[1], chan[2]);
-      else
-        snprintf (streamid, sizeof (streamid), "%s_%s", loc, chan);
-    }
-    /* Otherwise use the stream ID as the station and stream IDs */
-    else
-    {
-      memcpy (staid, ringstream->streamid, sizeof (staid));
-      memcpy (streamid, ringstream->streamid, sizeof (streamid));
-    }
-
-    /* Create new station entry and add to stack */
-    if (station_details == NULL || strcmp (station_details->id, staid) != 0)
-    {
-      station_details = (struct station_details *)malloc (sizeof (struct station_details));
-      if (station_details == NULL)
-      {
-        lprintf (0, "[%s] Error allocating memory", cinfo->hostname);
-        free (ringstream);
-        error = 1;
-        break;
-      }
-
-      memcpy (station_details->id, staid, sizeof (station_details->id));
-      station_details->earliestid = ringstream->earliestid;
-      station_details->latestid   = ringstream->latestid;
-
-      if (include_streams)
-      {
-        if ((station_details->streams = StackCreate ()) == NULL)
-        {
-          lprintf (0, "[%s] Error allocating memory", cinfo->hostname);
-          free (ringstream);
-          error = 1;
-          break;
-        }
-      }
-      else
-      {
-        station_details->streams = NULL;
-      }
-
-      StackUnshift (station_stack, station_details);
-    }
-    /* Otherwise, update station entry */
-    else
-    {
-      if (station_details->earliestid > ringstream->earliestid)
-        station_details->earliestid = ringstream->earliestid;
-      if (station_details->latestid < ringstream->latestid)
-        station_details->latestid = ringstream->latestid;
-    }
-
-    /* Add stream details if requested */
-    if (station_details->streams != NULL)
-    {
-      stream_details = (struct stream_details *)malloc (sizeof (struct stream_details));
-      if (stream_details == NULL)
-      {
-        lprintf (0, "[%s] Error allocating memory", cinfo->hostname);
-        free (ringstream);
-        error = 1;
-        break;
-      }
-
-      memcpy (stream_details->id, streamid, sizeof (stream_details->id));
-
-      if (type && strstr (type, "MSEED3"))
-      {
-        strcpy (stream_details->format, "3");
-      }
-      else if (type && strstr (type, "MSEED"))
-      {
-        strcpy (stream_details->format, "2");
-      }
-      else
-      {
-        strcpy (stream_details->format, "?");
-      }
-
-      strcpy (stream_details->subformat, "D");
-
-      stream_details->earliesttime = ringstream->earliestdstime;
-      stream_details->latesttime   = ringstream->latestdetime;
-
-      StackUnshift (station_details->streams, stream_details);
-    }
-
-    free (ringstream);
-  }
-
-  StackDestroy (ringstreams, free);
-
-  if (!error)
-  {
-    /* Create JSON */
-    station_array = yyjson_mut_obj_add_arr (doc, root, "station");
-
-    /* Traverse station stack creating "station" entries */
-    while ((station_details = (struct station_details *)StackPop (station_stack)) && !error)
-    {
-      station = yyjson_mut_arr_add_obj (doc, station_array);
-
-      yyjson_mut_obj_add_strcpy (doc, station, "id", station_details->id);
-      snprintf (string96, sizeof (string96), "Station ID %s", station_details->id);
-      yyjson_mut_obj_add_strcpy (doc, station, "description", string96);
-      yyjson_mut_obj_add_uint (doc, station, "start_seq", station_details->earliestid);
-      yyjson_mut_obj_add_uint (doc, station, "end_seq", station_details->latestid);
-
-      if (station_details->streams)
-      {
-        stream_array = yyjson_mut_obj_add_arr (doc, station, "stream");
-
-        /* Traverse stream stack creating "stream" entries */
-        while ((stream_details = (struct stream_details *)StackPop (station_details->streams)))
-        {
-          stream = yyjson_mut_arr_add_obj (doc, stream_array);
-
-          yyjson_mut_obj_add_strcpy (doc, stream, "id", stream_details->id);
-          yyjson_mut_obj_add_strcpy (doc, stream, "format", stream_details->format);
-          yyjson_mut_obj_add_strcpy (doc, stream, "subformat", stream_details->subformat);
-
-          ms_nstime2timestr (stream_details->earliesttime, string96, ISOMONTHDAY_Z, MICRO);
-          yyjson_mut_obj_add_strcpy (doc, stream, "start_time", string96);
-          ms_nstime2timestr (stream_details->latesttime, string96, ISOMONTHDAY_Z, MICRO);
-          yyjson_mut_obj_add_strcpy (doc, stream, "end_time", string96);
-
-          free (stream_details);
-        }
-
-        StackDestroy (station_details->streams, free);
-      }
-
-      free (station_details);
-    }
-  }
-
-  /* Free all temporary allocations */
-  while ((station_details = (struct station_details *)StackPop (station_stack)))
-  {
-    if (station_details->streams)
-    {
-      StackDestroy (station_details->streams, free);
-    }
-
-    free (station_details);
-  }
-
-  StackDestroy (station_stack, free);
-
-  if (match_code)
-    pcre2_code_free (match_code);
-  if (match_data)
-    pcre2_match_data_free (match_data);
-
-  return doc;
-}
-
 /***************************************************************************
  * info_add_connections:
  *
@@ -817,8 +554,10 @@ info_add_status (ClientInfo *cinfo, yyjson_mut_doc *doc)
   yyjson_mut_val *server;
   yyjson_mut_val *thread_array;
   yyjson_mut_val *thread;
+  yyjson_mut_val *archive;
 
   struct sthread *loopstp;
+  DSWriterStats writerstats;
 
   char packettime[50];
 
@@ -866,6 +605,23 @@ info_add_status (ClientInfo *cinfo, yyjson_mut_doc *doc)
     yyjson_mut_obj_add_strcpy (doc, server, "latest_data_end", packettime);
   }
 
+  /* Add miniSEED archive writer details if running */
+  if (ds_writerstats (&writerstats) == 0 &&
+      (archive = yyjson_mut_obj_add_obj (doc, server, "miniseed_archive")) != NULL)
+  {
+    yyjson_mut_obj_add_uint (doc, archive, "writer_threads", writerstats.threads);
+    yyjson_mut_obj_add_uint (doc, archive, "queue_capacity", writerstats.capacity);
+    yyjson_mut_obj_add_uint (doc, archive, "queued_records", writerstats.queued);
+    yyjson_mut_obj_add_uint (doc, archive, "queued_records_max", writerstats.queuedmax);
+    yyjson_mut_obj_add_uint (doc, archive, "written_records", writerstats.records);
+    yyjson_mut_obj_add_uint (doc, archive, "written_bytes", writerstats.bytes);
+    yyjson_mut_obj_add_uint (doc, archive, "write_calls", writerstats.writes);
+    yyjson_mut_obj_add_uint (doc, archive, "sync_calls", writerstats.syncs);
+    yyjson_mut_obj_add_uint (doc, archive, "write_errors", writerstats.errors);
+    yyjson_mut_obj_add_uint (doc, archive, "queue_waits", writerstats.waits);
+    yyjson_mut_obj_add_real (doc, archive, "queue_wait_seconds", (double)writerstats.waitus / 1000000.0);
+  }
+
   /* List server threads, lock thread list while looping */
   pthread_mutex_lock (&param.sthreads_lock);
   for (loopstp = param.sthreads; loopstp != NULL; loopstp = loopstp->next)
@@ -932,6 +688,8 @@ info_add_status (ClientInfo *cinfo, yyjson_mut_doc *doc)
  * v4 JSON info schema.
  *
  * Which elements are included is controlled by the elements bitmask.
+ * Station lists (INFO_STATIONS and INFO_STATION_STREAMS) are only
+ * generated by info_json_stream().
  *
  * The returned string is minified JSON document and allocated on the heap
  * that must be free'd by the caller.
@@ -980,20 +738,6 @@ info_json (ClientInfo *cinfo, const char *software, InfoElements elements,
     return NULL;
   }
 
-  if (elements & INFO_STATIONS &&
-      info_add_stations (cinfo, doc, 0, matchexpr) == NULL)
-  {
-    yyjson_mut_doc_free (doc);
-    return NULL;
-  }
-
-  if (elements & INFO_STATION_STREAMS &&
-      info_add_stations (cinfo, doc, 1, matchexpr) == NULL)
-  {
-    yyjson_mut_doc_free (doc);
-    return NULL;
-  }
-
   if (elements & INFO_STREAMS &&
       info_add_streams (cinfo, doc, matchexpr) == NULL)
   {
@@ -1023,6 +767,492 @@ info_json (ClientInfo *cinfo, const char *software, InfoElements elements,
   return json_string;
 }
 
+/***************************************************************************
+ * info_json_stream:
+ *
+ * Write a JSON document with server details, conforming to the SeedLink
+ * v4 JSON info schema, incrementally to an InfoWriter.
+ *
+ * This is the generator for the potentially very large stream and
+ * station lists.  The document is written directly from 'streams', a
+ * snapshot of the stream index sorted on stream ID as returned by
+ * GetStreamsArray(), without building a document tree so the memory
+ * needed is bounded by the writer buffer.  Only the INFO_ID,
+ * INFO_STATIONS, INFO_STATION_STREAMS and INFO_STREAMS elements are
+ * supported.
+ *
+ * Entries of 'streams' that do not match 'matchexpr' are removed from
+ * the snapshot and 'streamcount' is updated, the same snapshot may be
+ * used to write an identical document again (e.g. after determining
+ * the length).
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+info_json_stream (ClientInfo *cinfo, const char *software, InfoElements elements,
+                  RingStream *streams, uint32_t *streamcount, const char *matchexpr,
+                  InfoWriter *writer)
+{
+  RingStream *ringstream;
+  uint32_t count = 0;
+  uint32_t idx;
+  int groupend;
+  int rv = 0;
+
+  uint64_t earliestid;
+  uint64_t latestid;
+  char format;
+
+  char staid[MAXSTREAMID]    = {0};
+  char streamid[MAXSTREAMID] = {0};
+  char string96[96]          = {0};
+  char starttime[32]         = {0};
+  char endtime[32]           = {0};
+
+  pcre2_code *match_code       = NULL;
+  pcre2_match_data *match_data = NULL;
+
+  if (!cinfo || !writer || !streamcount || (*streamcount > 0 && !streams))
+    return -1;
+
+  if (elements & ~(INFO_ID | INFO_STATIONS | INFO_STATION_STREAMS | INFO_STREAMS))
+  {
+    lprintf (0, "[%s] %s(): Unsupported INFO elements", cinfo->hostname, __func__);
+    return -1;
+  }
+
+  /* Compile match expression if provided */
+  if (matchexpr && UpdatePattern (&match_code, &match_data, matchexpr, "stream match expression"))
+  {
+    return -1;
+  }
+
+  /* Remove streams that do not match provided expression */
+  for (idx = 0; idx < *streamcount; idx++)
+  {
+    if (match_code &&
+        pcre2_match (match_code, (PCRE2_SPTR8)streams[idx].streamid, PCRE2_ZERO_TERMINATED, 0, 0, match_data, NULL) < 0)
+      continue;
+
+    if (count != idx)
+      memcpy (&streams[count], &streams[idx], sizeof (RingStream));
+
+    count++;
+  }
+
+  *streamcount = count;
+
+  if (match_code)
+    pcre2_code_free (match_code);
+  if (match_data)
+    pcre2_match_data_free (match_data);
+
+  /* Root object and items that are in all documents */
+  rv = (info_write (writer, "{\"software\":", 12) ||
+        info_write_jsonstr (writer, software) ||
+        info_write (writer, ",\"organization\":", 16) ||
+        info_write_jsonstr (writer, config.serverid));
+
+  if (!rv && elements & INFO_ID)
+  {
+    ms_nstime2timestr (param.serverstarttime, starttime, ISOMONTHDAY_Z, NONE);
+    rv = info_writef (writer, ",\"server_start\":\"%s\"", starttime);
+  }
+
+  /* Station array, optionally with stream sub-arrays */
+  if (!rv && elements & (INFO_STATIONS | INFO_STATION_STREAMS))
+  {
+    rv = info_write (writer, ",\"station\":[", 12);
+
+    for (idx = 0; idx < count && !rv; idx = groupend)
+    {
+      if ((groupend = info_station_group (streams, count, idx, staid, &earliestid, &latestid)) < 0)
+      {
+        rv = -1;
+        break;
+      }
+
+      snprintf (string96, sizeof (string96), "Station ID %s", staid);
+
+      rv = (info_write (writer, (idx == 0) ? "{\"id\":" : ",{\"id\":", (idx == 0) ? 6 : 7) ||
+            info_write_jsonstr (writer, staid) ||
+            info_write (writer, ",\"description\":", 15) ||
+            info_write_jsonstr (writer, string96) ||
+            info_writef (writer, ",\"start_seq\":%" PRIu64 ",\"end_seq\":%" PRIu64,
+                         earliestid, latestid));
+
+      if (!rv && elements & INFO_STATION_STREAMS)
+      {
+        rv = info_write (writer, ",\"stream\":[", 11);
+
+        for (ringstream = &streams[idx]; ringstream < &streams[groupend] && !rv; ringstream++)
+        {
+          info_stream_ids (ringstream->streamid, staid, streamid, &format);
+
+          ms_nstime2timestr (ringstream->earliestdstime, starttime, ISOMONTHDAY_Z, MICRO);
+          ms_nstime2timestr (ringstream->latestdetime, endtime, ISOMONTHDAY_Z, MICRO);
+
+          rv = (info_write (writer, (ringstream == &streams[idx]) ? "{\"id\":" : ",{\"id\":",
+                            (ringstream == &streams[idx]) ? 6 : 7) ||
+                info_write_jsonstr (writer, streamid) ||
+                info_writef (writer, ",\"format\":\"%c\",\"subformat\":\"D\","
+                             "\"start_time\":\"%s\",\"end_time\":\"%s\"}",
+                             format, starttime, endtime));
+        }
+
+        if (!rv)
+          rv = info_write (writer, "]", 1);
+      }
+
+      if (!rv)
+        rv = info_write (writer, "}", 1);
+    }
+
+    if (!rv)
+      rv = info_write (writer, "]", 1);
+  }
+
+  /* Stream array */
+  if (!rv && elements & INFO_STREAMS)
+  {
+    rv = info_writef (writer, ",\"stream_count\":%" PRIu32 ",\"stream\":[",
+                      cinfo->ringparams->streamcount);
+
+    for (idx = 0; idx < count && !rv; idx++)
+    {
+      ringstream = &streams[idx];
+
+      rv = (info_write (writer, (idx == 0) ? "{\"id\":" : ",{\"id\":", (idx == 0) ? 6 : 7) ||
+            info_write_jsonstr (writer, ringstream->streamid));
+
+      ms_nstime2timestr (ringstream->earliestdstime, starttime, ISOMONTHDAY_Z, MICRO);
+      ms_nstime2timestr (ringstream->latestdetime, endtime, ISOMONTHDAY_Z, MICRO);
+
+      if (!rv)
+        rv = info_writef (writer, ",\"start_time\":\"%s\",\"end_time\":\"%s\",\"earliest_packet_id\":%" PRIu64,
+                          starttime, endtime, ringstream->earliestid);
+
+      ms_nstime2timestr (ringstream->earliestptime, starttime, ISOMONTHDAY_Z, MICRO);
+      ms_nstime2timestr (ringstream->latestptime, endtime, ISOMONTHDAY_Z, MICRO);
+
+      /* Data latency: the difference between the current time and time of last sample in
+       * whole seconds, written as the integral real value it is */
+      if (!rv)
+        rv = info_writef (writer, ",\"earliest_packet_time\":\"%s\",\"latest_packet_time\":\"%s\","
+                          "\"latest_packet_id\":%" PRIu64 ",\"data_latency\":%" PRId64 ".0}",
+                          starttime, endtime, ringstream->latestid,
+                          (int64_t)MS_NSTIME2EPOCH ((NSnow () - ringstream->latestdetime)));
+    }
+
+    if (!rv)
+      rv = info_write (writer, "]", 1);
+  }
+
+  if (!rv)
+    rv = info_write (writer, "}", 1);
+
+  if (!rv)
+    rv = info_write_finish (writer);
+
+  return (rv) ? -1 : 0;
+} /* End of info_json_stream() */
+
+/***************************************************************************
+ * info_station_group:
+ *
+ * Determine the group of entries in a sorted stream array, beginning
+ * at index 'first', that share a station ID.  The station ID is
+ * returned in 'staid', which must be MAXSTREAMID bytes, along with the
+ * earliest and latest packet IDs of the group.
+ *
+ * Returns the index following the group on success and -1 on error.
+ ***************************************************************************/
+int
+info_station_group (const RingStream *streams, uint32_t streamcount, uint32_t first,
+                    char *staid, uint64_t *earliestid, uint64_t *latestid)
+{
+  char nextstaid[MAXSTREAMID];
+  char streamid[MAXSTREAMID];
+  uint32_t idx;
+
+  if (!streams || first >= streamcount || !staid || !earliestid || !latestid)
+    return -1;
+
+  if (info_stream_ids (streams[first].streamid, staid, streamid, NULL))
+    return -1;
+
+  *earliestid = streams[first].earliestid;
+  *latestid   = streams[first].latestid;
+
+  for (idx = first + 1; idx < streamcount; idx++)
+  {
+    if (info_stream_ids (streams[idx].streamid, nextstaid, streamid, NULL))
+      return -1;
+
+    if (strcmp (nextstaid, staid) != 0)
+      break;
+
+    if (*earliestid > streams[idx].earliestid)
+      *earliestid = streams[idx].earliestid;
+    if (*latestid < streams[idx].latestid)
+      *latestid = streams[idx].latestid;
+  }
+
+  return (int)idx;
+} /* End of info_station_group() */
+
+/***************************************************************************
+ * info_stream_ids:
+ *
+ * Determine the station and stream IDs of a ring stream ID.  For FDSN
+ * Source IDs the station ID is the combination of network and station
+ * codes and the stream ID is the combination of location and channel
+ * codes, with SEED channels expanded.  Other stream IDs are used for
+ * both.  The 'staid' and 'streamid' buffers must be MAXSTREAMID bytes.
+ *
+ * If 'format' is not NULL it is set to the miniSEED format version
+ * of the stream, '2' or '3', or '?' if not miniSEED.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+info_stream_ids (const char *ringstreamid, char *staid, char *streamid, char *format)
+{
+  char id[MAXSTREAMID];
+  char net[MAXSTREAMID]  = {0};
+  char sta[MAXSTREAMID]  = {0};
+  char loc[MAXSTREAMID]  = {0};
+  char chan[MAXSTREAMID] = {0};
+  char *type;
+
+  strncpy (id, ringstreamid, sizeof (id) - 1);
+  id[sizeof (id) - 1] = '\0';
+
+  /* Truncate stream ID at type suffix */
+  if ((type = strchr (id, '/')))
+    *type++ = '\0';
+
+  /* Extract codes from FDSN Source ID (streamid) */
+  if (strncmp (id, "FDSN:", 5) == 0)
+  {
+    if (ms_sid2nslc (id, net, sta, loc, chan))
+    {
+      lprintf (0, "Error splitting stream ID: %s", id);
+      return -1;
+    }
+
+    /* Create station ID as combination of network and station codes */
+    snprintf (staid, MAXSTREAMID, "%s_%s", net, sta);
+
+    /* Create stream ID as combination of location and channel codes,
+     * expanding SEED channel if needed */
+    if (strlen (chan) == 3)
+      snprintf (streamid, MAXSTREAMID, "%s_%c_%c_%c", loc, chan[0], chan[1], chan[2]);
+    else
+      snprintf (streamid, MAXSTREAMID, "%s_%s", loc, chan);
+  }
+  /* Otherwise use the stream ID as the station and stream IDs */
+  else
+  {
+    memcpy (staid, id, MAXSTREAMID);
+    memcpy (streamid, id, MAXSTREAMID);
+  }
+
+  if (format)
+  {
+    if (type && strstr (type, "MSEED3"))
+      *format = '3';
+    else if (type && strstr (type, "MSEED"))
+      *format = '2';
+    else
+      *format = '?';
+  }
+
+  return 0;
+} /* End of info_stream_ids() */
+
+/***************************************************************************
+ * info_write:
+ *
+ * Append 'length' bytes from 'data' to the output of an InfoWriter,
+ * calling the writer's flush() whenever the buffer is full.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+info_write (InfoWriter *writer, const char *data, size_t length)
+{
+  size_t count;
+  int consumed;
+
+  while (length > 0)
+  {
+    /* Flush full buffer, which must consume output or enlarge the buffer */
+    if (writer->length >= writer->size)
+    {
+      if ((consumed = writer->flush (writer, 0)) < 0)
+        return -1;
+
+      if (consumed > 0)
+      {
+        writer->length -= consumed;
+        memmove (writer->buffer, writer->buffer + consumed, writer->length);
+      }
+      else if (writer->length >= writer->size)
+      {
+        lprintf (0, "%s(): INFO writer buffer not flushed", __func__);
+        return -1;
+      }
+    }
+
+    count = writer->size - writer->length;
+    if (count > length)
+      count = length;
+
+    memcpy (writer->buffer + writer->length, data, count);
+    writer->length += count;
+    writer->total += count;
+    data += count;
+    length -= count;
+  }
+
+  return 0;
+} /* End of info_write() */
+
+/***************************************************************************
+ * info_writef:
+ *
+ * Append printf-style formatted output of up to 511 bytes to the
+ * output of an InfoWriter.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+info_writef (InfoWriter *writer, const char *format, ...)
+{
+  char string[512];
+  va_list argptr;
+  int length;
+
+  va_start (argptr, format);
+  length = vsnprintf (string, sizeof (string), format, argptr);
+  va_end (argptr);
+
+  if (length < 0 || length >= (int)sizeof (string))
+  {
+    lprintf (0, "%s(): INFO output too long", __func__);
+    return -1;
+  }
+
+  return info_write (writer, string, length);
+} /* End of info_writef() */
+
+/***************************************************************************
+ * info_write_jsonstr:
+ *
+ * Append a string to the output of an InfoWriter as a quoted JSON
+ * string, escaped the same as yyjson.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+info_write_jsonstr (InfoWriter *writer, const char *string)
+{
+  const char *run;
+  char escape[12];
+  int length;
+
+  if (info_write (writer, "\"", 1))
+    return -1;
+
+  for (run = string; *string; string++)
+  {
+    if (*string != '"' && *string != '\\' && (unsigned char)*string >= 0x20)
+      continue;
+
+    if (string > run && info_write (writer, run, string - run))
+      return -1;
+
+    switch (*string)
+    {
+    case '"':  length = snprintf (escape, sizeof (escape), "\\\""); break;
+    case '\\': length = snprintf (escape, sizeof (escape), "\\\\"); break;
+    case '\b': length = snprintf (escape, sizeof (escape), "\\b"); break;
+    case '\f': length = snprintf (escape, sizeof (escape), "\\f"); break;
+    case '\n': length = snprintf (escape, sizeof (escape), "\\n"); break;
+    case '\r': length = snprintf (escape, sizeof (escape), "\\r"); break;
+    case '\t': length = snprintf (escape, sizeof (escape), "\\t"); break;
+    default:   length = snprintf (escape, sizeof (escape), "\\u%04X", (unsigned char)*string);
+    }
+
+    if (info_write (writer, escape, length))
+      return -1;
+
+    run = string + 1;
+  }
+
+  if (string > run && info_write (writer, run, string - run))
+    return -1;
+
+  return info_write (writer, "\"", 1);
+} /* End of info_write_jsonstr() */
+
+/***************************************************************************
+ * info_write_finish:
+ *
+ * Complete the output of an InfoWriter with a final call to flush().
+ * Any output not consumed remains in the writer buffer.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+info_write_finish (InfoWriter *writer)
+{
+  int consumed;
+
+  if ((consumed = writer->flush (writer, 1)) < 0)
+    return -1;
+
+  if (consumed > 0)
+  {
+    writer->length -= consumed;
+    memmove (writer->buffer, writer->buffer + consumed, writer->length);
+  }
+
+  return 0;
+} /* End of info_write_finish() */
+
+/***************************************************************************
+ * info_write_grow:
+ *
+ * An InfoWriter flush() that enlarges the allocated buffer, doubling it
+ * each time it is full, to collect the complete output in memory.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+info_write_grow (InfoWriter *writer, int final)
+{
+  char *buffer;
+  size_t size;
+
+  if (final)
+    return 0;
+
+  size = (writer->size) ? writer->size * 2 : 65536;
+
+  if ((buffer = (char *)realloc (writer->buffer, size)) == NULL)
+  {
+    lprintf (0, "%s(): Error allocating memory", __func__);
+    return -1;
+  }
+
+  writer->buffer = buffer;
+  writer->size   = size;
+
+  return 0;
+} /* End of info_write_grow() */
+
 /***************************************************************************
  * error_json:
  *
@@ -46,8 +46,37 @@ typedef enum
   INFO_STATUS          = 1u << 9,
 } InfoElements;
 
+/* Writer for INFO documents generated incrementally, output is
+ * accumulated in 'buffer' and passed to flush() when the buffer is
+ * full and when the document is complete ('final' is true).  flush()
+ * returns the count of leading bytes consumed, or -1 on error, and may
+ * instead enlarge the buffer to continue accumulating.  Output not
+ * consumed by the final flush() remains in the buffer. */
+typedef struct InfoWriter
+{
+  char       *buffer;       /* Output buffer */
+  size_t      size;         /* Size of output buffer */
+  size_t      length;       /* Length of pending output in buffer */
+  uint64_t    total;        /* Total length of output written */
+  int       (*flush) (struct InfoWriter *writer, int final);
+  void       *handle;       /* Context for flush() */
+} InfoWriter;
+
 extern char *info_json (ClientInfo *cinfo, const char *software,
                         InfoElements elements, const char *matchexpr);
+extern int info_json_stream (ClientInfo *cinfo, const char *software,
+                             InfoElements elements, RingStream *streams,
+                             uint32_t *streamcount, const char *matchexpr,
+                             InfoWriter *writer);
+extern int info_station_group (const RingStream *streams, uint32_t streamcount,
+                               uint32_t first, char *staid,
+                               uint64_t *earliestid, uint64_t *latestid);
+extern int info_stream_ids (const char *ringstreamid, char *staid,
+                            char *streamid, char *format);
+extern int info_write (InfoWriter *writer, const char *data, size_t length);
+extern int info_writef (InfoWriter *writer, const char *format, ...);
+extern int info_write_finish (InfoWriter *writer);
+extern int info_write_grow (InfoWriter *writer, int final);
 extern char *error_json (ClientInfo *cinfo, const char *software,
                          const char *code, const char *message);
 
@@ -21,6 +21,7 @@
  * @author Chad Trabant, EarthScope Data Services
  **************************************************************************/
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,6 +37,8 @@
 
 #define DASHNULL(x) ((x) ? (x) : "-")
 
+static int info_write_xmlstr (InfoWriter *writer, const char *string);
+
 /***************************************************************************
  * Return an SeedLink v3 INFO ID document in XML format.
  *
@@ -186,155 +189,157 @@ info_xml_slv3_capabilities (ClientInfo *cinfo, const char *software)
 }
 
 /***************************************************************************
- * Return an SeedLink v3 INFO STATIONS or INFO STREAMS document in XML format.
+ * Write a SeedLink v3 INFO STATIONS or STREAMS document in XML format
+ * incrementally to an InfoWriter.
  *
- * The returned document is allocated on the heap and should be freed by
- * the caller.
+ * The document is written directly from 'streams', a snapshot of the
+ * stream index sorted on stream ID as returned by GetStreamsArray(),
+ * without building a document tree so the memory needed is bounded by
+ * the writer buffer.  The output is the same as mxml would produce.
  *
- * Returns pointer to the document on success and NULL on error.
+ * Returns 0 on success and -1 on error.
  ***************************************************************************/
-char *
-info_xml_slv3_stations (ClientInfo *cinfo, const char *software, int include_streams)
+int
+info_xml_slv3_stations (ClientInfo *cinfo, const char *software, int include_streams,
+                        const RingStream *streams, uint32_t streamcount,
+                        InfoWriter *writer)
 {
-  mxml_node_t *xmldoc   = NULL;
-  mxml_node_t *seedlink = NULL;
-  mxml_node_t *station  = NULL;
-  mxml_node_t *stream   = NULL;
-
-  yyjson_doc *json;
-  yyjson_val *root;
-  yyjson_val *station_array;
-  yyjson_val *stream_array;
-  yyjson_val *station_iter = NULL;
-  yyjson_val *stream_iter  = NULL;
-  size_t idx, max;
-  size_t idxsub, maxsub;
+  const RingStream *ringstream;
+  uint32_t idx;
+  int groupend;
+  int rv = 0;
+
+  uint64_t earliestid;
+  uint64_t latestid;
+
+  char staid[MAXSTREAMID]    = {0};
+  char streamid[MAXSTREAMID] = {0};
+  char string96[96]          = {0};
+  char starttime[32]         = {0};
+  char endtime[32]           = {0};
+  char *ptr;
 
-  char *json_string;
-  char *xml_string = NULL;
+  if (!cinfo || !writer || (streamcount > 0 && !streams))
+    return -1;
 
-  char idstr[32] = {0};
-  char *ptr;
+  ms_nstime2timestr (param.serverstarttime, starttime, ISOMONTHDAY_Z, NONE);
 
-  InfoElements elements = (include_streams) ? INFO_STATION_STREAMS : INFO_STATIONS;
-  elements |= INFO_ID;
+  rv = (info_writef (writer, "<?xml version=\"1.0\" encoding=\"utf-8\"?><seedlink software=\"") ||
+        info_write_xmlstr (writer, software) ||
+        info_write (writer, "\" organization=\"", 16) ||
+        info_write_xmlstr (writer, config.serverid) ||
+        info_writef (writer, "\" started=\"%s\"%s", starttime, (streamcount > 0) ? ">" : "/>"));
 
-  /* Generate JSON formatted document for INFO STREAMS or STATIONS level */
-  if ((json_string = info_json (cinfo, software, elements, NULL)) == NULL)
+  /* Add stations */
+  for (idx = 0; idx < streamcount && !rv; idx = groupend)
   {
-    return NULL;
-  }
+    if ((groupend = info_station_group (streams, streamcount, idx, staid, &earliestid, &latestid)) < 0)
+    {
+      rv = -1;
+      break;
+    }
 
-  if ((json = yyjson_read (json_string, strlen (json_string), 0)) == NULL)
-  {
-    free (json_string);
-    return NULL;
-  }
-  free (json_string);
-  root = yyjson_doc_get_root (json);
+    snprintf (string96, sizeof (string96), "Station ID %s", staid);
 
-  if (!(xmldoc = mxmlNewXML ("1.0")))
-  {
-    yyjson_doc_free (json);
-    return NULL;
-  }
+    /* Split network code from station if separated by '_' */
+    if ((ptr = strchr (staid, '_')))
+      *ptr++ = '\0';
+    /* Otherwise use the full ID for both */
+    else
+      ptr = staid;
 
-  if (!(seedlink = mxmlNewElement (xmldoc, "seedlink")))
-  {
-    yyjson_doc_free (json);
-    mxmlRelease (xmldoc);
-    return NULL;
-  }
+    rv = (info_write (writer, "<station name=\"", 15) ||
+          info_write_xmlstr (writer, ptr) ||
+          info_write (writer, "\" network=\"", 11) ||
+          info_write_xmlstr (writer, staid) ||
+          info_write (writer, "\" description=\"", 15) ||
+          info_write_xmlstr (writer, string96) ||
+          info_writef (writer, "\" begin_seq=\"%" PRIu64 "\" end_seq=\"%" PRIu64 "\" stream_check=\"enabled\"%s",
+                       earliestid, latestid, (include_streams) ? ">" : "/>"));
 
-  /* Translate JSON to XML */
-  mxmlElementSetAttr (seedlink, "software",
-                      yyjson_get_str (yyjson_obj_get (root, "software")));
-  mxmlElementSetAttr (seedlink, "organization",
-                      yyjson_get_str (yyjson_obj_get (root, "organization")));
-  mxmlElementSetAttr (seedlink, "started",
-                      yyjson_get_str (yyjson_obj_get (root, "server_start")));
+    if (!include_streams)
+      continue;
 
-  /* Add stations */
-  if ((station_array = yyjson_obj_get (root, "station")) != NULL)
-  {
-    yyjson_arr_foreach (station_array, idx, max, station_iter)
+    for (ringstream = &streams[idx]; ringstream < &streams[groupend] && !rv; ringstream++)
     {
-      if (!(station = mxmlNewElement (seedlink, "station")))
-      {
-        break;
-      }
-
-      strncpy (idstr, DASHNULL (yyjson_get_str (yyjson_obj_get (station_iter, "id"))),
-               sizeof (idstr) - 1);
+      info_stream_ids (ringstream->streamid, staid, streamid, NULL);
 
-      /* Split network code from station if separated by '_' */
-      if ((ptr = strchr (idstr, '_')))
+      /* Split location code from station code if separated by '_' */
+      if ((ptr = strchr (streamid, '_')))
         *ptr++ = '\0';
       /* Otherwise use the full ID for both */
       else
-        ptr = idstr;
-
-      mxmlElementSetAttr (station, "name", ptr);
-      mxmlElementSetAttr (station, "network", idstr);
-      mxmlElementSetAttr (station, "description",
-                          yyjson_get_str (yyjson_obj_get (station_iter, "description")));
-      mxmlElementSetAttrf (station, "begin_seq", "%" PRIu64,
-                           yyjson_get_uint (yyjson_obj_get (station_iter, "start_seq")));
-      mxmlElementSetAttrf (station, "end_seq", "%" PRIu64,
-                           yyjson_get_uint (yyjson_obj_get (station_iter, "end_seq")));
-      mxmlElementSetAttr (station, "stream_check", "enabled");
+        ptr = streamid;
 
-      if ((stream_array = yyjson_obj_get (station_iter, "stream")) != NULL)
+      /* If "seedname" is an FDSN Source ID channel ('B_S_s'), collapse to a SEED channel */
+      if (strlen (ptr) == 5 && ptr[1] == '_' && ptr[3] == '_')
       {
-        yyjson_arr_foreach (stream_array, idxsub, maxsub, stream_iter)
-        {
-          if (!(stream = mxmlNewElement (station, "stream")))
-          {
-            break;
-          }
-
-          strncpy (idstr, yyjson_get_str (yyjson_obj_get (stream_iter, "id")),
-                   sizeof (idstr) - 1);
-
-          /* Split location code from station code if separated by '_' */
-          if ((ptr = strchr (idstr, '_')))
-            *ptr++ = '\0';
-          /* Otherwise use the full ID for both */
-          else
-            ptr = idstr;
-
-          /* If "seedname" is an FDSN Source ID channel ('B_S_s'), collapse to a SEED channel */
-          if (strlen (ptr) == 5 && ptr[1] == '_' && ptr[3] == '_')
-          {
-            ptr[1] = ptr[2];
-            ptr[2] = ptr[4];
-            ptr[3] = '\0';
-          }
-
-          mxmlElementSetAttr (stream, "location", idstr);
-          mxmlElementSetAttr (stream, "seedname", ptr);
-          mxmlElementSetAttr (stream, "type",
-                              yyjson_get_str (yyjson_obj_get (stream_iter, "subformat")));
-          mxmlElementSetAttr (stream, "begin_time",
-                              yyjson_get_str (yyjson_obj_get (stream_iter, "start_time")));
-          mxmlElementSetAttr (stream, "end_time",
-                              yyjson_get_str (yyjson_obj_get (stream_iter, "end_time")));
-        }
+        ptr[1] = ptr[2];
+        ptr[2] = ptr[4];
+        ptr[3] = '\0';
       }
+
+      ms_nstime2timestr (ringstream->earliestdstime, starttime, ISOMONTHDAY_Z, MICRO);
+      ms_nstime2timestr (ringstream->latestdetime, endtime, ISOMONTHDAY_Z, MICRO);
+
+      rv = (info_write (writer, "<stream location=\"", 18) ||
+            info_write_xmlstr (writer, streamid) ||
+            info_write (writer, "\" seedname=\"", 12) ||
+            info_write_xmlstr (writer, ptr) ||
+            info_writef (writer, "\" type=\"D\" begin_time=\"%s\" end_time=\"%s\"/>",
+                         starttime, endtime));
     }
+
+    if (!rv)
+      rv = info_write (writer, "</station>", 10);
   }
 
-  /* Generate XML string */
-  mxml_options_t *options = mxmlOptionsNew ();
-  mxmlOptionsSetWrapMargin (options, 0);
-  xml_string = mxmlSaveAllocString (xmldoc, options);
-  mxmlOptionsDelete (options);
+  if (!rv && streamcount > 0)
+    rv = info_write (writer, "</seedlink>", 11);
 
-  yyjson_doc_free (json);
-  mxmlRelease (xmldoc);
+  if (!rv)
+    rv = info_write_finish (writer);
 
-  return xml_string;
-}
+  return (rv) ? -1 : 0;
+} /* End of info_xml_slv3_stations() */
+
+/***************************************************************************
+ * info_write_xmlstr:
+ *
+ * Append a string to the output of an InfoWriter with the XML special
+ * characters replaced by entities, the same as mxml.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+info_write_xmlstr (InfoWriter *writer, const char *string)
+{
+  const char *run;
+  const char *entity;
+
+  for (run = string; *string; string++)
+  {
+    switch (*string)
+    {
+    case '&': entity = "&amp;"; break;
+    case '<': entity = "&lt;"; break;
+    case '>': entity = "&gt;"; break;
+    case '"': entity = "&quot;"; break;
+    default: continue;
+    }
+
+    if ((string > run && info_write (writer, run, string - run)) ||
+        info_write (writer, entity, strlen (entity)))
+      return -1;
+
+    run = string + 1;
+  }
+
+  if (string > run && info_write (writer, run, string - run))
+    return -1;
+
+  return 0;
+} /* End of info_write_xmlstr() */
 
 /***************************************************************************
  * Return an SeedLink v3 INFO CONNECTIONS document in XML format.
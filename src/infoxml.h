@@ -28,14 +28,16 @@ extern "C"
 #endif
 
 #include "clients.h"
+#include "infojson.h"
 #include "logging.h"
 #include "ring.h"
 #include "ringserver.h"
 
 extern char *info_xml_slv3_id (ClientInfo *cinfo, const char *software);
 extern char *info_xml_slv3_capabilities (ClientInfo *cinfo, const char *software);
-extern char *info_xml_slv3_stations (ClientInfo *cinfo, const char *software,
-                                     int include_streams);
+extern int info_xml_slv3_stations (ClientInfo *cinfo, const char *software,
+                                   int include_streams, const RingStream *streams,
+                                   uint32_t streamcount, InfoWriter *writer);
 extern char *info_xml_slv3_connections (ClientInfo *cinfo, const char *software);
 extern char *info_xml_dlv1 (ClientInfo *cinfo, const char *software, const char *level,
                             const char *matchexpr, uint8_t trusted);
@@ -42,6 +42,8 @@
 #define NEXTOFFSET(O, M, S) (((O) + (S) > (M)) ? 0 : (O) + (S))
 #define PREVOFFSET(O, M, S) (((O) == 0) ? (M) : (O) - (S))
 
+#define LOADBATCHv1 256 /* Packets read and written per batch */
+
 #define RING_SIGNATUREv1 "RING"
 #define RING_VERSIONv1   1
 #define MAXSTREAMIDv1    60
@@ -105,7 +107,8 @@ typedef struct RingPacketV1_s
  * LoadBufferV1:
  *
  * Open a ringserver version 1 packet buffer file and insert all data
- * packets into the current ring buffer.
+ * packets into the current ring buffer, in batches of consecutive
+ * packets.
  *
  * Return >=0 on success, number of packets loaded
  * Return  -1 on errors
@@ -115,11 +118,17 @@ LoadBufferV1 (char *ringfile_v1, RingParams *ringparams)
 {
   RingParamsV1 ringparams_v1;
   RingPacketV1 *packet_v1;
-  RingPacket packet;
+  RingPacket *packet;
+  RingPacket packets[LOADBATCHv1];
+  char *packetdata[LOADBATCHv1];
   char *packetbuffer   = NULL;
   int64_t offset       = -1;
+  int64_t lastoffset;
   uint8_t verbose_save = verbose;
   int64_t count        = 0;
+  ssize_t readsize;
+  int batchcnt;
+  int idx;
   int ringfd_v1;
 
   pcre2_code *pcre_code       = NULL;
@@ -177,8 +186,8 @@ LoadBufferV1 (char *ringfile_v1, RingParams *ringparams)
     return -1;
   }
 
-  /* Allocate memory for packet data */
-  if (!(packetbuffer = (char *)malloc (ringparams->pktsize)))
+  /* Allocate memory for a batch of packets */
+  if (!(packetbuffer = (char *)malloc ((size_t)LOADBATCHv1 * ringparams_v1.pktsize)))
   {
     lprintf (0, "%s(): error allocating memory for packet data", __func__);
     close (ringfd_v1);
@@ -200,74 +209,100 @@ LoadBufferV1 (char *ringfile_v1, RingParams *ringparams)
   /* Disable verbose logging during load */
   verbose = 0;
 
-  /* Traverse packet buffer from earliest to latest */
+  /* Traverse packet buffer from earliest to latest, in batches of consecutive packets */
   offset = ringparams_v1.earliestoffset;
   while (offset >= 0 && offset <= ringparams_v1.maxoffset)
   {
-    /* Read packet from offset */
-    if (pread (ringfd_v1, packetbuffer, ringparams_v1.pktsize, ringparams_v1.headersize + offset) != ringparams_v1.pktsize)
+    /* Batch ends at the latest packet or the end of the ring */
+    lastoffset = (ringparams_v1.latestoffset >= offset) ? ringparams_v1.latestoffset : ringparams_v1.maxoffset;
+    batchcnt   = (int)((lastoffset - offset) / ringparams_v1.pktsize) + 1;
+
+    if (batchcnt > LOADBATCHv1)
+      batchcnt = LOADBATCHv1;
+
+    lastoffset = offset + (int64_t)(batchcnt - 1) * ringparams_v1.pktsize;
+    readsize   = (ssize_t)batchcnt * ringparams_v1.pktsize;
+
+    /* Read packets from offset */
+    if (pread (ringfd_v1, packetbuffer, readsize, ringparams_v1.headersize + offset) != readsize)
     {
-      lprintf (0, "%s(): error reading packet from version 1 ring file %s: %s",
+      lprintf (0, "%s(): error reading packets from version 1 ring file %s: %s",
                __func__, ringfile_v1, strerror (errno));
       break;
     }
 
-    packet_v1 = (RingPacketV1 *)packetbuffer;
-
-    /* Convert packet to current version */
-    packet.pktid     = packet_v1->pktid;
-    packet.datastart = MS_HPTIME2NSTIME (packet_v1->datastart);
-    packet.dataend   = MS_HPTIME2NSTIME (packet_v1->dataend);
-    packet.datasize  = packet_v1->datasize;
-
-    /* Translate legacy stream ID: NN_SSSSS_LL_CCC/MSEED
-     * to an FDSN Source ID: FDSN:NN_SSSSS_LL_C_C_C/MSEED */
-    if (pcre_code != NULL &&
-        pcre2_match (pcre_code, (PCRE2_SPTR8)packet_v1->streamid,
-                     PCRE2_ZERO_TERMINATED, 0, 0,
-                     pcre_data, NULL) > 0)
+    for (idx = 0; idx < batchcnt; idx++)
     {
-      char *prechannel = strrchr (packet_v1->streamid, '_');
-
-      snprintf (packet.streamid, sizeof (packet.streamid),
-                "FDSN:%.*s_%c_%c_%c%s",
-                (int)(prechannel - packet_v1->streamid), packet_v1->streamid,
-                prechannel[1], prechannel[2], prechannel[3],
-                &prechannel[4]);
+      packet_v1 = (RingPacketV1 *)(packetbuffer + (size_t)idx * ringparams_v1.pktsize);
+      packet    = &packets[idx];
+
+      if (packet_v1->datasize > ringparams_v1.pktsize - sizeof (RingPacketV1))
+      {
+        lprintf (0, "%s(): invalid packet data size %u in version 1 ring file %s",
+                 __func__, packet_v1->datasize, ringfile_v1);
+        break;
+      }
+
+      /* Convert packet to current version */
+      packet->pktid     = packet_v1->pktid;
+      packet->datastart = MS_HPTIME2NSTIME (packet_v1->datastart);
+      packet->dataend   = MS_HPTIME2NSTIME (packet_v1->dataend);
+      packet->datasize  = packet_v1->datasize;
+
+      /* Translate legacy stream ID: NN_SSSSS_LL_CCC/MSEED
+       * to an FDSN Source ID: FDSN:NN_SSSSS_LL_C_C_C/MSEED */
+      if (pcre_code != NULL &&
+          pcre2_match (pcre_code, (PCRE2_SPTR8)packet_v1->streamid,
+                       PCRE2_ZERO_TERMINATED, 0, 0,
+                       pcre_data, NULL) > 0)
+      {
+        char *prechannel = strrchr (packet_v1->streamid, '_');
+
+        snprintf (packet->streamid, sizeof (packet->streamid),
+                  "FDSN:%.*s_%c_%c_%c%s",
+                  (int)(prechannel - packet_v1->streamid), packet_v1->streamid,
+                  prechannel[1], prechannel[2], prechannel[3],
+                  &prechannel[4]);
+
+        if (verbose_save >= 3)
+          lprintf (3, "Translating legacy stream ID: %s -> %s",
+                   packet_v1->streamid, packet->streamid);
+      }
+      /* Otherwise copy stream ID verbatim */
+      else
+      {
+        /* Copy the stream ID verbatim */
+        memcpy (packet->streamid, packet_v1->streamid, sizeof (packet->streamid));
+
+        /* Make sure the streamid is terminated */
+        packet->streamid[sizeof (packet->streamid) - 1] = '\0';
+      }
+
+      packetdata[idx] = (char *)packet_v1 + sizeof (RingPacketV1);
 
       if (verbose_save >= 3)
-        lprintf (3, "Translating legacy stream ID: %s -> %s",
-                 packet_v1->streamid, packet.streamid);
+        lprintf (0, "Loading packet ID %" PRId64 " from stream %s at offset %" PRId64,
+                 packet->pktid, packet->streamid, offset + (int64_t)idx * ringparams_v1.pktsize);
     }
-    /* Otherwise copy stream ID verbatim */
-    else
-    {
-      /* Copy the stream ID verbatim */
-      memcpy (packet.streamid, packet_v1->streamid, sizeof (packet.streamid));
 
-      /* Make sure the streamid is terminated */
-      packet.streamid[sizeof (packet.streamid) - 1] = '\0';
-    }
-
-    if (verbose_save >= 3)
-      lprintf (0, "Loading packet ID %" PRId64 " from stream %s at offset %" PRId64,
-               packet.pktid, packet.streamid, offset);
+    if (idx < batchcnt)
+      break;
 
-    /* Add packet to the current ring buffer */
-    if (RingWrite (ringparams, &packet, packetbuffer + sizeof (RingPacketV1), packet.datasize))
+    /* Add packets to the current ring buffer */
+    if (RingWriteBatch (ringparams, packets, packetdata, (uint32_t)batchcnt))
     {
-      lprintf (0, "%s(): error adding packet to current ring buffer", __func__);
+      lprintf (0, "%s(): error adding packets to current ring buffer", __func__);
       break;
     }
 
-    count++;
+    count += batchcnt;
 
-    if (offset == ringparams_v1.latestoffset)
+    if (lastoffset == ringparams_v1.latestoffset)
     {
       break;
     }
 
-    offset = NEXTOFFSET (offset, ringparams_v1.maxoffset, ringparams_v1.pktsize);
+    offset = NEXTOFFSET (lastoffset, ringparams_v1.maxoffset, ringparams_v1.pktsize);
   }
 
   verbose = verbose_save;
@@ -26,6 +26,18 @@
  * A balanced binary-tree is used to keep track of the files processed
  * and allows for operation with 100,000s of files.
  *
+ * Optionally (Linux only) the directories are watched for changes
+ * using inotify(7), only files reported as modified are checked and
+ * full scans are performed at a low frequency to catch anything
+ * missed, such as modifications through symbolic links.  Watches are
+ * added for each directory scanned and, at startup, for the
+ * directories of files in the statefile.
+ *
+ * New data is read from files in large chunks that are split into
+ * records.  The records of a chunk are parsed, including CRC
+ * validation, as a batch that is optionally shared with parsing
+ * threads, then inserted into the ring in file order.
+ *
  * Broken symbolic links are quietly skipped.  If they are eventually
  * re-connected to something the something will be scanned as
  * expected.
@@ -60,6 +72,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -69,6 +82,12 @@
 #include <time.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#define MSSCAN_WATCH 1
+#endif
+
 #include <libmseed.h>
 
 #include "generic.h"
@@ -81,6 +100,13 @@
 
 #define MSSCAN_MINRECLEN 40
 #define MSSCAN_READLEN 128
+#define MSSCAN_READBUFFER 524288 /* Minimum file read buffer size */
+#define MSSCAN_BATCHMAX 1024     /* Maximum number of records in a batch */
+#define MSSCAN_PARSEMIN 64       /* Minimum records in a batch to use parsing threads */
+#define MSSCAN_PARSECHUNK 16     /* Records claimed at a time when parsing a batch */
+
+/* Events that trigger checking of files in watched directories */
+#define MSSCAN_WATCHMASK (IN_CREATE | IN_MODIFY | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
 
 /* The FileKey and FileNode structures form the key and data elements
  * of a balanced tree that is used to keep track of all files being
@@ -103,6 +129,42 @@ typedef struct filenode
   int idledelay;   /* Idle file scan iteration delay */
 } FileNode;
 
+/* Structure used as the data for the tree of watched directories,
+ * the key is the watch descriptor */
+typedef struct watchnode
+{
+  int level;       /* Recursion level of directory */
+  char dirname[1]; /* Directory name, sized appropriately */
+} WatchNode;
+
+/* Structure used for each record of a batch read from a file */
+typedef struct scanrecord
+{
+  uint32_t reclen;   /* Record length in bytes */
+  int parseerr;      /* Parsing result, MS_NOERROR on success */
+} ScanRecord;
+
+/* Structure used for a batch of records and the threads parsing them.
+ * The scan thread publishes a batch by incrementing the generation,
+ * parses records along with the parsing threads and waits for all of
+ * them to finish the batch. */
+typedef struct ScanBatch
+{
+  ScanRecord records[MSSCAN_BATCHMAX];
+  RingPacket packets[MSSCAN_BATCHMAX]; /* Ring packet headers for the records */
+  char *packetdata[MSSCAN_BATCHMAX];   /* Records in the file read buffer */
+  int reccount;             /* Number of records in the batch */
+  int nextrecord;           /* Next record to parse, claimed atomically */
+  pthread_mutex_t lock;
+  pthread_cond_t workcond;  /* Signalled when a batch is published */
+  pthread_cond_t donecond;  /* Signalled when a batch is finished */
+  pthread_t *threads;       /* Parsing threads */
+  int threadcount;          /* Number of parsing threads */
+  int generation;           /* Batch generation, incremented for each batch */
+  int active;               /* Parsing threads working on the batch */
+  int shutdown;             /* Flag to stop the parsing threads */
+} ScanBatch;
+
 typedef struct EDIR_s
 {
   struct edirent *ents;
@@ -118,15 +180,33 @@ struct edirent
 };
 
 static int ScanFiles (MSScanInfo *mssinfo, char *targetdir, int level, time_t scantime);
+static int CheckFile (MSScanInfo *mssinfo, FileKey *fkey, FileNode *fnode, const char *name,
+                      ino_t dirino, struct stat *st, time_t scantime);
 static FileNode *FindFile (RBTree *filetree, FileKey *fkey);
 static FileNode *AddFile (RBTree *filetree, ino_t inode, char *filename, time_t modtime);
 static off_t ProcessFile (MSScanInfo *mssinfo, char *filename, FileNode *fnode,
-                          off_t newsize, time_t newmodtime);
+                          off_t newsize, time_t newmodtime, int *reachedmax);
+#if defined(MSSCAN_WATCH)
+static int WatchInit (MSScanInfo *mssinfo);
+static void WatchClose (MSScanInfo *mssinfo);
+static void WatchDirectory (MSScanInfo *mssinfo, const char *dirname, int level);
+static void WatchStateDirectories (MSScanInfo *mssinfo);
+static int WatchFiles (MSScanInfo *mssinfo, time_t scantime, int timeoutms);
+static void WatchAddPending (MSScanInfo *mssinfo, char *path, int level);
+static int WatchPath (MSScanInfo *mssinfo, char *path, int level, time_t scantime);
+static int WatchKeyCompare (const void *a, const void *b);
+static int WatchPathCompare (const void *a, const void *b);
+#endif
 static void PruneFiles (RBTree *filetree, time_t scantime);
 static void PrintFileList (RBTree *filetree, FILE *fd);
 static int SaveState (RBTree *filetree, char *statefile);
 static int RecoverState (RBTree *filetree, char *statefile);
-static int WriteRecord (MSScanInfo *mssinfo, char *record, uint64_t reclen);
+static int InitBatch (MSScanInfo *mssinfo);
+static void FreeBatch (MSScanInfo *mssinfo);
+static void *ParseThread (void *arg);
+static void ParseRecords (ScanBatch *batch, MS3Record **msr);
+static void ParseBatch (MSScanInfo *mssinfo, int reccount);
+static int WriteRecords (MSScanInfo *mssinfo, int reccount);
 static int Initialize (MSScanInfo *mssinfo);
 static int MSS_KeyCompare (const void *a, const void *b);
 static time_t CalcDayTime (int year, int day);
@@ -151,6 +231,7 @@ MS_ScanThread (void *arg)
   MSScanInfo *mssinfo;
   time_t scantime;
   time_t statetime;
+  time_t nextfullscan = 0;
   struct timeval scanstarttime;
   struct timeval scanendtime;
   struct timespec treq, treq0, trem;
@@ -158,11 +239,13 @@ MS_ScanThread (void *arg)
   double iostatsinterval;
   int iostatscount = 0;
   int scanerror    = 0;
+  int fullscan;
 
   mytdp   = (struct thread_data *)arg;
   mssinfo = (MSScanInfo *)mytdp->td_prvtptr;
 
   mssinfo->filetree = RBTreeCreate (MSS_KeyCompare, free, free);
+  mssinfo->watchfd  = -1;
 
   /* Initialize scanning parameters */
   if (Initialize (mssinfo) < 0)
@@ -207,6 +290,7 @@ MS_ScanThread (void *arg)
   {
     scantime                 = time (NULL);
     mssinfo->scanrecordsread = 0;
+    fullscan                 = 1;
 
     if (mssinfo->iostats && mssinfo->iostats == iostatscount)
     {
@@ -216,6 +300,17 @@ MS_ScanThread (void *arg)
       mssinfo->scanrecordswritten = 0;
     }
 
+#if defined(MSSCAN_WATCH)
+    /* Check watched directories for changes between full scans */
+    if (mssinfo->watchfd >= 0 && !mssinfo->watchfull && scantime < nextfullscan)
+    {
+      fullscan = 0;
+
+      if (WatchFiles (mssinfo, scantime, 1000) == -2)
+        scanerror = 1;
+    }
+    else
+#endif
     /* Check for base directory existence */
     if (lstat (mssinfo->dirname, &st) < 0)
     {
@@ -240,14 +335,27 @@ MS_ScanThread (void *arg)
       if (mssinfo->accesserr == 1)
         mssinfo->accesserr = 0;
 
+      mssinfo->watchfull = 0;
+
       if (ScanFiles (mssinfo, mssinfo->dirname, mssinfo->maxrecur, scantime) == -2)
         scanerror = 1;
     }
 
+#if defined(MSSCAN_WATCH)
+    /* Release watching resources if the watch limit was reached while scanning */
+    if (mssinfo->watchfd < 0 && mssinfo->watchtree)
+      WatchClose (mssinfo);
+#endif
+
+    /* Schedule the next full scan when watching, retrying soon after access errors */
+    if (fullscan)
+      nextfullscan = time (NULL) + ((mssinfo->accesserr) ? 1 : mssinfo->watchrescan);
+
     if (mytdp->td_state != TDS_CLOSE && !scanerror)
     {
       /* Prune files that were not found from the filelist */
-      PruneFiles (mssinfo->filetree, scantime);
+      if (fullscan)
+        PruneFiles (mssinfo->filetree, scantime);
 
       /* Save intermediate state file */
       if (*(mssinfo->statefile) && mssinfo->stateint && (scantime - statetime) > mssinfo->stateint)
@@ -257,16 +365,20 @@ MS_ScanThread (void *arg)
       }
 
       /* Reset the next new flag, the first scan is now complete */
-      if (mssinfo->nextnew)
+      if (mssinfo->nextnew && fullscan)
         mssinfo->nextnew = 0;
 
-      /* Sleep for specified interval */
-      if (mssinfo->scansleep)
-        nanosleep (&treq, &trem);
+      /* Sleep between scans unless watching, which waits for changes */
+      if (mssinfo->watchfd < 0)
+      {
+        /* Sleep for specified interval */
+        if (mssinfo->scansleep)
+          nanosleep (&treq, &trem);
 
-      /* Sleep for specified interval if no records were read */
-      if (mssinfo->scansleep0 && mssinfo->scanrecordsread == 0)
-        nanosleep (&treq0, &trem);
+        /* Sleep for specified interval if no records were read */
+        if (mssinfo->scansleep0 && mssinfo->scanrecordsread == 0)
+          nanosleep (&treq0, &trem);
+      }
     }
 
     /* Rate calculation */
@@ -326,6 +438,10 @@ MS_ScanThread (void *arg)
   if (*(mssinfo->statefile) != '\0')
     SaveState (mssinfo->filetree, mssinfo->statefile);
 
+#if defined(MSSCAN_WATCH)
+  WatchClose (mssinfo);
+#endif
+
   /* Release file tracking binary tree */
   if (mssinfo->filetree)
     RBTreeDestroy (mssinfo->filetree);
@@ -340,6 +456,8 @@ MS_ScanThread (void *arg)
   if (mssinfo->fnreject_data)
     pcre2_match_data_free (mssinfo->fnreject_data);
 
+  FreeBatch (mssinfo);
+
   if (mssinfo->readbuffer)
     free (mssinfo->readbuffer);
 
@@ -385,11 +503,18 @@ ScanFiles (MSScanInfo *mssinfo, char *targetdir, int level, time_t scantime)
   struct edirent *ede;
   time_t currentday = 0;
   EDIR *dir;
+  int rv;
 
   fkey = (FileKey *)&filekeybuf;
 
   lprintf (3, "[MSeedScan] Processing directory '%s'", targetdir);
 
+#if defined(MSSCAN_WATCH)
+  /* Watch directory before reading the entries so no changes are missed */
+  if (mssinfo->watchfd >= 0)
+    WatchDirectory (mssinfo, targetdir, mssinfo->recurlevel);
+#endif
+
   if ((dir = EOpenDir (targetdir)) == NULL)
   {
     lprintf (0, "[MSeedScan] Cannot open directory %s: %s", targetdir, strerror (errno));
@@ -499,99 +624,129 @@ ScanFiles (MSScanInfo *mssinfo, char *targetdir, int level, time_t scantime)
       continue;
     }
 
-    /* Increment files found counter */
-    if (mssinfo->iostats)
-      mssinfo->scanfileschecked++;
+    if ((rv = CheckFile (mssinfo, fkey, fnode, ede->d_name, ede->d_ino, &st, scantime)) == -2)
+      return -2;
 
-    /* Do regex matching if an expression was specified */
-    if (mssinfo->fnmatch)
-      if (pcre2_match (mssinfo->fnmatch, (PCRE2_SPTR8)ede->d_name, PCRE2_ZERO_TERMINATED, 0, 0,
-                       mssinfo->fnmatch_data, NULL) < 0)
-        continue;
+#if defined(MSSCAN_WATCH)
+    /* Check files with records left to read again without waiting for changes */
+    if (rv == 1 && mssinfo->watchfd >= 0)
+      WatchAddPending (mssinfo, fkey->filename, mssinfo->recurlevel);
+#endif
+  }
 
-    /* Do regex rejecting if an expression was specified */
-    if (mssinfo->fnreject)
-      if (pcre2_match (mssinfo->fnreject, (PCRE2_SPTR8)ede->d_name, PCRE2_ZERO_TERMINATED, 0, 0,
-                       mssinfo->fnreject_data, NULL) >= 0)
-        continue;
+  ECloseDir (dir);
 
-    /* Sanity check for a regular file */
-    if (!S_ISREG (st.st_mode))
-    {
-      lprintf (0, "[MSeedScan] %s is not a regular file", fkey->filename);
-      continue;
-    }
+  return 0;
+} /* End of ScanFiles() */
 
-    /* Sanity check that the dirent inode and stat inode are the same */
-    if (st.st_ino != ede->d_ino)
-    {
-      lprintf (0, "[MSeedScan] Inode numbers from dirent and stat do not match for %s\n", fkey->filename);
-      lprintf (0, "  dirent: %llu  VS  stat: %llu\n",
-               (unsigned long long int)ede->d_ino, (unsigned long long int)st.st_ino);
-      continue;
-    }
+/***************************************************************************
+ * CheckFile:
+ *
+ * Check a file found by scanning or reported by a directory watch and
+ * process any new data.  The file name is in the FileKey, the name
+ * without a directory is used for matching and the inode is that
+ * reported by the directory entry.  The FileNode is NULL if the file
+ * has never been seen.
+ *
+ * Return 0 on success, 1 when records were left to read due to the
+ * per scan maximum and -2 on fatal error.
+ ***************************************************************************/
+static int
+CheckFile (MSScanInfo *mssinfo, FileKey *fkey, FileNode *fnode, const char *name,
+           ino_t dirino, struct stat *st, time_t scantime)
+{
+  int reachedmax = 0;
 
-    lprintf (3, "[MSeedScan] Checking file %s", fkey->filename);
+  /* Increment files found counter */
+  if (mssinfo->iostats)
+    mssinfo->scanfileschecked++;
 
-    /* If the file has never been seen add it to the list */
-    if (!fnode)
-    {
-      /* Add new file to tree setting modtime to one second in the
-       * past so we are triggered to look at this file the first time. */
-      if (!(fnode = AddFile (mssinfo->filetree, fkey->inode, fkey->filename, st.st_mtime - 1)))
-      {
-        lprintf (0, "[MSeedScan] Error adding %s to file list", fkey->filename);
-        continue;
-      }
-    }
+  /* Do regex matching if an expression was specified */
+  if (mssinfo->fnmatch)
+    if (pcre2_match (mssinfo->fnmatch, (PCRE2_SPTR8)name, PCRE2_ZERO_TERMINATED, 0, 0,
+                     mssinfo->fnmatch_data, NULL) < 0)
+      return 0;
 
-    /* Only update the offset if skipping the first scan, otherwise process */
-    if (mssinfo->nextnew)
-      fnode->offset = st.st_size;
+  /* Do regex rejecting if an expression was specified */
+  if (mssinfo->fnreject)
+    if (pcre2_match (mssinfo->fnreject, (PCRE2_SPTR8)name, PCRE2_ZERO_TERMINATED, 0, 0,
+                     mssinfo->fnreject_data, NULL) >= 0)
+      return 0;
 
-    /* Check if the file is quiet and mark to always skip if true */
-    if (mssinfo->quietsec && st.st_mtime < (scantime - mssinfo->quietsec))
-    {
-      lprintf (2, "[MSeedScan] Marking file as quiet, no processing: %s", fkey->filename);
-      fnode->offset = -1;
-    }
+  /* Sanity check for a regular file */
+  if (!S_ISREG (st->st_mode))
+  {
+    lprintf (0, "[MSeedScan] %s is not a regular file", fkey->filename);
+    return 0;
+  }
+
+  /* Sanity check that the dirent inode and stat inode are the same */
+  if (st->st_ino != dirino)
+  {
+    lprintf (0, "[MSeedScan] Inode numbers from dirent and stat do not match for %s\n", fkey->filename);
+    lprintf (0, "  dirent: %llu  VS  stat: %llu\n",
+             (unsigned long long int)dirino, (unsigned long long int)st->st_ino);
+    return 0;
+  }
+
+  lprintf (3, "[MSeedScan] Checking file %s", fkey->filename);
 
-    /* Otherwise check if the file is idle and set idledelay appropriately */
-    else if (mssinfo->idledelay && fnode->idledelay == 0 &&
-             st.st_mtime < (scantime - mssinfo->idlesec))
+  /* If the file has never been seen add it to the list */
+  if (!fnode)
+  {
+    /* Add new file to tree setting modtime to one second in the
+     * past so we are triggered to look at this file the first time. */
+    if (!(fnode = AddFile (mssinfo->filetree, fkey->inode, fkey->filename, st->st_mtime - 1)))
     {
-      lprintf (2, "[MSeedScan] Marking file as idle, will not check for %d scans: %s",
-               mssinfo->idledelay, fkey->filename);
-      fnode->idledelay = (mssinfo->idledelay > 0) ? (mssinfo->idledelay - 1) : 0;
+      lprintf (0, "[MSeedScan] Error adding %s to file list", fkey->filename);
+      return 0;
     }
+  }
 
-    /* Process (read records from) the file if it's size has increased and
-     * is not marked for permanent skipping */
-    if (fnode->offset < st.st_size && fnode->offset != -1)
-    {
-      /* Increment files read counter */
-      if (mssinfo->iostats)
-        mssinfo->scanfilesread++;
+  /* Only update the offset if skipping the first scan, otherwise process */
+  if (mssinfo->nextnew)
+    fnode->offset = st->st_size;
 
-      fnode->offset = ProcessFile (mssinfo, fkey->filename, fnode, st.st_size, st.st_mtime);
+  /* Check if the file is quiet and mark to always skip if true */
+  if (mssinfo->quietsec && st->st_mtime < (scantime - mssinfo->quietsec))
+  {
+    lprintf (2, "[MSeedScan] Marking file as quiet, no processing: %s", fkey->filename);
+    fnode->offset = -1;
+  }
 
-      /* If a proper file read but fatal error occured set the offset correctly
-         and return a fatal error. */
-      if (fnode->offset < -1)
-      {
-        fnode->offset = -fnode->offset;
-        return -2;
-      }
-    }
+  /* Otherwise check if the file is idle and set idledelay appropriately */
+  else if (mssinfo->idledelay && fnode->idledelay == 0 &&
+           st->st_mtime < (scantime - mssinfo->idlesec))
+  {
+    lprintf (2, "[MSeedScan] Marking file as idle, will not check for %d scans: %s",
+             mssinfo->idledelay, fkey->filename);
+    fnode->idledelay = (mssinfo->idledelay > 0) ? (mssinfo->idledelay - 1) : 0;
+  }
+
+  /* Process (read records from) the file if it's size has increased and
+   * is not marked for permanent skipping */
+  if (fnode->offset < st->st_size && fnode->offset != -1)
+  {
+    /* Increment files read counter */
+    if (mssinfo->iostats)
+      mssinfo->scanfilesread++;
+
+    fnode->offset = ProcessFile (mssinfo, fkey->filename, fnode, st->st_size, st->st_mtime, &reachedmax);
 
-    /* Update scantime */
-    fnode->scantime = scantime;
+    /* If a proper file read but fatal error occured set the offset correctly
+       and return a fatal error. */
+    if (fnode->offset < -1)
+    {
+      fnode->offset = -fnode->offset;
+      return -2;
+    }
   }
 
-  ECloseDir (dir);
+  /* Update scantime */
+  fnode->scantime = scantime;
 
-  return 0;
-} /* End of ScanFiles() */
+  return reachedmax;
+} /* End of CheckFile() */
 
 /***************************************************************************
  * FindFile:
@@ -658,7 +813,15 @@ AddFile (RBTree *filetree, ino_t inode, char *filename, time_t modtime)
 /***************************************************************************
  * ProcessFile:
  *
- * Process a file by reading any data after the last offset.
+ * Process a file by reading any data after the last offset.  The
+ * reachedmax flag is set when the maximum number of records per scan
+ * was read before the end of the file.
+ *
+ * Data is read in chunks of up to the read buffer size and split into
+ * whole records, a record extending past the end of a chunk is read
+ * again at the start of the next chunk.  The records of each chunk
+ * are parsed as a batch and written to the ring in file order, the
+ * throttle interval is slept once per batch for all of its records.
  *
  * Return the new file offset on success and -1 on error reading file
  * and the negated file offset on successful read but fatal write (to ring)
@@ -666,23 +829,27 @@ AddFile (RBTree *filetree, ino_t inode, char *filename, time_t modtime)
  ***************************************************************************/
 static off_t
 ProcessFile (MSScanInfo *mssinfo, char *filename, FileNode *fnode,
-             off_t newsize, time_t newmodtime)
+             off_t newsize, time_t newmodtime, int *reachedmax)
 {
+  ScanBatch *batch = mssinfo->batch;
   ssize_t nread;
-  ssize_t detlen;
+  ssize_t detlen = 0;
+  size_t readlen;
+  size_t bufpos;
+  uint64_t throttlensec;
   int fd;
-  int reccnt     = 0;
-  int reachedmax = 0;
+  int reccnt = 0;
+  int batchcnt;
+  int idx;
   int flags;
+  int stop = 0;
   uint8_t msversion;
   off_t newoffset = fnode->offset;
   struct timespec treq, trem;
 
   lprintf (3, "[MSeedScan] Processing file %s", filename);
 
-  /* Set the throttling sleep time */
-  treq.tv_sec  = (time_t)0;
-  treq.tv_nsec = (long)mssinfo->throttlensec;
+  *reachedmax = 0;
 
 /* Set open flags */
 #if defined(__sun__) || defined(__sun)
@@ -704,23 +871,32 @@ ProcessFile (MSScanInfo *mssinfo, char *filename, FileNode *fnode,
   }
 
   /* Read and process data while minimum record length is available */
-  while ((newsize - newoffset) >= MSSCAN_MINRECLEN)
+  while (!stop && (newsize - newoffset) >= MSSCAN_MINRECLEN)
   {
     /* Jump out if we've read the maximum allowed number of records
        from this file for this scan */
     if (mssinfo->filemaxrecs && reccnt >= mssinfo->filemaxrecs)
     {
-      reachedmax = 1;
+      *reachedmax = 1;
       break;
     }
 
-    /* Read up to MSSCAN_READLEN bytes into buffer */
-    if ((nread = pread (fd, mssinfo->readbuffer, MSSCAN_READLEN, newoffset)) <= 0)
+    /* Read the new data up to the buffer size, limited to the most
+       the remaining records allowed for this scan could occupy */
+    readlen = mssinfo->readbuffersize;
+    if ((off_t)readlen > (newsize - newoffset))
+      readlen = (size_t)(newsize - newoffset);
+    if (mssinfo->filemaxrecs &&
+        readlen > (size_t)(mssinfo->filemaxrecs - reccnt) * mssinfo->maxreclen)
+      readlen = (size_t)(mssinfo->filemaxrecs - reccnt) * mssinfo->maxreclen;
+
+    if ((nread = pread (fd, mssinfo->readbuffer, readlen, newoffset)) <= 0)
     {
+      close (fd);
+
       if (!(param.shutdownsig && errno == EINTR))
       {
         lprintf (0, "[MSeedScan] Error: cannot read data from %s", filename);
-        close (fd);
         return -1;
       }
       else
@@ -729,87 +905,160 @@ ProcessFile (MSScanInfo *mssinfo, char *filename, FileNode *fnode,
       }
     }
 
-    /* Check buffer for miniSEED */
-    detlen = ms3_detect (mssinfo->readbuffer, (uint64_t)nread, &msversion);
+    /* Split the buffer into whole records */
+    batchcnt = 0;
+    bufpos   = 0;
+    while ((size_t)nread - bufpos >= MSSCAN_MINRECLEN && batchcnt < MSSCAN_BATCHMAX)
+    {
+      if (mssinfo->filemaxrecs && (reccnt + batchcnt) >= mssinfo->filemaxrecs)
+        break;
+
+      /* Read the next chunk if the detection length is not in the buffer */
+      if ((size_t)nread - bufpos < MSSCAN_READLEN && bufpos > 0 &&
+          (newoffset + nread) < newsize)
+        break;
+
+      /* Check buffer for miniSEED, with the same length as a single record read */
+      detlen = ms3_detect (mssinfo->readbuffer + bufpos,
+                           (uint64_t)(((size_t)nread - bufpos < MSSCAN_READLEN) ? (size_t)nread - bufpos : MSSCAN_READLEN),
+                           &msversion);
+
+      /* If miniSEED not detected or length could not be determined */
+      if (detlen <= 0)
+      {
+        stop = 1;
+        break;
+      }
+      /* Record is larger than packet payload maximum, aka read buffer size */
+      else if (detlen > mssinfo->maxreclen)
+      {
+        stop = 2;
+        break;
+      }
+      /* File does not contain whole record, done for now */
+      else if (detlen > (newsize - newoffset - (off_t)bufpos))
+      {
+        stop = 3;
+        break;
+      }
+      /* Record extends past the buffer, read it with the next chunk */
+      else if (detlen > (ssize_t)((size_t)nread - bufpos))
+      {
+        /* The buffer holds a maximum size record, the read was short */
+        if (bufpos == 0)
+          stop = 4;
+
+        break;
+      }
+
+      batch->packetdata[batchcnt] = mssinfo->readbuffer + bufpos;
+      batch->records[batchcnt++].reclen = (uint32_t)detlen;
 
-    /* If miniSEED not detected or length could not be determined */
-    if (detlen <= 0)
+      bufpos += detlen;
+    }
+
+    /* Nothing usable was read, e.g. the file was truncated */
+    if (batchcnt == 0 && !stop)
+      stop = 4;
+
+    if (batchcnt > 0)
     {
-      /* If no data has ever been read from this file, ignore file */
-      if (fnode->offset == 0)
+      /* Parse records and write them to ring buffer in file order */
+      ParseBatch (mssinfo, batchcnt);
+
+      /* Records up to the first that could not be parsed are written */
+      for (idx = 0; idx < batchcnt; idx++)
+      {
+        if (batch->records[idx].parseerr != MS_NOERROR)
+          break;
+
+        newoffset += batch->records[idx].reclen;
+      }
+
+      /* Increment records read counter */
+      mssinfo->scanrecordsread += idx;
+
+      if (idx > 0 && WriteRecords (mssinfo, idx))
       {
-        lprintf (0, "[MSeedScan] %s: Not a valid miniSEED record at offset %lld, ignoring file",
-                 filename, (long long)newoffset);
         close (fd);
-        return -1;
+        return -newoffset;
       }
-      /* Otherwise, if records have been read, skip until next scan */
-      else
+
+      /* Increment records written counter */
+      if (mssinfo->iostats)
+      {
+        mssinfo->scanrecordswritten += idx;
+      }
+
+      if (idx < batchcnt)
       {
-        lprintf (0, "[MSeedScan] %s: Not a valid miniSEED record at offset %lld (new bytes %lld), skipping for this scan",
-                 filename, (long long)newoffset, (long long)(newsize - newoffset));
+        lprintf (0, "[MSeedScan] Error unpacking record: %s", ms_errorstr (batch->records[idx].parseerr));
+
+        newoffset += batch->records[idx].reclen;
+        mssinfo->scanrecordsread++;
+
         close (fd);
-        return newoffset;
+        return -newoffset;
       }
-    }
-    /* Record is larger than packet payload maximum, aka read buffer size */
-    else if (detlen > mssinfo->readbuffersize)
-    {
-      lprintf (0, "[MSeedScan] %s: Record length (%" PRId64 ") at offset %" PRId64 ", larger than packet payload size (%u), ignoring file",
-               filename, (int64_t)detlen, (int64_t)newoffset, mssinfo->readbuffersize);
-      close (fd);
-      return -1;
-    }
-    /* File does not contain whole record, done for now */
-    else if (detlen > (newsize - newoffset))
-    {
-      return newoffset;
-    }
 
-    /* Read the rest of the record */
-    if (detlen > nread)
-    {
-      if (pread (fd, mssinfo->readbuffer + nread,
-                 (size_t)(detlen - nread),
-                 newoffset + nread) != detlen - nread)
+      reccnt += batchcnt;
+
+      /* Sleep for specified throttle interval for each record */
+      if (mssinfo->throttlensec)
       {
-        if (!(param.shutdownsig && errno == EINTR))
-        {
-          lprintf (0, "[MSeedScan] Error: cannot read remaining record data from %s", filename);
-          close (fd);
-          return -1;
-        }
-        else
-        {
-          return newoffset;
-        }
+        throttlensec = (uint64_t)mssinfo->throttlensec * batchcnt;
+        treq.tv_sec  = (time_t)(throttlensec / 1000000000);
+        treq.tv_nsec = (long)(throttlensec % 1000000000);
+
+        nanosleep (&treq, &trem);
       }
     }
+  }
 
-    newoffset += detlen;
-
-    /* Increment records read counter */
-    mssinfo->scanrecordsread++;
+  if (stop == 1)
+  {
+    close (fd);
 
-    /* Write record to ring buffer */
-    if (WriteRecord (mssinfo, mssinfo->readbuffer, (uint64_t)detlen))
+    /* If no data has ever been read from this file, ignore file */
+    if (fnode->offset == 0)
     {
-      return -newoffset;
+      lprintf (0, "[MSeedScan] %s: Not a valid miniSEED record at offset %lld, ignoring file",
+               filename, (long long)newoffset);
+      return -1;
     }
-
-    /* Increment records written counter */
-    if (mssinfo->iostats)
+    /* Otherwise, if records have been read, skip until next scan */
+    else
     {
-      mssinfo->scanrecordswritten++;
+      lprintf (0, "[MSeedScan] %s: Not a valid miniSEED record at offset %lld (new bytes %lld), skipping for this scan",
+               filename, (long long)newoffset, (long long)(newsize - newoffset));
+      return newoffset;
     }
+  }
+  else if (stop == 2)
+  {
+    lprintf (0, "[MSeedScan] %s: Record length (%" PRId64 ") at offset %" PRId64 ", larger than packet payload size (%u), ignoring file",
+             filename, (int64_t)detlen, (int64_t)newoffset, mssinfo->maxreclen);
+    close (fd);
+    return -1;
+  }
+  else if (stop == 3)
+  {
+    close (fd);
+    return newoffset;
+  }
+  else if (stop == 4)
+  {
+    close (fd);
 
-    /* Sleep for specified throttle interval */
-    if (mssinfo->throttlensec)
+    if (!(param.shutdownsig && errno == EINTR))
     {
-      nanosleep (&treq, &trem);
+      lprintf (0, "[MSeedScan] Error: cannot read remaining record data from %s", filename);
+      return -1;
+    }
+    else
+    {
+      return newoffset;
     }
-
-    reccnt++;
   }
 
   close (fd);
@@ -818,7 +1067,7 @@ ProcessFile (MSScanInfo *mssinfo, char *filename, FileNode *fnode,
    * If the maximum number of records have been reached we are not necessarily
    * at the end of the file so set the modtime one second in the past so we are
    * triggered to look at this file again. */
-  if (reachedmax)
+  if (*reachedmax)
     fnode->modtime = newmodtime - 1;
   else
     fnode->modtime = newmodtime;
@@ -1010,44 +1259,238 @@ RecoverState (RBTree *filetree, char *statefile)
 } /* End of RecoverState() */
 
 /***************************************************************************
- * WriteRecord:
+ * InitBatch:
  *
- * Send the specified record to the DataLink server.
+ * Allocate the record batch and start parsing threads, the scan
+ * thread itself is one of the configured parsing threads.
  *
  * Returns 0 on success, and -1 on failure
  ***************************************************************************/
 static int
-WriteRecord (MSScanInfo *mssinfo, char *record, uint64_t reclen)
+InitBatch (MSScanInfo *mssinfo)
 {
-  char streamid[100];
-  RingPacket packet;
-  uint32_t flags = MSF_VALIDATECRC;
-  int rv;
+  ScanBatch *batch;
+  int rc;
 
-  /* Parse miniSEED header */
-  if ((rv = msr3_parse (record, reclen, &(mssinfo->msr), flags, 0)) != MS_NOERROR)
+  if (!(batch = (ScanBatch *)calloc (1, sizeof (ScanBatch))))
   {
-    lprintf (0, "[MSeedScan] Error unpacking record: %s", ms_errorstr (rv));
+    lprintf (0, "[MSeedScan] Cannot allocate record batch");
     return -1;
   }
 
-  /* Generate stream ID for this record: SourceID/MSEED */
-  snprintf (streamid, sizeof (streamid), "%s/MSEED", mssinfo->msr->sid);
+  pthread_mutex_init (&batch->lock, NULL);
+  pthread_cond_init (&batch->workcond, NULL);
+  pthread_cond_init (&batch->donecond, NULL);
+
+  mssinfo->batch = batch;
+
+  if (mssinfo->parsethreads <= 1)
+    return 0;
+
+  if (!(batch->threads = (pthread_t *)calloc (mssinfo->parsethreads - 1, sizeof (pthread_t))))
+  {
+    lprintf (0, "[MSeedScan] Cannot allocate parsing threads");
+    FreeBatch (mssinfo);
+    return -1;
+  }
+
+  while (batch->threadcount < mssinfo->parsethreads - 1)
+  {
+    if ((rc = pthread_create (&batch->threads[batch->threadcount], NULL, ParseThread, batch)))
+    {
+      lprintf (0, "[MSeedScan] Error creating parsing thread: %s", strerror (rc));
+      FreeBatch (mssinfo);
+      return -1;
+    }
+
+    batch->threadcount++;
+  }
+
+  lprintf (1, "[MSeedScan] Started %d parsing threads [%s]", batch->threadcount, mssinfo->dirname);
+
+  return 0;
+} /* End of InitBatch() */
+
+/***************************************************************************
+ * FreeBatch:
+ *
+ * Stop parsing threads and free the record batch.
+ ***************************************************************************/
+static void
+FreeBatch (MSScanInfo *mssinfo)
+{
+  ScanBatch *batch = mssinfo->batch;
+  int idx;
+
+  if (!batch)
+    return;
+
+  pthread_mutex_lock (&batch->lock);
+  batch->shutdown = 1;
+  pthread_cond_broadcast (&batch->workcond);
+  pthread_mutex_unlock (&batch->lock);
+
+  for (idx = 0; idx < batch->threadcount; idx++)
+    pthread_join (batch->threads[idx], NULL);
+
+  pthread_mutex_destroy (&batch->lock);
+  pthread_cond_destroy (&batch->workcond);
+  pthread_cond_destroy (&batch->donecond);
+
+  if (batch->threads)
+    free (batch->threads);
+
+  free (batch);
+  mssinfo->batch = NULL;
+} /* End of FreeBatch() */
+
+/***************************************************************************
+ * ParseThread:
+ *
+ * Parsing thread, parse records of each published batch with a
+ * thread-specific MS3Record until shutdown.
+ *
+ * Returns NULL.
+ ***************************************************************************/
+static void *
+ParseThread (void *arg)
+{
+  ScanBatch *batch = (ScanBatch *)arg;
+  MS3Record *msr   = NULL;
+  int generation   = 0;
+
+  pthread_mutex_lock (&batch->lock);
+
+  while (!batch->shutdown)
+  {
+    if (batch->generation == generation)
+    {
+      pthread_cond_wait (&batch->workcond, &batch->lock);
+      continue;
+    }
+
+    generation = batch->generation;
+    pthread_mutex_unlock (&batch->lock);
+
+    ParseRecords (batch, &msr);
+
+    pthread_mutex_lock (&batch->lock);
+    if (--batch->active == 0)
+      pthread_cond_signal (&batch->donecond);
+  }
+
+  pthread_mutex_unlock (&batch->lock);
+
+  if (msr)
+    msr3_free (&msr);
 
-  memset (&packet, 0, sizeof (RingPacket));
-  memcpy (packet.streamid, streamid, sizeof (packet.streamid) - 1);
-  packet.datastart = mssinfo->msr->starttime;
-  packet.dataend   = msr3_endtime (mssinfo->msr);
-  packet.datasize  = (uint32_t)mssinfo->msr->reclen;
-  packet.pktid     = RINGID_NONE;
+  return NULL;
+} /* End of ParseThread() */
+
+/***************************************************************************
+ * ParseRecords:
+ *
+ * Parse records of the current batch, claiming MSSCAN_PARSECHUNK
+ * records at a time until none are left, and populate the ring packet
+ * header of each record.  CRCs are validated when present.
+ ***************************************************************************/
+static void
+ParseRecords (ScanBatch *batch, MS3Record **msr)
+{
+  ScanRecord *srec;
+  RingPacket *packet;
+  char streamid[100];
+  int start;
+  int end;
+  int idx;
+
+  while ((start = __atomic_fetch_add (&batch->nextrecord, MSSCAN_PARSECHUNK, __ATOMIC_RELAXED)) < batch->reccount)
+  {
+    end = (start + MSSCAN_PARSECHUNK < batch->reccount) ? start + MSSCAN_PARSECHUNK : batch->reccount;
+
+    for (idx = start; idx < end; idx++)
+    {
+      srec   = &batch->records[idx];
+      packet = &batch->packets[idx];
+
+      /* Parse miniSEED header */
+      if ((srec->parseerr = msr3_parse (batch->packetdata[idx], srec->reclen, msr, MSF_VALIDATECRC, 0)) != MS_NOERROR)
+        continue;
+
+      /* Generate stream ID for this record: SourceID/MSEED */
+      snprintf (streamid, sizeof (streamid), "%s/MSEED", (*msr)->sid);
+
+      memset (packet, 0, sizeof (RingPacket));
+      memcpy (packet->streamid, streamid, sizeof (packet->streamid) - 1);
+      packet->datastart = (*msr)->starttime;
+      packet->dataend   = msr3_endtime (*msr);
+      packet->datasize  = (uint32_t)(*msr)->reclen;
+      packet->pktid     = RINGID_NONE;
+    }
+  }
+} /* End of ParseRecords() */
+
+/***************************************************************************
+ * ParseBatch:
+ *
+ * Parse the first reccount records of the batch.  Batches of at least
+ * MSSCAN_PARSEMIN records are shared with the parsing threads, smaller
+ * batches are parsed by the scan thread alone.
+ ***************************************************************************/
+static void
+ParseBatch (MSScanInfo *mssinfo, int reccount)
+{
+  ScanBatch *batch = mssinfo->batch;
+
+  if (batch->threadcount == 0 || reccount < MSSCAN_PARSEMIN)
+  {
+    batch->reccount   = reccount;
+    batch->nextrecord = 0;
+
+    ParseRecords (batch, &(mssinfo->msr));
+    return;
+  }
+
+  /* Publish the batch to the parsing threads */
+  pthread_mutex_lock (&batch->lock);
+  batch->reccount   = reccount;
+  batch->nextrecord = 0;
+  batch->active     = batch->threadcount;
+  batch->generation++;
+  pthread_cond_broadcast (&batch->workcond);
+  pthread_mutex_unlock (&batch->lock);
+
+  ParseRecords (batch, &(mssinfo->msr));
+
+  /* Wait for all parsing threads to finish the batch */
+  pthread_mutex_lock (&batch->lock);
+  while (batch->active > 0)
+    pthread_cond_wait (&batch->donecond, &batch->lock);
+  pthread_mutex_unlock (&batch->lock);
+} /* End of ParseBatch() */
+
+/***************************************************************************
+ * WriteRecords:
+ *
+ * Send the specified number of parsed records at the start of the
+ * batch to the ring in a single batch write.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+WriteRecords (MSScanInfo *mssinfo, int reccount)
+{
+  ScanBatch *batch = mssinfo->batch;
+  int idx;
+  int rv;
 
-  /* Add the packet to the ring */
-  if ((rv = RingWrite (mssinfo->ringparams, &packet, record, packet.datasize)))
+  /* Add the packets to the ring */
+  if ((rv = RingWriteBatch (mssinfo->ringparams, batch->packets, batch->packetdata, (uint32_t)reccount)))
   {
     if (rv == -2)
-      lprintf (1, "[MSeedScan] Error with RingWrite, corrupt ring, shutdown signalled");
+      lprintf (1, "[MSeedScan] Error with RingWriteBatch, corrupt ring, shutdown signalled");
     else
-      lprintf (1, "[MSeedScan] Error with RingWrite");
+      lprintf (1, "[MSeedScan] Error with RingWriteBatch");
 
     /* Set the shutdown signal if ring corruption was detected */
     if (rv == -2)
@@ -1057,11 +1500,14 @@ WriteRecord (MSScanInfo *mssinfo, char *record, uint64_t reclen)
   }
 
   /* Update client receive counts */
-  mssinfo->rxpackets[0]++;
-  mssinfo->rxbytes[0] += packet.datasize;
+  for (idx = 0; idx < reccount; idx++)
+  {
+    mssinfo->rxpackets[0]++;
+    mssinfo->rxbytes[0] += batch->packets[idx].datasize;
+  }
 
   return 0;
-} /* End of WriteRecord() */
+} /* End of WriteRecords() */
 
 /***************************************************************************
  * Initialize:
@@ -1089,14 +1535,31 @@ Initialize (MSScanInfo *mssinfo)
     return -1;
   }
 
-  /* Calculate maximum allowed record length and allocate file read buffer */
-  mssinfo->readbuffersize = mssinfo->ringparams->pktsize - sizeof (RingPacket);
+  /* Calculate maximum allowed record length and allocate file read buffer,
+   * large enough for many records and at least one maximum length record */
+  mssinfo->maxreclen      = mssinfo->ringparams->pktsize - sizeof (RingPacket);
+  mssinfo->readbuffersize = (mssinfo->maxreclen > MSSCAN_READBUFFER) ? mssinfo->maxreclen : MSSCAN_READBUFFER;
   if ((mssinfo->readbuffer = (char *)malloc (mssinfo->readbuffersize)) == NULL)
   {
     lprintf (0, "[MSeedScan] Cannot allocate file read buffer");
     return -1;
   }
 
+  /* Allocate record batch and start parsing threads */
+  if (InitBatch (mssinfo))
+    return -1;
+
+  /* Start watching directories, falling back to scanning on failure */
+  if (mssinfo->watch)
+  {
+#if defined(MSSCAN_WATCH)
+    WatchInit (mssinfo);
+#else
+    lprintf (0, "[MSeedScan] Directory watching is not supported on this platform, scanning %s",
+             mssinfo->dirname);
+#endif
+  }
+
   /* Attempt to recover sequence numbers from state file */
   if (*(mssinfo->statefile) != '\0')
   {
@@ -1104,6 +1567,12 @@ Initialize (MSScanInfo *mssinfo)
     {
       lprintf (0, "[MSeedScan] State recovery failed for %s", mssinfo->dirname);
     }
+#if defined(MSSCAN_WATCH)
+    else if (mssinfo->watchfd >= 0)
+    {
+      WatchStateDirectories (mssinfo);
+    }
+#endif
   }
 
   return 0;
@@ -1208,6 +1677,480 @@ BudFileDayTime (char *filename)
   return daytime;
 } /* End of BudFileDayTime() */
 
+#if defined(MSSCAN_WATCH)
+/***************************************************************************
+ * WatchInit:
+ *
+ * Initialize directory watching with inotify(7).  Directories are
+ * added to the watch set by WatchDirectory() as they are scanned.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+WatchInit (MSScanInfo *mssinfo)
+{
+  if ((mssinfo->watchfd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) < 0)
+  {
+    lprintf (0, "[MSeedScan] Cannot initialize directory watching, scanning %s: %s",
+             mssinfo->dirname, strerror (errno));
+    mssinfo->watchfd = -1;
+    return -1;
+  }
+
+  mssinfo->watchtree    = RBTreeCreate (WatchKeyCompare, free, free);
+  mssinfo->watchpending = RBTreeCreate (WatchPathCompare, free, free);
+
+  lprintf (1, "[MSeedScan] Watching %s for changes, full scan every %d seconds",
+           mssinfo->dirname, mssinfo->watchrescan);
+
+  return 0;
+} /* End of WatchInit() */
+
+/***************************************************************************
+ * WatchClose:
+ *
+ * Stop directory watching and release the associated memory.
+ ***************************************************************************/
+static void
+WatchClose (MSScanInfo *mssinfo)
+{
+  if (mssinfo->watchfd >= 0)
+  {
+    close (mssinfo->watchfd);
+    mssinfo->watchfd = -1;
+  }
+
+  if (mssinfo->watchtree)
+  {
+    RBTreeDestroy (mssinfo->watchtree);
+    mssinfo->watchtree = NULL;
+  }
+
+  if (mssinfo->watchpending)
+  {
+    RBTreeDestroy (mssinfo->watchpending);
+    mssinfo->watchpending = NULL;
+  }
+} /* End of WatchClose() */
+
+/***************************************************************************
+ * WatchDirectory:
+ *
+ * Add a directory to the watch set, or update the name and recursion
+ * level of an already watched directory.
+ *
+ * If the system limit of watches is reached watching is stopped, the
+ * memory is released later by WatchClose(), and the scanning thread
+ * reverts to scanning.
+ ***************************************************************************/
+static void
+WatchDirectory (MSScanInfo *mssinfo, const char *dirname, int level)
+{
+  WatchNode *wnode;
+  RBNode *tnode;
+  size_t dirlen;
+  int *wdkey;
+  int wd;
+
+  if ((wd = inotify_add_watch (mssinfo->watchfd, dirname, MSSCAN_WATCHMASK)) < 0)
+  {
+    if (errno == ENOSPC || errno == ENOMEM)
+    {
+      lprintf (0, "[MSeedScan] Directory watch limit reached (fs.inotify.max_user_watches), scanning %s",
+               mssinfo->dirname);
+
+      close (mssinfo->watchfd);
+      mssinfo->watchfd = -1;
+    }
+    else if (errno != ENOENT)
+    {
+      lprintf (0, "[MSeedScan] Cannot watch directory %s: %s", dirname, strerror (errno));
+    }
+
+    return;
+  }
+
+  /* Nothing to do if already watched with the same name and level */
+  if ((tnode = RBFind (mssinfo->watchtree, &wd)))
+  {
+    wnode = (WatchNode *)tnode->data;
+
+    if (wnode->level == level && !strcmp (wnode->dirname, dirname))
+      return;
+  }
+
+  dirlen = strlen (dirname);
+
+  if (!(wnode = (WatchNode *)malloc (sizeof (WatchNode) + dirlen)))
+  {
+    lprintf (0, "[MSeedScan] Cannot allocate memory for directory watch");
+    return;
+  }
+
+  wnode->level = level;
+  memcpy (wnode->dirname, dirname, dirlen + 1);
+
+  if (tnode)
+  {
+    free (tnode->data);
+    tnode->data = wnode;
+  }
+  else if ((wdkey = (int *)malloc (sizeof (int))))
+  {
+    *wdkey = wd;
+    RBTreeInsert (mssinfo->watchtree, wdkey, wnode, 0);
+  }
+  else
+  {
+    lprintf (0, "[MSeedScan] Cannot allocate memory for directory watch");
+    free (wnode);
+  }
+} /* End of WatchDirectory() */
+
+/***************************************************************************
+ * WatchStateDirectories:
+ *
+ * Watch the directories of the files recovered from the statefile so
+ * that changes are reported while the first full scan is running.
+ ***************************************************************************/
+static void
+WatchStateDirectories (MSScanInfo *mssinfo)
+{
+  FileKey *fkey;
+  RBNode *tnode;
+  Stack *stack;
+  char dirname[MSSCAN_MAXFILENAME];
+  char lastdir[MSSCAN_MAXFILENAME] = {0};
+  size_t baselen;
+  size_t dirlen;
+  char *sep;
+  int level;
+  int count = 0;
+
+  baselen = strlen (mssinfo->dirname);
+
+  stack = StackCreate ();
+  RBBuildStack (mssinfo->filetree, stack);
+
+  while ((tnode = (RBNode *)StackPop (stack)) && mssinfo->watchfd >= 0)
+  {
+    fkey = (FileKey *)tnode->key;
+
+    /* Skip files that are not within the scanned directory */
+    if (strncmp (fkey->filename, mssinfo->dirname, baselen) ||
+        (fkey->filename[baselen] != '/' && (baselen == 0 || mssinfo->dirname[baselen - 1] != '/')))
+      continue;
+
+    if (!(sep = strrchr (fkey->filename, '/')) || sep < fkey->filename + baselen - 1)
+      continue;
+
+    dirlen = (size_t)(sep - fkey->filename);
+
+    /* The base directory, scanned with a trailing slash */
+    if (dirlen < baselen)
+      dirlen = baselen;
+
+    if (dirlen >= sizeof (dirname))
+      continue;
+
+    memcpy (dirname, fkey->filename, dirlen);
+    dirname[dirlen] = '\0';
+
+    if (!strcmp (dirname, lastdir))
+      continue;
+
+    /* Recursion level is the number of directories below the base */
+    level = 0;
+    for (sep = dirname + baselen; *sep; sep++)
+      if (*sep == '/')
+        level++;
+
+    WatchDirectory (mssinfo, dirname, level);
+    memcpy (lastdir, dirname, dirlen + 1);
+    count++;
+  }
+
+  StackDestroy (stack, NULL);
+
+  lprintf (2, "[MSeedScan] Watching directories of %d recovered file groups", count);
+} /* End of WatchStateDirectories() */
+
+/***************************************************************************
+ * WatchFiles:
+ *
+ * Wait up to timeoutms milliseconds for changes in watched directories
+ * and check the reported files and directories.  Files left with
+ * records to read, due to the maximum records per scan, are checked
+ * again on the next call without waiting.
+ *
+ * Return 0 on success and -2 on fatal error.
+ ***************************************************************************/
+static int
+WatchFiles (MSScanInfo *mssinfo, time_t scantime, int timeoutms)
+{
+  char buffer[16384] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  char path[MSSCAN_MAXFILENAME];
+  struct inotify_event *event;
+  struct pollfd pfd;
+  WatchNode *wnode;
+  RBNode *tnode;
+  Stack *stack;
+  ssize_t nread;
+  char *ptr;
+  int retval = 0;
+  int rv;
+
+  pfd.fd     = mssinfo->watchfd;
+  pfd.events = POLLIN;
+
+  /* Do not wait when files are left with records to read */
+  if (mssinfo->watchpending->root->left != mssinfo->watchpending->nil)
+    timeoutms = 0;
+
+  if (poll (&pfd, 1, timeoutms) < 0 && errno != EINTR)
+    lprintf (0, "[MSeedScan] Error waiting for directory changes: %s", strerror (errno));
+
+  /* Collect the changed files and directories, merging repeated events */
+  while ((nread = read (mssinfo->watchfd, buffer, sizeof (buffer))) > 0)
+  {
+    for (ptr = buffer; ptr < buffer + nread; ptr += sizeof (struct inotify_event) + event->len)
+    {
+      event = (struct inotify_event *)ptr;
+
+      if (event->mask & IN_Q_OVERFLOW)
+      {
+        lprintf (1, "[MSeedScan] Directory change events lost, scanning %s", mssinfo->dirname);
+        mssinfo->watchfull = 1;
+        continue;
+      }
+
+      if (!(tnode = RBFind (mssinfo->watchtree, &event->wd)))
+        continue;
+
+      wnode = (WatchNode *)tnode->data;
+
+      /* Watch removed, directory deleted or unmounted */
+      if (event->mask & IN_IGNORED)
+      {
+        RBDelete (mssinfo->watchtree, tnode);
+        continue;
+      }
+
+      /* Directory moved, a full scan watches it again if still in the tree */
+      if (event->mask & IN_MOVE_SELF)
+      {
+        inotify_rm_watch (mssinfo->watchfd, event->wd);
+        continue;
+      }
+
+      if (event->len == 0)
+        continue;
+
+      if (snprintf (path, sizeof (path), "%s/%s", wnode->dirname, event->name) >= sizeof (path))
+      {
+        lprintf (0, "[MSeedScan] Directory entry name beyond maximum of %lu characters, skipping:",
+                 sizeof (path) - 1);
+        lprintf (0, "  %s", event->name);
+        continue;
+      }
+
+      WatchAddPending (mssinfo, path, wnode->level);
+    }
+  }
+
+  if (nread < 0 && errno != EAGAIN && errno != EINTR)
+    lprintf (0, "[MSeedScan] Error reading directory changes: %s", strerror (errno));
+
+  /* Check changed files, retaining those with records left to read */
+  stack = StackCreate ();
+  RBBuildStack (mssinfo->watchpending, stack);
+
+  while (param.shutdownsig == 0 && (tnode = (RBNode *)StackPop (stack)))
+  {
+    rv = WatchPath (mssinfo, (char *)tnode->key, *(int *)tnode->data, scantime);
+
+    if (rv == -2)
+    {
+      retval = -2;
+      break;
+    }
+
+    if (rv == 0)
+      RBDelete (mssinfo->watchpending, tnode);
+  }
+
+  StackDestroy (stack, NULL);
+
+  /* Release watching resources if the watch limit was reached */
+  if (mssinfo->watchfd < 0)
+    WatchClose (mssinfo);
+
+  return retval;
+} /* End of WatchFiles() */
+
+/***************************************************************************
+ * WatchAddPending:
+ *
+ * Add a file in a watched directory at the specified recursion level
+ * to the files waiting to be checked, unless already waiting.
+ ***************************************************************************/
+static void
+WatchAddPending (MSScanInfo *mssinfo, char *path, int level)
+{
+  char *pathkey;
+  int *levelp;
+
+  if (RBFind (mssinfo->watchpending, path))
+    return;
+
+  if (!(pathkey = strdup (path)) || !(levelp = (int *)malloc (sizeof (int))))
+  {
+    lprintf (0, "[MSeedScan] Cannot allocate memory for changed file");
+    free (pathkey);
+    return;
+  }
+
+  *levelp = level;
+  RBTreeInsert (mssinfo->watchpending, pathkey, levelp, 0);
+} /* End of WatchAddPending() */
+
+/***************************************************************************
+ * WatchPath:
+ *
+ * Check a file or directory reported as changed in a watched directory
+ * at the specified recursion level.  New directories are scanned, and
+ * thereby watched, within the recursion limit.  Files are checked even
+ * if idle, quiet files and files permanently skipped are not checked.
+ *
+ * Return 0 on success, 1 when records were left to read due to the
+ * per scan maximum and -2 on fatal error.
+ ***************************************************************************/
+static int
+WatchPath (MSScanInfo *mssinfo, char *path, int level, time_t scantime)
+{
+  FileNode *fnode;
+  FileKey *fkey;
+  char filekeybuf[sizeof (FileKey) + MSSCAN_MAXFILENAME]; /* Room for fkey */
+  struct stat st;
+  const char *name;
+  ino_t dirino;
+  int recurlevel;
+  int rv;
+
+  name = strrchr (path, '/') + 1;
+
+  /* BUD file name latency check */
+  if (mssinfo->budlatency)
+  {
+    time_t budfiletime = BudFileDayTime ((char *)name);
+    struct tm cday;
+
+    gmtime_r (&scantime, &cday);
+
+    /* Skip this file if the BUD file name is more than budlatency days old */
+    if (budfiletime &&
+        ((CalcDayTime (cday.tm_year + 1900, cday.tm_yday + 1) - budfiletime) > (mssinfo->budlatency * 86400)))
+      return 0;
+  }
+
+  /* Stat the file, quietly skipping files already removed */
+  if (lstat (path, &st) < 0)
+  {
+    if (errno != ENOENT && !(param.shutdownsig && errno == EINTR))
+      lprintf (0, "[MSeedScan] Cannot stat %s: %s", path, strerror (errno));
+    return 0;
+  }
+
+  dirino = st.st_ino;
+
+  /* If symbolic link stat the real file, if it's a broken link skip */
+  if (S_ISLNK (st.st_mode) && stat (path, &st) < 0)
+  {
+    if (errno != ENOENT && !(param.shutdownsig && errno == EINTR))
+      lprintf (0, "[MSeedScan] Cannot stat (linked) %s: %s", path, strerror (errno));
+    return 0;
+  }
+
+  /* New directory, scan up to the recursion limit */
+  if (S_ISDIR (st.st_mode))
+  {
+    if (mssinfo->maxrecur < 0 || level < mssinfo->maxrecur)
+    {
+      lprintf (4, "[MSeedScan] Recursing into %s", path);
+
+      recurlevel          = mssinfo->recurlevel;
+      mssinfo->recurlevel = level + 1;
+      rv                  = ScanFiles (mssinfo, path, mssinfo->maxrecur, scantime);
+      mssinfo->recurlevel = recurlevel;
+
+      if (rv == -2)
+        return -2;
+    }
+
+    return 0;
+  }
+
+  /* Build a FileKey for this file */
+  fkey        = (FileKey *)&filekeybuf;
+  fkey->inode = dirino;
+  strcpy (fkey->filename, path);
+
+  /* Search for a matching entry in the filetree */
+  if ((fnode = FindFile (mssinfo->filetree, fkey)))
+  {
+    /* Check if the file is permanently skipped */
+    if (fnode->offset == -1)
+    {
+      fnode->scantime = scantime;
+      return 0;
+    }
+
+    /* A change was reported, check an idle file now */
+    fnode->idledelay = 0;
+  }
+
+  return CheckFile (mssinfo, fkey, fnode, name, dirino, &st, scantime);
+} /* End of WatchPath() */
+
+/***************************************************************************
+ * WatchKeyCompare:
+ *
+ * Compare two watch descriptors passed as void pointers.
+ *
+ * Return 1 if a > b, -1 if a < b and 0 otherwise (e.g. equality).
+ ***************************************************************************/
+static int
+WatchKeyCompare (const void *a, const void *b)
+{
+  if (*(const int *)a > *(const int *)b)
+    return 1;
+  else if (*(const int *)a < *(const int *)b)
+    return -1;
+
+  return 0;
+} /* End of WatchKeyCompare() */
+
+/***************************************************************************
+ * WatchPathCompare:
+ *
+ * Compare two path names passed as void pointers.
+ *
+ * Return 1 if a > b, -1 if a < b and 0 otherwise (e.g. equality).
+ ***************************************************************************/
+static int
+WatchPathCompare (const void *a, const void *b)
+{
+  int cmpval = strcmp ((const char *)a, (const char *)b);
+
+  if (cmpval > 0)
+    return 1;
+  else if (cmpval < 0)
+    return -1;
+
+  return 0;
+} /* End of WatchPathCompare() */
+#endif /* MSSCAN_WATCH */
+
 /***************************************************************************
  * SortEDirEntries:
  *
@@ -38,6 +38,8 @@ extern "C" {
 /* Maximum filename length */
 #define MSSCAN_MAXFILENAME 512
 
+struct ScanBatch;
+
 typedef struct MSScanInfo {
   /* Configuration parameters */
   char  dirname[512];     /* Base directory to scan */
@@ -53,6 +55,9 @@ typedef struct MSScanInfo {
   int   throttlensec;     /* Nanoseconds to sleep after reading each record */
   int   filemaxrecs;      /* Maximum records to read from each file per scan */
   int   stateint;         /* State saving interval in seconds */
+  int   watch;            /* Watch directories for changes instead of scanning */
+  int   watchrescan;      /* Full scan interval in seconds when watching */
+  int   parsethreads;     /* Threads parsing records, including the scan thread */
   char  statefile[512];   /* State file to save/restore time stamps (abs path) */
   char  matchstr[512];    /* Filename match expression */
   char  rejectstr[512];   /* Filename reject expression */
@@ -62,13 +67,19 @@ typedef struct MSScanInfo {
   pcre2_match_data *fnreject_data; /* Match data results */
 
   /* Internal tracking parameters */
+  uint32_t maxreclen;     /* Maximum record length, aka packet payload size */
   uint32_t readbuffersize;/* Size of file read buffer */
   char    *readbuffer;    /* File read buffer */
   RingParams *ringparams; /* Ring buffer parameters */
   MS3Record *msr;         /* Parsed miniSEED record */
+  struct ScanBatch *batch;/* Records read from a file and parsing threads */
   RBTree  *filetree;      /* Working list of scanned files in a tree */
   int      accesserr;     /* Flag to indicate directory access errors */
   int      recurlevel;    /* Track recursion level */
+  int      watchfd;       /* Directory watch (inotify) descriptor, -1 if not watching */
+  RBTree  *watchtree;     /* Watched directories by watch descriptor */
+  RBTree  *watchpending;  /* Files with changes waiting to be processed */
+  int      watchfull;     /* Flag to request a full scan, e.g. after lost events */
 
   uint64_t rxpackets[2];  /* Track total number of packets sent to ring */
   double   rxpacketrate;  /* Track rate of packet reading */
@@ -20,6 +20,10 @@
  * only one writer may modify the ring at a time.  Ring reading is
  * lockless with post-operation checking guaranteeing consistency.
  *
+ * Readers that have reached the end of the ring may register in a
+ * wait list and are notified via a descriptor when a new packet is
+ * written, allowing them to sleep in poll() along with other I/O.
+ *
  * In general, non-existent packets are represented with a packet ID
  * of 0 and an offset of -1.
  *
@@ -43,6 +47,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -52,23 +57,145 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <sys/resource.h>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+
 #include <libmseed.h>
 
 #include "generic.h"
 #include "logging.h"
-#include "rbtree.h"
 #include "ring.h"
 
+/* Stream match verdict cache sizing, in slots */
+#define MATCHCACHE_MINSIZE 256
+#define MATCHCACHE_MAXSIZE 1048576
+
+/* Stream match verdict cache values */
+#define MATCHCACHE_EMPTY 0
+#define MATCHCACHE_ACCEPT 1
+#define MATCHCACHE_REJECT 2
+
+/* Maximum number of selected streams a reader will follow using the
+ * per-stream packet chains, wider selections scan the ring */
+#define STREAMSET_MAXSTREAMS 128
+
+/* Stream index table size in slots and entry allocation block size, the
+ * block size keeps memory mapped blocks page aligned with common page sizes */
+#define STREAMIDX_MINSIZE 1024
+#define STREAMIDX_BLOCKSIZE 4096
+
+/* Number of stream index changes logged for readers to update their
+ * selected streams incrementally, see StreamSetBuild() */
+#define STREAMIDX_CHANGES 1024
+
+/* Number of consecutive packet slots summarized by each time index entry */
+#define TIMEIDX_BLOCKPACKETS 1024
+
+/* Time index values for blocks with no packets */
+#define TIMEIDX_EMPTY(B) ((B)->mindatastart = INT64_MAX, (B)->maxdataend = INT64_MIN)
+
+/* Ring rebuild parallelism, the maximum number of threads and the
+ * minimum number of packet slots handled by each thread */
+#define REBUILD_MAXTHREADS 32
+#define REBUILD_MINSLOTS 65536
+
+/* Size of ring memory pre-faulted in each step */
+#define PREFAULT_CHUNK (64 * 1024 * 1024)
+
+/* Length of the anonymous mapping of a ring packet buffer in memory,
+ * 0 when allocated with malloc(), see RingMemoryAlloc() */
+static size_t ringmapsize = 0;
+
+/* Part of the ring handled by a thread during a rebuild */
+typedef struct RebuildPart
+{
+  RingParams *ringparams;
+  pthread_t   thread;
+  int         started;       /* Flag indicating the thread was started */
+  int         rv;            /* Result, 0 on success and -1 on error */
+  uint64_t    start;         /* First slot, or ring position when linking */
+  uint64_t    count;         /* Number of slots or ring positions */
+  uint64_t    earliestslot;  /* Slot of earliest packet when linking or indexing */
+  uint64_t    ringcount;     /* Number of packets in ring when indexing */
+  uint64_t    valid;         /* Count of valid packet headers */
+  uint64_t    maxid;         /* Highest packet ID */
+  int64_t     maxslot;       /* Slot of highest packet ID, -1 if none */
+  int64_t    *runstarts;     /* Slots where runs of increasing packet IDs start */
+  uint64_t    runcount;      /* Count of run starts */
+  uint64_t    runsize;       /* Allocated size of runstarts */
+  RingStreamIdx *streamidx;  /* Streams of the part when linking */
+} RebuildPart;
+
+/* Packets are published to lock-free readers by storing the latest
+ * offset with release semantics after the packet is complete, readers
+ * load it with acquire semantics before reading packets */
+#define RING_PUBLISH(P, V) __atomic_store_n (&(P), (V), __ATOMIC_RELEASE)
+#define RING_ACQUIRE(P) __atomic_load_n (&(P), __ATOMIC_ACQUIRE)
+
 /* Macros to determine next and previous packet offsets given an
  * reference offset, maximum offset, and packet size */
 #define NEXTOFFSET(O, M, S) (((O) + (S) > (M)) ? 0 : (O) + (S))
 #define PREVOFFSET(O, M, S) (((O) == 0) ? (M) : (O) - (S))
 
 static int StreamStackNodeCmp (StackNode *a, StackNode *b);
+static int StreamCmp (const void *a, const void *b);
 static inline int64_t FindOffsetForID (RingParams *ringparams, uint64_t pktid, nstime_t *pkttime);
-static RingStream *AddStreamIdx (RBTree *streamidx, RingStream *stream, Key **ppkey);
-static RingStream *GetStreamIdx (RBTree *streamidx, char *streamid);
-static int DelStreamIdx (RBTree *streamidx, char *streamid);
+static RingStreamIdx *StreamIdxCreate (int fd);
+static int StreamIdxLoad (RingParams *ringparams, char *streamfilename);
+static int StreamIdxMap (RingParams *ringparams, char *streamfilename);
+static int StreamIdxSync (RingStreamIdx *streamidx);
+static void StreamIdxDestroy (RingStreamIdx *streamidx);
+static RingStream *StreamIdxBlock (RingStreamIdx *streamidx);
+static RingStream *AddStreamIdx (RingStreamIdx *streamidx, RingStream *stream, uint64_t *pkey);
+static RingStream *GetStreamIdx (RingStreamIdx *streamidx, char *streamid);
+static int DelStreamIdx (RingStreamIdx *streamidx, char *streamid);
+static void StreamIdxChanged (RingParams *ringparams, const char *streamid, uint64_t key,
+                              uint8_t removed);
+static inline uint32_t StreamIdxSlot (RingStreamIdx *streamidx, uint64_t key);
+static inline uint64_t StreamKey (const char *streamid);
+static void RingNotifyWaiters (RingParams *ringparams);
+static int StreamSelected (RingReader *reader, const char *streamid);
+static int MatchCacheInsert (RingMatchCache *cache, uint64_t key, uint8_t verdict);
+static uint64_t ReadNextPacket (RingReader *reader, RingPacket *packet, char *packetdata,
+                               char **packetref);
+static int StreamSetReadNext (RingReader *reader, RingPacket *packet, char *packetdata,
+                              char **packetref);
+static int StreamSetBuild (RingReader *reader);
+static int StreamSetCursor (RingParams *ringparams, RingStreamCursor *cursor, RingStream *entry,
+                            uint64_t key, uint64_t pktid);
+static void StreamSetHeapPush (RingStreamSet *set, int cidx);
+static void StreamSetHeapDown (RingStreamSet *set, int hidx);
+static inline void StreamUpdateBegin (RingParams *ringparams);
+static inline void StreamUpdateEnd (RingParams *ringparams);
+static void StreamCopy (RingParams *ringparams, RingStream *dest, RingStream *stream);
+static int RingReserve (RingParams *ringparams, RingPacket *packet, nstime_t pkttime,
+                        uint64_t *reserveseq);
+static int RingCommit (RingParams *ringparams);
+static inline RingPacket *RebuildPacket (RingParams *ringparams, uint64_t slot);
+static void *RebuildScan (void *arg);
+static void *RebuildLink (void *arg);
+static int RebuildRun (RebuildPart *parts, int partcount, void *(*routine) (void *));
+static int RingRebuild (RingParams *ringparams);
+static size_t HugePageSize (void);
+static void *RingMemoryAlloc (uint64_t ringsize, const RingMemOptions *memopts);
+static void RingMemoryFree (void *ring);
+static int RingMemoryPolicy (void *ring, uint64_t ringsize, const RingMemOptions *memopts);
+static void RingMemoryPrefault (void *ring, uint64_t ringsize, uint8_t mmapflag,
+                                const RingMemOptions *memopts);
+static void RingMemoryPolicyReset (const RingMemOptions *memopts);
+static int TimeIndexInit (RingParams *ringparams);
+static void *TimeIndexScan (void *arg);
+static void TimeIndexUpdate (RingParams *ringparams, RingPacket *packet);
+static int64_t TimeIndexSkipForward (RingParams *ringparams, int64_t offset,
+                                     int64_t latestoffset, nstime_t reftime,
+                                     uint64_t *count);
+static uint64_t TimeIndexSkipReverse (RingParams *ringparams, int64_t offset,
+                                      int64_t earliestoffset, nstime_t reftime);
 
 /***************************************************************************
  * RingInitialize:
@@ -79,6 +206,15 @@ static int DelStreamIdx (RBTree *streamidx, char *streamid);
  * ring file = main packet buffer file, optionally memory mapped
  * stream file = stream index file, loaded into ringparams->streams
  *
+ * If rebuildflag is set an existing ring that is marked as corrupt or
+ * busy, or whose stream index is missing or inconsistent, is rebuilt
+ * from the packet headers with RingRebuild() instead of being
+ * reported as corrupt.
+ *
+ * The optional memopts control huge pages, NUMA placement and
+ * pre-faulting of the packet buffer memory, see RingMemoryAlloc(),
+ * RingMemoryPolicy() and RingMemoryPrefault().
+ *
  * Return >0 on buffer version mismatch, the version number is returned
  * Return  0 on success
  * Return -1 on corruption errors
@@ -87,15 +223,15 @@ static int DelStreamIdx (RBTree *streamidx, char *streamid);
 int
 RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
                 uint32_t pktsize, uint8_t mmapflag, uint8_t volatileflag,
+                uint8_t rebuildflag, const RingMemOptions *memopts,
                 int *ringfd, RingParams **ringparams)
 {
   static pthread_mutex_t writelock;
   static pthread_mutex_t streamlock;
+  static pthread_mutex_t notifylock;
+  static pthread_cond_t commitcond;
 
   struct stat ringfilestat;
-  struct stat streamfilestat;
-  int streamidxfd;
-  RingStream stream;
 
   long pagesize;
   uint32_t headersize;
@@ -104,9 +240,9 @@ RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
   mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
 
   int corruptring = 0;
+  int rebuildring = 0;
   int ringinit    = 0;
   int rc;
-  ssize_t rv;
   RingPacket *packetptr;
   RingStream *streamptr;
 
@@ -219,6 +355,23 @@ RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
       lprintf (0, "%s(): error mmaping %s: %s", __func__, ringfilename, strerror (errno));
       return -1;
     }
+
+    /* Huge pages for file mappings are only possible for some file systems */
+    if (memopts && memopts->hugepages == RING_HUGEPAGES_TRANSPARENT)
+    {
+#if defined(MADV_HUGEPAGE)
+      if (madvise (*ringparams, ringsize, MADV_HUGEPAGE))
+        lprintf (0, "Cannot advise transparent huge pages for ring packet buffer file: %s",
+                 strerror (errno));
+#endif
+    }
+    else if (memopts && memopts->hugepages == RING_HUGEPAGES_EXPLICIT)
+    {
+      lprintf (0, "Explicit huge pages for a memory-mapped ring require a ring directory on hugetlbfs, ignoring");
+    }
+
+    if (RingMemoryPolicy (*ringparams, ringsize, memopts))
+      return -2;
   }
   /* Read ring packet buffer into memory if not memory-mapping. */
   else
@@ -226,13 +379,17 @@ RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
     lprintf (2, "Allocating ring packet buffer memory");
 
     /* Allocate ring packet buffer */
-    if (!(*ringparams = malloc (ringsize)))
+    if (!(*ringparams = RingMemoryAlloc (ringsize, memopts)))
     {
       lprintf (0, "%s(): error allocating %" PRIu64 " bytes for ring packet buffer",
                __func__, ringsize);
       return -2;
     }
 
+    /* Set memory placement before the memory is first touched */
+    if (RingMemoryPolicy (*ringparams, ringsize, memopts))
+      return -2;
+
     /* Force ring initialization if volatile */
     if (volatileflag)
       ringinit = 1;
@@ -251,18 +408,25 @@ RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
     }
   }
 
+  /* Fault in the packet buffer memory before it is used */
+  RingMemoryPrefault (*ringparams, ringsize, mmapflag, memopts);
+
   /* Check ring corruption flag, if set the ring was earlier determined to be corrupt */
   if ((*ringparams)->corruptflag && !volatileflag)
   {
     lprintf (0, "** Packet buffer is marked as corrupt");
-    return -1;
+    if (!rebuildflag)
+      return -1;
+    rebuildring = 1;
   }
 
   /* Check ring flux flag, if set the ring should be considered corrupt */
   if ((*ringparams)->fluxflag && !volatileflag)
   {
     lprintf (0, "** Packet buffer is marked as busy, probably corrupted");
-    return -1;
+    if (!rebuildflag)
+      return -1;
+    rebuildring = 1;
   }
 
   /* If signature match but version mismatch return current buffer version */
@@ -285,13 +449,29 @@ RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
     lprintf (0, "%s(): error initializing stream lock: %s", __func__, strerror (rc));
     return -2;
   }
+  if ((rc = pthread_mutex_init (&notifylock, NULL)))
+  {
+    lprintf (0, "%s(): error initializing notify lock: %s", __func__, strerror (rc));
+    return -2;
+  }
+  if ((rc = pthread_cond_init (&commitcond, NULL)))
+  {
+    lprintf (0, "%s(): error initializing commit condition: %s", __func__, strerror (rc));
+    return -2;
+  }
 
   /* Initialize volatile ring packet buffer parameters */
   (*ringparams)->writelock    = &writelock;
   (*ringparams)->streamlock   = &streamlock;
+  (*ringparams)->notifylock   = &notifylock;
+  (*ringparams)->commitcond   = &commitcond;
+  (*ringparams)->waiters      = NULL;
+  (*ringparams)->writeseq     = 0;
+  (*ringparams)->streamgen    = 0;
+  (*ringparams)->streamseq    = 0;
   (*ringparams)->mmapflag     = mmapflag;
   (*ringparams)->volatileflag = volatileflag;
-  (*ringparams)->streamidx    = RBTreeCreate (KeyCompare, free, free);
+  (*ringparams)->streamidx    = StreamIdxCreate (-1);
   (*ringparams)->streamcount  = 0;
   (*ringparams)->ringstart    = NSnow ();
   (*ringparams)->data         = ((uint8_t *)(*ringparams)) + headersize;
@@ -353,58 +533,21 @@ RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
 
     /* Clear unused header space */
     memset (((char *)(*ringparams)) + sizeof (RingParams), 0, headersize - sizeof (RingParams));
+
+    /* Nothing to rebuild in a reset ring */
+    rebuildring = 0;
   }
   /* If the ring has not been reset and packets are present recover stream index */
-  else if ((*ringparams)->earliestoffset >= 0)
+  else if ((*ringparams)->earliestoffset >= 0 && !rebuildring)
   {
     lprintf (1, "Recovering stream index");
 
-    /* Open stream index file */
-    if ((streamidxfd = open (streamfilename, O_RDONLY, 0)) < 0)
-    {
-      lprintf (0, "%s(): error opening %s: %s", __func__, streamfilename, strerror (errno));
-      return -1;
-    }
-
-    /* Stat the streams file */
-    if (fstat (streamidxfd, &streamfilestat))
-    {
-      lprintf (0, "%s(): error stating %s: %s", __func__, streamfilename, strerror (errno));
-      return -1;
-    }
-
-    if (streamfilestat.st_size > 0)
+    if (StreamIdxLoad (*ringparams, streamfilename))
     {
-      /* Read the saved RingStreams */
-      while ((rv = read (streamidxfd, &stream, sizeof (RingStream)) == sizeof (RingStream)))
-      {
-        /* Re-populating streams index */
-        if (!AddStreamIdx ((*ringparams)->streamidx, &stream, 0))
-        {
-          lprintf (0, "%s(): error adding stream to index", __func__);
-          corruptring = 1;
-        }
-        else
-        {
-          (*ringparams)->streamcount++;
-        }
-      }
-
-      /* Test for read error */
-      if (rv < 0)
-      {
-        lprintf (0, "%s(): error reading %s: %s", __func__, streamfilename, strerror (errno));
+      if (!rebuildflag)
         return -1;
-      }
-    }
-    else
-    {
-      lprintf (0, "%s(): stream index file empty!", __func__);
-      return -1;
+      rebuildring = 1;
     }
-
-    /* Close the stream index file and release file name memory */
-    close (streamidxfd);
   }
 
   if ((*ringparams)->earliestoffset > (*ringparams)->maxoffset)
@@ -420,7 +563,7 @@ RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
 
   /* Sanity checks: compare earliest and latest packet offsets between RingParams and lookups
    * and check the earliest and latest stream entries. */
-  if (!corruptring && (*ringparams)->earliestoffset >= 0)
+  if (!corruptring && !rebuildring && (*ringparams)->earliestoffset >= 0)
   {
     packetptr = (RingPacket *)((*ringparams)->data + (*ringparams)->earliestoffset);
 
@@ -435,7 +578,7 @@ RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
       corruptring = 1;
     }
   }
-  if (!corruptring && (*ringparams)->latestoffset >= 0)
+  if (!corruptring && !rebuildring && (*ringparams)->latestoffset >= 0)
   {
     packetptr = (RingPacket *)((*ringparams)->data + (*ringparams)->latestoffset);
 
@@ -451,17 +594,28 @@ RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
     }
   }
 
+  /* Rebuild the ring from the packet headers if inconsistent */
+  if (rebuildflag && (rebuildring || corruptring))
+  {
+    corruptring = (RingRebuild (*ringparams)) ? 1 : 0;
+  }
+
   /* If corruption was detected cleanup before returning */
   if (corruptring)
   {
-    RBTreeDestroy ((*ringparams)->streamidx);
+    StreamIdxDestroy ((*ringparams)->streamidx);
 
-    /* Unmap the ring file */
-    if (munmap ((void *)(*ringparams), ringsize))
+    /* Unmap the ring file or free the ring read into memory */
+    if (!mmapflag)
+    {
+      RingMemoryFree (*ringparams);
+    }
+    else if (munmap ((void *)(*ringparams), ringsize))
     {
       lprintf (0, "%s(): error unmapping ring file: %s", __func__, strerror (errno));
       return -1;
     }
+    *ringparams = NULL;
 
     /* Close the ring file and re-init the descriptor */
     if (close (*ringfd))
@@ -474,6 +628,27 @@ RingInitialize (char *ringfilename, char *streamfilename, uint64_t ringsize,
     return -1;
   }
 
+  /* Keep the stream index of a memory mapped ring in a memory mapped file */
+  if (mmapflag && StreamIdxMap (*ringparams, streamfilename))
+  {
+    lprintf (0, "%s(): error mapping stream index file %s", __func__, streamfilename);
+    return -2;
+  }
+
+  /* Allocate time index, summarizing packets already in the ring */
+  if (TimeIndexInit (*ringparams))
+  {
+    lprintf (0, "%s(): error allocating time index", __func__);
+    return -2;
+  }
+
+  /* Reservations of new packets follow the latest packet */
+  (*ringparams)->reserveoffset = (*ringparams)->latestoffset;
+  (*ringparams)->reserveid     = (*ringparams)->latestid;
+  (*ringparams)->reserveseq    = 0;
+  (*ringparams)->commitseq     = 0;
+  (*ringparams)->reservecount  = 0;
+
   lprintf (0, "Ring initialized");
 
   return 0;
@@ -496,10 +671,10 @@ RingShutdown (int ringfd, char *streamfilename, RingParams *ringparams)
   int streamidxfd;
   int rc;
   int rv = 0;
-  Stack *streams;
+  int mappedidx;
   RingStream *stream;
+  uint32_t slot;
 
-  RBNode *tnode;
   mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
 
   if (!ringparams)
@@ -508,56 +683,70 @@ RingShutdown (int ringfd, char *streamfilename, RingParams *ringparams)
   if (!ringparams->volatileflag && (!ringfd || !streamfilename))
     return -1;
 
+  mappedidx = (ringparams->streamidx->fd >= 0);
+
   /* Free memory and return if ring is volatile */
   if (ringparams->volatileflag)
   {
-    RBTreeDestroy (ringparams->streamidx);
-    free (ringparams);
+    StreamIdxDestroy (ringparams->streamidx);
+    free (ringparams->timeidx);
+    RingMemoryFree (ringparams);
     return 0;
   }
 
-  /* Open stream index file */
-  if ((streamidxfd = open (streamfilename, O_RDWR | O_CREAT | O_TRUNC, mode)) < 0)
-  {
-    lprintf (0, "%s(): error opening %s: %s", __func__, streamfilename, strerror (errno));
-    rv = -1;
-  }
-
   /* Lock ring against writes, never give this up, destroyed later */
   pthread_mutex_lock (ringparams->writelock);
 
   /* Set ring flux flag */
   ringparams->fluxflag = 1;
 
-  /* Create Stack of RingStreams */
-  streams = StackCreate ();
-  RBBuildStack (ringparams->streamidx, streams);
-
-  /* Write RingStreams to stream index file */
-  lprintf (1, "Writing stream index file");
-  while ((tnode = (RBNode *)StackPop (streams)))
+  /* A memory mapped stream index is current, flush it to the file */
+  if (mappedidx)
   {
-    stream = (RingStream *)tnode->data;
-
-    if (write (streamidxfd, stream, sizeof (RingStream)) != sizeof (RingStream))
+    lprintf (1, "Syncing stream index file");
+    if (StreamIdxSync (ringparams->streamidx))
     {
-      lprintf (0, "%s(): error writing to %s: %s", __func__, streamfilename, strerror (errno));
+      lprintf (0, "%s(): error syncing %s: %s", __func__, streamfilename, strerror (errno));
       rv = -1;
     }
   }
-
-  /* Close the streams file */
-  if (close (streamidxfd))
+  /* Otherwise write RingStreams to stream index file */
+  else if ((streamidxfd = open (streamfilename, O_RDWR | O_CREAT | O_TRUNC, mode)) < 0)
   {
-    lprintf (0, "%s(): error closing %s: %s", __func__, streamfilename, strerror (errno));
+    lprintf (0, "%s(): error opening %s: %s", __func__, streamfilename, strerror (errno));
     rv = -1;
   }
+  else
+  {
+    lprintf (1, "Writing stream index file");
+    for (slot = 0; slot < ringparams->streamidx->size; slot++)
+    {
+      if (!(stream = ringparams->streamidx->entries[slot]))
+        continue;
+
+      if (write (streamidxfd, stream, sizeof (RingStream)) != sizeof (RingStream))
+      {
+        lprintf (0, "%s(): error writing to %s: %s", __func__, streamfilename, strerror (errno));
+        rv = -1;
+      }
+    }
+
+    /* Close the streams file */
+    if (close (streamidxfd))
+    {
+      lprintf (0, "%s(): error closing %s: %s", __func__, streamfilename, strerror (errno));
+      rv = -1;
+    }
+  }
 
   /* Cleanup stream index related memory */
-  RBTreeDestroy (ringparams->streamidx);
-  StackDestroy (streams, 0);
+  StreamIdxDestroy (ringparams->streamidx);
   ringparams->streamidx = NULL;
 
+  /* Cleanup time index */
+  free (ringparams->timeidx);
+  ringparams->timeidx = NULL;
+
   /* Destroy streams index lock */
   if ((rc = pthread_mutex_destroy (ringparams->streamlock)))
   {
@@ -566,6 +755,23 @@ RingShutdown (int ringfd, char *streamfilename, RingParams *ringparams)
   }
   ringparams->streamlock = NULL;
 
+  /* Destroy reader notification lock */
+  if ((rc = pthread_mutex_destroy (ringparams->notifylock)))
+  {
+    lprintf (0, "%s(): error destroying notify lock: %s", __func__, strerror (rc));
+    rv = -1;
+  }
+  ringparams->notifylock = NULL;
+  ringparams->waiters    = NULL;
+
+  /* Destroy commit condition */
+  if ((rc = pthread_cond_destroy (ringparams->commitcond)))
+  {
+    lprintf (0, "%s(): error destroying commit condition: %s", __func__, strerror (rc));
+    rv = -1;
+  }
+  ringparams->commitcond = NULL;
+
   if (ringparams->mmapflag)
   {
     /* Clear ring flux flag */
@@ -618,7 +824,7 @@ RingShutdown (int ringfd, char *streamfilename, RingParams *ringparams)
     }
 
     /* Free the ring buffer memory */
-    free (ringparams);
+    RingMemoryFree (ringparams);
   }
 
   /* Close the ring file */
@@ -635,7 +841,7 @@ RingShutdown (int ringfd, char *streamfilename, RingParams *ringparams)
  * RingWrite:
  *
  * Add packet to the ring including updates to the packet and stream
- * indexes.
+ * indexes.  The packet data size is set to datasize.
  *
  * This routine will set the pktid, offset, pkttime, nextpacket and
  * nextstream values for the packet after they are determined.  If
@@ -643,8 +849,7 @@ RingShutdown (int ringfd, char *streamfilename, RingParams *ringparams)
  * ring will almost certainly be out of sync and should be considered
  * corrupt, this is indicated with a return value of -2.
  *
- * If ring corruption is detected the corruptflag ring parameter will
- * be set in order to trigger auto recovery on the next start.
+ * See RingWriteBatch() for details.
  *
  * Returns 0 on success, -1 on non-corruption error and -2 on corrupt
  * ring error.
@@ -653,36 +858,220 @@ int
 RingWrite (RingParams *ringparams, RingPacket *packet,
            char *packetdata, uint32_t datasize)
 {
-  RingStream *stream;
-  RingStream newstream;
-  RingPacket *earliest = NULL;
-  RingPacket *latest   = NULL;
-  RingPacket *prevlatest;
-  RBNode *node = NULL;
-  Key *skey;
+  if (!packet)
+    return -1;
 
-  uint64_t pktid;
-  int64_t offset;
+  packet->datasize = datasize;
+
+  return RingWriteBatch (ringparams, packet, &packetdata, 1);
+} /* End of RingWrite() */
+
+/***************************************************************************
+ * RingWriteBatch:
+ *
+ * Add an array of packets to the ring, in order, including updates to
+ * the packet and stream indexes.  The data of each packet, of the
+ * size in the packet header, is at the corresponding entry of the
+ * packetdata array.
+ *
+ * The pktid, offset, pkttime and nextinstream values of each packet
+ * are set after they are determined.  Packets are assigned contiguous
+ * IDs, unless an ID is specified, and share a creation time for each
+ * group of reservations.  All packet sizes are checked before any
+ * packet is added.  If this routine fails after starting to modify the
+ * ring constructs the ring will almost certainly be out of sync and
+ * should be considered corrupt, this is indicated with a return value
+ * of -2.
+ *
+ * Multiple producers write concurrently in three steps: slots are
+ * reserved (evicting the earliest packets if needed) under the ring
+ * write lock, the packets are copied into the slots without any lock
+ * and the reserved packets are committed, in reservation order, under
+ * the write lock by whichever producer finds the next reservation
+ * filled.  Each producer returns after its own packets have been
+ * committed.  A batch is reserved in groups of up to half of the
+ * reservation window, each group taking the write lock twice, so the
+ * lock and notification costs are shared by the packets of a group.
+ *
+ * The stream index lock is only held while streams are added or
+ * removed, stream entries are otherwise updated in place for readers
+ * using StreamCopy().  Packets are published to readers by the final
+ * store of the latest offset.
+ *
+ * The ring flux flag is only set while the ring and stream index are
+ * modified under the write lock, so a ring left by an unclean shutdown
+ * at any other time is consistent.  Packets reserved but not committed
+ * are beyond the latest packet and are overwritten after a restart.
+ *
+ * If ring corruption is detected the corruptflag ring parameter will
+ * be set in order to trigger auto recovery on the next start.
+ *
+ * Returns 0 on success, -1 on non-corruption error and -2 on corrupt
+ * ring error.
+ ***************************************************************************/
+int
+RingWriteBatch (RingParams *ringparams, RingPacket *packets,
+                char **packetdata, uint32_t count)
+{
+  RingPacket *packet;
+  nstime_t pkttime;
+  uint64_t firstseq = 0;
+  uint64_t reserveseq = 0;
+  uint64_t seq;
+  uint32_t groupmax;
+  uint32_t group;
+  uint32_t written = 0;
+  uint32_t idx;
+  int committed;
+  int rv = 0;
 
-  if (!ringparams || !packet || !packetdata)
+  if (!ringparams || !packets || !packetdata)
     return -1;
 
-  /* Check packet size */
-  if ((sizeof (RingPacket) + datasize) > ringparams->pktsize)
+  /* Check packet sizes */
+  for (idx = 0; idx < count; idx++)
   {
-    lprintf (0, "%s(): %s packet size too large (%lu), maximum is %d bytes",
-             __func__, packet->streamid, (sizeof (RingPacket) + datasize), ringparams->pktsize);
-    return -1;
+    if (!packetdata[idx])
+      return -1;
+
+    if ((sizeof (RingPacket) + packets[idx].datasize) > ringparams->pktsize)
+    {
+      lprintf (0, "%s(): %s packet size too large (%lu), maximum is %d bytes",
+               __func__, packets[idx].streamid, (sizeof (RingPacket) + packets[idx].datasize),
+               ringparams->pktsize);
+      return -1;
+    }
   }
 
-  /* Lock ring and streams index */
-  pthread_mutex_lock (ringparams->writelock);
-  pthread_mutex_lock (ringparams->streamlock);
+  /* Limit groups to half of the reservation window, leaving room for
+   * other producers, and to the ring capacity so that only committed
+   * packets are evicted */
+  groupmax = RING_MAXRESERVED / 2;
+  if (ringparams->maxpackets < groupmax + 2)
+    groupmax = (ringparams->maxpackets > 2) ? (uint32_t)(ringparams->maxpackets - 2) : 1;
 
-  /* Set ring flux flag */
-  ringparams->fluxflag = 1;
+  while (written < count)
+  {
+    group = (count - written < groupmax) ? count - written : groupmax;
+
+    /* Lock ring */
+    pthread_mutex_lock (ringparams->writelock);
+
+    /* Wait for reservations, the earliest packets evicted must be committed */
+    while (!ringparams->corruptflag && ringparams->reservecount &&
+           (ringparams->reservecount + group > RING_MAXRESERVED ||
+            ringparams->reservecount + group + 1 >= ringparams->maxpackets))
+    {
+      pthread_cond_wait (ringparams->commitcond, ringparams->writelock);
+    }
+
+    if (ringparams->corruptflag)
+    {
+      pthread_mutex_unlock (ringparams->writelock);
+      return -2;
+    }
+
+    /* Set ring flux flag */
+    ringparams->fluxflag = 1;
+
+    pkttime = NSnow ();
+
+    for (idx = written; idx < written + group; idx++)
+    {
+      if (RingReserve (ringparams, &packets[idx], pkttime, &reserveseq))
+      {
+        pthread_mutex_unlock (ringparams->writelock);
+        return -2;
+      }
+
+      if (idx == written)
+        firstseq = reserveseq;
+    }
+
+    /* Clear ring flux flag, reserved slots are not part of the ring until committed */
+    ringparams->fluxflag = 0;
+
+    pthread_mutex_unlock (ringparams->writelock);
+
+    /* Copy packet headers into ring */
+    for (idx = written; idx < written + group; idx++)
+    {
+      memcpy ((ringparams->data + packets[idx].offset), &packets[idx], sizeof (RingPacket));
+    }
+
+    /* Publish the headers before the data, readers referencing the data in
+     * place detect replacement by re-checking the header, see RingReadValid() */
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    /* Copy packet data into ring directly after headers */
+    for (idx = written; idx < written + group; idx++)
+    {
+      memcpy ((ringparams->data + packets[idx].offset + sizeof (RingPacket)),
+              packetdata[idx], packets[idx].datasize);
+    }
+
+    pthread_mutex_lock (ringparams->writelock);
+
+    for (seq = firstseq; seq <= reserveseq; seq++)
+      ringparams->reservefilled[seq % RING_MAXRESERVED] = 1;
+
+    /* Commit filled reservations in order, waiting for earlier producers if needed */
+    committed = RingCommit (ringparams);
+
+    while (ringparams->commitseq < reserveseq && !ringparams->corruptflag)
+    {
+      pthread_cond_wait (ringparams->commitcond, ringparams->writelock);
+    }
+
+    if (ringparams->commitseq < reserveseq || committed < 0)
+      rv = -2;
+
+    pthread_mutex_unlock (ringparams->writelock);
+
+    /* Wake up readers waiting for new packets */
+    if (committed > 0)
+      RingNotifyWaiters (ringparams);
+
+    if (rv)
+      return rv;
+
+    if (verbose >= 3)
+    {
+      for (idx = written; idx < written + group; idx++)
+      {
+        packet = &packets[idx];
+        lprintf (3, "Added packet for stream %s, pktid: %" PRIu64 ", offset: %" PRIu64,
+                 packet->streamid, packet->pktid, packet->offset);
+      }
+    }
+
+    written += group;
+  }
+
+  return 0;
+} /* End of RingWriteBatch() */
+
+/***************************************************************************
+ * RingReserve:
+ *
+ * Reserve the next packet slot following the latest reservation for a
+ * packet, evicting the earliest packet if the ring is full, and set
+ * the pktid, offset, pkttime and nextinstream values of the packet.
+ * Must be called with the ring write lock held and the flux flag set.
+ *
+ * Returns 0 on success, with the reservation sequence in reserveseq,
+ * and -2 on corrupt ring error, in which case the corrupt flag is set.
+ ***************************************************************************/
+static int
+RingReserve (RingParams *ringparams, RingPacket *packet, nstime_t pkttime,
+             uint64_t *reserveseq)
+{
+  RingPacket *earliest = NULL;
+  RingPacket *latest   = NULL;
+  uint64_t pktid;
+  int64_t offset;
 
-  /* Set packet entries for earliest and latest packets in ring */
+  /* Set packet entries for earliest and latest committed packets in ring */
   if (ringparams->earliestoffset >= 0)
   {
     earliest = (RingPacket *)(ringparams->data + ringparams->earliestoffset);
@@ -692,11 +1081,11 @@ RingWrite (RingParams *ringparams, RingPacket *packet,
     latest = (RingPacket *)(ringparams->data + ringparams->latestoffset);
   }
 
-  /* Determine next packet ID and offset */
-  if (latest)
+  /* Determine next packet ID and offset following the latest reservation */
+  if (ringparams->reserveoffset >= 0)
   {
-    offset = NEXTOFFSET (latest->offset, ringparams->maxoffset, ringparams->pktsize);
-    pktid  = latest->pktid + 1;
+    offset = NEXTOFFSET (ringparams->reserveoffset, ringparams->maxoffset, ringparams->pktsize);
+    pktid  = ringparams->reserveid + 1;
 
     /* In the unlikely event we reached the end of the universe start again with 1 */
     if (pktid > RINGID_MAXIMUM)
@@ -714,7 +1103,7 @@ RingWrite (RingParams *ringparams, RingPacket *packet,
   /* Update new packet details */
   packet->pktid        = (packet->pktid == RINGID_NONE) ? pktid : packet->pktid;
   packet->offset       = offset;
-  packet->pkttime      = NSnow ();
+  packet->pkttime      = pkttime;
   packet->nextinstream = -1;
 
   /* Remove earliest packet if ring is full (next == earliest) */
@@ -736,8 +1125,7 @@ RingWrite (RingParams *ringparams, RingPacket *packet,
         lprintf (0, "%s(): Error getting earliest packet stream", __func__);
         ringparams->corruptflag = 1;
         ringparams->fluxflag    = 0;
-        pthread_mutex_unlock (ringparams->writelock);
-        pthread_mutex_unlock (ringparams->streamlock);
+        pthread_cond_broadcast (ringparams->commitcond);
         return -2;
       }
 
@@ -756,109 +1144,164 @@ RingWrite (RingParams *ringparams, RingPacket *packet,
           earliest->offset == streamOfEarliest->latestoffset)
       {
         lprintf (2, "Removing stream index entry for %s", earliest->streamid);
+        pthread_mutex_lock (ringparams->streamlock);
         DelStreamIdx (ringparams->streamidx, earliest->streamid);
         ringparams->streamcount--;
+        StreamIdxChanged (ringparams, earliest->streamid, StreamKey (earliest->streamid), 1);
+        pthread_mutex_unlock (ringparams->streamlock);
       }
       /* Else update stream entry for the next packet in the stream */
       else if (nextInStream)
       {
+        StreamUpdateBegin (ringparams);
         streamOfEarliest->earliestdstime = nextInStream->datastart;
         streamOfEarliest->earliestdetime = nextInStream->dataend;
         streamOfEarliest->earliestptime  = nextInStream->pkttime;
         streamOfEarliest->earliestid     = nextInStream->pktid;
         streamOfEarliest->earliestoffset = nextInStream->offset;
+        StreamUpdateEnd (ringparams);
       }
     }
   }
 
-  /* Find RingStream entry, creating if not found */
-  if (!(stream = GetStreamIdx (ringparams->streamidx, packet->streamid)))
+  /* Reserve the slot */
+  *reserveseq = ++ringparams->reserveseq;
+  ringparams->reserveoffset = offset;
+  ringparams->reserveid     = packet->pktid;
+  ringparams->reservecount++;
+  ringparams->reservefilled[*reserveseq % RING_MAXRESERVED] = 0;
+
+  return 0;
+} /* End of RingReserve() */
+
+/***************************************************************************
+ * RingCommit:
+ *
+ * Commit reserved packets that have been copied into the ring, in
+ * reservation order, stopping at the first reservation not yet filled.
+ * Stream index entries are updated and each packet is published to
+ * readers.  Must be called with the ring write lock held.
+ *
+ * Returns the number of packets committed and -2 on corrupt ring error.
+ ***************************************************************************/
+static int
+RingCommit (RingParams *ringparams)
+{
+  RingStream *stream = NULL;
+  RingStream newstream;
+  RingPacket *packet;
+  RingPacket *prevlatest;
+  uint64_t skey;
+  int64_t offset;
+  int committed = 0;
+
+  while (ringparams->commitseq < ringparams->reserveseq &&
+         ringparams->reservefilled[(ringparams->commitseq + 1) % RING_MAXRESERVED])
   {
-    /* Populate and add RingStream entry */
-    memset (&newstream, 0, sizeof (RingStream));
-    memcpy (newstream.streamid, packet->streamid, sizeof (newstream.streamid));
-    newstream.earliestdstime = packet->datastart;
-    newstream.earliestdetime = packet->dataend;
-    newstream.earliestptime  = packet->pkttime;
-    newstream.earliestid     = packet->pktid;
-    newstream.earliestoffset = packet->offset;
-    newstream.latestoffset   = -1;
-    /* The "latest" fields are populated later */
+    /* Set ring flux flag */
+    ringparams->fluxflag = 1;
+
+    /* Reservations are consecutive slots following the latest packet */
+    if (ringparams->latestoffset >= 0)
+      offset = NEXTOFFSET (ringparams->latestoffset, ringparams->maxoffset, ringparams->pktsize);
+    else
+      offset = 0;
+
+    packet = (RingPacket *)(ringparams->data + offset);
 
-    /* Add new stream to index */
-    if (!(stream = AddStreamIdx (ringparams->streamidx, &newstream, &skey)))
+    /* Find RingStream entry unless same as the previous packet, entries are
+     * only removed by eviction under the write lock held here */
+    if (!stream || strcmp (stream->streamid, packet->streamid))
+      stream = GetStreamIdx (ringparams->streamidx, packet->streamid);
+
+    /* Create RingStream entry if not found */
+    if (!stream)
     {
-      lprintf (0, "%s(): Error adding new stream index", __func__);
-      if (node)
+      /* Populate and add RingStream entry */
+      memset (&newstream, 0, sizeof (RingStream));
+      memcpy (newstream.streamid, packet->streamid, sizeof (newstream.streamid));
+      newstream.earliestdstime = packet->datastart;
+      newstream.earliestdetime = packet->dataend;
+      newstream.earliestptime  = packet->pkttime;
+      newstream.earliestid     = packet->pktid;
+      newstream.earliestoffset = packet->offset;
+      newstream.latestoffset   = -1;
+      /* The "latest" fields are populated later */
+
+      /* Add new stream to index, before the packet is published */
+      pthread_mutex_lock (ringparams->streamlock);
+      stream = AddStreamIdx (ringparams->streamidx, &newstream, &skey);
+      if (stream)
       {
-        free (node->key);
-        free (node->data);
-        free (node);
+        ringparams->streamcount++;
+        StreamIdxChanged (ringparams, packet->streamid, skey, 0);
       }
-      ringparams->corruptflag = 1;
-      ringparams->fluxflag    = 0;
-      pthread_mutex_unlock (ringparams->writelock);
       pthread_mutex_unlock (ringparams->streamlock);
-      return -2;
+
+      if (!stream)
+      {
+        lprintf (0, "%s(): Error adding new stream index", __func__);
+        ringparams->corruptflag = 1;
+        ringparams->fluxflag    = 0;
+        pthread_cond_broadcast (ringparams->commitcond);
+        return -2;
+      }
+
+      lprintf (2, "Added stream entry for %s (key: %" PRIx64 ")", packet->streamid, skey);
     }
-    else
+
+    /* Update entry for previous packet in stream, before the packet is published
+     * as the latest so that readers following streams find all packets linked */
+    if (stream->latestoffset >= 0)
     {
-      ringparams->streamcount++;
+      prevlatest = (RingPacket *)(ringparams->data + stream->latestoffset);
+
+      prevlatest->nextinstream = packet->offset;
     }
 
-    lprintf (2, "Added stream entry for %s (key: %" PRIx64 ")", packet->streamid, *skey);
+    /* Update time index for the packet slot */
+    TimeIndexUpdate (ringparams, packet);
+
+    /* Update stream entry */
+    StreamUpdateBegin (ringparams);
+    stream->latestdstime = packet->datastart;
+    stream->latestdetime = packet->dataend;
+    stream->latestptime  = packet->pkttime;
+    stream->latestid     = packet->pktid;
+    stream->latestoffset = packet->offset;
+    StreamUpdateEnd (ringparams);
+
+    /* Update RingParams with new earliest packet (for initial packet) */
+    if (ringparams->earliestoffset < 0)
+    {
+      ringparams->earliestid     = packet->pktid;
+      ringparams->earliestptime  = packet->pkttime;
+      ringparams->earliestdstime = packet->datastart;
+      ringparams->earliestdetime = packet->dataend;
+      ringparams->earliestoffset = packet->offset;
+    }
+
+    /* Update RingParams with new latest packet, publishing the packet to
+     * readers with the release store of the latest offset */
+    ringparams->latestid     = packet->pktid;
+    ringparams->latestptime  = packet->pkttime;
+    ringparams->latestdstime = packet->datastart;
+    ringparams->latestdetime = packet->dataend;
+    RING_PUBLISH (ringparams->latestoffset, packet->offset);
+
+    ringparams->commitseq++;
+    ringparams->reservecount--;
+    committed++;
   }
 
-  /* Copy packet header into ring */
-  memcpy ((ringparams->data + offset), packet, sizeof (RingPacket));
+  /* Clear ring flux flag */
+  ringparams->fluxflag = 0;
 
-  /* Copy packet data into ring directly after header */
-  memcpy ((ringparams->data + offset + sizeof (RingPacket)), packetdata, datasize);
+  if (committed)
+    pthread_cond_broadcast (ringparams->commitcond);
 
-  /* Update RingParams with new latest packet */
-  ringparams->latestid     = packet->pktid;
-  ringparams->latestptime  = packet->pkttime;
-  ringparams->latestdstime = packet->datastart;
-  ringparams->latestdetime = packet->dataend;
-  ringparams->latestoffset = packet->offset;
-
-  /* Update RingParams with new earliest packet (for initial packet) */
-  if (!earliest)
-  {
-    ringparams->earliestid     = packet->pktid;
-    ringparams->earliestptime  = packet->pkttime;
-    ringparams->earliestdstime = packet->datastart;
-    ringparams->earliestdetime = packet->dataend;
-    ringparams->earliestoffset = packet->offset;
-  }
-
-  /* Update entry for previous packet in stream */
-  if (stream->latestoffset >= 0)
-  {
-    prevlatest = (RingPacket *)(ringparams->data + stream->latestoffset);
-
-    prevlatest->nextinstream = packet->offset;
-  }
-
-  /* Update stream entry */
-  stream->latestdstime = packet->datastart;
-  stream->latestdetime = packet->dataend;
-  stream->latestptime  = packet->pkttime;
-  stream->latestid     = packet->pktid;
-  stream->latestoffset = packet->offset;
-
-  /* Clear ring flux flag */
-  ringparams->fluxflag = 0;
-
-  /* Unlock ring and stream index */
-  pthread_mutex_unlock (ringparams->writelock);
-  pthread_mutex_unlock (ringparams->streamlock);
-
-  lprintf (3, "Added packet for stream %s, pktid: %" PRIu64 ", offset: %" PRIu64,
-           packet->streamid, packet->pktid, packet->offset);
-
-  return 0;
-} /* End of RingWrite() */
+  return committed;
+} /* End of RingCommit() */
 
 /***************************************************************************
  * RingRead:
@@ -946,11 +1389,84 @@ RingRead (RingReader *reader, uint64_t reqid,
  * position has fallen off the trailing edge of the ring and
  * reposition the search at the earliest packet.
  *
+ * Readers that select a limited set of streams follow the per-stream
+ * packet chains instead of scanning the ring, see StreamSetReadNext().
+ *
  * Returns packet ID on success, RINGID_NONE when no next packet
  * and RINGID_ERROR on error.
  ***************************************************************************/
 uint64_t
 RingReadNext (RingReader *reader, RingPacket *packet, char *packetdata)
+{
+  return ReadNextPacket (reader, packet, packetdata, NULL);
+} /* End of RingReadNext() */
+
+/***************************************************************************
+ * RingReadNextRef:
+ *
+ * Determine the next packet in the ring like RingReadNext() but, instead
+ * of copying the packet data, set packetref to the location of the data
+ * in the ring.  Only the packet header is copied.
+ *
+ * The referenced data may be replaced by a writer at any time.  After
+ * the data has been consumed, e.g. sent to a client, the caller must
+ * check with RingReadValid() that the packet was not replaced; if it
+ * was, the consumed data may be corrupt.
+ *
+ * Returns packet ID on success, RINGID_NONE when no next packet
+ * and RINGID_ERROR on error.
+ ***************************************************************************/
+uint64_t
+RingReadNextRef (RingReader *reader, RingPacket *packet, char **packetref)
+{
+  if (!packetref)
+    return RINGID_ERROR;
+
+  return ReadNextPacket (reader, packet, NULL, packetref);
+} /* End of RingReadNextRef() */
+
+/***************************************************************************
+ * RingReadValid:
+ *
+ * Check that a packet returned by RingReadNextRef() is still present
+ * in the ring, i.e. its slot has not been reused by a writer since
+ * the packet was read.
+ *
+ * Writers store the packet header before the packet data, separated
+ * by a release fence in RingWrite(), so if any of the data consumed
+ * before this check was replaced the new header will be seen here.
+ *
+ * Returns 1 if the packet is unchanged and 0 if it has been replaced.
+ ***************************************************************************/
+int
+RingReadValid (RingReader *reader, const RingPacket *packet)
+{
+  RingPacket *pkt;
+
+  if (!reader || !reader->ringparams || !packet)
+    return 0;
+
+  pkt = (RingPacket *)(reader->ringparams->data + packet->offset);
+
+  /* Order the preceding reads of the packet data before the header checks */
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+  return (__atomic_load_n (&pkt->pktid, __ATOMIC_RELAXED) == packet->pktid &&
+          __atomic_load_n (&pkt->pkttime, __ATOMIC_RELAXED) == packet->pkttime);
+} /* End of RingReadValid() */
+
+/***************************************************************************
+ * ReadNextPacket:
+ *
+ * Implementation of RingReadNext() and RingReadNextRef(), the packet
+ * data is either copied to packetdata or referenced by packetref.
+ *
+ * Returns packet ID on success, RINGID_NONE when no next packet
+ * and RINGID_ERROR on error.
+ ***************************************************************************/
+static uint64_t
+ReadNextPacket (RingReader *reader, RingPacket *packet, char *packetdata,
+                char **packetref)
 {
   RingParams *ringparams;
   RingPacket *pkt;
@@ -958,6 +1474,7 @@ RingReadNext (RingReader *reader, RingPacket *packet, char *packetdata)
   int64_t offset = -1;
   uint8_t skip;
   uint32_t skipped;
+  int rv;
 
   int64_t earliestoffset;
   int64_t latestoffset;
@@ -975,7 +1492,7 @@ RingReadNext (RingReader *reader, RingPacket *packet, char *packetdata)
   if (!ringparams)
     return RINGID_ERROR;
 
-  latestoffset   = ringparams->latestoffset;
+  latestoffset   = RING_ACQUIRE (ringparams->latestoffset);
   earliestoffset = ringparams->earliestoffset;
 
   /* If ring is empty return immediately */
@@ -990,6 +1507,15 @@ RingReadNext (RingReader *reader, RingPacket *packet, char *packetdata)
     return RINGID_NONE;
   }
 
+  /* Follow the packet chains of selected streams if possible */
+  if (reader->pktoffset >= 0)
+  {
+    if ((rv = StreamSetReadNext (reader, packet, packetdata, packetref)) > 0)
+      return packet->pktid;
+    else if (rv == 0)
+      return RINGID_NONE;
+  }
+
   /* Determine latest packet details directly to avoid race */
   latestid     = ((RingPacket *)(ringparams->data + latestoffset))->pktid;
   latestptime  = ((RingPacket *)(ringparams->data + latestoffset))->pkttime;
@@ -1074,23 +1600,9 @@ RingReadNext (RingReader *reader, RingPacket *packet, char *packetdata)
     reader->datastart = pkt->datastart;
     reader->dataend   = pkt->dataend;
 
-    /* Test limit expression if available */
-    if (reader->limit)
-      if (pcre2_match (reader->limit, (PCRE2_SPTR8)pkt->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                       reader->limit_data, NULL) < 0)
-        skip = 1;
-
-    /* Test match expression if available and not already skipping */
-    if (reader->match && skip == 0)
-      if (pcre2_match (reader->match, (PCRE2_SPTR8)pkt->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                       reader->match_data, NULL) < 0)
-        skip = 1;
-
-    /* Test reject expression if available and not already skipping */
-    if (reader->reject && skip == 0)
-      if (pcre2_match (reader->reject, (PCRE2_SPTR8)pkt->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                       reader->reject_data, NULL) >= 0)
-        skip = 1;
+    /* Test limit, match and reject expressions */
+    if (!StreamSelected (reader, pkt->streamid))
+      skip = 1;
 
     /* If skipping this packet determine the next packet in the ring */
     if (skip)
@@ -1107,9 +1619,11 @@ RingReadNext (RingReader *reader, RingPacket *packet, char *packetdata)
   /* Copy packet header */
   memcpy (packet, pkt, sizeof (RingPacket));
 
-  /* Copy packet data if a pointer is supplied */
+  /* Copy packet data if a pointer is supplied, otherwise reference it */
   if (packetdata)
     memcpy (packetdata, (uint8_t *)pkt + sizeof (RingPacket), pkt->datasize);
+  else if (packetref)
+    *packetref = (char *)pkt + sizeof (RingPacket);
 
   /* Sanity check that the data was not overwritten during processing */
   if (pkttime != pkt->pkttime)
@@ -1118,7 +1632,7 @@ RingReadNext (RingReader *reader, RingPacket *packet, char *packetdata)
   }
 
   return packet->pktid;
-} /* End of RingReadNext() */
+} /* End of ReadNextPacket() */
 
 /***************************************************************************
  * RingPosition:
@@ -1209,7 +1723,8 @@ RingPosition (RingReader *reader, uint64_t pktid, nstime_t pkttime)
  * the readers's match and reject expressions) based on packet data
  * time.  The ring is searched from the earliest packet forward,
  * stopping at the first matching packet with a data end time after
- * the reference time.
+ * the reference time.  Blocks of packets that all end before the
+ * reference time are skipped using the ring time index.
  *
  * The position can be set to either the first packet with a data time
  * after the reference time or the packet just before depending on the
@@ -1241,7 +1756,9 @@ RingAfter (RingReader *reader, nstime_t reftime, int whence)
   nstime_t datastart;
   nstime_t dataend;
   int64_t offset;
+  int64_t lastoffset;
   uint64_t skipped = 0;
+  uint64_t count;
   uint8_t skip;
 
   if (!reader)
@@ -1259,6 +1776,17 @@ RingAfter (RingReader *reader, nstime_t reftime, int whence)
   {
     skip = 0;
 
+    /* Skip the rest of a time index block if no packets end after the reference time */
+    if ((lastoffset = TimeIndexSkipForward (ringparams, offset,
+                                            RING_ACQUIRE (ringparams->latestoffset),
+                                            reftime, &count)) >= 0)
+    {
+      pkt0    = (RingPacket *)(ringparams->data + lastoffset);
+      offset  = NEXTOFFSET (lastoffset, ringparams->maxoffset, ringparams->pktsize);
+      skipped += count;
+      continue;
+    }
+
     /* Get pointer to RingPacket */
     pkt1 = (RingPacket *)(ringparams->data + offset);
 
@@ -1267,23 +1795,9 @@ RingAfter (RingReader *reader, nstime_t reftime, int whence)
     if (pkt1->dataend < reftime)
       skip = 1;
 
-    /* Test limit expression if available */
-    if (reader->limit && !skip)
-      if (pcre2_match (reader->limit, (PCRE2_SPTR8)pkt1->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                       reader->limit_data, NULL) < 0)
-        skip = 1;
-
-    /* Test match expression if available and not already skipping */
-    if (reader->match && !skip)
-      if (pcre2_match (reader->match, (PCRE2_SPTR8)pkt1->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                       reader->match_data, NULL) < 0)
-        skip = 1;
-
-    /* Test reject expression if available and not already skipping */
-    if (reader->reject && !skip)
-      if (pcre2_match (reader->reject, (PCRE2_SPTR8)pkt1->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                       reader->reject_data, NULL) >= 0)
-        skip = 1;
+    /* Test limit, match and reject expressions if not already skipping */
+    if (!skip && !StreamSelected (reader, pkt1->streamid))
+      skip = 1;
 
     /* Done if this matching packet has a data end time after that specified */
     if (!skip && pkt1->dataend > reftime)
@@ -1295,7 +1809,7 @@ RingAfter (RingReader *reader, nstime_t reftime, int whence)
     pkt0 = pkt1;
 
     /* Done if we reach the latest packet */
-    if (offset == ringparams->latestoffset)
+    if (offset == RING_ACQUIRE (ringparams->latestoffset))
     {
       break;
     }
@@ -1344,8 +1858,12 @@ RingAfter (RingReader *reader, nstime_t reftime, int whence)
  * Set the ring reading position to a matching packet (as defined by
  * the readers's match and reject expressions) based on packet data
  * time.  The ring is searched from the latest packet backward,
- * stopping at the first matching packet with a data end time after
+ * stopping at the first matching packet with a data start time before
  * the reference time or after skipping pktlimit number of packets.
+ * From that point the ring is searched forward for the first matching
+ * packet with a data end time after the reference time.  In both
+ * directions the ring time index is used to skip blocks of packets
+ * that cannot match.
  *
  * The position can be set to either the first packet with a data time
  * after the reference time or the packet just before depending on the
@@ -1379,8 +1897,12 @@ RingAfterRev (RingReader *reader, nstime_t reftime, uint64_t pktlimit,
   uint64_t pktid;
   int64_t offset;
   int64_t soffset;
+  int64_t lastoffset;
+  int64_t latestoffset;
+  int64_t earliestoffset;
   uint64_t count = 0;
-  uint8_t skip;
+  uint64_t nskip;
+  uint8_t stopped = 0;
 
   if (!reader)
     return RINGID_ERROR;
@@ -1390,61 +1912,80 @@ RingAfterRev (RingReader *reader, nstime_t reftime, uint64_t pktlimit,
     return RINGID_ERROR;
 
   /* Start searching with the latest packet in the ring */
-  offset  = ringparams->latestoffset;
-  soffset = offset;
+  latestoffset   = RING_ACQUIRE (ringparams->latestoffset);
+  earliestoffset = ringparams->earliestoffset;
+  soffset        = latestoffset;
 
-  /* Loop through packets in reverse order */
+  /* Loop through packets in reverse order to find a matching packet with
+   * a data start time before that specified, the search stop point */
   while (count < pktlimit)
   {
-    skip = 0;
+    /* Skip time index blocks with no packets starting before the reference time */
+    if ((nskip = TimeIndexSkipReverse (ringparams, soffset, earliestoffset, reftime)))
+    {
+      if (nskip > (pktlimit - count))
+        nskip = pktlimit - count;
+
+      soffset -= (int64_t)(nskip * ringparams->pktsize);
+      if (soffset < 0)
+        soffset += ringparams->maxoffset + ringparams->pktsize;
+
+      count += nskip;
+      continue;
+    }
 
     /* Get pointer to RingPacket */
     spkt = (RingPacket *)(ringparams->data + soffset);
 
-    /* Test limit expression if available */
-    if (reader->limit)
-      if (pcre2_match (reader->limit, (PCRE2_SPTR8)spkt->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                       reader->limit_data, NULL) < 0)
-        skip = 1;
+    /* Done if we reach a matching packet with earlier start time */
+    if (spkt->datastart < reftime && StreamSelected (reader, spkt->streamid))
+    {
+      stopped = 1;
+      break;
+    }
+
+    /* Done if we reach the earliest packet */
+    if (soffset == earliestoffset)
+    {
+      stopped = 1;
+      break;
+    }
 
-    /* Test match expression if available and not already skipping */
-    if (reader->match && !skip)
-      if (pcre2_match (reader->match, (PCRE2_SPTR8)spkt->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                       reader->match_data, NULL) < 0)
-        skip = 1;
+    soffset = PREVOFFSET (soffset, ringparams->maxoffset, ringparams->pktsize);
+    count++;
+  }
 
-    /* Test reject expression if available and not already skipping */
-    if (reader->reject && !skip)
-      if (pcre2_match (reader->reject, (PCRE2_SPTR8)spkt->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                       reader->reject_data, NULL) >= 0)
-        skip = 1;
+  /* Search forward from the stop point, or the last packet within the limit,
+   * for the first matching packet with a data end time after that specified */
+  if (stopped || count > 0)
+  {
+    offset = (stopped) ? soffset : NEXTOFFSET (soffset, ringparams->maxoffset, ringparams->pktsize);
 
-    if (!skip)
+    while (1)
     {
-      /* Set ID and time if this matching packet has a data end time after that specified */
-      if (spkt->dataend > reftime)
+      /* Skip the rest of a time index block if no packets end after the reference time */
+      if ((lastoffset = TimeIndexSkipForward (ringparams, offset, latestoffset,
+                                              reftime, &nskip)) >= 0)
+      {
+        offset = NEXTOFFSET (lastoffset, ringparams->maxoffset, ringparams->pktsize);
+        continue;
+      }
+
+      spkt = (RingPacket *)(ringparams->data + offset);
+
+      if (spkt->dataend > reftime && StreamSelected (reader, spkt->streamid))
       {
-        offset  = soffset;
         pktid   = spkt->pktid;
         pkttime = spkt->pkttime;
         pkt     = spkt;
+        break;
       }
 
-      /* Done if we reach a matching packet with earlier start time */
-      if (spkt->datastart < reftime)
-      {
+      if (offset == latestoffset)
         break;
-      }
-    }
 
-    /* Done if we reach the earliest packet */
-    if (soffset == ringparams->earliestoffset)
-    {
-      break;
+      offset = NEXTOFFSET (offset, ringparams->maxoffset, ringparams->pktsize);
     }
-
-    soffset = PREVOFFSET (soffset, ringparams->maxoffset, ringparams->pktsize);
-    count++;
   }
 
   /* Safety valve, if no packets were ever seen */
@@ -1607,260 +2148,2278 @@ UpdatePattern (pcre2_code **code, pcre2_match_data **data,
 } /* End of UpdatePattern() */
 
 /***************************************************************************
- * StreamStackNodeCmp:
+ * RingUpdatePattern:
  *
- * Compare two RingStream entries contained in two StackNode entries
- * as the result of strncmp() on the two stream IDs.  This function is
- * used to sort a Stack of RingStream entries by stream ID.
+ * Update a limit, match or reject pattern of a RingReader using
+ * UpdatePattern() and reset the reader's cache of stream match
+ * verdicts, which are no longer valid.
  *
- * Return the result of strncmp() on the stream IDs.
+ * Returns 0 on success and -1 on error.
  ***************************************************************************/
 int
-StreamStackNodeCmp (StackNode *a, StackNode *b)
+RingUpdatePattern (RingReader *reader, pcre2_code **code, pcre2_match_data **data,
+                   const char *pattern, const char *description)
 {
-  return strncmp (((RingStream *)(a->data))->streamid,
-                  ((RingStream *)(b->data))->streamid,
-                  MAXSTREAMID);
-} /* End of StreamStackNodeCmp() */
+  RingMatchCache *cache;
+
+  if (!reader)
+    return -1;
+
+  if ((cache = reader->matchcache) && cache->count > 0)
+  {
+    memset (cache->entries, 0, cache->size * sizeof (RingMatchEntry));
+    cache->count = 0;
+  }
+
+  /* The selected streams must be resolved again */
+  if (reader->streamset)
+  {
+    reader->streamset->valid   = 0;
+    reader->streamset->counted = 0;
+    reader->streamset->scan    = 0;
+  }
+
+  return UpdatePattern (code, data, pattern, description);
+} /* End of RingUpdatePattern() */
 
 /***************************************************************************
- * GetStreamsStack:
- *
- * Build a copy of the stream index as a Stack sorted on stream ID.
- * It is up to the caller to free the Stack, i.e. using
- * StackDestroy(stack, free).
- *
- * If ringreader is not NULL only the streamids that match the
- * reader's limit and match expressions and do not match the reader's
- * reject expression will be included in the output Stack.
+ * RingReaderFree:
  *
- * Return a Stack on success and 0 on error.
+ * Free the cache of stream match verdicts and the set of followed
+ * streams for a RingReader.  The expressions are not free'd.
  ***************************************************************************/
-Stack *
-GetStreamsStack (RingParams *ringparams, RingReader *reader)
+void
+RingReaderFree (RingReader *reader)
 {
-  RingStream *stream;
-  RingStream *newstream;
-  RBNode *tnode;
-  Stack *streams;
-  Stack *newstreams;
+  if (!reader)
+    return;
 
-  if (!ringparams)
-    return 0;
+  if (reader->matchcache)
+  {
+    free (reader->matchcache->entries);
+    free (reader->matchcache);
+    reader->matchcache = NULL;
+  }
 
-  /* Lock the streams index */
-  pthread_mutex_lock (ringparams->streamlock);
+  if (reader->streamset)
+  {
+    free (reader->streamset->cursors);
+    free (reader->streamset->spare);
+    free (reader->streamset->heap);
+    free (reader->streamset);
+    reader->streamset = NULL;
+  }
+} /* End of RingReaderFree() */
 
-  streams    = StackCreate ();
-  newstreams = StackCreate ();
+/***************************************************************************
+ * StreamSelected:
+ *
+ * Determine if a stream ID is selected by the limit, match and reject
+ * expressions of a RingReader.
+ *
+ * The verdict for each stream is cached in the reader, keyed on the
+ * FNVhash64() of the stream ID, so the expressions are evaluated once
+ * per distinct stream instead of once per packet.  The cache is reset
+ * by RingUpdatePattern() whenever an expression changes.
+ *
+ * Returns 1 if the stream is selected and 0 if not.
+ ***************************************************************************/
+static int
+StreamSelected (RingReader *reader, const char *streamid)
+{
+  RingMatchCache *cache;
+  uint64_t key;
+  size_t mask;
+  size_t idx;
+  uint8_t verdict = MATCHCACHE_ACCEPT;
 
-  RBBuildStack (ringparams->streamidx, streams);
+  /* All streams are selected without expressions */
+  if (!reader->limit && !reader->match && !reader->reject)
+    return 1;
 
-  /* Loop through streams copying content to new Stack */
-  while ((tnode = (RBNode *)StackPop (streams)))
+  key = FNVhash64 (streamid);
+
+  /* Search for a cached verdict */
+  if ((cache = reader->matchcache))
   {
-    stream = (RingStream *)tnode->data;
+    mask = cache->size - 1;
 
-    /* If a RingReader is specified apply the match & reject expressions */
-    if (reader)
+    for (idx = key & mask; cache->entries[idx].verdict != MATCHCACHE_EMPTY; idx = (idx + 1) & mask)
     {
-      /* Test limit expression if available */
-      if (reader->limit)
-        if (pcre2_match (reader->limit, (PCRE2_SPTR8)stream->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                         reader->limit_data, NULL) < 0)
-          continue;
-
-      /* Test match expression if available */
-      if (reader->match)
-        if (pcre2_match (reader->match, (PCRE2_SPTR8)stream->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                         reader->match_data, NULL) < 0)
-          continue;
-
-      /* Test reject expression if available */
-      if (reader->reject)
-        if (pcre2_match (reader->reject, (PCRE2_SPTR8)stream->streamid, PCRE2_ZERO_TERMINATED, 0, 0,
-                         reader->reject_data, NULL) >= 0)
-          continue;
+      if (cache->entries[idx].key == key)
+        return (cache->entries[idx].verdict == MATCHCACHE_ACCEPT);
     }
+  }
 
-    /* Allocate memory for new stream entry */
-    if (!(newstream = (RingStream *)malloc (sizeof (RingStream))))
+  /* Test limit expression if available */
+  if (reader->limit)
+    if (pcre2_match (reader->limit, (PCRE2_SPTR8)streamid, PCRE2_ZERO_TERMINATED, 0, 0,
+                     reader->limit_data, NULL) < 0)
+      verdict = MATCHCACHE_REJECT;
+
+  /* Test match expression if available and not already rejected */
+  if (reader->match && verdict == MATCHCACHE_ACCEPT)
+    if (pcre2_match (reader->match, (PCRE2_SPTR8)streamid, PCRE2_ZERO_TERMINATED, 0, 0,
+                     reader->match_data, NULL) < 0)
+      verdict = MATCHCACHE_REJECT;
+
+  /* Test reject expression if available and not already rejected */
+  if (reader->reject && verdict == MATCHCACHE_ACCEPT)
+    if (pcre2_match (reader->reject, (PCRE2_SPTR8)streamid, PCRE2_ZERO_TERMINATED, 0, 0,
+                     reader->reject_data, NULL) >= 0)
+      verdict = MATCHCACHE_REJECT;
+
+  /* Allocate cache on first use */
+  if (!reader->matchcache)
+  {
+    if ((cache = (RingMatchCache *)calloc (1, sizeof (RingMatchCache))) == NULL ||
+        (cache->entries = (RingMatchEntry *)calloc (MATCHCACHE_MINSIZE, sizeof (RingMatchEntry))) == NULL)
     {
       lprintf (0, "%s(): Error allocating memory", __func__);
-      return 0;
+      free (cache);
+      return (verdict == MATCHCACHE_ACCEPT);
     }
 
-    /* Copy stream entry and add to new streams Stack */
-    memcpy (newstream, stream, sizeof (RingStream));
-
-    /* Use unshift operation so copied Stack is in the same order */
-    StackUnshift (newstreams, newstream);
+    cache->size        = MATCHCACHE_MINSIZE;
+    reader->matchcache = cache;
   }
 
-  /* Cleanup streams Stack structures but not data */
-  StackDestroy (streams, 0);
+  /* Cache the verdict, a failure only means it will be evaluated again */
+  MatchCacheInsert (reader->matchcache, key, verdict);
 
-  /* Unlock the streams index */
-  pthread_mutex_unlock (ringparams->streamlock);
+  return (verdict == MATCHCACHE_ACCEPT);
+} /* End of StreamSelected() */
 
-  /* Sort Stack on the stream IDs if more than one entry */
-  if (newstreams->top && newstreams->top != newstreams->tail)
+/***************************************************************************
+ * MatchCacheInsert:
+ *
+ * Insert a stream match verdict into the cache.  The table is doubled
+ * in size when it becomes half full, once the maximum size is reached
+ * the table is cleared instead of growing.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+MatchCacheInsert (RingMatchCache *cache, uint64_t key, uint8_t verdict)
+{
+  RingMatchEntry *entries;
+  size_t newsize;
+  size_t mask;
+  size_t idx;
+  size_t oidx;
+
+  if ((cache->count + 1) * 2 > cache->size)
   {
-    if (StackSort (newstreams, StreamStackNodeCmp) < 0)
+    if (cache->size >= MATCHCACHE_MAXSIZE)
     {
-      lprintf (0, "%s(): Error sorting Stack", __func__);
-      return 0;
+      memset (cache->entries, 0, cache->size * sizeof (RingMatchEntry));
+      cache->count = 0;
+    }
+    else
+    {
+      newsize = cache->size * 2;
+
+      if ((entries = (RingMatchEntry *)calloc (newsize, sizeof (RingMatchEntry))) == NULL)
+      {
+        lprintf (0, "%s(): Error allocating memory", __func__);
+        return -1;
+      }
+
+      /* Rehash existing entries into the new table */
+      mask = newsize - 1;
+      for (oidx = 0; oidx < cache->size; oidx++)
+      {
+        if (cache->entries[oidx].verdict == MATCHCACHE_EMPTY)
+          continue;
+
+        for (idx = cache->entries[oidx].key & mask; entries[idx].verdict != MATCHCACHE_EMPTY; idx = (idx + 1) & mask)
+          ;
+
+        entries[idx] = cache->entries[oidx];
+      }
+
+      free (cache->entries);
+      cache->entries = entries;
+      cache->size    = newsize;
     }
   }
 
-  return newstreams;
-} /* End of GetStreamsStack() */
+  mask = cache->size - 1;
+  for (idx = key & mask; cache->entries[idx].verdict != MATCHCACHE_EMPTY; idx = (idx + 1) & mask)
+    ;
+
+  cache->entries[idx].key     = key;
+  cache->entries[idx].verdict = verdict;
+  cache->count++;
+
+  return 0;
+} /* End of MatchCacheInsert() */
 
 /***************************************************************************
- * FindOffsetForID:
- *
- * Determine the offset in the ring buffer to a specified packet ID.
- *
- * Assumptions:
- *
- * - If the earliest ID >= largest ID, they represent a range between
- * which the pktid must fall and they increase from earliest to latest.
+ * StreamSetReadNext:
  *
- * - If the earliest ID < largest ID, the ID set has no useful ordering.
+ * Read the next packet for a reader by following the nextinstream
+ * chains of the reader's selected streams, merged in packet ID order
+ * using a min-heap of per-stream cursors.  The cost is proportional
+ * to the selected packets instead of the size of the ring.
  *
- * If pkttime is not NULL, it will be set to the time of the packet if the
- * search is successful.
+ * The set of selected streams is resolved from the stream index by
+ * StreamSetBuild() when the reader position, the expressions or the
+ * stream index change.  Readers without expressions, with more than
+ * STREAMSET_MAXSTREAMS selected streams or that have been lapped by
+ * the writer use the sequential scan in RingReadNext() instead.
  *
- * Return the offset to the RingPacket on success or -1 if no match.
+ * Returns 1 when a packet was read, 0 when no next packet is available
+ * and -1 when the caller should scan the ring.
  ***************************************************************************/
-static inline int64_t
-FindOffsetForID (RingParams *ringparams, uint64_t pktid, nstime_t *pkttime)
+static int
+StreamSetReadNext (RingReader *reader, RingPacket *packet, char *packetdata,
+                   char **packetref)
 {
-  RingPacket *packet = NULL;
-  int64_t latestoffset;
-  int64_t earliestoffset;
-  int64_t offset;
-
-  if (!ringparams)
-    return -1;
-
-  latestoffset   = ringparams->latestoffset;
-  earliestoffset = ringparams->earliestoffset;
+  RingParams *ringparams = reader->ringparams;
+  RingStreamSet *set;
+  RingStreamCursor *cursor;
+  RingPacket *pkt;
+  int64_t nextoffset;
+  uint64_t latestid;
+  int idx;
 
-  /* Ring is empty */
-  if (earliestoffset < 0 || latestoffset < 0)
-  {
+  /* Only readers with expressions select a subset of streams */
+  if (!reader->limit && !reader->match && !reader->reject)
     return -1;
-  }
 
-  /* Earliest ID is less than latest ID.
-   * Assume they increment from earliest to latest.
-   * Assume the pktid must exist within the range. */
-  if (ringparams->earliestid <= ringparams->latestid)
+  if (!reader->streamset)
   {
-    /* Check that requested packet ID is within earliest - latest range */
-    if (pktid < ringparams->earliestid || pktid > ringparams->latestid)
+    if (!(reader->streamset = (RingStreamSet *)calloc (1, sizeof (RingStreamSet))))
     {
+      lprintf (0, "%s(): Error allocating memory", __func__);
       return -1;
     }
+  }
 
-    int64_t latestoffset_unwrapped = (latestoffset < earliestoffset) ? latestoffset + ringparams->maxoffset : latestoffset;
+  set = reader->streamset;
 
-    int64_t lowpkt = 0;
-    int64_t highpkt = (latestoffset_unwrapped - earliestoffset) / ringparams->pktsize;
-    int64_t midpkt;
+  /* All packets up to the latest are linked into their streams.  The latest
+   * packet must be determined before checking the stream index generation,
+   * streams are added to the index before their first packet is published. */
+  latestid = ((RingPacket *)(ringparams->data + RING_ACQUIRE (ringparams->latestoffset)))->pktid;
 
-    /* Binary search for a matching ID */
-    while (lowpkt <= highpkt)
+  /* Selection is too wide and the stream index has not changed */
+  if (set->scan && set->streamgen == ringparams->streamgen)
+    return -1;
+
+  /* Resolve selected streams relative to the current reader position */
+  if (!set->valid || set->scan ||
+      set->streamgen != ringparams->streamgen ||
+      set->pktid != reader->pktid ||
+      set->pktoffset != reader->pktoffset)
+  {
+    if (StreamSetBuild (reader) || set->scan)
+      return -1;
+  }
+
+  /* Add waiting cursors to the heap when their next packet is available */
+  for (idx = 0; idx < set->count; idx++)
+  {
+    cursor = &set->cursors[idx];
+
+    if (!cursor->waiting)
+      continue;
+
+    pkt        = (RingPacket *)(ringparams->data + cursor->offset);
+    nextoffset = pkt->nextinstream;
+
+    /* Last packet of stream was replaced, the reader has been lapped */
+    if (pkt->pktid != cursor->pktid)
+    {
+      set->valid = 0;
+      return -1;
+    }
+
+    if (nextoffset < 0)
+      continue;
+
+    cursor->offset  = nextoffset;
+    cursor->pktid   = ((RingPacket *)(ringparams->data + nextoffset))->pktid;
+    cursor->waiting = 0;
+
+    StreamSetHeapPush (set, idx);
+  }
+
+  if (set->heapcount == 0)
+    return 0;
+
+  cursor = &set->cursors[set->heap[0]];
+
+  if (cursor->pktid > latestid)
+    return 0;
+
+  pkt = (RingPacket *)(ringparams->data + cursor->offset);
+
+  /* Copy packet header */
+  memcpy (packet, pkt, sizeof (RingPacket));
+
+  /* Copy packet data if a pointer is supplied, otherwise reference it */
+  if (packetdata)
+    memcpy (packetdata, (uint8_t *)pkt + sizeof (RingPacket), pkt->datasize);
+  else if (packetref)
+    *packetref = (char *)pkt + sizeof (RingPacket);
+
+  /* Sanity check that the packet was not replaced, if so the reader has been lapped */
+  if (packet->pktid != cursor->pktid || pkt->pktid != cursor->pktid ||
+      !StreamSelected (reader, packet->streamid))
+  {
+    set->valid = 0;
+    return -1;
+  }
+
+  /* Update reader position */
+  reader->pktoffset = packet->offset;
+  reader->pktid     = packet->pktid;
+  reader->pkttime   = packet->pkttime;
+  reader->datastart = packet->datastart;
+  reader->dataend   = packet->dataend;
+
+  set->pktid     = reader->pktid;
+  set->pktoffset = reader->pktoffset;
+
+  /* Advance cursor to the next packet in the stream */
+  nextoffset = pkt->nextinstream;
+
+  if (pkt->pktid != cursor->pktid)
+  {
+    set->valid = 0;
+  }
+  else if (nextoffset < 0)
+  {
+    cursor->waiting = 1;
+
+    /* Remove from heap */
+    set->heap[0] = set->heap[--set->heapcount];
+    StreamSetHeapDown (set, 0);
+  }
+  else
+  {
+    cursor->offset = nextoffset;
+    cursor->pktid  = ((RingPacket *)(ringparams->data + nextoffset))->pktid;
+
+    StreamSetHeapDown (set, 0);
+  }
+
+  return 1;
+} /* End of StreamSetReadNext() */
+
+/***************************************************************************
+ * StreamSetBuild:
+ *
+ * Resolve the reader's selected streams from the stream index and
+ * position a cursor in each stream at the first packet after the
+ * current reader position.
+ *
+ * If the reader has not been repositioned only the stream index
+ * changes since the last build are applied: cursors are added for
+ * new selected streams and dropped for removed streams.  The full
+ * index is walked for the first build, after the reader has been
+ * repositioned or when the changes are no longer in the change log.
+ *
+ * If more than STREAMSET_MAXSTREAMS streams are selected the set is
+ * flagged for scanning, the count of selected streams is maintained
+ * from the change log until the selection is narrow enough to follow.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+StreamSetBuild (RingReader *reader)
+{
+  RingParams *ringparams   = reader->ringparams;
+  RingStreamSet *set       = reader->streamset;
+  RingStreamIdx *streamidx = ringparams->streamidx;
+  RingStreamChange *change;
+  RingStreamCursor *cursors;
+  RingStreamCursor *cursor;
+  uint64_t pktid = reader->pktid;
+  uint64_t streamgen;
+  uint32_t slot;
+  uint8_t retain;
+  uint8_t updated = 0;
+  uint8_t lapped  = 0;
+  int selected    = 0;
+  int count       = 0;
+  int idx;
+
+  /* Cursor arrays are allocated once and reused for each build */
+  if ((!set->cursors &&
+       !(set->cursors = (RingStreamCursor *)malloc (STREAMSET_MAXSTREAMS * sizeof (RingStreamCursor)))) ||
+      (!set->spare &&
+       !(set->spare = (RingStreamCursor *)malloc (STREAMSET_MAXSTREAMS * sizeof (RingStreamCursor)))) ||
+      (!set->heap && !(set->heap = (int *)malloc (STREAMSET_MAXSTREAMS * sizeof (int)))))
+  {
+    lprintf (0, "%s(): Error allocating memory", __func__);
+    return -1;
+  }
+
+  /* Existing cursors are valid if the reader has not been repositioned */
+  retain = (set->valid && set->pktid == reader->pktid && set->pktoffset == reader->pktoffset);
+
+  /* Lock the streams index, no streams are added or removed while locked */
+  pthread_mutex_lock (ringparams->streamlock);
+
+  streamgen = ringparams->streamgen;
+
+  /* Apply the stream index changes since the last build if all are logged */
+  if (set->counted && streamidx->changes &&
+      set->streamgen >= streamidx->changestart &&
+      streamgen - set->streamgen <= STREAMIDX_CHANGES)
+  {
+    for (; !lapped && set->streamgen < streamgen; set->streamgen++)
+    {
+      change = &streamidx->changes[set->streamgen % STREAMIDX_CHANGES];
+
+      if (!StreamSelected (reader, change->streamid))
+        continue;
+
+      set->selected += (change->removed) ? -1 : 1;
+
+      if (!retain)
+        continue;
+
+      for (idx = 0; idx < set->count; idx++)
+      {
+        if (set->cursors[idx].key == change->key)
+          break;
+      }
+
+      /* Drop cursor of removed stream */
+      if (change->removed)
+      {
+        if (idx < set->count)
+          set->cursors[idx] = set->cursors[--set->count];
+      }
+      /* Add cursor for new stream if still in the index */
+      else if (idx == set->count && set->count < STREAMSET_MAXSTREAMS)
+      {
+        slot = StreamIdxSlot (streamidx, change->key);
+
+        if (streamidx->keys[slot])
+        {
+          if (StreamSetCursor (ringparams, &set->cursors[set->count], streamidx->entries[slot],
+                               change->key, pktid))
+            lapped = 1;
+          else
+            set->count++;
+        }
+      }
+    }
+
+    /* Cursors are current if there is one for each selected stream */
+    updated = (set->selected > STREAMSET_MAXSTREAMS ||
+               (retain && !set->scan && set->count == set->selected));
+  }
+
+  /* Otherwise walk the full index */
+  if (!updated && !lapped)
+  {
+    cursors = set->spare;
+
+    for (slot = 0; !lapped && slot < streamidx->size; slot++)
+    {
+      if (!streamidx->keys[slot] || !StreamSelected (reader, streamidx->entries[slot]->streamid))
+        continue;
+
+      /* Count all selected streams but only follow a limited number */
+      if (++selected > STREAMSET_MAXSTREAMS)
+        continue;
+
+      cursor = &cursors[count++];
+
+      /* Retain existing cursor for this stream */
+      if (retain)
+      {
+        for (idx = 0; idx < set->count; idx++)
+        {
+          if (set->cursors[idx].key == streamidx->keys[slot])
+          {
+            *cursor = set->cursors[idx];
+            break;
+          }
+        }
+
+        if (idx < set->count)
+          continue;
+      }
+
+      if (StreamSetCursor (ringparams, cursor, streamidx->entries[slot],
+                           streamidx->keys[slot], pktid))
+        lapped = 1;
+    }
+
+    if (!lapped)
+    {
+      set->spare     = set->cursors;
+      set->cursors   = cursors;
+      set->count     = count;
+      set->selected  = selected;
+      set->streamgen = streamgen;
+      set->counted   = 1;
+    }
+  }
+
+  pthread_mutex_unlock (ringparams->streamlock);
+
+  /* Stream chain was overwritten while following it, the reader is at the trailing edge */
+  if (lapped)
+  {
+    set->valid   = 0;
+    set->counted = 0;
+    return -1;
+  }
+
+  set->scan      = (set->selected > STREAMSET_MAXSTREAMS);
+  set->count     = (set->scan) ? 0 : set->count;
+  set->heapcount = 0;
+  set->pktid     = reader->pktid;
+  set->pktoffset = reader->pktoffset;
+  set->valid     = !set->scan;
+
+  /* Add cursors with a next packet to the heap */
+  for (idx = 0; idx < set->count; idx++)
+  {
+    if (!set->cursors[idx].waiting)
+      StreamSetHeapPush (set, idx);
+  }
+
+  lprintf (3, "%s(): reader following %d of %d selected streams%s%s", __func__,
+           set->count, set->selected, (updated) ? ", updated" : "",
+           (set->scan) ? ", too many, scanning ring" : "");
+
+  return 0;
+} /* End of StreamSetBuild() */
+
+/***************************************************************************
+ * StreamSetCursor:
+ *
+ * Position a cursor at the first packet of a stream after the specified
+ * packet ID, or at the stream's latest packet if there is none yet.
+ * The stream lock must be held by the caller.
+ *
+ * Returns 0 on success and -1 if the stream was overwritten while
+ * following it.
+ ***************************************************************************/
+static int
+StreamSetCursor (RingParams *ringparams, RingStreamCursor *cursor, RingStream *entry,
+                 uint64_t key, uint64_t pktid)
+{
+  RingStream stream;
+  RingPacket *pkt;
+  int64_t offset;
+  uint64_t prevpktid = 0;
+
+  StreamCopy (ringparams, &stream, entry);
+
+  cursor->key = key;
+
+  /* All packets in stream are after reader position, including a new
+   * stream whose first packet is not yet published */
+  if (stream.earliestid > pktid)
+  {
+    cursor->offset  = stream.earliestoffset;
+    cursor->pktid   = stream.earliestid;
+    cursor->waiting = 0;
+    return 0;
+  }
+
+  /* All packets in stream are at or before reader position */
+  if (stream.latestid <= pktid)
+  {
+    cursor->offset  = stream.latestoffset;
+    cursor->pktid   = stream.latestid;
+    cursor->waiting = 1;
+    return 0;
+  }
+
+  /* Otherwise follow the stream to the first packet after reader position,
+   * packets are written concurrently so stop if the chain is overwritten */
+  offset = stream.earliestoffset;
+  pkt    = (RingPacket *)(ringparams->data + offset);
+
+  while (1)
+  {
+    if (pkt->pktid < prevpktid || strcmp (pkt->streamid, stream.streamid))
+      return -1;
+
+    if (pkt->pktid > pktid || pkt->nextinstream < 0)
+      break;
+
+    prevpktid = pkt->pktid;
+    offset    = pkt->nextinstream;
+    pkt       = (RingPacket *)(ringparams->data + offset);
+  }
+
+  cursor->offset  = offset;
+  cursor->pktid   = pkt->pktid;
+  cursor->waiting = (pkt->pktid <= pktid);
+
+  return 0;
+} /* End of StreamSetCursor() */
+
+/***************************************************************************
+ * StreamSetHeapPush:
+ *
+ * Add a cursor index to the min-heap ordered by cursor packet ID.
+ ***************************************************************************/
+static void
+StreamSetHeapPush (RingStreamSet *set, int cidx)
+{
+  int hidx = set->heapcount++;
+  int parent;
+
+  while (hidx > 0)
+  {
+    parent = (hidx - 1) / 2;
+
+    if (set->cursors[set->heap[parent]].pktid <= set->cursors[cidx].pktid)
+      break;
+
+    set->heap[hidx] = set->heap[parent];
+    hidx            = parent;
+  }
+
+  set->heap[hidx] = cidx;
+} /* End of StreamSetHeapPush() */
+
+/***************************************************************************
+ * StreamSetHeapDown:
+ *
+ * Restore the min-heap order by moving the entry at a heap index down.
+ ***************************************************************************/
+static void
+StreamSetHeapDown (RingStreamSet *set, int hidx)
+{
+  int cidx;
+  int child;
+
+  if (hidx >= set->heapcount)
+    return;
+
+  cidx = set->heap[hidx];
+
+  while ((child = 2 * hidx + 1) < set->heapcount)
+  {
+    if (child + 1 < set->heapcount &&
+        set->cursors[set->heap[child + 1]].pktid < set->cursors[set->heap[child]].pktid)
+      child++;
+
+    if (set->cursors[cidx].pktid <= set->cursors[set->heap[child]].pktid)
+      break;
+
+    set->heap[hidx] = set->heap[child];
+    hidx            = child;
+  }
+
+  set->heap[hidx] = cidx;
+} /* End of StreamSetHeapDown() */
+
+/***************************************************************************
+ * StreamStackNodeCmp:
+ *
+ * Compare two RingStream entries contained in two StackNode entries
+ * as the result of strncmp() on the two stream IDs.  This function is
+ * used to sort a Stack of RingStream entries by stream ID.
+ *
+ * Return the result of strncmp() on the stream IDs.
+ ***************************************************************************/
+int
+StreamStackNodeCmp (StackNode *a, StackNode *b)
+{
+  return strncmp (((RingStream *)(a->data))->streamid,
+                  ((RingStream *)(b->data))->streamid,
+                  MAXSTREAMID);
+} /* End of StreamStackNodeCmp() */
+
+/***************************************************************************
+ * GetStreamsStack:
+ *
+ * Build a copy of the stream index as a Stack sorted on stream ID.
+ * It is up to the caller to free the Stack, i.e. using
+ * StackDestroy(stack, free).
+ *
+ * If ringreader is not NULL only the streamids that match the
+ * reader's limit and match expressions and do not match the reader's
+ * reject expression will be included in the output Stack.
+ *
+ * Return a Stack on success and 0 on error.
+ ***************************************************************************/
+Stack *
+GetStreamsStack (RingParams *ringparams, RingReader *reader)
+{
+  RingStreamIdx *streamidx;
+  RingStream *copies;
+  RingStream *newstream;
+  Stack *newstreams;
+  uint32_t count = 0;
+  uint32_t slot;
+  uint32_t idx;
+
+  if (!ringparams)
+    return 0;
+
+  /* Lock the streams index, only blocks the addition and removal of streams */
+  pthread_mutex_lock (ringparams->streamlock);
+
+  streamidx = ringparams->streamidx;
+
+  if (!(copies = (RingStream *)malloc ((streamidx->count + 1) * sizeof (RingStream))))
+  {
+    pthread_mutex_unlock (ringparams->streamlock);
+    lprintf (0, "%s(): Error allocating memory", __func__);
+    return 0;
+  }
+
+  /* Copy stream entries, applying the limit, match & reject expressions
+   * if a RingReader is specified */
+  for (slot = 0; slot < streamidx->size; slot++)
+  {
+    if (!streamidx->keys[slot])
+      continue;
+
+    if (reader && !StreamSelected (reader, streamidx->entries[slot]->streamid))
+      continue;
+
+    StreamCopy (ringparams, &copies[count++], streamidx->entries[slot]);
+  }
+
+  /* Unlock the streams index */
+  pthread_mutex_unlock (ringparams->streamlock);
+
+  newstreams = StackCreate ();
+
+  for (idx = 0; idx < count; idx++)
+  {
+    /* Allocate memory for new stream entry */
+    if (!(newstream = (RingStream *)malloc (sizeof (RingStream))))
+    {
+      lprintf (0, "%s(): Error allocating memory", __func__);
+      StackDestroy (newstreams, free);
+      free (copies);
+      return 0;
+    }
+
+    memcpy (newstream, &copies[idx], sizeof (RingStream));
+
+    StackUnshift (newstreams, newstream);
+  }
+
+  free (copies);
+
+  /* Sort Stack on the stream IDs if more than one entry */
+  if (newstreams->top && newstreams->top != newstreams->tail)
+  {
+    if (StackSort (newstreams, StreamStackNodeCmp) < 0)
+    {
+      lprintf (0, "%s(): Error sorting Stack", __func__);
+      return 0;
+    }
+  }
+
+  return newstreams;
+} /* End of GetStreamsStack() */
+
+/***************************************************************************
+ * StreamCmp:
+ *
+ * Compare two RingStream entries as the result of strncmp() on the
+ * stream IDs.  This function is used to sort an array of RingStream
+ * entries by stream ID with qsort().
+ *
+ * Return the result of strncmp() on the stream IDs.
+ ***************************************************************************/
+static int
+StreamCmp (const void *a, const void *b)
+{
+  return strncmp (((const RingStream *)a)->streamid,
+                  ((const RingStream *)b)->streamid,
+                  MAXSTREAMID);
+} /* End of StreamCmp() */
+
+/***************************************************************************
+ * GetStreamsArray:
+ *
+ * Build a copy of the stream index as an array sorted on stream ID.
+ * The array is a single allocation that must be free'd by the caller,
+ * for large indexes it is much lighter than GetStreamsStack().
+ *
+ * If ringreader is not NULL only the streamids that match the
+ * reader's limit and match expressions and do not match the reader's
+ * reject expression will be included in the output array.
+ *
+ * The number of entries is returned in 'count'.
+ *
+ * Return an array on success and NULL on error.
+ ***************************************************************************/
+RingStream *
+GetStreamsArray (RingParams *ringparams, RingReader *reader, uint32_t *count)
+{
+  RingStreamIdx *streamidx;
+  RingStream *copies;
+  uint32_t slot;
+
+  if (!ringparams || !count)
+    return NULL;
+
+  *count = 0;
+
+  /* Lock the streams index, only blocks the addition and removal of streams */
+  pthread_mutex_lock (ringparams->streamlock);
+
+  streamidx = ringparams->streamidx;
+
+  if (!(copies = (RingStream *)malloc ((streamidx->count + 1) * sizeof (RingStream))))
+  {
+    pthread_mutex_unlock (ringparams->streamlock);
+    lprintf (0, "%s(): Error allocating memory", __func__);
+    return NULL;
+  }
+
+  /* Copy stream entries, applying the limit, match & reject expressions
+   * if a RingReader is specified */
+  for (slot = 0; slot < streamidx->size; slot++)
+  {
+    if (!streamidx->keys[slot])
+      continue;
+
+    if (reader && !StreamSelected (reader, streamidx->entries[slot]->streamid))
+      continue;
+
+    StreamCopy (ringparams, &copies[(*count)++], streamidx->entries[slot]);
+  }
+
+  /* Unlock the streams index */
+  pthread_mutex_unlock (ringparams->streamlock);
+
+  if (*count > 1)
+    qsort (copies, *count, sizeof (RingStream), StreamCmp);
+
+  return copies;
+} /* End of GetStreamsArray() */
+
+/***************************************************************************
+ * RingNotifyInit:
+ *
+ * Create the notification descriptors for a RingReader.  When the
+ * reader is in the wait list the read end (notifyfd[0]) becomes
+ * readable after a packet is written to the ring.  On Linux a single
+ * eventfd is used for both ends, elsewhere a non-blocking pipe.
+ *
+ * Return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+RingNotifyInit (RingReader *reader)
+{
+  if (!reader)
+    return -1;
+
+  reader->waiting    = 0;
+  reader->notified   = 0;
+  reader->nextwaiter = NULL;
+  reader->prevwaiter = NULL;
+
+#if defined(__linux__)
+  if ((reader->notifyfd[0] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+  {
+    lprintf (0, "%s(): error creating eventfd: %s", __func__, strerror (errno));
+    reader->notifyfd[1] = -1;
+    return -1;
+  }
+
+  reader->notifyfd[1] = reader->notifyfd[0];
+#else
+  if (pipe (reader->notifyfd))
+  {
+    lprintf (0, "%s(): error creating pipe: %s", __func__, strerror (errno));
+    reader->notifyfd[0] = reader->notifyfd[1] = -1;
+    return -1;
+  }
+
+  for (int idx = 0; idx < 2; idx++)
+  {
+    if (fcntl (reader->notifyfd[idx], F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl (reader->notifyfd[idx], F_SETFD, FD_CLOEXEC) == -1)
+    {
+      lprintf (0, "%s(): error setting pipe flags: %s", __func__, strerror (errno));
+      close (reader->notifyfd[0]);
+      close (reader->notifyfd[1]);
+      reader->notifyfd[0] = reader->notifyfd[1] = -1;
+      return -1;
+    }
+  }
+#endif
+
+  return 0;
+} /* End of RingNotifyInit() */
+
+/***************************************************************************
+ * RingNotifyFree:
+ *
+ * Remove a RingReader from the wait list if needed and close the
+ * notification descriptors.
+ ***************************************************************************/
+void
+RingNotifyFree (RingReader *reader)
+{
+  if (!reader)
+    return;
+
+  RingWaitDisarm (reader);
+
+  if (reader->notifyfd[0] >= 0)
+    close (reader->notifyfd[0]);
+  if (reader->notifyfd[1] >= 0 && reader->notifyfd[1] != reader->notifyfd[0])
+    close (reader->notifyfd[1]);
+
+  reader->notifyfd[0] = reader->notifyfd[1] = -1;
+} /* End of RingNotifyFree() */
+
+/***************************************************************************
+ * RingWaitArm:
+ *
+ * Add a RingReader to the ring's wait list so it will be notified when
+ * the next packet is written.  The writeseq argument is the value of
+ * RingParams.writeseq observed before the reader last searched the
+ * ring; if packets have been written since then the reader is not
+ * added and should search again instead of waiting.
+ *
+ * Return 1 when the reader is waiting, 0 when new packets are already
+ * available and -1 on error.
+ ***************************************************************************/
+int
+RingWaitArm (RingReader *reader, uint64_t writeseq)
+{
+  RingParams *ringparams;
+  int rv = 1;
+
+  if (!reader || !reader->ringparams || reader->notifyfd[1] < 0)
+    return -1;
+
+  ringparams = reader->ringparams;
+
+  pthread_mutex_lock (ringparams->notifylock);
+
+  if (ringparams->writeseq != writeseq)
+  {
+    rv = 0;
+  }
+  else if (!reader->waiting)
+  {
+    reader->prevwaiter = NULL;
+    reader->nextwaiter = ringparams->waiters;
+    if (ringparams->waiters)
+      ringparams->waiters->prevwaiter = reader;
+    ringparams->waiters = reader;
+    __atomic_store_n (&reader->waiting, 1, __ATOMIC_RELAXED);
+  }
+
+  pthread_mutex_unlock (ringparams->notifylock);
+
+  return rv;
+} /* End of RingWaitArm() */
+
+/***************************************************************************
+ * RingWaitDisarm:
+ *
+ * Remove a RingReader from the ring's wait list, if still present, and
+ * drain any pending notification from the read descriptor.  The
+ * descriptor is only read when a notification was written.
+ ***************************************************************************/
+void
+RingWaitDisarm (RingReader *reader)
+{
+  RingParams *ringparams;
+  uint64_t drain[8];
+
+  if (!reader || !reader->ringparams)
+    return;
+
+  ringparams = reader->ringparams;
+
+  /* Only this reader adds itself to the wait list, if it is not waiting
+   * it cannot be added concurrently and the lock is not needed */
+  if (__atomic_load_n (&reader->waiting, __ATOMIC_RELAXED) && ringparams->notifylock)
+  {
+    pthread_mutex_lock (ringparams->notifylock);
+
+    if (reader->waiting)
+    {
+      if (reader->prevwaiter)
+        reader->prevwaiter->nextwaiter = reader->nextwaiter;
+      else
+        ringparams->waiters = reader->nextwaiter;
+      if (reader->nextwaiter)
+        reader->nextwaiter->prevwaiter = reader->prevwaiter;
+
+      reader->nextwaiter = NULL;
+      reader->prevwaiter = NULL;
+      __atomic_store_n (&reader->waiting, 0, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock (ringparams->notifylock);
+  }
+
+  /* Drain notification, descriptor is non-blocking */
+  if (reader->notifyfd[0] >= 0 &&
+      __atomic_exchange_n (&reader->notified, 0, __ATOMIC_ACQUIRE))
+  {
+    while (read (reader->notifyfd[0], drain, sizeof (drain)) > 0)
+      ;
+  }
+} /* End of RingWaitDisarm() */
+
+/***************************************************************************
+ * RingNotifyWaiters:
+ *
+ * Increment the ring write sequence and signal every RingReader in the
+ * wait list, emptying the list.  Called after a packet is written.
+ ***************************************************************************/
+static void
+RingNotifyWaiters (RingParams *ringparams)
+{
+  RingReader *reader;
+  RingReader *next;
+  uint64_t one = 1;
+
+  pthread_mutex_lock (ringparams->notifylock);
+
+  /* Lock-free readers load the write sequence with acquire semantics */
+  __atomic_add_fetch (&ringparams->writeseq, 1, __ATOMIC_RELEASE);
+
+  for (reader = ringparams->waiters; reader; reader = next)
+  {
+    next = reader->nextwaiter;
+
+    /* A full eventfd counter or pipe already has a pending notification */
+    if (write (reader->notifyfd[1], &one, sizeof (one)) < 0 && errno != EAGAIN)
+      lprintf (0, "%s(): error signalling reader: %s", __func__, strerror (errno));
+
+    __atomic_store_n (&reader->notified, 1, __ATOMIC_RELEASE);
+
+    reader->nextwaiter = NULL;
+    reader->prevwaiter = NULL;
+    __atomic_store_n (&reader->waiting, 0, __ATOMIC_RELAXED);
+  }
+
+  ringparams->waiters = NULL;
+
+  pthread_mutex_unlock (ringparams->notifylock);
+} /* End of RingNotifyWaiters() */
+
+/***************************************************************************
+ * StreamUpdateBegin:
+ *
+ * Start an update of stream entries in the index.  Stream entries are
+ * updated by the ring writer without the stream lock, readers copy them
+ * with StreamCopy() which retries if an update was in progress.
+ ***************************************************************************/
+static inline void
+StreamUpdateBegin (RingParams *ringparams)
+{
+  __atomic_store_n (&ringparams->streamseq, ringparams->streamseq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+} /* End of StreamUpdateBegin() */
+
+/***************************************************************************
+ * StreamUpdateEnd:
+ *
+ * Complete an update of stream entries started with StreamUpdateBegin().
+ ***************************************************************************/
+static inline void
+StreamUpdateEnd (RingParams *ringparams)
+{
+  __atomic_store_n (&ringparams->streamseq, ringparams->streamseq + 1, __ATOMIC_RELEASE);
+} /* End of StreamUpdateEnd() */
+
+/***************************************************************************
+ * StreamCopy:
+ *
+ * Copy a consistent version of a stream entry, retrying while the
+ * writer is updating stream entries.  The stream lock must be held by
+ * the caller to protect the entry from removal.
+ ***************************************************************************/
+static void
+StreamCopy (RingParams *ringparams, RingStream *dest, RingStream *stream)
+{
+  uint64_t seq;
+
+  do
+  {
+    while ((seq = __atomic_load_n (&ringparams->streamseq, __ATOMIC_ACQUIRE)) & 1)
+      ;
+
+    memcpy (dest, stream, sizeof (RingStream));
+
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  } while (seq != __atomic_load_n (&ringparams->streamseq, __ATOMIC_RELAXED));
+} /* End of StreamCopy() */
+
+/***************************************************************************
+ * TimeIndexInit:
+ *
+ * Allocate and initialize the time index for the ring.  Each entry
+ * summarizes the data times of TIMEIDX_BLOCKPACKETS consecutive packet
+ * slots.  The packet headers of a ring containing packets at
+ * initialization are scanned in parallel parts, each block summarizing
+ * all of its packets in both the current and previous lap values.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+TimeIndexInit (RingParams *ringparams)
+{
+  RebuildPart parts[REBUILD_MAXTHREADS];
+  RingTimeBlock *block;
+  uint64_t blocks;
+  uint64_t latestslot;
+  uint64_t idx;
+  long cpus;
+  int partcount;
+  int part;
+
+  blocks = (ringparams->maxpackets + TIMEIDX_BLOCKPACKETS - 1) / TIMEIDX_BLOCKPACKETS;
+
+  if (!(ringparams->timeidx = (RingTimeBlock *)malloc (blocks * sizeof (RingTimeBlock))))
+    return -1;
+
+  for (idx = 0; idx < blocks; idx++)
+  {
+    block = &ringparams->timeidx[idx];
+
+    TIMEIDX_EMPTY (block);
+
+    block->prevmindatastart = block->mindatastart;
+    block->prevmaxdataend   = block->maxdataend;
+  }
+
+  if (ringparams->earliestoffset < 0 || ringparams->latestoffset < 0)
+    return 0;
+
+  latestslot = (uint64_t)ringparams->latestoffset / ringparams->pktsize;
+
+  /* Use a thread per processor, each covering at least REBUILD_MINSLOTS */
+  cpus      = sysconf (_SC_NPROCESSORS_ONLN);
+  partcount = (cpus > 1) ? (int)cpus : 1;
+  if (partcount > REBUILD_MAXTHREADS)
+    partcount = REBUILD_MAXTHREADS;
+  if ((uint64_t)partcount > (ringparams->maxpackets + REBUILD_MINSLOTS - 1) / REBUILD_MINSLOTS)
+    partcount = (int)((ringparams->maxpackets + REBUILD_MINSLOTS - 1) / REBUILD_MINSLOTS);
+
+  /* Parts cover whole blocks */
+  memset (parts, 0, sizeof (parts));
+  for (part = 0; part < partcount; part++)
+  {
+    parts[part].ringparams   = ringparams;
+    parts[part].start        = blocks * part / partcount;
+    parts[part].count        = blocks * (part + 1) / partcount - parts[part].start;
+    parts[part].earliestslot = (uint64_t)ringparams->earliestoffset / ringparams->pktsize;
+    parts[part].ringcount    = (latestslot + ringparams->maxpackets - parts[part].earliestslot) %
+                               ringparams->maxpackets + 1;
+  }
+
+  RebuildRun (parts, partcount, TimeIndexScan);
+
+  return 0;
+} /* End of TimeIndexInit() */
+
+/***************************************************************************
+ * TimeIndexScan:
+ *
+ * Thread routine to summarize the data times of the packets in a range
+ * of time index blocks, only slots from the earliest to the latest
+ * packet hold packets of the ring.  The summary of a block covers all
+ * of its packets as both the current and previous lap values, which
+ * remains correct as the block is overwritten.
+ ***************************************************************************/
+static void *
+TimeIndexScan (void *arg)
+{
+  RebuildPart *part = (RebuildPart *)arg;
+  RingParams *ringparams = part->ringparams;
+  RingTimeBlock *block;
+  RingPacket *packet;
+  uint64_t blockidx;
+  uint64_t slot;
+  uint64_t lastslot;
+
+  for (blockidx = part->start; blockidx < part->start + part->count; blockidx++)
+  {
+    block    = &ringparams->timeidx[blockidx];
+    slot     = blockidx * TIMEIDX_BLOCKPACKETS;
+    lastslot = slot + TIMEIDX_BLOCKPACKETS;
+    if (lastslot > ringparams->maxpackets)
+      lastslot = ringparams->maxpackets;
+
+    for (; slot < lastslot; slot++)
+    {
+      /* Skip slots not between the earliest and latest packets */
+      if ((slot + ringparams->maxpackets - part->earliestslot) % ringparams->maxpackets >= part->ringcount)
+        continue;
+
+      packet = (RingPacket *)(ringparams->data + slot * ringparams->pktsize);
+
+      if (packet->datastart < block->mindatastart)
+        block->mindatastart = packet->datastart;
+      if (packet->dataend > block->maxdataend)
+        block->maxdataend = packet->dataend;
+    }
+
+    block->prevmindatastart = block->mindatastart;
+    block->prevmaxdataend   = block->maxdataend;
+  }
+
+  return NULL;
+} /* End of TimeIndexScan() */
+
+/***************************************************************************
+ * TimeIndexUpdate:
+ *
+ * Update the time index entry for the slot of a packet being written.
+ *
+ * Slots are written in order, so when the first slot of a block is
+ * written the existing summary is retained as the previous lap values
+ * until the last slot of the block is written.  Must be called with the
+ * ring write lock held.
+ ***************************************************************************/
+static void
+TimeIndexUpdate (RingParams *ringparams, RingPacket *packet)
+{
+  RingTimeBlock *block;
+  uint64_t slot;
+
+  slot  = (uint64_t)packet->offset / ringparams->pktsize;
+  block = &ringparams->timeidx[slot / TIMEIDX_BLOCKPACKETS];
+
+  if ((slot % TIMEIDX_BLOCKPACKETS) == 0)
+  {
+    block->prevmindatastart = block->mindatastart;
+    block->prevmaxdataend   = block->maxdataend;
+    block->mindatastart     = packet->datastart;
+    block->maxdataend       = packet->dataend;
+  }
+  else
+  {
+    if (packet->datastart < block->mindatastart)
+      block->mindatastart = packet->datastart;
+    if (packet->dataend > block->maxdataend)
+      block->maxdataend = packet->dataend;
+  }
+
+  /* All packets of the previous lap are replaced after the last slot */
+  if ((slot % TIMEIDX_BLOCKPACKETS) == (TIMEIDX_BLOCKPACKETS - 1) ||
+      slot == (ringparams->maxpackets - 1))
+  {
+    block->prevmindatastart = INT64_MAX;
+    block->prevmaxdataend   = INT64_MIN;
+  }
+} /* End of TimeIndexUpdate() */
+
+/***************************************************************************
+ * TimeIndexSkipForward:
+ *
+ * Determine if the packets from offset to the end of its time index
+ * block can be skipped when searching forward for a packet with a data
+ * end time after reftime, i.e. none of them end after reftime.  Blocks
+ * containing latestoffset are never skipped.
+ *
+ * Returns the offset of the last skippable packet and sets count to
+ * the number of packets skipped, or -1 if the packets must be examined.
+ ***************************************************************************/
+static int64_t
+TimeIndexSkipForward (RingParams *ringparams, int64_t offset,
+                      int64_t latestoffset, nstime_t reftime,
+                      uint64_t *count)
+{
+  RingTimeBlock *block;
+  uint64_t slot;
+  uint64_t lastslot;
+  int64_t lastoffset;
+
+  if (!ringparams->timeidx || offset < 0)
+    return -1;
+
+  slot  = (uint64_t)offset / ringparams->pktsize;
+  block = &ringparams->timeidx[slot / TIMEIDX_BLOCKPACKETS];
+
+  if (block->maxdataend > reftime || block->prevmaxdataend > reftime)
+    return -1;
+
+  lastslot = slot - (slot % TIMEIDX_BLOCKPACKETS) + TIMEIDX_BLOCKPACKETS - 1;
+  if (lastslot >= ringparams->maxpackets)
+    lastslot = ringparams->maxpackets - 1;
+
+  lastoffset = (int64_t)(lastslot * ringparams->pktsize);
+
+  if (latestoffset >= offset && latestoffset <= lastoffset)
+    return -1;
+
+  *count = lastslot - slot + 1;
+
+  return lastoffset;
+} /* End of TimeIndexSkipForward() */
+
+/***************************************************************************
+ * TimeIndexSkipReverse:
+ *
+ * Determine if the packets from offset back to the start of its time
+ * index block can be skipped when searching backward for a packet with
+ * a data start time before reftime, i.e. none of them start before
+ * reftime.  Blocks containing earliestoffset are never skipped.
+ *
+ * Returns the number of packets that can be skipped, 0 if the packets
+ * must be examined.
+ ***************************************************************************/
+static uint64_t
+TimeIndexSkipReverse (RingParams *ringparams, int64_t offset,
+                      int64_t earliestoffset, nstime_t reftime)
+{
+  RingTimeBlock *block;
+  uint64_t slot;
+  uint64_t firstslot;
+  int64_t firstoffset;
+
+  if (!ringparams->timeidx || offset < 0)
+    return 0;
+
+  slot  = (uint64_t)offset / ringparams->pktsize;
+  block = &ringparams->timeidx[slot / TIMEIDX_BLOCKPACKETS];
+
+  if (block->mindatastart < reftime || block->prevmindatastart < reftime)
+    return 0;
+
+  firstslot   = slot - (slot % TIMEIDX_BLOCKPACKETS);
+  firstoffset = (int64_t)(firstslot * ringparams->pktsize);
+
+  if (earliestoffset >= firstoffset && earliestoffset <= offset)
+    return 0;
+
+  return slot - firstslot + 1;
+} /* End of TimeIndexSkipReverse() */
+
+/***************************************************************************
+ * RebuildPacket:
+ *
+ * Validate the packet header in a slot of the ring, the header must
+ * refer to its own offset, have a usable packet ID, a terminated
+ * stream ID and data that fits in the slot.
+ *
+ * Return a pointer to the packet if valid and 0 otherwise.
+ ***************************************************************************/
+static inline RingPacket *
+RebuildPacket (RingParams *ringparams, uint64_t slot)
+{
+  RingPacket *packet = (RingPacket *)(ringparams->data + slot * ringparams->pktsize);
+
+  if (packet->offset != (int64_t)(slot * ringparams->pktsize) ||
+      packet->pktid == 0 || packet->pktid > RINGID_MAXIMUM ||
+      packet->datasize > (ringparams->pktsize - sizeof (RingPacket)) ||
+      packet->streamid[0] == '\0' ||
+      !memchr (packet->streamid, '\0', sizeof (packet->streamid)))
+    return 0;
+
+  return packet;
+} /* End of RebuildPacket() */
+
+/***************************************************************************
+ * RebuildScan:
+ *
+ * Thread routine to validate the packet headers in a range of slots,
+ * tracking the maximum packet ID and the slots where runs of
+ * increasing packet IDs start.  A run starts at a valid packet when
+ * the packet in the preceding slot, wrapping to the last slot, is not
+ * valid or does not have a lower packet ID.
+ ***************************************************************************/
+static void *
+RebuildScan (void *arg)
+{
+  RebuildPart *part = (RebuildPart *)arg;
+  RingParams *ringparams = part->ringparams;
+  RingPacket *packet;
+  RingPacket *prevpacket;
+  int64_t *runstarts;
+  uint64_t slot;
+
+  slot       = (part->start) ? part->start - 1 : ringparams->maxpackets - 1;
+  prevpacket = RebuildPacket (ringparams, slot);
+
+  for (slot = part->start; slot < part->start + part->count; slot++, prevpacket = packet)
+  {
+    if (!(packet = RebuildPacket (ringparams, slot)))
+      continue;
+
+    part->valid++;
+
+    if (part->maxslot < 0 || packet->pktid > part->maxid)
+    {
+      part->maxid   = packet->pktid;
+      part->maxslot = (int64_t)slot;
+    }
+
+    if (prevpacket && prevpacket->pktid < packet->pktid)
+      continue;
+
+    if (part->runcount == part->runsize)
+    {
+      part->runsize = (part->runsize) ? part->runsize * 2 : 64;
+
+      if (!(runstarts = (int64_t *)realloc (part->runstarts, part->runsize * sizeof (int64_t))))
+      {
+        part->rv = -1;
+        return NULL;
+      }
+
+      part->runstarts = runstarts;
+    }
+
+    part->runstarts[part->runcount++] = (int64_t)slot;
+  }
+
+  return NULL;
+} /* End of RebuildScan() */
+
+/***************************************************************************
+ * RebuildLink:
+ *
+ * Thread routine to link the packets in a range of ring positions,
+ * counted from the earliest packet, into per-stream chains.  The
+ * streams of the range are collected in a private stream index, the
+ * chains of consecutive ranges are joined by RingRebuild().
+ ***************************************************************************/
+static void *
+RebuildLink (void *arg)
+{
+  RebuildPart *part = (RebuildPart *)arg;
+  RingParams *ringparams = part->ringparams;
+  RingPacket *packet;
+  RingStream *stream;
+  RingStream newstream;
+  uint64_t slot;
+  uint64_t idx;
+
+  if (!(part->streamidx = StreamIdxCreate (-1)))
+  {
+    part->rv = -1;
+    return NULL;
+  }
+
+  for (idx = part->start; idx < part->start + part->count; idx++)
+  {
+    slot   = (part->earliestslot + idx) % ringparams->maxpackets;
+    packet = (RingPacket *)(ringparams->data + slot * ringparams->pktsize);
+
+    packet->nextinstream = -1;
+
+    if (!(stream = GetStreamIdx (part->streamidx, packet->streamid)))
+    {
+      memset (&newstream, 0, sizeof (RingStream));
+      memcpy (newstream.streamid, packet->streamid, sizeof (newstream.streamid));
+      newstream.earliestdstime = packet->datastart;
+      newstream.earliestdetime = packet->dataend;
+      newstream.earliestptime  = packet->pkttime;
+      newstream.earliestid     = packet->pktid;
+      newstream.earliestoffset = packet->offset;
+
+      if (!(stream = AddStreamIdx (part->streamidx, &newstream, 0)))
+      {
+        part->rv = -1;
+        return NULL;
+      }
+    }
+    else
+    {
+      ((RingPacket *)(ringparams->data + stream->latestoffset))->nextinstream = packet->offset;
+    }
+
+    stream->latestdstime = packet->datastart;
+    stream->latestdetime = packet->dataend;
+    stream->latestptime  = packet->pkttime;
+    stream->latestid     = packet->pktid;
+    stream->latestoffset = packet->offset;
+  }
+
+  return NULL;
+} /* End of RebuildLink() */
+
+/***************************************************************************
+ * RebuildRun:
+ *
+ * Run a rebuild routine for each part in parallel threads, parts for
+ * which a thread cannot be started are run in the calling thread.
+ *
+ * Return 0 if all parts succeeded and -1 otherwise.
+ ***************************************************************************/
+static int
+RebuildRun (RebuildPart *parts, int partcount, void *(*routine) (void *))
+{
+  int idx;
+  int rv = 0;
+
+  for (idx = 1; idx < partcount; idx++)
+  {
+    parts[idx].started = (pthread_create (&parts[idx].thread, NULL, routine, &parts[idx]) == 0);
+  }
+
+  routine (&parts[0]);
+
+  for (idx = 0; idx < partcount; idx++)
+  {
+    if (idx > 0)
+    {
+      if (parts[idx].started)
+        pthread_join (parts[idx].thread, NULL);
+      else
+        routine (&parts[idx]);
+    }
+
+    if (parts[idx].rv)
+      rv = -1;
+  }
+
+  return rv;
+} /* End of RebuildRun() */
+
+/***************************************************************************
+ * RingRebuild:
+ *
+ * Rebuild the stream index, the earliest and latest packet parameters
+ * and the nextinstream chains of a ring from the packet headers, for
+ * a ring left inconsistent by an unclean shutdown or with a missing
+ * stream index.
+ *
+ * The packet slots are scanned in parallel parts and the ring is
+ * determined as the run of increasing packet IDs ending at the latest
+ * packet, either the latest packet recorded in the ring parameters if
+ * still valid or the packet with the highest ID.  Packets outside of
+ * this run, e.g. reserved packets that were never committed, are not
+ * included.  The packets of the ring are then linked per stream in
+ * parallel parts and the streams of the parts are merged in ring
+ * order.
+ *
+ * Return 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+RingRebuild (RingParams *ringparams)
+{
+  RebuildPart parts[REBUILD_MAXTHREADS];
+  RingPacket *packet;
+  RingStream *stream;
+  RingStream *partstream;
+  nstime_t starttime = NSnow ();
+  uint64_t maxpackets = ringparams->maxpackets;
+  uint64_t valid = 0;
+  uint64_t count;
+  uint64_t distance;
+  uint64_t mindistance = UINT64_MAX;
+  int64_t latestslot = -1;
+  int64_t earliestslot = -1;
+  int64_t maxslot = -1;
+  uint64_t maxid = 0;
+  uint64_t run;
+  uint32_t slot;
+  long cpus;
+  int partcount;
+  int idx;
+  int rv = 0;
+
+  lprintf (0, "Rebuilding ring from packet headers");
+
+  /* Use a thread per processor, each covering at least REBUILD_MINSLOTS */
+  cpus      = sysconf (_SC_NPROCESSORS_ONLN);
+  partcount = (cpus > 1) ? (int)cpus : 1;
+  if (partcount > REBUILD_MAXTHREADS)
+    partcount = REBUILD_MAXTHREADS;
+  if ((uint64_t)partcount > (maxpackets + REBUILD_MINSLOTS - 1) / REBUILD_MINSLOTS)
+    partcount = (int)((maxpackets + REBUILD_MINSLOTS - 1) / REBUILD_MINSLOTS);
+
+  /* Start with an empty stream index */
+  StreamIdxDestroy (ringparams->streamidx);
+  ringparams->streamcount = 0;
+  if (!(ringparams->streamidx = StreamIdxCreate (-1)))
+  {
+    lprintf (0, "%s(): error allocating stream index", __func__);
+    return -1;
+  }
+
+  /* Scan packet headers of all slots */
+  memset (parts, 0, sizeof (parts));
+  for (idx = 0; idx < partcount; idx++)
+  {
+    parts[idx].ringparams = ringparams;
+    parts[idx].start      = maxpackets * idx / partcount;
+    parts[idx].count      = maxpackets * (idx + 1) / partcount - parts[idx].start;
+    parts[idx].maxslot    = -1;
+  }
+
+  if (RebuildRun (parts, partcount, RebuildScan))
+  {
+    lprintf (0, "%s(): error scanning packet headers", __func__);
+    rv = -1;
+  }
+
+  /* Merge the scan results */
+  for (idx = 0; idx < partcount && rv == 0; idx++)
+  {
+    valid += parts[idx].valid;
+
+    if (parts[idx].maxslot >= 0 && (maxslot < 0 || parts[idx].maxid > maxid))
+    {
+      maxid   = parts[idx].maxid;
+      maxslot = parts[idx].maxslot;
+    }
+  }
+
+  if (rv == 0 && valid > 0)
+  {
+    /* Use the recorded latest packet if valid, otherwise the highest packet ID */
+    if (ringparams->latestoffset >= 0 &&
+        ringparams->latestoffset <= ringparams->maxoffset &&
+        (ringparams->latestoffset % ringparams->pktsize) == 0 &&
+        (packet = RebuildPacket (ringparams, ringparams->latestoffset / ringparams->pktsize)) &&
+        packet->pktid == ringparams->latestid)
+      latestslot = ringparams->latestoffset / ringparams->pktsize;
+    else
+      latestslot = maxslot;
+
+    /* The earliest packet is the nearest run start at or before the latest */
+    for (idx = 0; idx < partcount; idx++)
+    {
+      for (run = 0; run < parts[idx].runcount; run++)
+      {
+        distance = (latestslot - parts[idx].runstarts[run] + maxpackets) % maxpackets;
+
+        if (distance < mindistance)
+        {
+          mindistance  = distance;
+          earliestslot = parts[idx].runstarts[run];
+        }
+      }
+    }
+
+    if (earliestslot < 0)
+    {
+      lprintf (0, "%s(): error determining earliest packet", __func__);
+      rv = -1;
+    }
+  }
+
+  for (idx = 0; idx < partcount; idx++)
+  {
+    free (parts[idx].runstarts);
+  }
+
+  if (rv)
+    return -1;
+
+  /* Empty ring */
+  if (valid == 0)
+  {
+    ringparams->earliestid     = RINGID_NONE;
+    ringparams->earliestptime  = NSTUNSET;
+    ringparams->earliestdstime = NSTUNSET;
+    ringparams->earliestdetime = NSTUNSET;
+    ringparams->earliestoffset = -1;
+    ringparams->latestid       = RINGID_NONE;
+    ringparams->latestptime    = NSTUNSET;
+    ringparams->latestdstime   = NSTUNSET;
+    ringparams->latestdetime   = NSTUNSET;
+    ringparams->latestoffset   = -1;
+    ringparams->corruptflag    = 0;
+    ringparams->fluxflag       = 0;
+
+    lprintf (0, "Rebuilt ring, no packets found");
+
+    return 0;
+  }
+
+  /* Link the packets of the ring into stream chains */
+  count = mindistance + 1;
+  if ((uint64_t)partcount > (count + REBUILD_MINSLOTS - 1) / REBUILD_MINSLOTS)
+    partcount = (int)((count + REBUILD_MINSLOTS - 1) / REBUILD_MINSLOTS);
+
+  memset (parts, 0, sizeof (parts));
+  for (idx = 0; idx < partcount; idx++)
+  {
+    parts[idx].ringparams   = ringparams;
+    parts[idx].earliestslot = (uint64_t)earliestslot;
+    parts[idx].start        = count * idx / partcount;
+    parts[idx].count        = count * (idx + 1) / partcount - parts[idx].start;
+  }
+
+  if (RebuildRun (parts, partcount, RebuildLink))
+  {
+    lprintf (0, "%s(): error linking stream packets", __func__);
+    rv = -1;
+  }
+
+  /* Merge the streams of each part in ring order, joining the chains */
+  for (idx = 0; idx < partcount && rv == 0; idx++)
+  {
+    for (slot = 0; slot < parts[idx].streamidx->size; slot++)
+    {
+      if (!(partstream = parts[idx].streamidx->entries[slot]))
+        continue;
+
+      if ((stream = GetStreamIdx (ringparams->streamidx, partstream->streamid)))
+      {
+        ((RingPacket *)(ringparams->data + stream->latestoffset))->nextinstream = partstream->earliestoffset;
+
+        stream->latestdstime = partstream->latestdstime;
+        stream->latestdetime = partstream->latestdetime;
+        stream->latestptime  = partstream->latestptime;
+        stream->latestid     = partstream->latestid;
+        stream->latestoffset = partstream->latestoffset;
+      }
+      else if (AddStreamIdx (ringparams->streamidx, partstream, 0))
+      {
+        ringparams->streamcount++;
+      }
+      else
+      {
+        lprintf (0, "%s(): error adding stream to index", __func__);
+        rv = -1;
+        break;
+      }
+    }
+  }
+
+  for (idx = 0; idx < partcount; idx++)
+  {
+    StreamIdxDestroy (parts[idx].streamidx);
+  }
+
+  if (rv)
+    return -1;
+
+  packet = (RingPacket *)(ringparams->data + earliestslot * ringparams->pktsize);
+  ringparams->earliestid     = packet->pktid;
+  ringparams->earliestptime  = packet->pkttime;
+  ringparams->earliestdstime = packet->datastart;
+  ringparams->earliestdetime = packet->dataend;
+  ringparams->earliestoffset = packet->offset;
+
+  packet = (RingPacket *)(ringparams->data + latestslot * ringparams->pktsize);
+  ringparams->latestid     = packet->pktid;
+  ringparams->latestptime  = packet->pkttime;
+  ringparams->latestdstime = packet->datastart;
+  ringparams->latestdetime = packet->dataend;
+  ringparams->latestoffset = packet->offset;
+
+  ringparams->corruptflag = 0;
+  ringparams->fluxflag    = 0;
+
+  lprintf (0, "Rebuilt ring with %" PRIu64 " packets in %u streams (%" PRIu64 " packets excluded) in %.3f seconds",
+           count, ringparams->streamcount, valid - count,
+           (double)(NSnow () - starttime) / NSTMODULUS);
+
+  return 0;
+} /* End of RingRebuild() */
+
+/***************************************************************************
+ * FindOffsetForID:
+ *
+ * Determine the offset in the ring buffer to a specified packet ID.
+ *
+ * Assumptions:
+ *
+ * - If the earliest ID >= largest ID, they represent a range between
+ * which the pktid must fall and they increase from earliest to latest.
+ *
+ * - If the earliest ID < largest ID, the ID set has no useful ordering.
+ *
+ * If pkttime is not NULL, it will be set to the time of the packet if the
+ * search is successful.
+ *
+ * Return the offset to the RingPacket on success or -1 if no match.
+ ***************************************************************************/
+static inline int64_t
+FindOffsetForID (RingParams *ringparams, uint64_t pktid, nstime_t *pkttime)
+{
+  RingPacket *packet = NULL;
+  int64_t latestoffset;
+  int64_t earliestoffset;
+  int64_t offset;
+
+  if (!ringparams)
+    return -1;
+
+  latestoffset   = RING_ACQUIRE (ringparams->latestoffset);
+  earliestoffset = ringparams->earliestoffset;
+
+  /* Ring is empty */
+  if (earliestoffset < 0 || latestoffset < 0)
+  {
+    return -1;
+  }
+
+  /* Earliest ID is less than latest ID.
+   * Assume they increment from earliest to latest.
+   * Assume the pktid must exist within the range. */
+  if (ringparams->earliestid <= ringparams->latestid)
+  {
+    /* Check that requested packet ID is within earliest - latest range */
+    if (pktid < ringparams->earliestid || pktid > ringparams->latestid)
+    {
+      return -1;
+    }
+
+    int64_t latestoffset_unwrapped = (latestoffset < earliestoffset) ? latestoffset + ringparams->maxoffset : latestoffset;
+
+    int64_t lowpkt = 0;
+    int64_t highpkt = (latestoffset_unwrapped - earliestoffset) / ringparams->pktsize;
+    int64_t midpkt;
+
+    /* Binary search for a matching ID */
+    while (lowpkt <= highpkt)
     {
       midpkt = lowpkt + (highpkt - lowpkt) / 2;
 
-      int64_t offset_unwrapped = earliestoffset + (midpkt * ringparams->pktsize);
+      int64_t offset_unwrapped = earliestoffset + (midpkt * ringparams->pktsize);
+
+      offset = (offset_unwrapped > ringparams->maxoffset) ? offset_unwrapped - ringparams->maxoffset : offset_unwrapped;
+
+      packet = (RingPacket *)(ringparams->data + offset);
+
+      /* If packet ID is found return the offset */
+      if (packet->pktid == pktid)
+      {
+        if (pkttime)
+          *pkttime = packet->pkttime;
+
+        return offset;
+      }
+
+      if (packet->pktid < pktid)
+      {
+        lowpkt = midpkt + 1;
+      }
+      else
+      {
+        highpkt = midpkt - 1;
+      }
+    }
+  }
+  /* Otherwise the ID set has either wrapped or is otherwise unordered */
+  else
+  {
+    /* Brute force search backwards from the latest */
+    offset = NEXTOFFSET (latestoffset, ringparams->maxoffset, ringparams->pktsize);
+    do
+    {
+      offset = PREVOFFSET (offset, ringparams->maxoffset, ringparams->pktsize);
+
+      packet = (RingPacket *)(ringparams->data + offset);
+
+      if (packet->pktid == pktid)
+      {
+        if (pkttime)
+          *pkttime = packet->pkttime;
+
+        return offset;
+      }
+    } while (offset != ringparams->earliestoffset);
+  }
+
+  return -1;
+} /* End of FindOffsetForID() */
+
+/***************************************************************************
+ * StreamKey:
+ *
+ * Generate the stream index key for a stream ID, 0 is reserved for
+ * empty table slots.
+ ***************************************************************************/
+static inline uint64_t
+StreamKey (const char *streamid)
+{
+  uint64_t key = FNVhash64 (streamid);
+
+  return (key) ? key : 1;
+} /* End of StreamKey() */
+
+/***************************************************************************
+ * StreamIdxCreate:
+ *
+ * Allocate and initialize an empty stream index.  If fd is not -1 the
+ * stream entries are allocated in blocks memory mapped from that file,
+ * otherwise in memory.
+ *
+ * Return a pointer to the stream index on success and 0 on error.
+ ***************************************************************************/
+static RingStreamIdx *
+StreamIdxCreate (int fd)
+{
+  RingStreamIdx *streamidx;
+
+  if (!(streamidx = (RingStreamIdx *)calloc (1, sizeof (RingStreamIdx))))
+    return 0;
+
+  streamidx->fd      = fd;
+  streamidx->size    = STREAMIDX_MINSIZE;
+  streamidx->keys    = (uint64_t *)calloc (streamidx->size, sizeof (uint64_t));
+  streamidx->entries = (RingStream **)calloc (streamidx->size, sizeof (RingStream *));
+
+  if (!streamidx->keys || !streamidx->entries)
+  {
+    StreamIdxDestroy (streamidx);
+    return 0;
+  }
+
+  return streamidx;
+} /* End of StreamIdxCreate() */
+
+/***************************************************************************
+ * StreamIdxDestroy:
+ *
+ * Free all memory associated with a stream index.
+ ***************************************************************************/
+static void
+StreamIdxDestroy (RingStreamIdx *streamidx)
+{
+  uint32_t idx;
+
+  if (!streamidx)
+    return;
+
+  for (idx = 0; idx < streamidx->blockcount; idx++)
+  {
+    if (streamidx->fd >= 0)
+      munmap (streamidx->blocks[idx], STREAMIDX_BLOCKSIZE * sizeof (RingStream));
+    else
+      free (streamidx->blocks[idx]);
+  }
+
+  if (streamidx->fd >= 0)
+    close (streamidx->fd);
+
+  free (streamidx->blocks);
+  free (streamidx->freeentries);
+  free (streamidx->keys);
+  free (streamidx->entries);
+  free (streamidx->changes);
+  free (streamidx);
+} /* End of StreamIdxDestroy() */
+
+/***************************************************************************
+ * StreamIdxBlock:
+ *
+ * Allocate a block of STREAMIDX_BLOCKSIZE stream entries, either in
+ * memory or by extending and memory mapping the stream index file.
+ * The entries of a new block are zeroed, i.e. unused.
+ *
+ * Return a pointer to the block on success and 0 on error.
+ ***************************************************************************/
+static RingStream *
+StreamIdxBlock (RingStreamIdx *streamidx)
+{
+  size_t blocksize = STREAMIDX_BLOCKSIZE * sizeof (RingStream);
+  off_t blockoffset = (off_t)streamidx->blockcount * blocksize;
+  void *block;
+
+  if (streamidx->fd < 0)
+    return (RingStream *)calloc (STREAMIDX_BLOCKSIZE, sizeof (RingStream));
+
+  if (ftruncate (streamidx->fd, blockoffset + blocksize))
+    return 0;
+
+  block = mmap (NULL, blocksize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                streamidx->fd, blockoffset);
+
+  return (block == MAP_FAILED) ? 0 : (RingStream *)block;
+} /* End of StreamIdxBlock() */
+
+/***************************************************************************
+ * StreamIdxLoad:
+ *
+ * Populate the stream index of the ring from the RingStream entries
+ * saved in streamfilename.  Unused entries of a memory mapped stream
+ * index, with an empty stream ID, are skipped.
+ *
+ * Return 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+StreamIdxLoad (RingParams *ringparams, char *streamfilename)
+{
+  struct stat streamfilestat;
+  RingStream stream;
+  ssize_t rv;
+  int streamidxfd;
+  int retval = 0;
+
+  /* Open stream index file */
+  if ((streamidxfd = open (streamfilename, O_RDONLY, 0)) < 0)
+  {
+    lprintf (0, "%s(): error opening %s: %s", __func__, streamfilename, strerror (errno));
+    return -1;
+  }
+
+  /* Stat the streams file */
+  if (fstat (streamidxfd, &streamfilestat))
+  {
+    lprintf (0, "%s(): error stating %s: %s", __func__, streamfilename, strerror (errno));
+    close (streamidxfd);
+    return -1;
+  }
+
+  if (streamfilestat.st_size <= 0)
+  {
+    lprintf (0, "%s(): stream index file empty!", __func__);
+    close (streamidxfd);
+    return -1;
+  }
+
+  /* Read the saved RingStreams */
+  while ((rv = read (streamidxfd, &stream, sizeof (RingStream))) == sizeof (RingStream))
+  {
+    /* Skip unused entries of a memory mapped stream index */
+    if (stream.streamid[0] == '\0')
+      continue;
+
+    /* Re-populating streams index */
+    if (!AddStreamIdx (ringparams->streamidx, &stream, 0))
+    {
+      lprintf (0, "%s(): error adding stream to index", __func__);
+      retval = -1;
+    }
+    else
+    {
+      ringparams->streamcount++;
+    }
+  }
+
+  /* Test for read error */
+  if (rv < 0)
+  {
+    lprintf (0, "%s(): error reading %s: %s", __func__, streamfilename, strerror (errno));
+    retval = -1;
+  }
+
+  close (streamidxfd);
+
+  return retval;
+} /* End of StreamIdxLoad() */
+
+/***************************************************************************
+ * StreamIdxMap:
+ *
+ * Move the stream index of the ring into blocks memory mapped from
+ * streamfilename.  Stream entries are then updated in the file as
+ * packets are written and the stream index survives an unclean
+ * shutdown without being written by RingShutdown().
+ *
+ * The file is a plain array of RingStream entries, unused entries have
+ * an empty stream ID.  If the entries do not align with the system
+ * page size the index is left in memory and written on shutdown.
+ *
+ * Return 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+StreamIdxMap (RingParams *ringparams, char *streamfilename)
+{
+  RingStreamIdx *streamidx;
+  RingStream *stream;
+  long pagesize;
+  uint32_t slot;
+  int fd;
+
+  if ((pagesize = sysconf (_SC_PAGESIZE)) <= 0 ||
+      (STREAMIDX_BLOCKSIZE * sizeof (RingStream)) % pagesize)
+  {
+    lprintf (1, "Stream index entries do not align with pages, index kept in memory");
+    return 0;
+  }
+
+  if ((fd = open (streamfilename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0)
+  {
+    lprintf (0, "%s(): error opening %s: %s", __func__, streamfilename, strerror (errno));
+    return -1;
+  }
+
+  /* Rewrite the file from the index loaded in memory */
+  if (ftruncate (fd, 0) || !(streamidx = StreamIdxCreate (fd)))
+  {
+    lprintf (0, "%s(): error initializing %s: %s", __func__, streamfilename, strerror (errno));
+    close (fd);
+    return -1;
+  }
+
+  for (slot = 0; slot < ringparams->streamidx->size; slot++)
+  {
+    if (!(stream = ringparams->streamidx->entries[slot]))
+      continue;
 
-      offset = (offset_unwrapped > ringparams->maxoffset) ? offset_unwrapped - ringparams->maxoffset : offset_unwrapped;
+    if (!AddStreamIdx (streamidx, stream, 0))
+    {
+      StreamIdxDestroy (streamidx);
+      return -1;
+    }
+  }
 
-      packet = (RingPacket *)(ringparams->data + offset);
+  StreamIdxDestroy (ringparams->streamidx);
+  ringparams->streamidx = streamidx;
 
-      /* If packet ID is found return the offset */
-      if (packet->pktid == pktid)
-      {
-        if (pkttime)
-          *pkttime = packet->pkttime;
+  return 0;
+} /* End of StreamIdxMap() */
 
-        return offset;
-      }
+/***************************************************************************
+ * StreamIdxSync:
+ *
+ * Flush the blocks of a memory mapped stream index to the file.
+ *
+ * Return 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+StreamIdxSync (RingStreamIdx *streamidx)
+{
+  uint32_t idx;
+  int rv = 0;
 
-      if (packet->pktid < pktid)
-      {
-        lowpkt = midpkt + 1;
-      }
-      else
-      {
-        highpkt = midpkt - 1;
-      }
-    }
-  }
-  /* Otherwise the ID set has either wrapped or is otherwise unordered */
-  else
+  for (idx = 0; idx < streamidx->blockcount; idx++)
   {
-    /* Brute force search backwards from the latest */
-    offset = NEXTOFFSET (latestoffset, ringparams->maxoffset, ringparams->pktsize);
-    do
-    {
-      offset = PREVOFFSET (offset, ringparams->maxoffset, ringparams->pktsize);
+    if (msync (streamidx->blocks[idx], STREAMIDX_BLOCKSIZE * sizeof (RingStream), MS_SYNC))
+      rv = -1;
+  }
 
-      packet = (RingPacket *)(ringparams->data + offset);
+  return rv;
+} /* End of StreamIdxSync() */
 
-      if (packet->pktid == pktid)
-      {
-        if (pkttime)
-          *pkttime = packet->pkttime;
+/***************************************************************************
+ * StreamIdxSlot:
+ *
+ * Find the table slot for a key, either the slot containing the key
+ * or the empty slot where it would be inserted.
+ ***************************************************************************/
+static inline uint32_t
+StreamIdxSlot (RingStreamIdx *streamidx, uint64_t key)
+{
+  uint32_t mask = streamidx->size - 1;
+  uint32_t slot = (uint32_t)(key ^ (key >> 32)) & mask;
 
-        return offset;
-      }
-    } while (offset != ringparams->earliestoffset);
+  while (streamidx->keys[slot] && streamidx->keys[slot] != key)
+    slot = (slot + 1) & mask;
+
+  return slot;
+} /* End of StreamIdxSlot() */
+
+/***************************************************************************
+ * StreamIdxResize:
+ *
+ * Rehash the stream index into a table of the specified size.
+ *
+ * Return 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+StreamIdxResize (RingStreamIdx *streamidx, uint32_t size)
+{
+  uint64_t *oldkeys       = streamidx->keys;
+  RingStream **oldentries = streamidx->entries;
+  uint32_t oldsize        = streamidx->size;
+  uint32_t slot;
+  uint32_t idx;
+
+  streamidx->keys    = (uint64_t *)calloc (size, sizeof (uint64_t));
+  streamidx->entries = (RingStream **)calloc (size, sizeof (RingStream *));
+
+  if (!streamidx->keys || !streamidx->entries)
+  {
+    free (streamidx->keys);
+    free (streamidx->entries);
+    streamidx->keys    = oldkeys;
+    streamidx->entries = oldentries;
+    return -1;
   }
 
-  return -1;
-} /* End of FindOffsetForID() */
+  streamidx->size = size;
+
+  for (idx = 0; idx < oldsize; idx++)
+  {
+    if (oldkeys[idx])
+    {
+      slot                     = StreamIdxSlot (streamidx, oldkeys[idx]);
+      streamidx->keys[slot]    = oldkeys[idx];
+      streamidx->entries[slot] = oldentries[idx];
+    }
+  }
+
+  free (oldkeys);
+  free (oldentries);
+
+  return 0;
+} /* End of StreamIdxResize() */
 
 /***************************************************************************
  * AddStreamIdx:
  *
  * Add a RingStream to the specified stream index, no checking is done
- * to determine if this entry already exists.  Return a pointer to the
- * newly generated Key if **ppkey is supplied.
+ * to determine if this entry already exists.  Set the key of the new
+ * entry if pkey is supplied.
+ *
+ * Stream entries are allocated in blocks and never move, pointers to
+ * them remain valid until the entry is removed.
  *
  * Return a pointer to the added RingStream on success and 0 on error.
  ***************************************************************************/
 static RingStream *
-AddStreamIdx (RBTree *streamidx, RingStream *stream, Key **ppkey)
+AddStreamIdx (RingStreamIdx *streamidx, RingStream *stream, uint64_t *pkey)
 {
-  Key *newkey;
   RingStream *newdata;
+  RingStream *block;
+  RingStream **freeentries;
+  uint64_t key;
+  uint32_t slot;
+  uint32_t idx;
 
   if (!streamidx || !stream)
     return 0;
 
-  /* Create new tree key */
-  newkey = (Key *)malloc (sizeof (Key));
+  /* Grow table to keep load factor at or below 1/2 */
+  if ((streamidx->count + 1) * 2 > streamidx->size)
+  {
+    if (StreamIdxResize (streamidx, streamidx->size * 2))
+      return 0;
+  }
+
+  /* Allocate a new block of stream entries if none are unused */
+  if (streamidx->freecount == 0)
+  {
+    block       = StreamIdxBlock (streamidx);
+    freeentries = (RingStream **)realloc (streamidx->freeentries,
+                                          (streamidx->blockcount + 1) * STREAMIDX_BLOCKSIZE * sizeof (RingStream *));
+    if (freeentries)
+      streamidx->freeentries = freeentries;
+
+    if (!block || !freeentries ||
+        !(streamidx->blocks = (RingStream **)realloc (streamidx->blocks,
+                                                      (streamidx->blockcount + 1) * sizeof (RingStream *))))
+    {
+      lprintf (0, "%s(): error allocating stream entries: %s", __func__, strerror (errno));
+      return 0;
+    }
+
+    streamidx->blocks[streamidx->blockcount++] = block;
 
-  /* Create new stream node */
-  newdata = (RingStream *)malloc (sizeof (RingStream));
+    for (idx = STREAMIDX_BLOCKSIZE; idx > 0; idx--)
+      streamidx->freeentries[streamidx->freecount++] = &block[idx - 1];
+  }
 
-  if (!newkey || !newdata)
-    return 0;
+  newdata = streamidx->freeentries[--streamidx->freecount];
 
-  /* Populate the new data node and key */
+  /* Populate the new entry and add to the table */
   memcpy (newdata, stream, sizeof (RingStream));
-  *newkey = FNVhash64 (newdata->streamid);
+  key  = StreamKey (newdata->streamid);
+  slot = StreamIdxSlot (streamidx, key);
 
-  /* Add to the stream index */
-  RBTreeInsert (streamidx, newkey, newdata, 0);
+  streamidx->keys[slot]    = key;
+  streamidx->entries[slot] = newdata;
+  streamidx->count++;
 
-  /* Set pointer to hash key if requested */
-  if (ppkey)
-    *ppkey = newkey;
+  /* Set hash key if requested */
+  if (pkey)
+    *pkey = key;
 
   return newdata;
 } /* End of AddStreamIdx() */
@@ -1873,51 +4432,421 @@ AddStreamIdx (RBTree *streamidx, RingStream *stream, Key **ppkey)
  * Return a pointer to a RingStream if found or 0 if no match.
  ***************************************************************************/
 static RingStream *
-GetStreamIdx (RBTree *streamidx, char *streamid)
+GetStreamIdx (RingStreamIdx *streamidx, char *streamid)
 {
-  Key key;
-  RingStream *stream = 0;
-  RBNode *tnode;
+  uint32_t slot;
 
   if (!streamidx || !streamid)
     return 0;
 
-  /* Generate key from streamid */
-  key = FNVhash64 (streamid);
-
-  /* Search for a matching key */
-  if ((tnode = RBFind (streamidx, &key)))
-  {
-    stream = (RingStream *)tnode->data;
-  }
+  slot = StreamIdxSlot (streamidx, StreamKey (streamid));
 
-  return stream;
+  return streamidx->entries[slot];
 } /* End of GetStreamIdx() */
 
 /***************************************************************************
  * DelStreamIdx:
  *
- * Remove the specified stream ID from the stream index.
+ * Remove the specified stream ID from the stream index.  Following
+ * entries in the probe sequence are shifted back so no deletion
+ * markers are needed.
  *
  * Return 0 on success and -1 on error.
  ***************************************************************************/
 static int
-DelStreamIdx (RBTree *streamidx, char *streamid)
+DelStreamIdx (RingStreamIdx *streamidx, char *streamid)
 {
-  Key key;
-  RBNode *tnode;
+  uint32_t mask;
+  uint32_t slot;
+  uint32_t next;
+  uint32_t home;
 
   if (!streamidx || !streamid)
     return -1;
 
-  /* Generate key from streamid */
-  key = FNVhash64 (streamid);
+  mask = streamidx->size - 1;
+  slot = StreamIdxSlot (streamidx, StreamKey (streamid));
+
+  if (!streamidx->keys[slot])
+    return -1;
+
+  /* Mark entry unused, as it will be found in a memory mapped index */
+  streamidx->entries[slot]->streamid[0] = '\0';
 
-  /* Search for a matching key */
-  if ((tnode = RBFind (streamidx, &key)))
+  streamidx->freeentries[streamidx->freecount++] = streamidx->entries[slot];
+  streamidx->count--;
+
+  /* Shift back entries that would not be found after emptying the slot */
+  next = slot;
+  while (1)
   {
-    RBDelete (streamidx, tnode);
+    next = (next + 1) & mask;
+
+    if (!streamidx->keys[next])
+      break;
+
+    home = (uint32_t)(streamidx->keys[next] ^ (streamidx->keys[next] >> 32)) & mask;
+
+    /* Entry can move to the empty slot if its home is not cyclically in (slot, next] */
+    if ((slot <= next) ? (home <= slot || home > next) : (home <= slot && home > next))
+    {
+      streamidx->keys[slot]    = streamidx->keys[next];
+      streamidx->entries[slot] = streamidx->entries[next];
+      slot                     = next;
+    }
   }
 
-  return (tnode) ? 0 : -1;
+  streamidx->keys[slot]    = 0;
+  streamidx->entries[slot] = NULL;
+
+  return 0;
 } /* End of DelStreamIdx() */
+
+/***************************************************************************
+ * StreamIdxChanged:
+ *
+ * Record the addition or removal of a stream in the change log of the
+ * ring's stream index and advance the stream index generation.  The
+ * log holds the last STREAMIDX_CHANGES changes, indexed by generation.
+ * The stream lock must be held by the caller.
+ ***************************************************************************/
+static void
+StreamIdxChanged (RingParams *ringparams, const char *streamid, uint64_t key, uint8_t removed)
+{
+  RingStreamIdx *streamidx = ringparams->streamidx;
+  RingStreamChange *change;
+
+  /* Allocate change log on first use, readers walk the index without it */
+  if (!streamidx->changes)
+  {
+    if ((streamidx->changes = (RingStreamChange *)malloc (STREAMIDX_CHANGES * sizeof (RingStreamChange))))
+      streamidx->changestart = ringparams->streamgen;
+  }
+
+  if (streamidx->changes)
+  {
+    change = &streamidx->changes[ringparams->streamgen % STREAMIDX_CHANGES];
+
+    memcpy (change->streamid, streamid, sizeof (change->streamid));
+    change->key     = key;
+    change->removed = removed;
+  }
+
+  ringparams->streamgen++;
+} /* End of StreamIdxChanged() */
+
+/***************************************************************************
+ * HugePageSize:
+ *
+ * Determine the default size of explicit huge pages from /proc/meminfo.
+ *
+ * Returns the huge page size in bytes, 2 MiB if it cannot be determined.
+ ***************************************************************************/
+static size_t
+HugePageSize (void)
+{
+  char line[200];
+  unsigned long kbytes = 0;
+  FILE *meminfo;
+
+  if ((meminfo = fopen ("/proc/meminfo", "r")))
+  {
+    while (fgets (line, sizeof (line), meminfo))
+    {
+      if (sscanf (line, "Hugepagesize: %lu kB", &kbytes) == 1)
+        break;
+    }
+
+    fclose (meminfo);
+  }
+
+  return (kbytes > 0) ? (size_t)kbytes * 1024 : 2 * 1024 * 1024;
+} /* End of HugePageSize() */
+
+/***************************************************************************
+ * RingMemoryAlloc:
+ *
+ * Allocate memory for a ring packet buffer that is not memory mapped
+ * from the packet buffer file.
+ *
+ * Without memory options the buffer is allocated with malloc().  With
+ * any option the buffer is an anonymous memory mapping, page aligned
+ * for NUMA policies and, if requested, backed by explicit huge pages or
+ * advised for transparent huge pages.  If explicit huge pages are not
+ * available, e.g. none are reserved, transparent huge pages are used.
+ *
+ * Returns a pointer to the memory on success and NULL on error.
+ ***************************************************************************/
+static void *
+RingMemoryAlloc (uint64_t ringsize, const RingMemOptions *memopts)
+{
+  void *ring;
+  size_t hugesize;
+  size_t mapsize;
+
+  ringmapsize = 0;
+
+  if (!memopts || (memopts->hugepages == RING_HUGEPAGES_NONE &&
+                   memopts->prefault == RING_PREFAULT_NONE &&
+                   memopts->numapolicy == RING_NUMA_DEFAULT))
+    return malloc (ringsize);
+
+#if defined(MAP_HUGETLB)
+  if (memopts->hugepages == RING_HUGEPAGES_EXPLICIT)
+  {
+    hugesize = HugePageSize ();
+    mapsize  = (size_t)((ringsize + hugesize - 1) / hugesize * hugesize);
+
+    ring = mmap (NULL, mapsize, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if (ring != MAP_FAILED)
+    {
+      lprintf (1, "Ring packet buffer allocated in %zu huge pages of %zu KiB",
+               mapsize / hugesize, hugesize / 1024);
+
+      ringmapsize = mapsize;
+      return ring;
+    }
+
+    lprintf (0, "Cannot allocate ring packet buffer in explicit huge pages (%s), using transparent huge pages",
+             strerror (errno));
+  }
+#else
+  (void)hugesize;
+  (void)mapsize;
+
+  if (memopts->hugepages == RING_HUGEPAGES_EXPLICIT)
+    lprintf (0, "Explicit huge pages not supported on this platform, using transparent huge pages");
+#endif
+
+  ring = mmap (NULL, ringsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (ring == MAP_FAILED)
+    return NULL;
+
+  ringmapsize = ringsize;
+
+  if (memopts->hugepages != RING_HUGEPAGES_NONE)
+  {
+#if defined(MADV_HUGEPAGE)
+    if (madvise (ring, ringsize, MADV_HUGEPAGE))
+      lprintf (0, "Cannot advise transparent huge pages for ring packet buffer: %s", strerror (errno));
+    else
+      lprintf (1, "Ring packet buffer advised for transparent huge pages");
+#else
+    lprintf (0, "Transparent huge pages not supported on this platform");
+#endif
+  }
+
+  return ring;
+} /* End of RingMemoryAlloc() */
+
+/***************************************************************************
+ * RingMemoryFree:
+ *
+ * Free ring packet buffer memory allocated with RingMemoryAlloc().
+ ***************************************************************************/
+static void
+RingMemoryFree (void *ring)
+{
+  if (!ring)
+    return;
+
+  if (ringmapsize)
+  {
+    if (munmap (ring, ringmapsize))
+      lprintf (0, "%s(): error unmapping ring packet buffer: %s", __func__, strerror (errno));
+
+    ringmapsize = 0;
+  }
+  else
+  {
+    free (ring);
+  }
+} /* End of RingMemoryFree() */
+
+/***************************************************************************
+ * RingMemoryPolicy:
+ *
+ * Set the NUMA memory policy for the ring packet buffer memory.  The
+ * policy is set for the memory range, which determines the placement
+ * of anonymous memory when it is first touched.  Pages of a memory
+ * mapped file are placed according to the policy of the thread that
+ * faults them, so the policy is also set for the calling thread until
+ * RingMemoryPrefault() restores the default.  Pages already present,
+ * e.g. in the page cache, are not moved.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+RingMemoryPolicy (void *ring, uint64_t ringsize, const RingMemOptions *memopts)
+{
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_set_mempolicy)
+  char line[200];
+  unsigned long nodemask;
+  uint64_t nodes;
+  int mode;
+  FILE *online;
+
+  if (!memopts || memopts->numapolicy == RING_NUMA_DEFAULT)
+    return 0;
+
+  nodes = memopts->numanodes;
+
+  /* Use all online nodes if none are specified */
+  if (!nodes)
+  {
+    if (!(online = fopen ("/sys/devices/system/node/online", "r")))
+    {
+      lprintf (0, "Cannot determine online NUMA nodes: %s", strerror (errno));
+      return -1;
+    }
+
+    if (!fgets (line, sizeof (line), online) || ParseNumberList (line, &nodes))
+    {
+      lprintf (0, "Cannot parse online NUMA nodes");
+      fclose (online);
+      return -1;
+    }
+
+    fclose (online);
+  }
+
+  nodemask = (unsigned long)nodes;
+  mode     = (memopts->numapolicy == RING_NUMA_BIND) ? MPOL_BIND : MPOL_INTERLEAVE;
+
+  if (syscall (SYS_mbind, ring, (unsigned long)ringsize, mode, &nodemask,
+               (unsigned long)(sizeof (nodemask) * 8), 0))
+  {
+    lprintf (0, "Cannot set NUMA policy for ring packet buffer: %s", strerror (errno));
+    return -1;
+  }
+
+  if (syscall (SYS_set_mempolicy, mode, &nodemask, (unsigned long)(sizeof (nodemask) * 8)))
+  {
+    lprintf (0, "Cannot set NUMA policy for ring initialization: %s", strerror (errno));
+    return -1;
+  }
+
+  lprintf (1, "Ring packet buffer NUMA policy: %s, node mask 0x%lx",
+           (mode == MPOL_BIND) ? "bind" : "interleave", nodemask);
+
+  return 0;
+#else
+  if (memopts && memopts->numapolicy != RING_NUMA_DEFAULT)
+    lprintf (0, "NUMA memory policies not supported on this platform, ignoring");
+
+  return 0;
+#endif
+} /* End of RingMemoryPolicy() */
+
+/***************************************************************************
+ * RingMemoryPrefault:
+ *
+ * Fault in all pages of the ring packet buffer, and optionally lock
+ * them in memory, to avoid page faults while serving clients.  Pages
+ * of a memory mapped file are read, anonymous memory is written so
+ * that private pages are allocated.  Progress is logged in steps of
+ * 10 percent, followed by the elapsed time and page fault counts.
+ *
+ * A failure to lock the memory, e.g. due to RLIMIT_MEMLOCK, is logged
+ * but not fatal.
+ ***************************************************************************/
+static void
+RingMemoryPrefault (void *ring, uint64_t ringsize, uint8_t mmapflag,
+                    const RingMemOptions *memopts)
+{
+  struct rusage before;
+  struct rusage after;
+  nstime_t starttime;
+  char sizestr[32];
+  long pagesize;
+  uint64_t offset;
+  uint64_t length;
+  uint64_t page;
+  int percent = 0;
+  int advice  = -1;
+
+  if (!memopts)
+    return;
+
+  /* The NUMA policy of the thread is only needed while pre-faulting */
+  if (memopts->prefault == RING_PREFAULT_NONE)
+  {
+    RingMemoryPolicyReset (memopts);
+    return;
+  }
+
+  if ((pagesize = sysconf (_SC_PAGESIZE)) <= 0)
+    pagesize = 4096;
+
+#if defined(MADV_POPULATE_READ) && defined(MADV_POPULATE_WRITE)
+  advice = (mmapflag) ? MADV_POPULATE_READ : MADV_POPULATE_WRITE;
+#endif
+
+  HumanSizeString (ringsize, sizestr, sizeof (sizestr));
+  lprintf (1, "Pre-faulting %s ring packet buffer", sizestr);
+
+  getrusage (RUSAGE_SELF, &before);
+  starttime = NSnow ();
+
+  for (offset = 0; offset < ringsize; offset += length)
+  {
+    length = (ringsize - offset < PREFAULT_CHUNK) ? ringsize - offset : PREFAULT_CHUNK;
+
+    /* Touch each page if the kernel cannot populate the range */
+    if (advice < 0 || madvise ((uint8_t *)ring + offset, length, advice))
+    {
+      advice = -1;
+
+      for (page = 0; page < length; page += pagesize)
+      {
+        volatile uint8_t *byte = (uint8_t *)ring + offset + page;
+
+        if (mmapflag)
+          (void)*byte;
+        else
+          *byte = *byte;
+      }
+    }
+
+    if ((offset + length) * 10 / ringsize > (uint64_t)percent / 10)
+    {
+      percent = (int)((offset + length) * 10 / ringsize) * 10;
+      lprintf (1, "Pre-faulted %d%% of ring packet buffer", percent);
+    }
+  }
+
+  getrusage (RUSAGE_SELF, &after);
+
+  lprintf (0, "Pre-faulted ring packet buffer in %.1f seconds, page faults: %ld minor, %ld major",
+           (double)(NSnow () - starttime) / NSTMODULUS,
+           after.ru_minflt - before.ru_minflt, after.ru_majflt - before.ru_majflt);
+
+  if (memopts->prefault == RING_PREFAULT_LOCK)
+  {
+    if (mlock (ring, ringsize))
+      lprintf (0, "Cannot lock ring packet buffer in memory, check RLIMIT_MEMLOCK (ulimit -l): %s",
+               strerror (errno));
+    else
+      lprintf (1, "Ring packet buffer locked in memory");
+  }
+
+  RingMemoryPolicyReset (memopts);
+} /* End of RingMemoryPrefault() */
+
+/***************************************************************************
+ * RingMemoryPolicyReset:
+ *
+ * Restore the default NUMA policy of the calling thread after it was
+ * set by RingMemoryPolicy().
+ ***************************************************************************/
+static void
+RingMemoryPolicyReset (const RingMemOptions *memopts)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+  if (memopts && memopts->numapolicy != RING_NUMA_DEFAULT)
+    syscall (SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0UL);
+#endif
+} /* End of RingMemoryPolicyReset() */
@@ -39,12 +39,15 @@ extern "C" {
 #include <pcre2.h>
 #define PCRE2_COMPILE_OPTIONS (PCRE2_NO_AUTO_CAPTURE | PCRE2_NEVER_UTF)
 
-#include "rbtree.h"
+#include "stack.h"
 
 /* Static ring parameters */
 #define RING_SIGNATURE "RING"
 #define RING_VERSION  2
 
+/* Maximum number of packets reserved by writers but not yet committed */
+#define RING_MAXRESERVED 64
+
 /* Special ring packet ID values, the highest 10 values are reserved */
 #define RINGID_ERROR    (UINT64_MAX)
 #define RINGID_NONE     (UINT64_MAX - 1)
@@ -60,10 +63,44 @@ extern "C" {
    of the form:  NN_SSSSS_LL_CCC/MSEED */
 #define LEGACY_MSEED_STREAMID_PATTERN "^[0-9A-Z]{1,2}_[0-9A-Z]{1,5}_[0-9A-Z]{0,2}_[0-9A-Z]{3}/MSEED$"
 
-/* Macros for updating different patterns */
-#define RingLimit(reader, pattern) UpdatePattern (&(reader)->limit, &(reader)->limit_data, pattern, "ring limit")
-#define RingMatch(reader, pattern) UpdatePattern (&(reader)->match, &(reader)->match_data, pattern, "ring match")
-#define RingReject(reader, pattern) UpdatePattern (&(reader)->reject, &(reader)->reject_data, pattern, "ring reject")
+/* Macros for updating different patterns, any cached stream verdicts are reset */
+#define RingLimit(reader, pattern) RingUpdatePattern (reader, &(reader)->limit, &(reader)->limit_data, pattern, "ring limit")
+#define RingMatch(reader, pattern) RingUpdatePattern (reader, &(reader)->match, &(reader)->match_data, pattern, "ring match")
+#define RingReject(reader, pattern) RingUpdatePattern (reader, &(reader)->reject, &(reader)->reject_data, pattern, "ring reject")
+
+/* Huge page use for the ring packet buffer */
+#define RING_HUGEPAGES_NONE        0
+#define RING_HUGEPAGES_TRANSPARENT 1
+#define RING_HUGEPAGES_EXPLICIT    2
+
+/* Pre-faulting of the ring packet buffer at initialization */
+#define RING_PREFAULT_NONE     0
+#define RING_PREFAULT_POPULATE 1
+#define RING_PREFAULT_LOCK     2
+
+/* NUMA memory policy for the ring packet buffer */
+#define RING_NUMA_DEFAULT    0
+#define RING_NUMA_INTERLEAVE 1
+#define RING_NUMA_BIND       2
+
+/* Ring packet buffer memory options, see RingInitialize() */
+typedef struct RingMemOptions
+{
+  uint8_t   hugepages;        /* RING_HUGEPAGES_* value */
+  uint8_t   prefault;         /* RING_PREFAULT_* value */
+  uint8_t   numapolicy;       /* RING_NUMA_* value */
+  uint64_t  numanodes;        /* Bit mask of NUMA nodes, 0 for all online nodes */
+} RingMemOptions;
+
+/* Time index entry summarizing the data times of a block of packet slots,
+ * the prev* values cover packets of the previous lap not yet overwritten */
+typedef struct RingTimeBlock
+{
+  nstime_t  mindatastart;     /* Minimum data start time in block */
+  nstime_t  maxdataend;       /* Maximum data end time in block */
+  nstime_t  prevmindatastart; /* Minimum data start time of remaining older packets */
+  nstime_t  prevmaxdataend;   /* Maximum data end time of remaining older packets */
+} RingTimeBlock;
 
 /* Ring parameters, stored at the beginning of the packet buffer file */
 typedef struct RingParams
@@ -80,7 +117,7 @@ typedef struct RingParams
   uint8_t   mmapflag;         /* Memory mapped flag */
   uint8_t   volatileflag;     /* Volatile ring flag */
   pthread_mutex_t *writelock; /* Mutex lock for ring write access */
-  RBTree   *streamidx;        /* Binary tree of streams */
+  struct RingStreamIdx *streamidx; /* Hash index of streams */
   pthread_mutex_t *streamlock;/* Mutex lock for stream index */
   uint32_t   streamcount;     /* Count of streams in index */
   uint64_t  earliestid;       /* Earliest packet ID */
@@ -99,6 +136,19 @@ typedef struct RingParams
   double    rxpacketrate;     /* Reception packet rate in Hz */
   double    rxbyterate;       /* Reception byte rate in Hz */
   uint8_t  *data;             /* Pointer to start of data buffer */
+  pthread_mutex_t *notifylock;/* Mutex lock for reader notification */
+  struct RingReader *waiters; /* List of readers waiting for new packets */
+  uint64_t  writeseq;         /* Write sequence, incremented for each packet */
+  uint64_t  streamgen;        /* Stream index generation, incremented on add/remove */
+  struct RingTimeBlock *timeidx; /* Time index of packet slot blocks */
+  uint64_t  streamseq;        /* Stream entry update sequence, odd while updating */
+  pthread_cond_t *commitcond; /* Condition signalled when packets are committed */
+  int64_t   reserveoffset;    /* Offset of the latest reserved packet */
+  uint64_t  reserveid;        /* Packet ID of the latest reserved packet */
+  uint64_t  reserveseq;       /* Reservation sequence, incremented for each packet */
+  uint64_t  commitseq;        /* Reservation sequence of the latest committed packet */
+  uint32_t  reservecount;     /* Count of reserved packets not yet committed */
+  uint8_t   reservefilled[RING_MAXRESERVED]; /* Filled flags of reservations */
 } RingParams;
 
 /* Ring packet header structure, data follows header in the ring */
@@ -131,6 +181,73 @@ typedef struct RingStream
   int64_t     latestoffset;  /* Offset of latest packet */
 } RingStream;
 
+/* Stream index change, an addition or removal of a stream */
+typedef struct RingStreamChange
+{
+  char        streamid[MAXSTREAMID]; /* Stream ID added or removed */
+  uint64_t    key;           /* Stream ID hash key */
+  uint8_t     removed;       /* Flag indicating the stream was removed */
+} RingStreamChange;
+
+/* Stream index, an open-addressing hash table keyed on FNVhash64() of the
+ * stream ID with stream entries allocated in blocks, optionally memory
+ * mapped from the stream index file */
+typedef struct RingStreamIdx
+{
+  uint64_t    *keys;         /* Table of stream keys, 0 for empty slots */
+  RingStream **entries;      /* Table of stream entries, parallel to keys */
+  uint32_t     size;         /* Table size in slots, a power of 2 */
+  uint32_t     count;        /* Count of streams in index */
+  RingStream **blocks;       /* Allocated blocks of stream entries */
+  uint32_t     blockcount;   /* Count of allocated blocks */
+  RingStream **freeentries;  /* Stack of unused stream entries */
+  uint32_t     freecount;    /* Count of unused stream entries */
+  int          fd;           /* Descriptor of memory mapped index file, -1 if none */
+  RingStreamChange *changes; /* Log of recent changes, indexed by generation */
+  uint64_t     changestart;  /* First generation recorded in the change log */
+} RingStreamIdx;
+
+/* Stream match verdict cache entry, keyed on FNVhash64() of stream ID */
+typedef struct RingMatchEntry
+{
+  uint64_t key;              /* Stream ID hash key */
+  uint8_t  verdict;          /* Match verdict, zero for an empty slot */
+} RingMatchEntry;
+
+/* Stream match verdict cache, an open-addressing hash table */
+typedef struct RingMatchCache
+{
+  RingMatchEntry *entries;   /* Hash table of entries */
+  size_t      size;          /* Number of slots, a power of 2 */
+  size_t      count;         /* Number of occupied slots */
+} RingMatchCache;
+
+/* Cursor following the packets of a single stream via nextinstream */
+typedef struct RingStreamCursor
+{
+  uint64_t key;              /* Stream ID hash key */
+  int64_t  offset;           /* Offset of next packet, or last packet if waiting */
+  uint64_t pktid;            /* ID of packet at offset */
+  uint8_t  waiting;          /* Flag indicating next packet is not yet in ring */
+} RingStreamCursor;
+
+/* Set of selected streams followed by a reader, merged with a heap */
+typedef struct RingStreamSet
+{
+  RingStreamCursor *cursors; /* Cursors for each selected stream */
+  RingStreamCursor *spare;   /* Cursors being built, swapped with cursors */
+  int        *heap;          /* Min-heap of non-waiting cursor indexes by packet ID */
+  int         count;         /* Number of cursors */
+  int         selected;      /* Number of selected streams in the stream index */
+  int         heapcount;     /* Number of cursors in heap */
+  uint64_t    streamgen;     /* Stream index generation the set was built for */
+  uint64_t    pktid;         /* Reader packet ID the cursors are relative to */
+  int64_t     pktoffset;     /* Reader packet offset the cursors are relative to */
+  uint8_t     valid;         /* Flag indicating the cursors are valid */
+  uint8_t     counted;       /* Flag indicating the selected count is valid */
+  uint8_t     scan;          /* Flag indicating selection is too wide to follow */
+} RingStreamSet;
+
 /* Ring reader parameters */
 typedef struct RingReader
 {
@@ -146,25 +263,45 @@ typedef struct RingReader
   pcre2_match_data *match_data;  /* Match data results */
   pcre2_code *reject;        /* Compiled reject expression */
   pcre2_match_data *reject_data; /* Match data results */
+  RingMatchCache *matchcache;    /* Cache of stream match verdicts */
+  RingStreamSet *streamset;      /* Selected streams followed by the reader */
+  int         notifyfd[2];   /* Notification descriptors, read and write ends */
+  uint8_t     waiting;       /* Flag indicating reader is in the wait list */
+  uint8_t     notified;      /* Flag indicating a notification was not yet drained */
+  struct RingReader *nextwaiter; /* Next reader in the wait list */
+  struct RingReader *prevwaiter; /* Previous reader in the wait list */
 } RingReader;
 
 extern int RingInitialize (char *ringfilename, char *streamfilename,
                            uint64_t ringsize, uint32_t pktsize,
                            uint8_t mmapflag, uint8_t volatileflag,
+                           uint8_t rebuildflag, const RingMemOptions *memopts,
                            int *ringfd, RingParams **ringparams);
 extern int RingShutdown (int ringfd, char *streamfilename, RingParams *ringparams);
+extern int RingWriteBatch (RingParams *ringparams, RingPacket *packets,
+                           char **packetdata, uint32_t count);
 extern int RingWrite (RingParams *ringparams, RingPacket *packet,
                       char *packetdata, uint32_t datasize);
 extern uint64_t RingRead (RingReader *reader, uint64_t reqid,
                           RingPacket *packet, char *packetdata);
 extern uint64_t RingReadNext (RingReader *reader, RingPacket *packet, char *packetdata);
+extern uint64_t RingReadNextRef (RingReader *reader, RingPacket *packet, char **packetref);
+extern int RingReadValid (RingReader *reader, const RingPacket *packet);
 extern uint64_t RingPosition (RingReader *reader, uint64_t pktid, nstime_t pkttime);
 extern uint64_t RingAfter (RingReader *reader, nstime_t reftime, int whence);
 extern uint64_t RingAfterRev (RingReader *reader, nstime_t reftime, uint64_t pktlimit, int whence);
 extern void LogRingParameters (RingParams *ringparams);
 extern int UpdatePattern (pcre2_code **code, pcre2_match_data **data,
                           const char *pattern, const char *description);
+extern int RingUpdatePattern (RingReader *reader, pcre2_code **code, pcre2_match_data **data,
+                              const char *pattern, const char *description);
+extern void RingReaderFree (RingReader *reader);
 extern Stack* GetStreamsStack (RingParams *ringparams, RingReader *reader);
+extern RingStream *GetStreamsArray (RingParams *ringparams, RingReader *reader, uint32_t *count);
+extern int RingNotifyInit (RingReader *reader);
+extern void RingNotifyFree (RingReader *reader);
+extern int RingWaitArm (RingReader *reader, uint64_t writeseq);
+extern void RingWaitDisarm (RingReader *reader);
 
 
 #ifdef __cplusplus
@@ -54,11 +54,24 @@
 #include "ringserver.h"
 #include "config.h"
 #include "loadbuffer.h"
+#include "tls.h"
 
 /* Reserve connection count, allows connections from addresses with write
  * permission even when the maximum connection count has been reached. */
 #define RESERVECONNECTIONS 10
 
+/* Number of hash buckets for per-address client counts */
+#define IPCOUNT_BUCKETS 4096
+
+/* Count of connected clients for an address */
+typedef struct IPCount
+{
+  int family;              /* Address family, AF_INET or AF_INET6 */
+  uint8_t address[16];     /* IPv4 or IPv6 address */
+  uint32_t count;          /* Number of connected clients */
+  struct IPCount *next;    /* Next entry in hash bucket */
+} IPCount;
+
 #define GIBIBYTE (1024ULL * 1024ULL * 1024ULL)
 
 /* Global parameter declaration and defaults */
@@ -67,6 +80,7 @@ struct param_s param = {
     .clientcount         = 0,
     .shutdownsig         = 0,
     .configfilemtime     = 0,
+    .statsgen            = 0,
     .sthreads_lock       = PTHREAD_MUTEX_INITIALIZER,
     .sthreads            = NULL,
     .cthreads_lock       = PTHREAD_MUTEX_INITIALIZER,
@@ -83,15 +97,25 @@ struct config_s config = {
     .maxclients          = 600,
     .maxclientsperip     = 0,
     .clienttimeout       = 3600,
+    .workerthreads       = 0,
+    .listenbacklog       = 1024,
+    .listenthreads       = 1,
     .timewinlimit        = 1.0,
     .resolvehosts        = 1,
     .memorymapring       = 1,
     .volatilering        = 0,
     .autorecovery        = 1,
+    .workeruring         = 0,
+    .ringmem             = {RING_HUGEPAGES_NONE, RING_PREFAULT_NONE, RING_NUMA_DEFAULT, 0},
     .webroot             = NULL,
     .httpheaders         = NULL,
     .mseedarchive        = NULL,
     .mseedidleto         = 300,
+    .mseedwritethreads   = 1,
+    .mseedwritequeue     = 10000,
+    .mseedwriteflush     = 0,
+    .mseedwriteopenfiles = 50,
+    .mseedwritesync      = -1,
     .limitips            = NULL,
     .matchips            = NULL,
     .rejectips           = NULL,
@@ -109,6 +133,8 @@ static void *ListenThread (void *arg);
 static int CalcStats (ClientInfo *cinfo);
 static IPNet *MatchIP (IPNet *list, struct sockaddr *addr);
 static int ClientIPCount (struct sockaddr *addr);
+static void ClientIPTrack (struct sockaddr *addr, int delta);
+static IPCount **IPCountFind (struct sockaddr *addr);
 static void *SignalThread (void *arg);
 static void PrintHandler ();
 
@@ -117,6 +143,9 @@ static int tcpprotonumber = -1;
 
 static RingParams *ringparams = NULL;
 
+/* Per-address client counts, protected by param.cthreads_lock */
+static IPCount *ipcounts[IPCOUNT_BUCKETS];
+
 int
 main (int argc, char *argv[])
 {
@@ -212,6 +241,7 @@ main (int argc, char *argv[])
     if ((ringinit = RingInitialize (ringfilename, streamfilename,
                                     config.ringsize, config.pktsize,
                                     config.memorymapring, config.volatilering,
+                                    (config.autorecovery == 3), &config.ringmem,
                                     &ringfd, &ringparams)))
     {
       /* Exit on unrecoverable errors or if no auto recovery */
@@ -229,8 +259,10 @@ main (int argc, char *argv[])
         }
       }
 
-      /* Move corrupt packet buffer and index to backup (.corrupt) files */
-      if (config.autorecovery == 1 && (ringinit == -1 || ringinit > 0))
+      /* Move corrupt packet buffer and index to backup (.corrupt) files,
+       * also when a rebuild from the packet headers was not possible */
+      if ((config.autorecovery == 1 || config.autorecovery == 3) &&
+          (ringinit == -1 || ringinit > 0))
       {
         if (ringinit == -1)
         {
@@ -290,13 +322,13 @@ main (int argc, char *argv[])
       if ((ringinit = RingInitialize (ringfilename, streamfilename,
                                       config.ringsize, config.pktsize,
                                       config.memorymapring, config.volatilering,
-                                      &ringfd, &ringparams)))
+                                      0, &config.ringmem, &ringfd, &ringparams)))
       {
         lprintf (0, "Error re-initializing ring buffer on auto-recovery (%d)", ringinit);
         return 1;
       }
 
-      if (config.autorecovery == 1 && convert_version > 0)
+      if (convert_version > 0)
       {
         int64_t loaded_packets = 0;
 
@@ -362,6 +394,25 @@ main (int argc, char *argv[])
   LogRingParameters (ringparams);
   LogServerParameters ();
 
+  /* Load the TLS configuration shared by all TLS connections */
+  if (config.tlscertfile && tls_load ())
+    lprintf (0, "Error loading TLS certificate and key, TLS connections will fail");
+
+  /* Start client worker threads if configured, otherwise a thread per client */
+  if (config.workerthreads && ClientWorkersStart (config.workerthreads, config.workeruring))
+  {
+    lprintf (0, "Error starting client worker threads, using a thread per client");
+    config.workerthreads = 0;
+  }
+
+  /* Start miniSEED archive writer threads if configured, otherwise clients write directly */
+  if (config.mseedarchive && config.mseedwritethreads &&
+      ds_writerstart (config.mseedwritethreads, config.mseedwritequeue, config.mseedwriteflush))
+  {
+    lprintf (0, "Error starting miniSEED archive writer threads, clients will write directly");
+    config.mseedwritethreads = 0;
+  }
+
   /* Set loop interval check tick to 1/4 second */
   timereq.tv_sec  = 0;
   timereq.tv_nsec = 250000000;
@@ -647,7 +698,8 @@ main (int argc, char *argv[])
         if (ctp->next)
           ctp->next->prev = ctp->prev;
 
-        if ((errno = pthread_join (ctp->td->td_id, NULL)))
+        /* Clients served by worker threads have no thread to join */
+        if (!ctp->td->td_pooled && (errno = pthread_join (ctp->td->td_id, NULL)))
         {
           lprintf (0, "Error joining CLOSED thread %lu: %s",
                    (unsigned long int)ctp->td->td_id, strerror (errno));
@@ -655,7 +707,18 @@ main (int argc, char *argv[])
 
         /* Free the ClientInfo structure stored at the prvtptr */
         if (ctp->td->td_prvtptr)
-          free (ctp->td->td_prvtptr);
+        {
+          ClientInfo *cinfo = (ClientInfo *)ctp->td->td_prvtptr;
+
+          /* Release per-address count and socket address, allocated in ListenThread() */
+          if (cinfo->addr)
+          {
+            ClientIPTrack (cinfo->addr, -1);
+            free (cinfo->addr);
+          }
+
+          free (cinfo);
+        }
 
         /* Free thread data structure */
         if (ctp->td)
@@ -709,6 +772,9 @@ main (int argc, char *argv[])
     ringparams->rxpacketrate = rxpacketrate;
     ringparams->rxbyterate   = rxbyterate;
 
+    /* Updated statistics expire cached server information responses */
+    param.statsgen++;
+
     /* Check for config file updates */
     if (config.configfile && !lstat (config.configfile, &cfstat))
     {
@@ -720,6 +786,10 @@ main (int argc, char *argv[])
       }
     }
 
+    /* Reload the shared TLS configuration if the certificate or key changed */
+    if (config.tlscertfile && !param.shutdownsig)
+      tls_load ();
+
     /* Reset transfer log writing time windows using the current time as the reference */
     if (TLogParams.tlogbasedir && !param.shutdownsig && (tlogwrite || configreset))
     {
@@ -753,6 +823,15 @@ main (int argc, char *argv[])
     chktime     = curtime;
   } /* End of main watchdog loop */
 
+  /* Stop client worker threads */
+  if (config.workerthreads)
+    ClientWorkersStop ();
+
+  /* Stop miniSEED archive writer threads after writing queued records */
+  ds_writerstop ();
+
+  tls_free ();
+
   /* Shutdown ring buffer */
   if (config.ringdir || config.volatilering)
   {
@@ -805,8 +884,9 @@ InitThreadData (void *prvtptr)
     return 0;
   }
 
-  rtdp->td_id    = 0;
-  rtdp->td_state = TDS_SPAWNING;
+  rtdp->td_id     = 0;
+  rtdp->td_state  = TDS_SPAWNING;
+  rtdp->td_pooled = 0;
 
   rtdp->td_prvtptr = prvtptr;
 
@@ -873,7 +953,12 @@ ListenThread (void *arg)
       snprintf(ipstr, sizeof(ipstr), "unix");
       snprintf(portstr, sizeof(portstr), "%s", lpp->portstr);
     } else {
+      addrlen = sizeof (addr_storage);
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+      clientsocket = accept4(lpp->socket, paddr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
       clientsocket = accept(lpp->socket, paddr, &addrlen);
+#endif
       if (clientsocket == -1) {
         if (errno == ECONNABORTED || errno == EINTR)
           continue;
@@ -1025,7 +1110,7 @@ ListenThread (void *arg)
     /* Initialize the miniSEED write parameters */
     if (config.mseedarchive)
     {
-      if (!(cinfo->mswrite = (DataStream *)malloc (sizeof (DataStream))))
+      if (!(cinfo->mswrite = (DataStream *)calloc (1, sizeof (DataStream))))
       {
         lprintf (0, "Error allocating memory for miniSEED write parameters");
         if (clientsocket)
@@ -1035,9 +1120,10 @@ ListenThread (void *arg)
 
       cinfo->mswrite->path          = config.mseedarchive;
       cinfo->mswrite->idletimeout   = config.mseedidleto;
-      cinfo->mswrite->maxopenfiles  = 50;
+      cinfo->mswrite->maxopenfiles  = config.mseedwriteopenfiles;
       cinfo->mswrite->openfilecount = 0;
-      cinfo->mswrite->grouproot     = NULL;
+      cinfo->mswrite->syncinterval  = config.mseedwritesync;
+      cinfo->mswrite->writer        = ds_writerassign ();
     }
 
     /* Create new client thread */
@@ -1049,7 +1135,22 @@ ListenThread (void *arg)
       break;
     }
 
-    if ((errno = pthread_create (&ctid, NULL, ClientThread, (void *)tdp)))
+    /* Hand the client to a worker thread if configured, TLS clients are
+     * always served by their own thread as TLS operations may block */
+    if (config.workerthreads && !cinfo->tls)
+    {
+      if (ClientWorkerAdd (tdp))
+      {
+        lprintf (0, "Error adding client to worker thread");
+        if (clientsocket)
+          close (clientsocket);
+        if (tdp)
+          free (tdp);
+        tdp = NULL;
+        continue;
+      }
+    }
+    else if ((errno = pthread_create (&ctid, NULL, ClientThread, (void *)tdp)))
     {
       lprintf (0, "Error creating new client thread: %s", strerror (errno));
       if (clientsocket)
@@ -1063,38 +1164,39 @@ ListenThread (void *arg)
     {
       /* Update thread id, no locking, should be safe */
       tdp->td_id = ctid;
+    }
 
-      ctp = (struct cthread *)malloc (sizeof (struct cthread));
-      if (ctp == NULL)
-      {
-        lprintf (0, "Error malloc'ing cthread: %s", strerror (errno));
-        if (clientsocket)
-          close (clientsocket);
-        if (tdp)
-          free (tdp);
-        break;
-      }
-
-      ctp->td   = tdp;
-      ctp->prev = NULL;
+    ctp = (struct cthread *)malloc (sizeof (struct cthread));
+    if (ctp == NULL)
+    {
+      lprintf (0, "Error malloc'ing cthread: %s", strerror (errno));
+      if (clientsocket)
+        close (clientsocket);
+      if (tdp)
+        free (tdp);
+      break;
+    }
 
-      /* Add ctp to the beginning of the client threads list (cthreads) */
-      pthread_mutex_lock (&param.cthreads_lock);
-      if (param.cthreads)
-      {
-        ctp->next            = param.cthreads;
-        param.cthreads->prev = ctp;
-      }
-      else
-      {
-        ctp->next = NULL;
-      }
-      param.cthreads = ctp;
-      pthread_mutex_unlock (&param.cthreads_lock);
+    ctp->td   = tdp;
+    ctp->prev = NULL;
 
-      /* Increment client count */
-      param.clientcount++;
+    /* Add ctp to the beginning of the client threads list (cthreads) */
+    pthread_mutex_lock (&param.cthreads_lock);
+    ClientIPTrack (cinfo->addr, 1);
+    if (param.cthreads)
+    {
+      ctp->next            = param.cthreads;
+      param.cthreads->prev = ctp;
+    }
+    else
+    {
+      ctp->next = NULL;
     }
+    param.cthreads = ctp;
+
+    /* Increment client count */
+    param.clientcount++;
+    pthread_mutex_unlock (&param.cthreads_lock);
   }
 
   /* Set thread closing status */
@@ -1258,60 +1360,127 @@ MatchIP (IPNet *list, struct sockaddr *addr)
 /***************************************************************************
  * ClientIPCount:
  *
- * Search the global client list and return a count of the connected
- * clients that match the specified address.
+ * Return a count of the connected clients that match the specified
+ * address from the per-address count table.
  *
  * Returns count of the client connections with a matching address.
  ***************************************************************************/
 static int
 ClientIPCount (struct sockaddr *addr)
 {
-  struct cthread *ctp;
-  struct sockaddr_in *tsin[2];
-  struct sockaddr_in6 *tsin6[2];
+  IPCount **entry;
   int addrcount = 0;
 
   pthread_mutex_lock (&param.cthreads_lock);
-  ctp = param.cthreads;
-  while (ctp)
+  if ((entry = IPCountFind (addr)) && *entry)
+    addrcount = (*entry)->count;
+  pthread_mutex_unlock (&param.cthreads_lock);
+
+  return addrcount;
+} /* End of ClientIPCount() */
+
+/***************************************************************************
+ * ClientIPTrack:
+ *
+ * Add delta to the count of connected clients for an address, adding
+ * and removing entries of the count table as needed.  Addresses of
+ * families other than IPv4 and IPv6 are not tracked.
+ *
+ * The caller must hold param.cthreads_lock.
+ ***************************************************************************/
+static void
+ClientIPTrack (struct sockaddr *addr, int delta)
+{
+  IPCount **entry;
+  IPCount *ipcount;
+
+  if (!(entry = IPCountFind (addr)))
+    return;
+
+  if (*entry == NULL)
   {
-    /* If the same IP protocol family */
-    if (((ClientInfo *)ctp->td->td_prvtptr)->addr->sa_family == addr->sa_family)
+    if (delta <= 0)
+      return;
+
+    if (!(ipcount = (IPCount *)calloc (1, sizeof (IPCount))))
     {
-      /* Compare IPv4 addresses */
-      if (addr->sa_family == AF_INET)
-      {
-        tsin[0] = (struct sockaddr_in *)((ClientInfo *)ctp->td->td_prvtptr)->addr;
-        tsin[1] = (struct sockaddr_in *)addr;
+      lprintf (0, "%s(): Error allocating memory", __func__);
+      return;
+    }
 
-        if (0 == memcmp (&tsin[0]->sin_addr.s_addr,
-                         &tsin[1]->sin_addr.s_addr,
-                         sizeof (tsin[0]->sin_addr.s_addr)))
-        {
-          addrcount++;
-        }
-      }
-      /* Compare IPv6 addresses */
-      else if (addr->sa_family == AF_INET6)
-      {
-        tsin6[0] = (struct sockaddr_in6 *)((ClientInfo *)ctp->td->td_prvtptr)->addr;
-        tsin6[1] = (struct sockaddr_in6 *)addr;
+    ipcount->family = addr->sa_family;
+    if (addr->sa_family == AF_INET)
+      memcpy (ipcount->address, &((struct sockaddr_in *)addr)->sin_addr.s_addr, 4);
+    else
+      memcpy (ipcount->address, ((struct sockaddr_in6 *)addr)->sin6_addr.s6_addr, 16);
 
-        if (0 == memcmp (&tsin6[0]->sin6_addr.s6_addr,
-                         &tsin6[1]->sin6_addr.s6_addr,
-                         sizeof (tsin6[0]->sin6_addr.s6_addr)))
-        {
-          addrcount++;
-        }
-      }
-    }
+    *entry = ipcount;
+  }
+
+  ipcount = *entry;
 
-    ctp = ctp->next;
+  if (delta < 0 && ipcount->count <= (uint32_t)-delta)
+  {
+    *entry = ipcount->next;
+    free (ipcount);
   }
-  pthread_mutex_unlock (&param.cthreads_lock);
+  else
+  {
+    ipcount->count += delta;
+  }
+} /* End of ClientIPTrack() */
 
-  return addrcount;
-} /* End of ClientIPCount() */
+/***************************************************************************
+ * IPCountFind:
+ *
+ * Find the per-address count table entry for an address using an
+ * FNV-1a hash of the address.
+ *
+ * Returns a pointer to the link of the matching entry, which is NULL
+ * if no entry exists, or NULL if the address family is not tracked.
+ ***************************************************************************/
+static IPCount **
+IPCountFind (struct sockaddr *addr)
+{
+  IPCount **entry;
+  const uint8_t *address;
+  size_t length;
+  uint32_t hash = 2166136261u;
+  size_t idx;
+
+  if (!addr)
+    return NULL;
+
+  if (addr->sa_family == AF_INET)
+  {
+    address = (const uint8_t *)&((struct sockaddr_in *)addr)->sin_addr.s_addr;
+    length  = 4;
+  }
+  else if (addr->sa_family == AF_INET6)
+  {
+    address = ((struct sockaddr_in6 *)addr)->sin6_addr.s6_addr;
+    length  = 16;
+  }
+  else
+  {
+    return NULL;
+  }
+
+  for (idx = 0; idx < length; idx++)
+  {
+    hash ^= address[idx];
+    hash *= 16777619u;
+  }
+
+  entry = &ipcounts[hash % IPCOUNT_BUCKETS];
+
+  while (*entry &&
+         ((*entry)->family != addr->sa_family ||
+          memcmp ((*entry)->address, address, length)))
+    entry = &(*entry)->next;
+
+  return entry;
+} /* End of IPCountFind() */
 
 /***************************************************************************
  * GenProtocolString:
@@ -1414,6 +1583,11 @@ void LogServerParameters ()
   char netmask[INET6_ADDRSTRLEN];
   char timestring[32];
 
+  /* Names of ring memory options, indexed by RING_HUGEPAGES_*, RING_PREFAULT_* and RING_NUMA_* */
+  const char *ringhugepages[]  = {"none", "transparent", "explicit"};
+  const char *ringprefault[]   = {"none", "populate", "lock"};
+  const char *ringnumapolicy[] = {"default", "interleave", "bind"};
+
   lprintf (1, "Server parameters:");
   lprintf (1, "   server ID: %s", config.serverid);
   lprintf (1, "   ring directory: %s", (config.ringdir) ? config.ringdir : "NONE");
@@ -1422,9 +1596,17 @@ void LogServerParameters ()
 
   lprintf (2, "   configuration file: %s", (config.configfile) ? config.configfile : "NONE");
   lprintf (2, "   client timeout: %u seconds", config.clienttimeout);
+  lprintf (2, "   worker threads: %u", config.workerthreads);
+  lprintf (2, "   worker I/O: %s", (config.workeruring) ? "io_uring" : "epoll");
+  lprintf (2, "   listen backlog: %u", config.listenbacklog);
+  lprintf (2, "   listen threads per port: %u", config.listenthreads);
   lprintf (2, "   time window limit: %.0f%%", config.timewinlimit * 100);
   lprintf (2, "   resolve hostnames: %s", (config.resolvehosts) ? "yes" : "no");
   lprintf (2, "   auto recovery: %u", config.autorecovery);
+  lprintf (2, "   ring huge pages: %s", ringhugepages[config.ringmem.hugepages]);
+  lprintf (2, "   ring pre-fault: %s", ringprefault[config.ringmem.prefault]);
+  lprintf (2, "   ring NUMA policy: %s, nodes: 0x%" PRIx64,
+           ringnumapolicy[config.ringmem.numapolicy], config.ringmem.numanodes);
   lprintf (2, "   TLS certificate file: %s", (config.tlscertfile) ? config.tlscertfile : "NONE");
   lprintf (2, "   TLS key file: %s", (config.tlskeyfile) ? config.tlskeyfile : "NONE");
   lprintf (2, "   TLS verify client certificate: %s", (config.tlsverifyclientcert) ? "yes" : "no");
@@ -1433,6 +1615,16 @@ void LogServerParameters ()
   lprintf (3, "   HTTP headers: %s", (config.httpheaders) ? config.httpheaders : "NONE");
   lprintf (3, "   miniSEED archive: %s", (config.mseedarchive) ? config.mseedarchive : "NONE");
   lprintf (3, "   miniSEED idle file timeout: %u seconds", config.mseedidleto);
+  lprintf (3, "   miniSEED archive writer threads: %u", config.mseedwritethreads);
+  lprintf (3, "   miniSEED archive writer queue: %u records", config.mseedwritequeue);
+  lprintf (3, "   miniSEED archive writer flush: %u milliseconds", config.mseedwriteflush);
+  lprintf (3, "   miniSEED archive open files: %u", config.mseedwriteopenfiles);
+  if (config.mseedwritesync < 0)
+    lprintf (3, "   miniSEED archive sync: none");
+  else if (config.mseedwritesync == 0)
+    lprintf (3, "   miniSEED archive sync: always");
+  else
+    lprintf (3, "   miniSEED archive sync: %d seconds", config.mseedwritesync);
 
   lprintf (3, "   transfer log: %s", (TLogParams.tlogbasedir) ? TLogParams.tlogbasedir : "NONE");
   if (TLogParams.tlogbasedir && verbose >= 3)
@@ -52,6 +52,7 @@ struct thread_data {
   pthread_t       td_id;
   ThreadState     td_state;
   int             td_done;
+  int             td_pooled;
   void           *td_prvtptr;
 };
 
@@ -141,6 +142,7 @@ struct param_s
   int clientcount;          /* Track number of connected clients */
   int shutdownsig;          /* Shutdown signal */
   time_t configfilemtime;   /* Modification time of configuration file */
+  uint64_t statsgen;        /* Statistics generation, incremented when rates are updated */
   pthread_mutex_t sthreads_lock;
   struct sthread *sthreads; /* Server threads list */
   pthread_mutex_t cthreads_lock;
@@ -160,15 +162,25 @@ struct config_s
   uint32_t maxclients;      /* Enforce maximum number of clients */
   uint32_t maxclientsperip; /* Enforce maximum number of clients per IP */
   uint32_t clienttimeout;   /* Drop clients if no communication within this limit */
+  uint32_t workerthreads;   /* Client worker threads, 0 for a thread per client */
+  uint32_t listenbacklog;   /* Backlog of pending connections for listening sockets */
+  uint32_t listenthreads;   /* Accepting threads for each listening port */
   float timewinlimit;       /* Time window search limit in percent */
   uint8_t resolvehosts;     /* Flag to control resolving of client hostnames */
   uint8_t memorymapring;    /* Flag to control mmap'ing of packet buffer */
   uint8_t volatilering;     /* Flag to control if ring is volatile or not */
   uint8_t autorecovery;     /* Flag to control auto recovery from corruption */
+  uint8_t workeruring;      /* Flag to control use of io_uring by worker threads */
+  RingMemOptions ringmem;   /* Ring packet buffer memory options */
   char *webroot;            /* Web content root directory */
   char *httpheaders;        /* HTTP headers to include in each HTTP response */
   char *mseedarchive;       /* miniSEED archive definition */
   int mseedidleto;          /* miniSEED idle file timeout */
+  uint32_t mseedwritethreads; /* miniSEED archive writer threads, 0 to write directly */
+  uint32_t mseedwritequeue; /* miniSEED records held by each archive writer */
+  uint32_t mseedwriteflush; /* miniSEED archive writer flush interval in milliseconds */
+  uint32_t mseedwriteopenfiles; /* miniSEED archive files open for each client */
+  int mseedwritesync;       /* miniSEED archive sync interval, 0 always, -1 never */
   IPNet *limitips;          /* List of limit-by-IP entries */
   IPNet *matchips;          /* List of IPs allowed to connect */
   IPNet *rejectips;         /* List of IPs not allowed to connect */
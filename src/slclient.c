@@ -67,6 +67,7 @@
 #include "slclient.h"
 #include "infojson.h"
 #include "infoxml.h"
+#include "wirecache.h"
 
 /* Define list of valid characters for selectors and station & network codes */
 #define VALIDSELECTCHARS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789?*_-!"
@@ -75,15 +76,38 @@
 /* Define the number of no-action loops that trigger the throttle */
 #define THROTTLE_TRIGGER 10
 
+/* Maximum SeedLink header size, v4 header with a full station ID */
+#define SLMAXHEADSIZE (SLHEADSIZE_V4 + MAXSTREAMID)
+
+/* Size of the buffer for INFO station lists written in chunks */
+#define INFOCHUNKSIZE 65536
+
+/* Context for packing an INFO document into miniSEED records */
+typedef struct InfoRecordPack
+{
+  ClientInfo *cinfo;
+  char       *record;
+  int8_t      swapflag;
+  int         seqnum;
+} InfoRecordPack;
+
+/* Record headers shared by all SeedLink v4 clients */
+static WireCache headercache;
+
 static int HandleNegotiation (ClientInfo *cinfo);
 static int HandleInfo_v3 (ClientInfo *cinfo);
 static int HandleInfo_v4 (ClientInfo *cinfo);
 static int SendReply (ClientInfo *cinfo, char *reply, ErrorCode code, char *extreply);
 static int SendPacket (uint64_t pktid, char *payload, uint32_t payloadlen,
                        const char *staid, char format, char subformat, void *vcinfo);
-static int SendRecord (RingPacket *packet, char *record, uint32_t reclen,
-                       void *vcinfo);
+static int CreateHeader (uint64_t pktid, uint32_t payloadlen, const char *staid,
+                         char format, char subformat, SLInfo *slinfo, char *header);
+static int CreateRecordHeader (RingPacket *packet, char *record, ClientInfo *cinfo,
+                               char *header);
 static void SendInfoRecord (char *record, uint32_t reclen, void *vcinfo);
+static int FlushInfoRecords (InfoWriter *writer, int final);
+static int SendInfoJSON (ClientInfo *cinfo, InfoElements elements, const char *matchexpr);
+static int FlushInfoJSON (InfoWriter *writer, int final);
 static void FreeReqStationID (void *rbnode);
 static int StaKeyCompare (const void *a, const void *b);
 static ReqStationID *GetReqStationID (RBTree *tree, char *staid);
@@ -367,9 +391,18 @@ SLHandleCmd (ClientInfo *cinfo)
  *
  * Send selected ring packets to SeedLink client.
  *
- * The next read packet is only be sent if the type is allowed by
- * SeedLink, e.g. miniSEED, but the size is returned to the caller
- * to indicate that a packet was available.
+ * Up to STREAM_BATCH_PACKETS packets, or about STREAM_BATCH_BYTES of
+ * packet data, are read from the ring and sent together to reduce the
+ * system call overhead for clients catching up.  Records are sent
+ * directly from the ring and checked after sending, as described for
+ * DLStreamPackets().
+ * WebSocket clients are sent the same batch with a frame header before
+ * each packet, in the same gather write, so that each SeedLink packet
+ * is contained in its own WebSocket message.
+ *
+ * Read packets are only sent if the type is allowed by SeedLink,
+ * e.g. miniSEED, but the size is returned to the caller to indicate
+ * that a packet was available.
  *
  * Return packet size processed on successful read from ring, zero
  * when no next packet is available, or negative value on error.  On
@@ -380,57 +413,77 @@ SLStreamPackets (ClientInfo *cinfo)
 {
   SLInfo *slinfo;
   StreamNode *stream;
-  uint64_t readid;
-  int skiprecord = 0;
+  RingPacket packets[STREAM_BATCH_PACKETS];
+  StreamNode *streams[STREAM_BATCH_PACKETS];
+  char headers[STREAM_BATCH_PACKETS][SLMAXHEADSIZE];
+  uint8_t wsframes[STREAM_BATCH_PACKETS][WS_FRAMEMAX];
+  void *buffers[STREAM_BATCH_PACKETS * 3];
+  size_t buflens[STREAM_BATCH_PACKETS * 3];
+  RingPacket *packet;
+  char *record;
+  size_t batchbytes;
+  uint64_t readid = RINGID_NONE;
+  int bufcount  = 0;
+  int processed = 0;
+  int reads     = 0;
+  int count     = 0;
+  int timewinend = 0;
+  int skiprecord;
+  int headerlen;
   int newstream;
+  int idx;
 
   if (!cinfo || !cinfo->extinfo)
     return -1;
 
-  slinfo = (SLInfo *)cinfo->extinfo;
-
-  /* Read next packet from ring */
-  readid = RingReadNext (cinfo->reader, &cinfo->packet, cinfo->sendbuf);
+  slinfo     = (SLInfo *)cinfo->extinfo;
+  batchbytes = 0;
 
-  if (readid == RINGID_ERROR)
-  {
-    lprintf (0, "[%s] Error reading next packet from ring", cinfo->hostname);
-    return -1;
-  }
-  else if (readid == RINGID_NONE)
+  /* Read packets from ring until the batch is full */
+  while (count < STREAM_BATCH_PACKETS && reads < STREAM_BATCH_PACKETS &&
+         batchbytes < STREAM_BATCH_BYTES)
   {
-    if (slinfo->dialup)
+    packet = &packets[count];
+
+    readid = RingReadNextRef (cinfo->reader, packet, &record);
+    reads++;
+
+    if (readid == RINGID_ERROR)
     {
-      lprintf (2, "[%s] Dial-up mode reached end of buffer", cinfo->hostname);
-      SendData (cinfo, "END", 3, 0);
+      lprintf (0, "[%s] Error reading next packet from ring", cinfo->hostname);
       return -1;
     }
-    else
+    else if (readid == RINGID_NONE)
     {
-      return 0;
+      break;
     }
-  }
-  else if ((MS2_ISVALIDHEADER (cinfo->sendbuf) ||
-            MS3_ISVALIDHEADER (cinfo->sendbuf)))
-  {
+    else if (!(MS2_ISVALIDHEADER (record) || MS3_ISVALIDHEADER (record)))
+    {
+      /* Not sent, but reported as processed */
+      processed += packet->datasize;
+      continue;
+    }
+
     lprintf (3, "[%s] Read %s (%u bytes) packet ID %" PRIu64 " from ring",
-             cinfo->hostname, cinfo->packet.streamid, cinfo->packet.datasize, cinfo->packet.pktid);
+             cinfo->hostname, packet->streamid, packet->datasize, packet->pktid);
 
     /* Get (creating if needed) the StreamNode for this streamid */
     if ((stream = GetStreamNode (cinfo->streams, &cinfo->streams_lock,
-                                 cinfo->packet.streamid, &newstream)) == NULL)
+                                 packet->streamid, &newstream)) == NULL)
     {
       lprintf (0, "[%s] Error with GetStreamNode() for %s",
-               cinfo->hostname, cinfo->packet.streamid);
+               cinfo->hostname, packet->streamid);
       return -1;
     }
 
     if (newstream)
     {
-      lprintf (3, "[%s] New stream for client: %s", cinfo->hostname, cinfo->packet.streamid);
+      lprintf (3, "[%s] New stream for client: %s", cinfo->hostname, packet->streamid);
       cinfo->streamscount++;
     }
 
+    skiprecord = 0;
+
     /* Perform time-windowing end time checks */
     if (cinfo->endtime != 0 && cinfo->endtime != NSTUNSET)
     {
@@ -442,10 +495,10 @@ SLStreamPackets (ClientInfo *cinfo)
       {
         skiprecord = 1;
       }
-      else if (cinfo->packet.datastart > cinfo->endtime)
+      else if (packet->datastart > cinfo->endtime)
       {
         lprintf (2, "[%s] End of time window reached for %s",
-                 cinfo->hostname, cinfo->packet.streamid);
+                 cinfo->hostname, packet->streamid);
         stream->endtimereached = 1;
         slinfo->timewinchannels--;
 
@@ -456,44 +509,93 @@ SLStreamPackets (ClientInfo *cinfo)
       /* If end times for each received channel have been met the time-windowing is done */
       if (slinfo->timewinchannels <= 0)
       {
-        lprintf (2, "[%s] End of time window reached for all channels", cinfo->hostname);
-        SendData (cinfo, "END", 3, 0);
-        return -1;
+        timewinend = 1;
+        break;
       }
     }
 
-    /* If not skipping this record send to the client and update byte count */
-    if (!skiprecord)
+    /* If skipping this record do not add it to the batch */
+    if (skiprecord)
+      continue;
+
+    if ((headerlen = CreateRecordHeader (packet, record, cinfo, headers[count])) < 0)
     {
-      /* Send miniSEED record to client */
-      if (SendRecord (&cinfo->packet, cinfo->sendbuf, cinfo->packet.datasize, cinfo))
-      {
-        if (cinfo->socketerr != -2)
-          lprintf (0, "[%s] Error sending record to client", cinfo->hostname);
+      lprintf (0, "[%s] Error creating header for %s", cinfo->hostname, packet->streamid);
+      return -1;
+    }
+
+    /* Each record is sent to a WebSocket client in a separate frame */
+    if (cinfo->websocket)
+    {
+      buffers[bufcount]   = wsframes[count];
+      buflens[bufcount++] = WSFrameHeader (wsframes[count], headerlen + packet->datasize);
+    }
+
+    streams[count]      = stream;
+    buffers[bufcount]   = headers[count];
+    buflens[bufcount++] = (size_t)headerlen;
+    buffers[bufcount]   = record;
+    buflens[bufcount++] = packet->datasize;
+
+    batchbytes += packet->datasize;
+    count++;
+  }
+
+  /* Send all records to client and update counts */
+  if (count > 0)
+  {
+    /* WebSocket frames were added above */
+    if (SendDataMB (cinfo, buffers, buflens, bufcount, 1))
+    {
+      if (cinfo->socketerr != -2)
+        lprintf (0, "[%s] Error sending record to client", cinfo->hostname);
 
+      return -1;
+    }
+
+    for (idx = 0; idx < count; idx++)
+    {
+      /* Records replaced in the ring while sending cannot be recalled */
+      if (!RingReadValid (cinfo->reader, &packets[idx]))
+      {
+        lprintf (0, "[%s] Packet ID %" PRIu64 " was replaced in the ring while sending, disconnecting",
+                 cinfo->hostname, packets[idx].pktid);
         return -1;
       }
 
       /* Update StreamNode packet and byte count */
       pthread_mutex_lock (&(cinfo->streams_lock));
-      stream->txpackets++;
-      stream->txbytes += cinfo->packet.datasize;
+      streams[idx]->txpackets++;
+      streams[idx]->txbytes += packets[idx].datasize;
       pthread_mutex_unlock (&(cinfo->streams_lock));
 
       /* Update client transmit and counts */
       cinfo->txpackets[0]++;
-      cinfo->txbytes[0] += cinfo->packet.datasize;
+      cinfo->txbytes[0] += packets[idx].datasize;
 
-      /* Update last sent packet ID */
-      cinfo->lastid = cinfo->packet.pktid;
-    }
-    else
-    {
-      readid = RINGID_NONE;
+      processed += packets[idx].datasize;
     }
+
+    /* Update last sent packet ID and retain the last packet sent */
+    cinfo->lastid = packets[count - 1].pktid;
+    memcpy (&cinfo->packet, &packets[count - 1], sizeof (RingPacket));
+  }
+
+  if (timewinend)
+  {
+    lprintf (2, "[%s] End of time window reached for all channels", cinfo->hostname);
+    SendData (cinfo, "END", 3, 0);
+    return -1;
+  }
+
+  if (readid == RINGID_NONE && reads == 1 && slinfo->dialup)
+  {
+    lprintf (2, "[%s] Dial-up mode reached end of buffer", cinfo->hostname);
+    SendData (cinfo, "END", 3, 0);
+    return -1;
   }
 
-  return (readid != RINGID_NONE) ? (int)cinfo->packet.datasize : 0;
+  return processed;
 } /* End of SLStreamPackets() */
 
 /***********************************************************************
@@ -1200,14 +1302,23 @@ HandleNegotiation (ClientInfo *cinfo)
 static int
 HandleInfo_v3 (ClientInfo *cinfo)
 {
-  SLInfo *slinfo = (SLInfo *)cinfo->extinfo;
   char *xmlstr = NULL;
   int xmllength;
   char *level   = NULL;
   char errflag  = 0;
+  int stations  = -1;
+  int rv        = 0;
+
+  RingStream *streams = NULL;
+  uint32_t streamcount;
 
   char *record = NULL;
   int8_t swapflag;
+  char xmlbuffer[456 * 16];
+
+  InfoRecordPack pack;
+  InfoWriter writer = {.buffer = xmlbuffer, .size = sizeof (xmlbuffer),
+                       .flush = FlushInfoRecords, .handle = &pack};
 
   uint16_t year = 0;
   uint16_t yday = 0;
@@ -1268,7 +1379,7 @@ HandleInfo_v3 (ClientInfo *cinfo)
     {
       lprintf (1, "[%s] Received INFO STATIONS request", cinfo->hostname);
 
-      xmlstr = info_xml_slv3_stations (cinfo, SLSERVER_ID, 0);
+      stations = 0;
     }
   }
   else if (!strncasecmp (level, "STREAMS", 7))
@@ -1282,7 +1393,7 @@ HandleInfo_v3 (ClientInfo *cinfo)
     {
       lprintf (1, "[%s] Received INFO STREAMS request", cinfo->hostname);
 
-      xmlstr = info_xml_slv3_stations (cinfo, SLSERVER_ID, 1);
+      stations = 1;
     }
   }
   else if (!strncasecmp (level, "CONNECTIONS", 11))
@@ -1310,16 +1421,8 @@ HandleInfo_v3 (ClientInfo *cinfo)
 
 
   /* Pack XML into miniSEED and send to client */
-  if (xmlstr)
+  if (xmlstr || stations >= 0)
   {
-    /* Trim final newline character if present */
-    xmllength = strlen (xmlstr);
-    if (xmlstr[xmllength - 1] == '\n')
-    {
-      xmlstr[xmllength - 1] = '\0';
-      xmllength--;
-    }
-
     /* Check to see if byte swapping is needed, miniSEED 2 is written big endian */
     swapflag = (ms_bigendianhost ()) ? 0 : 1;
 
@@ -1359,49 +1462,39 @@ HandleInfo_v3 (ClientInfo *cinfo)
     *pMS2B1000_RECLEN (record + 48)    = 9; /* 2^9 = 512 byte record */
     *pMS2B1000_RESERVED (record + 48)  = 0;
 
-    /* Pack all XML into 512-byte records and send to client */
-    if (!cinfo->socketerr)
-    {
-      char seqnumstr[11];
-      int seqnum = 1;
-      int offset = 0;
-      int nsamps;
+    pack.cinfo    = cinfo;
+    pack.record   = record;
+    pack.swapflag = swapflag;
+    pack.seqnum   = 1;
 
-      while (offset < xmllength && !cinfo->socketerr)
+    /* Station lists are written from a snapshot of the stream index
+     * directly into records as they are generated */
+    if (stations >= 0)
+    {
+      if ((streams = GetStreamsArray (cinfo->ringparams, cinfo->reader, &streamcount)) == NULL)
       {
-        nsamps = ((xmllength - offset) > 456) ? 456 : (xmllength - offset);
-
-        /* Update sequence number and number of samples */
-        snprintf (seqnumstr, sizeof (seqnumstr), "%06d", seqnum);
-        memcpy (pMS2FSDH_SEQNUM (record), seqnumstr, 6);
-
-        *pMS2FSDH_NUMSAMPLES (record) = HO2u (nsamps, swapflag);
-
-        /* Copy XML data into record */
-        memcpy (record + 56, xmlstr + offset, nsamps);
-
-        /* Pad any remaining record bytes with NULLs */
-        if (nsamps + 56 < 512)
-          memset (record + 56 + nsamps, 0, 512 - 56 - nsamps);
-
-        /* Roll-over sequence number */
-        if (seqnum >= 999999)
-          seqnum = 1;
-        else
-          seqnum++;
-
-        /* Update offset */
-        offset += nsamps;
-
-        /* Set termination flag if this is the last record */
-        if (offset == xmllength)
-          slinfo->terminfo = 1;
-        else
-          slinfo->terminfo = 0;
-
-        /* Send INFO record to client, blind toss */
-        SendInfoRecord (record, SLINFORECSIZE, cinfo);
+        lprintf (0, "[%s] Error getting streams", cinfo->hostname);
+        rv = -1;
+      }
+      else if (info_xml_slv3_stations (cinfo, SLSERVER_ID, stations, streams, streamcount, &writer))
+      {
+        if (!cinfo->socketerr)
+          lprintf (0, "[%s] Error creating INFO response", cinfo->hostname);
+        rv = -1;
+      }
+    }
+    else
+    {
+      /* Trim final newline character if present */
+      xmllength = strlen (xmlstr);
+      if (xmlstr[xmllength - 1] == '\n')
+      {
+        xmlstr[xmllength - 1] = '\0';
+        xmllength--;
       }
+
+      if (info_write (&writer, xmlstr, xmllength) || info_write_finish (&writer))
+        rv = -1;
     }
   }
 
@@ -1409,10 +1502,13 @@ HandleInfo_v3 (ClientInfo *cinfo)
   if (xmlstr)
     free (xmlstr);
 
+  if (streams)
+    free (streams);
+
   if (record)
     free (record);
 
-  return (cinfo->socketerr) ? -1 : 0;
+  return (rv || cinfo->socketerr) ? -1 : 0;
 } /* End of HandleInfo_v3 */
 
 /***************************************************************************
@@ -1438,6 +1534,8 @@ HandleInfo_v4 (ClientInfo *cinfo)
   int fields;
   int errflag = 0;
 
+  InfoElements elements = 0;
+
   struct strnode selector = {.string = stream, .next = NULL};
 
   if (strncasecmp (cinfo->recvbuf, "INFO", 4) != 0)
@@ -1491,7 +1589,7 @@ HandleInfo_v4 (ClientInfo *cinfo)
       }
     }
 
-    json_string = info_json (cinfo, SLSERVER_ID, INFO_STATIONS, matchregex);
+    elements = INFO_STATIONS;
   }
   else if (!strncasecmp (item, "STREAMS", 7))
   {
@@ -1509,7 +1607,7 @@ HandleInfo_v4 (ClientInfo *cinfo)
       }
     }
 
-    json_string = info_json (cinfo, SLSERVER_ID, INFO_STATION_STREAMS, matchregex);
+    elements = INFO_STATION_STREAMS;
   }
   else if (!strncasecmp (item, "CONNECTIONS", 11))
   {
@@ -1536,11 +1634,19 @@ HandleInfo_v4 (ClientInfo *cinfo)
     lprintf (0, "[%s] Unrecognized INFO item: %s", cinfo->hostname, item);
   }
 
-  /* Send INFO response to client */
+  /* Send INFO response to client, station lists are written as generated */
   if (json_string)
   {
     SendPacket (0, json_string, strlen (json_string), "", 'J', (errflag) ? 'E' : 'I', cinfo);
   }
+  else if (elements)
+  {
+    if (SendInfoJSON (cinfo, elements, matchregex) && !cinfo->socketerr)
+    {
+      lprintf (0, "[%s] Error creating INFO response", cinfo->hostname);
+      cinfo->socketerr = -1;
+    }
+  }
   else
   {
     lprintf (0, "[%s] Error creating INFO response", cinfo->hostname);
@@ -1639,17 +1745,38 @@ SendPacket (uint64_t pktid, char *payload, uint32_t payloadlen,
             const char *staid, char format, char subformat, void *vcinfo)
 {
   ClientInfo *cinfo = (ClientInfo *)vcinfo;
-  SLInfo *slinfo    = (SLInfo *)cinfo->extinfo;
-  char header[40]   = {0};
-  size_t headerlen  = 0;
-  uint8_t l_staidlen;
+  char header[SLMAXHEADSIZE] = {0};
+  int headerlen;
 
   if (!payload || !vcinfo)
     return -1;
 
+  headerlen = CreateHeader (pktid, payloadlen, staid, format, subformat,
+                            (SLInfo *)cinfo->extinfo, header);
+
+  if (SendDataMB (cinfo, (void *[]){header, payload}, (size_t[]){(size_t)headerlen, payloadlen}, 2, 0))
+    return -1;
+
+  return 0;
+} /* End of SendPacket() */
+
+/***************************************************************************
+ * CreateHeader:
+ *
+ * Create an appropriate SeedLink header for the negotiated protocol
+ * version in 'header', which must be at least SLMAXHEADSIZE bytes.
+ *
+ * Returns the length of the header.
+ ***************************************************************************/
+static int
+CreateHeader (uint64_t pktid, uint32_t payloadlen, const char *staid,
+              char format, char subformat, SLInfo *slinfo, char *header)
+{
+  uint8_t l_staidlen;
+
   if (slinfo->proto_major == 4) /* Create v4 header */
   {
-    l_staidlen = (staid) ? (uint8_t)strlen (staid) : 0;
+    l_staidlen = (staid) ? (uint8_t)strnlen (staid, MAXSTREAMID - 1) : 0;
 
     /* V4 header values are little-endian byte order */
     if (ms_bigendianhost ())
@@ -1667,47 +1794,44 @@ SendPacket (uint64_t pktid, char *payload, uint32_t payloadlen,
     memcpy (header + 16, &l_staidlen, 1);
     memcpy (header + 17, staid, l_staidlen);
 
-    headerlen = SLHEADSIZE_V4 + l_staidlen;
+    return SLHEADSIZE_V4 + l_staidlen;
   }
-  else /* Create v3 header */
-  {
-    /* Create v3 SeedLink header: signature + sequence number
-     * Use ony the lowest 24-bits of pktid, maximum allowed in v3 sequence */
-    snprintf (header, sizeof (header), "SL%06X", (uint32_t)(pktid & 0xFFFFFF));
-    headerlen = SLHEADSIZE_V3;
-  }
-
-  if (SendDataMB (cinfo, (void *[]){header, payload}, (size_t[]){headerlen, payloadlen}, 2, 0))
-    return -1;
 
-  /* Update the time of the last packet exchange */
-  cinfo->lastxchange = NSnow ();
+  /* Create v3 SeedLink header: signature + sequence number
+   * Use ony the lowest 24-bits of pktid, maximum allowed in v3 sequence,
+   * as 6 upper case hexadecimal digits, equivalent to "SL%06X" */
+  header[0] = 'S';
+  header[1] = 'L';
+  for (int idx = 7; idx >= 2; idx--, pktid >>= 4)
+    header[idx] = "0123456789ABCDEF"[pktid & 0xF];
+  header[8] = '\0';
 
-  return 0;
-} /* End of SendPacket() */
+  return SLHEADSIZE_V3;
+} /* End of CreateHeader() */
 
 /***************************************************************************
- * SendRecord:
+ * CreateRecordHeader:
  *
- * Send 'reclen' bytes from 'record' to 'cinfo->socket' and prefix
- * with an appropriate SeedLink header.
+ * Create an appropriate SeedLink header for a miniSEED record from
+ * the ring in 'header', which must be at least SLMAXHEADSIZE bytes.
  *
- * Returns 0 on success and -1 on error, the ClientInfo.socketerr value
- * is set on socket errors.
+ * The v4 header is identical for all clients, it is created by the
+ * first client to send a record and copied from the shared header
+ * cache by the others.  The v3 header is only the sequence number and
+ * is simply created.
+ *
+ * Returns the length of the header on success and -1 on error.
  ***************************************************************************/
 static int
-SendRecord (RingPacket *packet, char *record, uint32_t reclen, void *vcinfo)
+CreateRecordHeader (RingPacket *packet, char *record, ClientInfo *cinfo, char *header)
 {
-  ClientInfo *cinfo = (ClientInfo *)vcinfo;
-  SLInfo *slinfo    = (SLInfo *)cinfo->extinfo;
+  SLInfo *slinfo = (SLInfo *)cinfo->extinfo;
 
   char staid[MAXSTREAMID] = {0};
 
   char format    = ' ';
   char subformat = 'D'; /* All miniSEED records are data/generic */
-
-  if (!record || !vcinfo)
-    return -1;
+  int headerlen;
 
   /* Prepare details needed for v4 protocol header */
   if (slinfo->proto_major == 4)
@@ -1715,6 +1839,9 @@ SendRecord (RingPacket *packet, char *record, uint32_t reclen, void *vcinfo)
     char net[16];
     char sta[16];
 
+    if ((headerlen = WireCacheGet (&headercache, packet, header)) > 0)
+      return headerlen;
+
     /* Extract network and station codes from FDSN Source ID (streamid) */
     if (strncmp (packet->streamid, "FDSN:", 5) == 0)
     {
@@ -1730,7 +1857,7 @@ SendRecord (RingPacket *packet, char *record, uint32_t reclen, void *vcinfo)
     /* Otherwise use the stream ID as the station ID */
     else
     {
-      memcpy (staid, packet->streamid, sizeof (staid));
+      memcpy (staid, packet->streamid, sizeof (staid) - 1);
     }
 
     if (MS3_ISVALIDHEADER (record))
@@ -1741,9 +1868,14 @@ SendRecord (RingPacket *packet, char *record, uint32_t reclen, void *vcinfo)
       return -1;
   }
 
-  return SendPacket (packet->pktid, record, reclen, staid,
-                     format, subformat, vcinfo);
-} /* End of SendRecord() */
+  headerlen = CreateHeader (packet->pktid, packet->datasize, staid,
+                            format, subformat, slinfo, header);
+
+  if (slinfo->proto_major == 4)
+    WireCachePut (&headercache, packet, header, headerlen);
+
+  return headerlen;
+} /* End of CreateRecordHeader() */
 
 /***************************************************************************
  * SendInfoRecord:
@@ -1777,6 +1909,164 @@ SendInfoRecord (char *record, uint32_t reclen, void *vcinfo)
   return;
 } /* End of SendInfoRecord() */
 
+/***************************************************************************
+ * FlushInfoRecords:
+ *
+ * InfoWriter flush() for SeedLink v3 INFO responses: pack the pending
+ * document into 512-byte miniSEED records and send them to the client.
+ * Until the 'final' flush at least one record is kept back so that the
+ * last record can be flagged as terminating the response.
+ *
+ * Returns the count of bytes consumed on success and -1 on error.
+ ***************************************************************************/
+static int
+FlushInfoRecords (InfoWriter *writer, int final)
+{
+  InfoRecordPack *pack = (InfoRecordPack *)writer->handle;
+  ClientInfo *cinfo    = pack->cinfo;
+  SLInfo *slinfo       = (SLInfo *)cinfo->extinfo;
+  char *record         = pack->record;
+  char seqnumstr[11];
+  size_t offset = 0;
+  int nsamps;
+
+  while (!cinfo->socketerr &&
+         ((final) ? offset < writer->length : (writer->length - offset) > 456))
+  {
+    nsamps = ((writer->length - offset) > 456) ? 456 : (writer->length - offset);
+
+    /* Update sequence number and number of samples */
+    snprintf (seqnumstr, sizeof (seqnumstr), "%06d", pack->seqnum);
+    memcpy (pMS2FSDH_SEQNUM (record), seqnumstr, 6);
+
+    *pMS2FSDH_NUMSAMPLES (record) = HO2u (nsamps, pack->swapflag);
+
+    /* Copy XML data into record */
+    memcpy (record + 56, writer->buffer + offset, nsamps);
+
+    /* Pad any remaining record bytes with NULLs */
+    if (nsamps + 56 < 512)
+      memset (record + 56 + nsamps, 0, 512 - 56 - nsamps);
+
+    /* Roll-over sequence number */
+    if (pack->seqnum >= 999999)
+      pack->seqnum = 1;
+    else
+      pack->seqnum++;
+
+    /* Update offset */
+    offset += nsamps;
+
+    /* Set termination flag if this is the last record */
+    if (final && offset == writer->length)
+      slinfo->terminfo = 1;
+    else
+      slinfo->terminfo = 0;
+
+    /* Send INFO record to client */
+    SendInfoRecord (record, SLINFORECSIZE, cinfo);
+  }
+
+  return (cinfo->socketerr) ? -1 : (int)offset;
+} /* End of FlushInfoRecords() */
+
+/***************************************************************************
+ * SendInfoJSON:
+ *
+ * Send a SeedLink v4 INFO response with a station list, written from a
+ * snapshot of the stream index as it is generated.
+ *
+ * The packet header includes the payload length, so the document is
+ * written twice from the same snapshot: first only to determine the
+ * length and then to the client in INFOCHUNKSIZE chunks.  WebSocket
+ * messages are a single frame, for those the complete document is
+ * collected in memory.
+ *
+ * Returns 0 on success and -1 on error, the ClientInfo.socketerr value
+ * is set on socket errors.
+ ***************************************************************************/
+static int
+SendInfoJSON (ClientInfo *cinfo, InfoElements elements, const char *matchexpr)
+{
+  char header[SLMAXHEADSIZE] = {0};
+  RingStream *streams;
+  uint32_t streamcount;
+  uint64_t payloadlen;
+  int headerlen;
+  int rv = -1;
+
+  InfoWriter writer = {0};
+
+  if ((streams = GetStreamsArray (cinfo->ringparams, cinfo->reader, &streamcount)) == NULL)
+    return -1;
+
+  if (cinfo->websocket)
+  {
+    writer.flush = info_write_grow;
+
+    if (info_write_grow (&writer, 0) == 0 &&
+        info_json_stream (cinfo, SLSERVER_ID, elements, streams, &streamcount,
+                          matchexpr, &writer) == 0 &&
+        writer.length <= UINT32_MAX)
+    {
+      rv = SendPacket (0, writer.buffer, (uint32_t)writer.length, "", 'J', 'I', cinfo);
+    }
+  }
+  else if ((writer.buffer = (char *)malloc (INFOCHUNKSIZE)) != NULL)
+  {
+    writer.size   = INFOCHUNKSIZE;
+    writer.flush  = FlushInfoJSON;
+    writer.handle = NULL;
+
+    /* Determine the length of the document, discarding output */
+    if (info_json_stream (cinfo, SLSERVER_ID, elements, streams, &streamcount,
+                          matchexpr, &writer) == 0 &&
+        writer.total <= UINT32_MAX)
+    {
+      payloadlen = writer.total;
+
+      headerlen = CreateHeader (0, (uint32_t)payloadlen, "", 'J', 'I',
+                                (SLInfo *)cinfo->extinfo, header);
+
+      /* Write the document again to the client */
+      writer.total  = 0;
+      writer.handle = cinfo;
+
+      if (SendData (cinfo, header, headerlen, 0) == 0 &&
+          info_json_stream (cinfo, SLSERVER_ID, elements, streams, &streamcount,
+                            matchexpr, &writer) == 0 &&
+          writer.total == payloadlen)
+      {
+        rv = 0;
+      }
+    }
+  }
+
+  free (writer.buffer);
+  free (streams);
+
+  return rv;
+} /* End of SendInfoJSON() */
+
+/***************************************************************************
+ * FlushInfoJSON:
+ *
+ * InfoWriter flush() for SeedLink v4 INFO responses: send the pending
+ * output to the client, or discard it if no client is set.
+ *
+ * Returns the count of bytes consumed on success and -1 on error.
+ ***************************************************************************/
+static int
+FlushInfoJSON (InfoWriter *writer, int final)
+{
+  ClientInfo *cinfo = (ClientInfo *)writer->handle;
+
+  if (cinfo && writer->length > 0 && SendData (cinfo, writer->buffer, writer->length, 0))
+    return -1;
+
+  return (int)writer->length;
+} /* End of FlushInfoJSON() */
+
 /***************************************************************************
  * FreeReqStationID:
  *
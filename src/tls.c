@@ -19,9 +19,51 @@
  * @author Chad Trabant, EarthScope Data Services
  **************************************************************************/
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
 #include "tls.h"
 #include "logging.h"
 
+/* Lifetime of TLS session tickets and cached sessions in seconds */
+#define TLS_SESSION_LIFETIME 86400
+
+/* Maximum number of cached TLS sessions */
+#define TLS_SESSION_CACHE 5000
+
+/* TLS configuration shared by all connections, a new configuration is
+ * created when the certificate or key files change and the previous one
+ * is released when the last connection using it is closed. */
+typedef struct TLSShared
+{
+  mbedtls_ssl_config conf;
+  mbedtls_ctr_drbg_context ctr_drbg;
+  mbedtls_entropy_context entropy;
+  mbedtls_x509_crt srvcert;
+  mbedtls_pk_context pkey;
+  mbedtls_ssl_ticket_context ticket;
+  mbedtls_ssl_cache_context cache;
+  char *certfile;          /* Certificate file name */
+  char *keyfile;           /* Key file name */
+  time_t certmtime;        /* Modification time of certificate file */
+  time_t keymtime;         /* Modification time of key file */
+  int refcount;            /* Number of connections using this configuration */
+} TLSShared;
+
+static TLSShared *tlsshared = NULL;
+static pthread_mutex_t tlsshared_lock = PTHREAD_MUTEX_INITIALIZER;
+static int psa_initialized = 0;
+
+/* Modification times of certificate and key files that failed to load */
+static time_t failedcertmtime = 0;
+static time_t failedkeymtime  = 0;
+
+static TLSShared *tls_create (const char *certfile, const char *keyfile);
+static void tls_release (TLSShared *shared);
+
 /* Debug output for TLS */
 void
 tls_debug (void *ctx, int level, const char *file, int line, const char *str)
@@ -34,49 +76,139 @@ tls_debug (void *ctx, int level, const char *file, int line, const char *str)
 
 /***********************************************************************
  *
- * Initialize and negotiation TLS on connected client socket.
+ * Load the shared TLS configuration from the certificate and key files,
+ * or reload it if the file names or modification times have changed.
  *
- * Return 0 on success and non-zero on error.
+ * This is called at startup and periodically by the main thread,
+ * connections already established keep using the configuration they
+ * were started with.  Files that failed to load are not retried until
+ * they are modified.
+ *
+ * Return 0 on success or no change and -1 on error.
  ***********************************************************************/
 int
-tls_configure (ClientInfo *cinfo)
+tls_load (void)
 {
-  TLSCTX *tlsctx         = NULL;
-  char *evalue           = NULL;
-  uint32_t flags;
-  int debug_level = 0;
-  int ret;
-  psa_status_t status;
+  TLSShared *shared;
+  TLSShared *previous = NULL;
+  struct stat certstat;
+  struct stat keystat;
 
-  if (config.tlscertfile == NULL)
+  if (config.tlscertfile == NULL || config.tlskeyfile == NULL)
+    return 0;
+
+  if (stat (config.tlscertfile, &certstat) || stat (config.tlskeyfile, &keystat))
   {
-    lprintf (0, "[%s] No TLS certificate provided, cannot configure TLS", cinfo->hostname);
+    if (failedcertmtime != -1)
+      lprintf (0, "Cannot stat TLS certificate or key file: %s", strerror (errno));
+
+    failedcertmtime = failedkeymtime = -1;
     return -1;
   }
 
-  if (config.tlskeyfile == NULL)
+  if (certstat.st_mtime == failedcertmtime && keystat.st_mtime == failedkeymtime)
+    return -1;
+
+  pthread_mutex_lock (&tlsshared_lock);
+  shared = tlsshared;
+  pthread_mutex_unlock (&tlsshared_lock);
+
+  /* Nothing to do if the configuration is current */
+  if (shared &&
+      !strcmp (shared->certfile, config.tlscertfile) &&
+      !strcmp (shared->keyfile, config.tlskeyfile) &&
+      shared->certmtime == certstat.st_mtime &&
+      shared->keymtime == keystat.st_mtime)
+    return 0;
+
+  if (shared)
+    lprintf (1, "Reloading TLS certificate and key");
+
+  if ((shared = tls_create (config.tlscertfile, config.tlskeyfile)) == NULL)
   {
-    lprintf (0, "[%s] No TLS key provided, cannot configure TLS", cinfo->hostname);
+    failedcertmtime = certstat.st_mtime;
+    failedkeymtime  = keystat.st_mtime;
     return -1;
   }
 
-  lprintf (2, "[%s] Configuring TLS", cinfo->hostname);
+  failedcertmtime = failedkeymtime = 0;
 
-  /* Allocate TLS data structure context */
-  if ((cinfo->tlsctx = malloc (sizeof (TLSCTX))) == NULL)
+  shared->certmtime = certstat.st_mtime;
+  shared->keymtime  = keystat.st_mtime;
+
+  /* Replace the current configuration, releasing the reference held for it */
+  pthread_mutex_lock (&tlsshared_lock);
+  previous  = tlsshared;
+  tlsshared = shared;
+  pthread_mutex_unlock (&tlsshared_lock);
+
+  if (previous)
+    tls_release (previous);
+
+  return 0;
+} /* End of tls_load() */
+
+/***********************************************************************
+ *
+ * Release the shared TLS configuration and the PSA Crypto library
+ * state, called during shutdown after all connections are closed.
+ *
+ ***********************************************************************/
+void
+tls_free (void)
+{
+  TLSShared *shared;
+
+  pthread_mutex_lock (&tlsshared_lock);
+  shared    = tlsshared;
+  tlsshared = NULL;
+  pthread_mutex_unlock (&tlsshared_lock);
+
+  if (shared)
+    tls_release (shared);
+
+  if (psa_initialized)
   {
-    lprintf (0, "[%s] Cannot allocate memory for TLS context", cinfo->hostname);
-    return -1;
+    mbedtls_psa_crypto_free ();
+    psa_initialized = 0;
   }
+} /* End of tls_free() */
 
-  tlsctx = (TLSCTX *)cinfo->tlsctx;
+/***********************************************************************
+ *
+ * Create a TLS configuration: seed the random number generator, parse
+ * the certificate and key and set up session tickets and a session
+ * cache for abbreviated handshakes by reconnecting clients.
+ *
+ * The returned configuration holds one reference for the caller.
+ *
+ * Return configuration on success and NULL on error.
+ ***********************************************************************/
+static TLSShared *
+tls_create (const char *certfile, const char *keyfile)
+{
+  TLSShared *shared = NULL;
+  char *evalue      = NULL;
+  int debug_level   = 0;
+  int ret;
+  psa_status_t status;
+
+  if (!psa_initialized)
+  {
+    if ((status = psa_crypto_init ()) != PSA_SUCCESS)
+    {
+      lprintf (0, "Failed to initialize PSA Crypto implementation: %d", (int)status);
+      return NULL;
+    }
+
+    psa_initialized = 1;
+  }
 
   /* Set debug level from environment variable if set */
   if ((evalue = getenv ("RINGSERVER_TLS_DEBUG")) != NULL)
   {
     debug_level = (int)strtol (evalue, NULL, 10);
-    lprintf (1, "[%s] Configuring debug level %d (from RINGSERVER_TLS_DEBUG)",
-             cinfo->hostname, debug_level);
+    lprintf (1, "Configuring TLS debug level %d (from RINGSERVER_TLS_DEBUG)", debug_level);
 
     if (debug_level > 0)
     {
@@ -84,70 +216,189 @@ tls_configure (ClientInfo *cinfo)
     }
   }
 
-  tlsctx->client_fd.fd = cinfo->socket;
-  mbedtls_ssl_init (&tlsctx->ssl);
-  mbedtls_ssl_config_init (&tlsctx->conf);
-  mbedtls_entropy_init (&tlsctx->entropy);
-  mbedtls_x509_crt_init (&tlsctx->srvcert);
-  mbedtls_pk_init (&tlsctx->pkey);
-  mbedtls_ctr_drbg_init (&tlsctx->ctr_drbg);
+  if ((shared = (TLSShared *)calloc (1, sizeof (TLSShared))) == NULL)
+  {
+    lprintf (0, "Cannot allocate memory for TLS configuration");
+    return NULL;
+  }
+
+  mbedtls_ssl_config_init (&shared->conf);
+  mbedtls_entropy_init (&shared->entropy);
+  mbedtls_x509_crt_init (&shared->srvcert);
+  mbedtls_pk_init (&shared->pkey);
+  mbedtls_ctr_drbg_init (&shared->ctr_drbg);
+  mbedtls_ssl_ticket_init (&shared->ticket);
+  mbedtls_ssl_cache_init (&shared->cache);
+
+  shared->certfile = strdup (certfile);
+  shared->keyfile  = strdup (keyfile);
+  shared->refcount = 1;
 
-  if ((status = psa_crypto_init ()) != PSA_SUCCESS)
+  if (!shared->certfile || !shared->keyfile)
   {
-    lprintf (0, "[%s] Failed to initialize PSA Crypto implementation: %d",
-             cinfo->hostname, (int)status);
-    return -1;
+    lprintf (0, "Cannot allocate memory for TLS configuration");
+    tls_release (shared);
+    return NULL;
   }
 
-  if ((ret = mbedtls_ctr_drbg_seed (&tlsctx->ctr_drbg, mbedtls_entropy_func,
-                                    &tlsctx->entropy,
-                                    (const unsigned char *)cinfo->hostname,
-                                    strlen (cinfo->hostname))) != 0)
+  if ((ret = mbedtls_ctr_drbg_seed (&shared->ctr_drbg, mbedtls_entropy_func,
+                                    &shared->entropy,
+                                    (const unsigned char *)"ringserver", 10)) != 0)
   {
-    lprintf (0, "[%s] mbedtls_ctr_drbg_seed() returned %d", cinfo->hostname, ret);
-    return -1;
+    lprintf (0, "mbedtls_ctr_drbg_seed() returned %d", ret);
+    tls_release (shared);
+    return NULL;
   }
 
-  lprintf (2, "[%s] Reading TLS cert from '%s'", cinfo->hostname, config.tlscertfile);
+  lprintf (2, "Reading TLS cert from '%s'", certfile);
 
-  if ((ret = mbedtls_x509_crt_parse_file (&tlsctx->srvcert, config.tlscertfile)) != 0)
+  if ((ret = mbedtls_x509_crt_parse_file (&shared->srvcert, certfile)) != 0)
   {
-    lprintf (0, "[%s] mbedtls_x509_crt_parse_file() returned -0x%x",
-             cinfo->hostname, (unsigned int)-ret);
-    return -1;
+    lprintf (0, "mbedtls_x509_crt_parse_file() returned -0x%x", (unsigned int)-ret);
+    tls_release (shared);
+    return NULL;
   }
 
-  lprintf (2, "[%s] Reading TLS key from '%s'", cinfo->hostname, config.tlskeyfile);
+  lprintf (2, "Reading TLS key from '%s'", keyfile);
 
-  if ((ret = mbedtls_pk_parse_keyfile (&tlsctx->pkey, config.tlskeyfile, "",
-                                       mbedtls_ctr_drbg_random, &tlsctx->ctr_drbg)) != 0)
+  if ((ret = mbedtls_pk_parse_keyfile (&shared->pkey, keyfile, "",
+                                       mbedtls_ctr_drbg_random, &shared->ctr_drbg)) != 0)
   {
-    lprintf (0, "[%s] mbedtls_pk_parse_keyfile() returned -0x%x", cinfo->hostname, (unsigned int)-ret);
-    return -1;
+    lprintf (0, "mbedtls_pk_parse_keyfile() returned -0x%x", (unsigned int)-ret);
+    tls_release (shared);
+    return NULL;
   }
 
-  if ((ret = mbedtls_ssl_config_defaults (&tlsctx->conf,
+  if ((ret = mbedtls_ssl_config_defaults (&shared->conf,
                                           MBEDTLS_SSL_IS_SERVER,
                                           MBEDTLS_SSL_TRANSPORT_STREAM,
                                           MBEDTLS_SSL_PRESET_DEFAULT)) != 0)
   {
-    lprintf (0, "[%s] mbedtls_ssl_config_defaults() returned %d", cinfo->hostname, ret);
+    lprintf (0, "mbedtls_ssl_config_defaults() returned %d", ret);
+    tls_release (shared);
+    return NULL;
+  }
+
+  mbedtls_ssl_conf_authmode (&shared->conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
+  mbedtls_ssl_conf_rng (&shared->conf, mbedtls_ctr_drbg_random, &shared->ctr_drbg);
+  mbedtls_ssl_conf_dbg (&shared->conf, tls_debug, NULL);
+
+  mbedtls_ssl_conf_ca_chain (&shared->conf, &shared->srvcert, NULL);
+
+  if ((ret = mbedtls_ssl_conf_own_cert (&shared->conf, &shared->srvcert, &shared->pkey)) != 0)
+  {
+    lprintf (0, "mbedtls_ssl_conf_own_cert() returned %d", ret);
+    tls_release (shared);
+    return NULL;
+  }
+
+  /* Session tickets allow resumption without server side state */
+  if ((ret = mbedtls_ssl_ticket_setup (&shared->ticket, mbedtls_ctr_drbg_random, &shared->ctr_drbg,
+                                       MBEDTLS_CIPHER_AES_256_GCM, TLS_SESSION_LIFETIME)) != 0)
+  {
+    lprintf (0, "mbedtls_ssl_ticket_setup() returned -0x%x", (unsigned int)-ret);
+    tls_release (shared);
+    return NULL;
+  }
+
+  mbedtls_ssl_conf_session_tickets_cb (&shared->conf, mbedtls_ssl_ticket_write,
+                                       mbedtls_ssl_ticket_parse, &shared->ticket);
+
+  /* Session cache for TLS 1.2 clients that do not support tickets */
+  mbedtls_ssl_cache_set_timeout (&shared->cache, TLS_SESSION_LIFETIME);
+  mbedtls_ssl_cache_set_max_entries (&shared->cache, TLS_SESSION_CACHE);
+  mbedtls_ssl_conf_session_cache (&shared->conf, &shared->cache,
+                                  mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+
+  lprintf (1, "TLS configuration loaded from '%s' and '%s'", certfile, keyfile);
+
+  return shared;
+} /* End of tls_create() */
+
+/***********************************************************************
+ *
+ * Release a reference to a TLS configuration, freeing it when no
+ * references remain.
+ *
+ ***********************************************************************/
+static void
+tls_release (TLSShared *shared)
+{
+  int refcount;
+
+  pthread_mutex_lock (&tlsshared_lock);
+  refcount = --shared->refcount;
+  pthread_mutex_unlock (&tlsshared_lock);
+
+  if (refcount > 0)
+    return;
+
+  mbedtls_ssl_config_free (&shared->conf);
+  mbedtls_ssl_ticket_free (&shared->ticket);
+  mbedtls_ssl_cache_free (&shared->cache);
+  mbedtls_x509_crt_free (&shared->srvcert);
+  mbedtls_pk_free (&shared->pkey);
+  mbedtls_ctr_drbg_free (&shared->ctr_drbg);
+  mbedtls_entropy_free (&shared->entropy);
+
+  free (shared->certfile);
+  free (shared->keyfile);
+  free (shared);
+} /* End of tls_release() */
+
+/***********************************************************************
+ *
+ * Initialize and negotiation TLS on connected client socket using the
+ * shared TLS configuration.
+ *
+ * Return 0 on success and non-zero on error.
+ ***********************************************************************/
+int
+tls_configure (ClientInfo *cinfo)
+{
+  TLSCTX *tlsctx         = NULL;
+  uint32_t flags;
+  int ret;
+
+  if (config.tlscertfile == NULL)
+  {
+    lprintf (0, "[%s] No TLS certificate provided, cannot configure TLS", cinfo->hostname);
     return -1;
   }
 
-  mbedtls_ssl_conf_authmode (&tlsctx->conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
-  mbedtls_ssl_conf_rng (&tlsctx->conf, mbedtls_ctr_drbg_random, &tlsctx->ctr_drbg);
-  mbedtls_ssl_conf_dbg (&tlsctx->conf, tls_debug, NULL);
+  if (config.tlskeyfile == NULL)
+  {
+    lprintf (0, "[%s] No TLS key provided, cannot configure TLS", cinfo->hostname);
+    return -1;
+  }
 
-  mbedtls_ssl_conf_ca_chain (&tlsctx->conf, &tlsctx->srvcert, NULL);
+  lprintf (2, "[%s] Configuring TLS", cinfo->hostname);
 
-  if ((ret = mbedtls_ssl_conf_own_cert (&tlsctx->conf, &tlsctx->srvcert, &tlsctx->pkey)) != 0)
+  /* Allocate TLS data structure context */
+  if ((cinfo->tlsctx = calloc (1, sizeof (TLSCTX))) == NULL)
   {
-    lprintf (0, "[%s] mbedtls_ssl_conf_own_cert() returned %d", cinfo->hostname, ret);
+    lprintf (0, "[%s] Cannot allocate memory for TLS context", cinfo->hostname);
     return -1;
   }
 
-  if ((ret = mbedtls_ssl_setup (&tlsctx->ssl, &tlsctx->conf)) != 0)
+  tlsctx = (TLSCTX *)cinfo->tlsctx;
+
+  tlsctx->client_fd.fd = cinfo->socket;
+  mbedtls_ssl_init (&tlsctx->ssl);
+
+  /* Reference the shared configuration */
+  pthread_mutex_lock (&tlsshared_lock);
+  if ((tlsctx->shared = tlsshared) != NULL)
+    tlsshared->refcount++;
+  pthread_mutex_unlock (&tlsshared_lock);
+
+  if (tlsctx->shared == NULL)
+  {
+    lprintf (0, "[%s] TLS configuration is not loaded, check certificate and key", cinfo->hostname);
+    return -1;
+  }
+
+  if ((ret = mbedtls_ssl_setup (&tlsctx->ssl, &((TLSShared *)tlsctx->shared)->conf)) != 0)
   {
     lprintf (0, "[%s] mbedtls_ssl_setup() returned %d", cinfo->hostname, ret);
     return -1;
@@ -174,8 +425,11 @@ tls_configure (ClientInfo *cinfo)
       return -1;
     }
 
-    /* Wait for socket availability for 1 second */
-    PollSocket (cinfo->socket, 1, 1, 1000);
+    /* Wait up to 1 second for the socket to be ready for the operation needed,
+     * polling for both would return immediately for a writable socket */
+    PollSocket (cinfo->socket,
+                (ret != MBEDTLS_ERR_SSL_WANT_WRITE),
+                (ret == MBEDTLS_ERR_SSL_WANT_WRITE), 1000);
   }
 
   if (config.tlsverifyclientcert)
@@ -214,12 +468,9 @@ tls_cleanup (ClientInfo *cinfo)
     TLSCTX *tlsctx = (TLSCTX *)cinfo->tlsctx;
 
     mbedtls_ssl_free (&tlsctx->ssl);
-    mbedtls_ssl_config_free (&tlsctx->conf);
-    mbedtls_entropy_free (&tlsctx->entropy);
-    mbedtls_x509_crt_free (&tlsctx->srvcert);
-    mbedtls_pk_free (&tlsctx->pkey);
-    mbedtls_ctr_drbg_free (&tlsctx->ctr_drbg);
-    mbedtls_psa_crypto_free ();
+
+    if (tlsctx->shared)
+      tls_release ((TLSShared *)tlsctx->shared);
 
     free (cinfo->tlsctx);
     cinfo->tlsctx = NULL;
@@ -35,6 +35,8 @@ extern "C"
 #include <mbedtls/x509_crt.h>
 #include <mbedtls/pk.h>
 #include <mbedtls/error.h>
+#include <mbedtls/ssl_cache.h>
+#include <mbedtls/ssl_ticket.h>
 
 #include "clients.h"
 
@@ -43,13 +45,11 @@ typedef struct TLSCTX
 {
   mbedtls_net_context client_fd;
   mbedtls_ssl_context ssl;
-  mbedtls_ssl_config conf;
-  mbedtls_ctr_drbg_context ctr_drbg;
-  mbedtls_entropy_context entropy;
-  mbedtls_x509_crt srvcert;
-  mbedtls_pk_context pkey;
+  void *shared;     /* Shared TLS configuration */
 } TLSCTX;
 
+extern int tls_load (void);
+extern void tls_free (void);
 extern int tls_configure (ClientInfo *cinfo);
 extern void tls_cleanup (ClientInfo *cinfo);
 
@@ -0,0 +1,248 @@
+/**************************************************************************
+ * unmaskbench.c
+ *
+ * Equivalence check and micro-benchmark of WebSocket payload
+ * unmasking.  WSUnmask(), which uses AVX2, SSE2 or 8-byte blocks
+ * depending on the CPU, is compared with a byte at a time reference
+ * for all payload lengths from 0 to 599 bytes at each buffer
+ * alignment and mask position, whole and unmasked in two pieces.
+ * The throughput of both is then measured for a range of lengths.
+ *
+ * Build with 'make unmaskbench', not part of the server.
+ *
+ * Usage: unmaskbench [megabytes per length]
+ *
+ * This file is part of the ringserver.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Copyright (C) 2024:
+ * @author Chad Trabant, EarthScope Data Services
+ **************************************************************************/
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http.h"
+
+/* Range of checked payload lengths, buffer alignments and guard bytes */
+#define CHECK_MAXLENGTH 600
+#define CHECK_ALIGNMENTS 64
+#define CHECK_GUARD 64
+
+static void UnmaskReference (uint8_t *buffer, size_t length, const uint8_t mask[4],
+                             size_t maskidx);
+static int CheckEquivalence (void);
+static double Benchmark (size_t length, size_t total, int reference);
+static double ElapsedSeconds (const struct timespec *start);
+
+int
+main (int argc, char **argv)
+{
+  static const size_t lengths[] = {16, 64, 125, 512, 4096, 65536, 1048576};
+  size_t total = 256;
+  size_t idx;
+  double reference;
+  double unmask;
+
+  if (argc > 1 && (total = strtoul (argv[1], NULL, 10)) == 0)
+  {
+    fprintf (stderr, "Usage: %s [megabytes per length]\n", argv[0]);
+    return 1;
+  }
+
+  total *= 1024 * 1024;
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  printf ("AVX2 %s\n", (__builtin_cpu_supports ("avx2")) ? "supported" : "not supported");
+#endif
+
+  if (CheckEquivalence ())
+    return 1;
+
+  printf ("%10s %14s %14s %8s\n", "Length", "Reference MB/s", "WSUnmask MB/s", "Speedup");
+
+  for (idx = 0; idx < sizeof (lengths) / sizeof (lengths[0]); idx++)
+  {
+    reference = Benchmark (lengths[idx], total, 1);
+    unmask    = Benchmark (lengths[idx], total, 0);
+
+    printf ("%10zu %14.0f %14.0f %7.1fx\n", lengths[idx], reference, unmask,
+            (reference > 0.0) ? unmask / reference : 0.0);
+  }
+
+  return 0;
+} /* End of main() */
+
+/***************************************************************************
+ * UnmaskReference:
+ *
+ * Unmask a WebSocket payload one byte at a time, the reference for
+ * WSUnmask().
+ ***************************************************************************/
+static void
+UnmaskReference (uint8_t *buffer, size_t length, const uint8_t mask[4], size_t maskidx)
+{
+  size_t idx;
+
+  for (idx = 0; idx < length; idx++)
+    buffer[idx] ^= mask[(maskidx + idx) % 4];
+} /* End of UnmaskReference() */
+
+/***************************************************************************
+ * CheckEquivalence:
+ *
+ * Compare WSUnmask() with UnmaskReference() for each payload length,
+ * buffer alignment and mask position.  Each payload is unmasked whole
+ * and in two pieces split at a length dependent point.  The guard
+ * bytes around the payload must not be modified.
+ *
+ * Returns 0 if all results match and -1 otherwise.
+ ***************************************************************************/
+static int
+CheckEquivalence (void)
+{
+  uint8_t source[CHECK_MAXLENGTH + CHECK_ALIGNMENTS + 2 * CHECK_GUARD];
+  uint8_t expect[sizeof (source)];
+  uint8_t result[sizeof (source)];
+  uint8_t mask[4];
+  size_t length;
+  size_t align;
+  size_t maskidx;
+  size_t split;
+  size_t idx;
+  uint64_t checks = 0;
+  int failures    = 0;
+
+  srand (1);
+
+  for (idx = 0; idx < sizeof (source); idx++)
+    source[idx] = (uint8_t)rand ();
+
+  for (length = 0; length < CHECK_MAXLENGTH; length++)
+  {
+    for (align = 0; align < CHECK_ALIGNMENTS; align++)
+    {
+      for (maskidx = 0; maskidx < 4; maskidx++)
+      {
+        for (idx = 0; idx < 4; idx++)
+          mask[idx] = (uint8_t)rand ();
+
+        memcpy (expect, source, sizeof (source));
+        UnmaskReference (expect + CHECK_GUARD + align, length, mask, maskidx);
+
+        /* Unmask whole payload */
+        memcpy (result, source, sizeof (source));
+        WSUnmask (result + CHECK_GUARD + align, length, mask, maskidx);
+
+        if (memcmp (expect, result, sizeof (source)))
+        {
+          if (failures++ < 10)
+            fprintf (stderr, "Mismatch: length %zu, alignment %zu, mask index %zu\n",
+                     length, align, maskidx);
+        }
+
+        /* Unmask payload in two pieces */
+        split = (length * 7 + align) % (length + 1);
+
+        memcpy (result, source, sizeof (source));
+        WSUnmask (result + CHECK_GUARD + align, split, mask, maskidx);
+        WSUnmask (result + CHECK_GUARD + align + split, length - split, mask, maskidx + split);
+
+        if (memcmp (expect, result, sizeof (source)))
+        {
+          if (failures++ < 10)
+            fprintf (stderr, "Mismatch: length %zu, alignment %zu, mask index %zu, split at %zu\n",
+                     length, align, maskidx, split);
+        }
+
+        checks += 2;
+      }
+    }
+  }
+
+  printf ("Equivalence check: %" PRIu64 " cases, %d mismatches\n", checks, failures);
+
+  return (failures) ? -1 : 0;
+} /* End of CheckEquivalence() */
+
+/***************************************************************************
+ * Benchmark:
+ *
+ * Unmask a payload of the specified length repeatedly until 'total'
+ * bytes are processed, with either WSUnmask() or the reference.
+ *
+ * Returns the throughput in megabytes per second.
+ ***************************************************************************/
+static double
+Benchmark (size_t length, size_t total, int reference)
+{
+  static const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+  struct timespec start;
+  uint8_t *buffer;
+  size_t iterations;
+  size_t iter;
+  double seconds;
+  unsigned int sum = 0;
+
+  if (!(buffer = (uint8_t *)malloc (length)))
+  {
+    fprintf (stderr, "Error allocating %zu bytes\n", length);
+    return 0.0;
+  }
+
+  memset (buffer, 0x5a, length);
+
+  iterations = (total + length - 1) / length;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  for (iter = 0; iter < iterations; iter++)
+  {
+    if (reference)
+      UnmaskReference (buffer, length, mask, iter);
+    else
+      WSUnmask (buffer, length, mask, iter);
+
+    sum += buffer[iter % length];
+  }
+
+  seconds = ElapsedSeconds (&start);
+
+  free (buffer);
+
+  /* Use the sum so the unmasking is not optimized away */
+  if (sum == 1)
+    printf (" ");
+
+  return (seconds > 0.0) ? (double)iterations * length / seconds / 1e6 : 0.0;
+} /* End of Benchmark() */
+
+/***************************************************************************
+ * ElapsedSeconds:
+ *
+ * Returns the seconds elapsed since 'start'.
+ ***************************************************************************/
+static double
+ElapsedSeconds (const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+} /* End of ElapsedSeconds() */
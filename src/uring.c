@@ -0,0 +1,468 @@
+/**************************************************************************
+ * uring.c
+ *
+ * A minimal interface to Linux io_uring used by the client worker
+ * threads, implemented directly on the system calls so that no
+ * additional library is required.
+ *
+ * Only the operations used by the workers are provided: multishot
+ * polls of descriptors, sends, cancellation and the submission of
+ * all prepared requests with a wait for completions in a single
+ * system call.  The queues are used by a single thread and are not
+ * thread-safe.
+ *
+ * On platforms without io_uring, or when the headers do not provide
+ * it, URingInit() fails with ENOSYS and callers use another method.
+ *
+ * This file is part of the ringserver.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Copyright (C) 2024:
+ * @author Chad Trabant, EarthScope Data Services
+ **************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_FEAT_RSRC_TAGS)
+#define URING_SUPPORTED 1
+#endif
+#endif
+#endif
+
+#if defined(URING_SUPPORTED)
+
+/* Features required: no dropped completions, a timeout when waiting
+ * and multishot polls, which were added in the same release (5.13) as
+ * resource tags */
+#define URING_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | \
+                        IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS)
+
+static struct io_uring_sqe *URingGetSQE (URing *ring);
+
+/***************************************************************************
+ * URingInit:
+ *
+ * Set up an io_uring instance with at least 'entries' submission
+ * queue entries and 'cqentries' completion queue entries, and map
+ * its queues.
+ *
+ * Returns 0 on success and -1 on error with errno set, ENOTSUP if the
+ * kernel does not provide the required features.
+ ***************************************************************************/
+int
+URingInit (URing *ring, uint32_t entries, uint32_t cqentries)
+{
+  struct io_uring_params params;
+  uint8_t *map;
+  int errsave;
+
+  if (!ring)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset (ring, 0, sizeof (URing));
+  memset (&params, 0, sizeof (params));
+
+  params.flags      = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+  params.cq_entries = cqentries;
+
+  if ((ring->fd = (int)syscall (__NR_io_uring_setup, entries, &params)) < 0)
+  {
+    ring->fd = -1;
+    return -1;
+  }
+
+  if ((params.features & URING_FEATURES) != URING_FEATURES)
+  {
+    close (ring->fd);
+    ring->fd = -1;
+    errno    = ENOTSUP;
+    return -1;
+  }
+
+  /* Submission and completion queue rings share a single mapping */
+  ring->ringmapsize = params.sq_off.array + params.sq_entries * sizeof (uint32_t);
+  if (ring->ringmapsize < params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe))
+    ring->ringmapsize = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+
+  ring->ringmap = mmap (NULL, ring->ringmapsize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+  if (ring->ringmap == MAP_FAILED)
+  {
+    ring->ringmap = NULL;
+    goto failed;
+  }
+
+  ring->sqemapsize = params.sq_entries * sizeof (struct io_uring_sqe);
+  ring->sqemap     = mmap (NULL, ring->sqemapsize, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+  if (ring->sqemap == MAP_FAILED)
+  {
+    ring->sqemap = NULL;
+    goto failed;
+  }
+
+  map              = (uint8_t *)ring->ringmap;
+  ring->sqheadp    = (uint32_t *)(map + params.sq_off.head);
+  ring->sqtailp    = (uint32_t *)(map + params.sq_off.tail);
+  ring->sqarray    = (uint32_t *)(map + params.sq_off.array);
+  ring->sqmask     = *(uint32_t *)(map + params.sq_off.ring_mask);
+  ring->sqentries  = params.sq_entries;
+  ring->sqtail     = *ring->sqtailp;
+  ring->sqes       = ring->sqemap;
+  ring->cqheadp    = (uint32_t *)(map + params.cq_off.head);
+  ring->cqtailp    = (uint32_t *)(map + params.cq_off.tail);
+  ring->cqmask     = *(uint32_t *)(map + params.cq_off.ring_mask);
+  ring->cqes       = map + params.cq_off.cqes;
+
+  return 0;
+
+failed:
+  errsave = errno;
+  URingFree (ring);
+  errno = errsave;
+
+  return -1;
+} /* End of URingInit() */
+
+/***************************************************************************
+ * URingFree:
+ *
+ * Unmap the queues and close an io_uring instance, outstanding
+ * requests are canceled by the kernel.
+ ***************************************************************************/
+void
+URingFree (URing *ring)
+{
+  if (!ring)
+    return;
+
+  if (ring->sqemap)
+    munmap (ring->sqemap, ring->sqemapsize);
+
+  if (ring->ringmap)
+    munmap (ring->ringmap, ring->ringmapsize);
+
+  if (ring->fd >= 0)
+    close (ring->fd);
+
+  memset (ring, 0, sizeof (URing));
+  ring->fd = -1;
+} /* End of URingFree() */
+
+/***************************************************************************
+ * URingGetSQE:
+ *
+ * Get the next free submission queue entry, submitting the prepared
+ * entries first if the queue is full.  The entry is cleared and
+ * counted as prepared, it is submitted with the next URingSubmit().
+ *
+ * Returns a pointer to the entry or NULL on error with errno set.
+ ***************************************************************************/
+static struct io_uring_sqe *
+URingGetSQE (URing *ring)
+{
+  struct io_uring_sqe *sqe;
+  uint32_t index;
+
+  if (ring->sqtail - __atomic_load_n (ring->sqheadp, __ATOMIC_ACQUIRE) >= ring->sqentries)
+  {
+    if (URingSubmit (ring, 0) < 0)
+      return NULL;
+
+    if (ring->sqtail - __atomic_load_n (ring->sqheadp, __ATOMIC_ACQUIRE) >= ring->sqentries)
+    {
+      errno = EBUSY;
+      return NULL;
+    }
+  }
+
+  index = ring->sqtail & ring->sqmask;
+  sqe   = (struct io_uring_sqe *)ring->sqes + index;
+  memset (sqe, 0, sizeof (struct io_uring_sqe));
+
+  ring->sqarray[index] = index;
+  ring->sqtail++;
+  ring->sqsubmit++;
+
+  return sqe;
+} /* End of URingGetSQE() */
+
+/***************************************************************************
+ * URingPrepPoll:
+ *
+ * Prepare a multishot poll of a descriptor for the poll(2) 'events',
+ * a completion with the events is posted each time the descriptor
+ * becomes ready.  The completion flags include URING_CQE_MORE while
+ * the poll remains active.
+ *
+ * Returns 0 on success and -1 on error with errno set.
+ ***************************************************************************/
+int
+URingPrepPoll (URing *ring, int fd, uint32_t events, uint64_t userdata)
+{
+  struct io_uring_sqe *sqe;
+
+  if (!(sqe = URingGetSQE (ring)))
+    return -1;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  events = (events << 16) | (events >> 16);
+#endif
+
+  sqe->opcode        = IORING_OP_POLL_ADD;
+  sqe->fd            = fd;
+  sqe->len           = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = events;
+  sqe->user_data     = userdata;
+
+  __atomic_store_n (ring->sqtailp, ring->sqtail, __ATOMIC_RELEASE);
+
+  return 0;
+} /* End of URingPrepPoll() */
+
+/***************************************************************************
+ * URingPrepPollRemove:
+ *
+ * Prepare the removal of the poll identified by 'target' user data.
+ *
+ * Returns 0 on success and -1 on error with errno set.
+ ***************************************************************************/
+int
+URingPrepPollRemove (URing *ring, uint64_t target, uint64_t userdata)
+{
+  struct io_uring_sqe *sqe;
+
+  if (!(sqe = URingGetSQE (ring)))
+    return -1;
+
+  sqe->opcode    = IORING_OP_POLL_REMOVE;
+  sqe->fd        = -1;
+  sqe->addr      = target;
+  sqe->user_data = userdata;
+
+  __atomic_store_n (ring->sqtailp, ring->sqtail, __ATOMIC_RELEASE);
+
+  return 0;
+} /* End of URingPrepPollRemove() */
+
+/***************************************************************************
+ * URingPrepSend:
+ *
+ * Prepare a send of 'length' bytes from 'buffer' to a socket, the
+ * buffer must remain valid until the completion is reaped.  The
+ * completion result is the number of bytes sent or a negated errno.
+ *
+ * Returns 0 on success and -1 on error with errno set.
+ ***************************************************************************/
+int
+URingPrepSend (URing *ring, int fd, const void *buffer, size_t length,
+               uint64_t userdata)
+{
+  struct io_uring_sqe *sqe;
+
+  if (!(sqe = URingGetSQE (ring)))
+    return -1;
+
+  sqe->opcode    = IORING_OP_SEND;
+  sqe->fd        = fd;
+  sqe->addr      = (uint64_t)(uintptr_t)buffer;
+  sqe->len       = (length > UINT32_MAX) ? UINT32_MAX : (uint32_t)length;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = userdata;
+
+  __atomic_store_n (ring->sqtailp, ring->sqtail, __ATOMIC_RELEASE);
+
+  return 0;
+} /* End of URingPrepSend() */
+
+/***************************************************************************
+ * URingPrepCancel:
+ *
+ * Prepare the cancellation of the request identified by 'target' user
+ * data, a canceled request completes with -ECANCELED.
+ *
+ * Returns 0 on success and -1 on error with errno set.
+ ***************************************************************************/
+int
+URingPrepCancel (URing *ring, uint64_t target, uint64_t userdata)
+{
+  struct io_uring_sqe *sqe;
+
+  if (!(sqe = URingGetSQE (ring)))
+    return -1;
+
+  sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+  sqe->fd        = -1;
+  sqe->addr      = target;
+  sqe->user_data = userdata;
+
+  __atomic_store_n (ring->sqtailp, ring->sqtail, __ATOMIC_RELEASE);
+
+  return 0;
+} /* End of URingPrepCancel() */
+
+/***************************************************************************
+ * URingSubmit:
+ *
+ * Submit all prepared requests and, if 'timeout_ms' is not 0, wait up
+ * to 'timeout_ms' milliseconds for at least one completion.  A
+ * negative timeout waits without limit.
+ *
+ * Returns 0 on success, including a timeout or interruption, and -1
+ * on error with errno set.
+ ***************************************************************************/
+int
+URingSubmit (URing *ring, int timeout_ms)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  uint32_t flags  = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+  uint32_t waitnr = (timeout_ms != 0) ? 1 : 0;
+  int rv;
+
+  memset (&arg, 0, sizeof (arg));
+
+  if (timeout_ms > 0)
+  {
+    ts.tv_sec  = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+    arg.ts     = (uint64_t)(uintptr_t)&ts;
+  }
+
+  /* Do not wait when completions are already available */
+  if (__atomic_load_n (ring->cqtailp, __ATOMIC_ACQUIRE) != *ring->cqheadp)
+    waitnr = 0;
+
+  rv = (int)syscall (__NR_io_uring_enter, ring->fd, ring->sqsubmit, waitnr,
+                     flags, &arg, sizeof (arg));
+
+  if (rv < 0)
+  {
+    if (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN)
+      return 0;
+
+    return -1;
+  }
+
+  ring->sqsubmit -= ((uint32_t)rv < ring->sqsubmit) ? (uint32_t)rv : ring->sqsubmit;
+
+  return 0;
+} /* End of URingSubmit() */
+
+/***************************************************************************
+ * URingReap:
+ *
+ * Consume the next completion, if any, returning its user data,
+ * result and flags.
+ *
+ * Returns 1 when a completion was consumed and 0 when none is available.
+ ***************************************************************************/
+int
+URingReap (URing *ring, uint64_t *userdata, int32_t *result, uint32_t *flags)
+{
+  struct io_uring_cqe *cqe;
+  uint32_t head = *ring->cqheadp;
+
+  if (head == __atomic_load_n (ring->cqtailp, __ATOMIC_ACQUIRE))
+    return 0;
+
+  cqe = (struct io_uring_cqe *)ring->cqes + (head & ring->cqmask);
+
+  *userdata = cqe->user_data;
+  *result   = cqe->res;
+  *flags    = cqe->flags;
+
+  __atomic_store_n (ring->cqheadp, head + 1, __ATOMIC_RELEASE);
+
+  return 1;
+} /* End of URingReap() */
+
+#else /* !URING_SUPPORTED */
+
+int
+URingInit (URing *ring, uint32_t entries, uint32_t cqentries)
+{
+  if (ring)
+  {
+    memset (ring, 0, sizeof (URing));
+    ring->fd = -1;
+  }
+
+  errno = ENOSYS;
+  return -1;
+}
+
+void
+URingFree (URing *ring)
+{
+}
+
+int
+URingPrepPoll (URing *ring, int fd, uint32_t events, uint64_t userdata)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+int
+URingPrepPollRemove (URing *ring, uint64_t target, uint64_t userdata)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+int
+URingPrepSend (URing *ring, int fd, const void *buffer, size_t length,
+               uint64_t userdata)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+int
+URingPrepCancel (URing *ring, uint64_t target, uint64_t userdata)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+int
+URingSubmit (URing *ring, int timeout_ms)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+int
+URingReap (URing *ring, uint64_t *userdata, int32_t *result, uint32_t *flags)
+{
+  return 0;
+}
+
+#endif /* URING_SUPPORTED */
@@ -0,0 +1,74 @@
+/**************************************************************************
+ * uring.h
+ *
+ * Declarations for the minimal io_uring interface used by the client
+ * worker threads.
+ *
+ * This file is part of the ringserver.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Copyright (C) 2024:
+ * @author Chad Trabant, EarthScope Data Services
+ **************************************************************************/
+
+#ifndef URING_H
+#define URING_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Completion flag: a multishot request remains active */
+#define URING_CQE_MORE (1U << 1)
+
+/* An io_uring instance with its mapped submission and completion queues */
+typedef struct URing
+{
+  int fd;                  /* io_uring descriptor, -1 when not set up */
+  uint32_t sqmask;         /* Submission queue index mask */
+  uint32_t sqentries;      /* Submission queue entries */
+  uint32_t sqtail;         /* Local submission queue tail */
+  uint32_t sqsubmit;       /* Entries prepared but not yet submitted */
+  uint32_t *sqheadp;       /* Kernel submission queue head */
+  uint32_t *sqtailp;       /* Kernel submission queue tail */
+  uint32_t *sqarray;       /* Submission queue index array */
+  void *sqes;              /* Submission queue entries */
+  uint32_t cqmask;         /* Completion queue index mask */
+  uint32_t *cqheadp;       /* Kernel completion queue head */
+  uint32_t *cqtailp;       /* Kernel completion queue tail */
+  void *cqes;              /* Completion queue entries */
+  void *ringmap;           /* Mapping of the queue rings */
+  size_t ringmapsize;      /* Size of queue rings mapping */
+  void *sqemap;            /* Mapping of the submission queue entries */
+  size_t sqemapsize;       /* Size of submission queue entries mapping */
+} URing;
+
+extern int URingInit (URing *ring, uint32_t entries, uint32_t cqentries);
+extern void URingFree (URing *ring);
+extern int URingPrepPoll (URing *ring, int fd, uint32_t events, uint64_t userdata);
+extern int URingPrepPollRemove (URing *ring, uint64_t target, uint64_t userdata);
+extern int URingPrepSend (URing *ring, int fd, const void *buffer, size_t length,
+                          uint64_t userdata);
+extern int URingPrepCancel (URing *ring, uint64_t target, uint64_t userdata);
+extern int URingSubmit (URing *ring, int timeout_ms);
+extern int URingReap (URing *ring, uint64_t *userdata, int32_t *result, uint32_t *flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* URING_H */
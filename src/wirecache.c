@@ -0,0 +1,127 @@
+/**************************************************************************
+ * wirecache.c
+ *
+ * A cache of encoded packet headers shared by all clients.
+ *
+ * Each client streaming a packet sends the same protocol header in
+ * front of the packet data.  Instead of every client formatting the
+ * header, the first client to send a packet stores the encoded header
+ * and other clients copy it.  The cache is direct mapped by packet ID,
+ * so clients following the ring in real time share the entries of
+ * the most recent packets.
+ *
+ * Entries are read and written without locks using a sequence
+ * counter per entry.  A writer that finds an entry being updated by
+ * another writer does not wait and simply does not cache its header.
+ *
+ * This file is part of the ringserver.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Copyright (C) 2024:
+ * @author Chad Trabant, EarthScope Data Services
+ **************************************************************************/
+
+#include <string.h>
+
+#include "wirecache.h"
+
+/***************************************************************************
+ * WireCacheGet:
+ *
+ * Copy the cached header for the specified packet to 'header', which
+ * must be large enough for any header stored in this cache.  Entries are matched on
+ * both packet ID and packet time so that headers are not reused for a
+ * different packet after the ring is reset.
+ *
+ * Returns the length of the header when found and 0 otherwise.
+ ***************************************************************************/
+int
+WireCacheGet (WireCache *cache, const RingPacket *packet, char *header)
+{
+  WireCacheEntry *entry;
+  uint32_t headerlen;
+  uint32_t seq;
+
+  if (!cache || !packet || !header)
+    return 0;
+
+  entry = &cache->entries[packet->pktid & (WIRECACHE_ENTRIES - 1)];
+
+  seq = __atomic_load_n (&entry->seq, __ATOMIC_ACQUIRE);
+
+  /* Entry is empty or being updated */
+  if (seq == 0 || (seq & 1))
+    return 0;
+
+  if (__atomic_load_n (&entry->pktid, __ATOMIC_RELAXED) != packet->pktid ||
+      __atomic_load_n (&entry->pkttime, __ATOMIC_RELAXED) != packet->pkttime)
+    return 0;
+
+  headerlen = __atomic_load_n (&entry->headerlen, __ATOMIC_RELAXED);
+
+  if (headerlen == 0 || headerlen > WIRECACHE_HEADERMAX)
+    return 0;
+
+  memcpy (header, entry->header, headerlen);
+
+  /* Entry was updated while copying */
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  if (__atomic_load_n (&entry->seq, __ATOMIC_RELAXED) != seq)
+    return 0;
+
+  return (int)headerlen;
+} /* End of WireCacheGet() */
+
+/***************************************************************************
+ * WireCachePut:
+ *
+ * Store the encoded header for the specified packet in the cache,
+ * replacing the header of any other packet in the same entry.  If
+ * another thread is updating the entry the header is not stored.
+ ***************************************************************************/
+void
+WireCachePut (WireCache *cache, const RingPacket *packet,
+              const char *header, int headerlen)
+{
+  WireCacheEntry *entry;
+  uint32_t seq;
+  uint32_t nextseq;
+
+  if (!cache || !packet || !header || headerlen <= 0 || headerlen > WIRECACHE_HEADERMAX)
+    return;
+
+  entry = &cache->entries[packet->pktid & (WIRECACHE_ENTRIES - 1)];
+
+  seq = __atomic_load_n (&entry->seq, __ATOMIC_RELAXED);
+
+  /* Claim the entry by making the sequence odd, give up if another writer has it */
+  if ((seq & 1) ||
+      !__atomic_compare_exchange_n (&entry->seq, &seq, seq + 1, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    return;
+
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  __atomic_store_n (&entry->pktid, packet->pktid, __ATOMIC_RELAXED);
+  __atomic_store_n (&entry->pkttime, packet->pkttime, __ATOMIC_RELAXED);
+  __atomic_store_n (&entry->headerlen, (uint32_t)headerlen, __ATOMIC_RELAXED);
+  memcpy (entry->header, header, headerlen);
+
+  /* Publish the entry, skipping 0 which marks an empty entry */
+  nextseq = seq + 2;
+  if (nextseq == 0)
+    nextseq = 2;
+
+  __atomic_store_n (&entry->seq, nextseq, __ATOMIC_RELEASE);
+} /* End of WireCachePut() */
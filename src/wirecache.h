@@ -0,0 +1,62 @@
+/**************************************************************************
+ * wirecache.h
+ *
+ * Declarations for the cache of encoded packet headers.
+ *
+ * This file is part of the ringserver.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Copyright (C) 2024:
+ * @author Chad Trabant, EarthScope Data Services
+ **************************************************************************/
+
+#ifndef WIRECACHE_H
+#define WIRECACHE_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "ring.h"
+
+#define WIRECACHE_ENTRIES   4096          /* Cached packet headers, must be a power of 2 */
+#define WIRECACHE_HEADERMAX (UINT8_MAX + 3) /* Largest header, a DataLink wire header */
+
+/* Encoded header of a single packet, updated under a sequence lock */
+typedef struct WireCacheEntry
+{
+  uint32_t seq;       /* Update sequence, odd while updating and 0 when empty */
+  uint32_t headerlen; /* Length of encoded header */
+  uint64_t pktid;     /* Packet ID of encoded header */
+  nstime_t pkttime;   /* Packet time of encoded header */
+  char     header[WIRECACHE_HEADERMAX];
+} WireCacheEntry;
+
+/* Direct mapped cache of encoded headers indexed by packet ID */
+typedef struct WireCache
+{
+  WireCacheEntry entries[WIRECACHE_ENTRIES];
+} WireCache;
+
+extern int WireCacheGet (WireCache *cache, const RingPacket *packet, char *header);
+extern void WireCachePut (WireCache *cache, const RingPacket *packet,
+                          const char *header, int headerlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WIRECACHE_H */
@@ -0,0 +1,128 @@
+/**************************************************************************
+ * wsunmask.c
+ *
+ * Unmasking of WebSocket payloads received from clients.
+ *
+ * Kept separate from the HTTP handling so the routines can be built
+ * with the unmask benchmark and equivalence check, see unmaskbench.c.
+ *
+ * This file is part of the ringserver.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Copyright (C) 2024:
+ * @author Chad Trabant, EarthScope Data Services
+ **************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "http.h"
+
+/* AVX2 unmasking is compiled for x86-64 and selected at run time */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define WS_UNMASK_AVX2 1
+static size_t WSUnmaskAVX2 (uint8_t *buffer, size_t length, uint32_t mask32);
+#endif
+
+/***************************************************************************
+ * WSUnmask:
+ *
+ * Unmask 'length' bytes of a WebSocket payload in place.  The
+ * 'maskidx' is the position of the first byte in the payload,
+ * allowing a payload to be unmasked in pieces.
+ *
+ * The mask repeats every 4 bytes, so it is rotated to start with the
+ * first byte and applied to blocks of 32 (AVX2), 16 (SSE2) or 8 bytes
+ * depending on the CPU, remaining bytes are unmasked individually.
+ ***************************************************************************/
+void
+WSUnmask (uint8_t *buffer, size_t length, const uint8_t mask[4], size_t maskidx)
+{
+  uint8_t rotated[4];
+  uint32_t mask32;
+  uint64_t mask64;
+  uint64_t word;
+  size_t idx;
+
+  if (!buffer || !mask)
+    return;
+
+  for (idx = 0; idx < 4; idx++)
+    rotated[idx] = mask[(maskidx + idx) % 4];
+
+  memcpy (&mask32, rotated, sizeof (mask32));
+
+  idx = 0;
+
+#if defined(WS_UNMASK_AVX2)
+  if (length >= 64 && __builtin_cpu_supports ("avx2"))
+    idx = WSUnmaskAVX2 (buffer, length, mask32);
+#endif
+
+#if defined(__SSE2__)
+  if (length - idx >= 16)
+  {
+    __m128i mask128 = _mm_set1_epi32 ((int)mask32);
+    __m128i block;
+
+    for (; idx + 16 <= length; idx += 16)
+    {
+      block = _mm_loadu_si128 ((const __m128i *)(buffer + idx));
+      _mm_storeu_si128 ((__m128i *)(buffer + idx), _mm_xor_si128 (block, mask128));
+    }
+  }
+#endif
+
+  mask64 = ((uint64_t)mask32 << 32) | mask32;
+
+  for (; idx + 8 <= length; idx += 8)
+  {
+    memcpy (&word, buffer + idx, sizeof (word));
+    word ^= mask64;
+    memcpy (buffer + idx, &word, sizeof (word));
+  }
+
+  for (; idx < length; idx++)
+    buffer[idx] ^= rotated[idx % 4];
+} /* End of WSUnmask() */
+
+#if defined(WS_UNMASK_AVX2)
+/***************************************************************************
+ * WSUnmaskAVX2:
+ *
+ * Unmask blocks of 32 bytes with AVX2 instructions using a mask
+ * rotated to start with the first byte.
+ *
+ * Returns the number of bytes unmasked.
+ ***************************************************************************/
+__attribute__ ((target ("avx2"))) static size_t
+WSUnmaskAVX2 (uint8_t *buffer, size_t length, uint32_t mask32)
+{
+  __m256i mask256 = _mm256_set1_epi32 ((int)mask32);
+  __m256i block;
+  size_t idx;
+
+  for (idx = 0; idx + 32 <= length; idx += 32)
+  {
+    block = _mm256_loadu_si256 ((const __m256i *)(buffer + idx));
+    _mm256_storeu_si256 ((__m256i *)(buffer + idx), _mm256_xor_si256 (block, mask256));
+  }
+
+  return idx;
+} /* End of WSUnmaskAVX2() */
+#endif